@@ -3,15 +3,19 @@
 // Joe Schutte
 //=================================================================================================================================
 
-#include "PathTracer.h"
+#include "DeferredPathTracer.h"
 #include "SceneLib/SceneResource.h"
 #include "SceneLib/GeometryCache.h"
+#include "SceneLib/SubsceneResource.h"
 #include "Shading/SurfaceScattering.h"
 #include "Shading/VolumetricScattering.h"
 #include "Shading/SurfaceParameters.h"
+#include "Shading/DisneySimd.h"
 #include "Shading/IntegratorContexts.h"
 #include "Shading/AreaLighting.h"
 #include "Shading/PathTracingBatcher.h"
+#include "Shading/RayStream.h"
+#include "TextureLib/PtexFilterCache.h"
 #include "GeometryLib/Camera.h"
 #include "GeometryLib/Ray.h"
 #include "MathLib/FloatFuncs.h"
@@ -19,7 +23,7 @@
 #include "MathLib/Trigonometric.h"
 #include "MathLib/ImportanceSampling.h"
 #include "MathLib/Random.h"
-#include "ThreadingLib/Thread.h"
+#include "ThreadingLib/JobSystem.h"
 #include "SystemLib/OSThreading.h"
 #include "SystemLib/Atomic.h"
 #include "SystemLib/MemoryAllocation.h"
@@ -34,33 +38,190 @@
 #include "embree3/rtcore_ray.h"
 
 #define MaxBounceCount_         2048
-#define WorkerThreadCount_         7
 #define SamplesPerPixelX_          4
 #define SamplesPerPixelY_          4
 #define OutputLayers_              1
+#define RayStreamChunkSize_     4096
+// -- Evaluates the next event estimation BSDFs of sorted hits 8 at a time with EvaluateDisney8
+#define SimdShading_               1
+// -- Number of sorted hits whose surface parameters are calculated together so per-geometry work is shared
+#define SurfaceBatchSize_         64
+// -- Rays that reach a subscene whose geometry is not resident are parked until the loader threads bring it in rather than
+// -- blocking the tracing thread on disk
+#define DeferNonResidentRays_      1
 
 namespace Selas
 {
     namespace DeferredPathTracer
     {
+        // -- Rays and hits waiting on the geometry of one subscene
+        struct ParkedRayQueue
+        {
+            void*                 spinlock;
+            CArray<DeferredRay>   rays;
+            CArray<OcclusionRay>  occlusionRays;
+            CArray<HitParameters> hits;
+        };
+
+        // -- Per kernel integrator state. Kept for the whole pass so the ptex filters and framebuffer writer stay warm across
+        // -- the many short lived kernels that run during it.
+        struct KernelState
+        {
+            volatile int32      inUse;
+            GIIntegratorContext context;
+            RayStagingBuffer*   staging;
+            RayStream           stream;
+        };
+
         struct KernelData
         {
             const RayCastCameraSettings* camera;
             PathTracingBatcher*          ptBatcher;
             Framebuffer*                 frame;
-            volatile int64               kernelCounter;
             volatile int64               pixelIndex;
+            uint64                       passIndex;
+            SamplerType                  samplerType;
             const SceneResource*         scene;
             GeometryCache*               geometryCache;
             TextureCache*                textureCache;
+            RayPacketWidth               packetWidth;
+            HitShadingMode               shadingMode;
+
+            // -- Kernels return to the job system as soon as they run out of ready batches rather than blocking so nested
+            // -- ParallelFor calls and idle threads can always make progress. Every running kernel is counted in
+            // -- activeKernels so there are never more of them than there are kernel states.
+            TaskGroup                    kernelGroup;
+            KernelState*                 kernelStates;
+            int64                        workerCount;
+            volatile int64               activeKernels;
+            volatile int64               partialFlushCount;
+            volatile int64               shadedHitCount;
+            volatile int64               shadingMicroseconds;
+            PtexFilterCacheStats         ptexStats;
+
+            // -- One queue per subscene of the scene
+            ParkedRayQueue*              parkedQueues;
+            uint                         parkedQueueCount;
+            volatile int64               parkedRayCount;
+            volatile int64               totalParkedRays;
         };
 
         //=========================================================================================================================
-        static void ShadeHitPosition(GIIntegratorContext* __restrict context, PathTracingBatcher* ptBatcher,
-                                     const HitParameters& hit)
+        static ParkedRayQueue* EnterParkedQueue(KernelData* __restrict kernelData, uint32 instanceId)
+        {
+            uint subsceneIndex = (uint)kernelData->scene->data->subsceneInstances[instanceId].index;
+            ParkedRayQueue* queue = &kernelData->parkedQueues[subsceneIndex];
+
+            // -- Counted before the ray's batch is freed so the batcher is never empty while the frame still has work
+            Atomic::Increment64(&kernelData->parkedRayCount);
+            Atomic::Increment64(&kernelData->totalParkedRays);
+
+            EnterSpinLock(queue->spinlock);
+            return queue;
+        }
+
+        //=========================================================================================================================
+        static void ParkRay(KernelData* __restrict kernelData, uint32 instanceId, const DeferredRay& ray)
+        {
+            ParkedRayQueue* queue = EnterParkedQueue(kernelData, instanceId);
+            queue->rays.Add(ray);
+            LeaveSpinLock(queue->spinlock);
+        }
+
+        //=========================================================================================================================
+        static void ParkRay(KernelData* __restrict kernelData, uint32 instanceId, const OcclusionRay& ray)
+        {
+            ParkedRayQueue* queue = EnterParkedQueue(kernelData, instanceId);
+            queue->occlusionRays.Add(ray);
+            LeaveSpinLock(queue->spinlock);
+        }
+
+        //=========================================================================================================================
+        // -- Hits on textured surfaces need their subscene's uvs. These are parked on the subscene that was evicted after the hit
+        // -- was found rather than waiting for it to be loaded again.
+        static void ParkHit(KernelData* __restrict kernelData, const HitParameters& hit)
+        {
+            ParkedRayQueue* queue = EnterParkedQueue(kernelData, (uint32)hit.instId[0]);
+            queue->hits.Add(hit);
+            LeaveSpinLock(queue->spinlock);
+        }
+
+        //=========================================================================================================================
+        static void AddLightSample(PathTracingBatcher* ptBatcher, RayStagingBuffer* staging, const HitParameters& hit,
+                                   const SurfaceParameters& surface, const LightDirectSample& lightSample, float3 reflectance,
+                                   float weight)
+        {
+            float3 sample = weight * reflectance * lightSample.radiance * (1.0f / lightSample.pdfW);
+            if(Dot(sample, float3::One_) > 0) {
+                float3 offset = OffsetRayOrigin(surface, lightSample.direction, 0.1f);
+
+                OcclusionRay occlusionRay;
+                occlusionRay.ray = MakeRay(offset, lightSample.direction);
+                occlusionRay.distance = lightSample.distance;
+                occlusionRay.index = hit.index;
+                occlusionRay.value = sample * hit.throughput;
+                ptBatcher->AddUnsortedOcclusionRay(staging, occlusionRay);
+            }
+        }
+
+        //=========================================================================================================================
+        static void AddBounceRay(GIIntegratorContext* __restrict context, PathTracingBatcher* ptBatcher,
+                                 RayStagingBuffer* staging, const HitParameters& hit, const SurfaceParameters& surface)
+        {
+            // - sample the bsdf
+            BsdfSample bsdfSample;
+            if(SampleBsdfFunction(&context->sampler, surface, hit.view, bsdfSample) == false) {
+                return;
+            }
+
+            float skyPdfW = BackgroundLightingPdf(context, bsdfSample.wi);
+            float misWeight = ImportanceSampling::BalanceHeuristic(1, bsdfSample.forwardPdfW, 1, skyPdfW);
+
+            float3 throughput = misWeight * hit.throughput * bsdfSample.reflectance;
+            if(LengthSquared(throughput) == 0.0f) {
+                return;
+            }
+
+            // --Russian roulette path termination
+            if(hit.trackedBounces >= MaxTrackedBounces_) {
+                float continuationProb = Max<float>(Max<float>(throughput.x, throughput.y), throughput.z);
+                if(context->sampler.UniformFloat() >= continuationProb) {
+                    return;
+                }
+                Assert_(continuationProb > 0.0f);
+                throughput = throughput * (1.0f / continuationProb);
+            }
+
+            float3 offsetOrigin = OffsetRayOrigin(surface, bsdfSample.wi, 1.0f);
+
+            DeferredRay bounceRay;
+            bounceRay.error = hit.error;
+            bounceRay.index = hit.index;
+            bounceRay.diracScatterOnly = hit.diracScatterOnly && bsdfSample.flags & SurfaceEventFlags::eDiracEvent;
+            bounceRay.ray = MakeRay(offsetOrigin, bsdfSample.wi);
+            bounceRay.cone = BounceRayCone(hit, (bsdfSample.flags & SurfaceEventFlags::eDiracEvent) != 0,
+                                           bsdfSample.forwardPdfW);
+            bounceRay.throughput = throughput;
+            bounceRay.trackedBounces = Min<uint32>(MaxTrackedBounces_, hit.trackedBounces + 1);
+            ptBatcher->AddUnsortedDeferredRay(staging, bounceRay);
+        }
+
+        //=========================================================================================================================
+        static void ShadeHitPosition(KernelData* __restrict kernelData, GIIntegratorContext* __restrict context,
+                                     PathTracingBatcher* ptBatcher, RayStagingBuffer* staging, const HitParameters& hit)
         {
+            SubsceneResource* pinned;
+            if(PinSurfaceGeometry(context, &hit, pinned) == false) {
+                ParkHit(kernelData, hit);
+                return;
+            }
+
             SurfaceParameters surface;
-            if(CalculateSurfaceParams(context, &hit, surface) == false) {
+            bool calculated = CalculateSurfaceParams(context, &hit, surface);
+            if(pinned != nullptr) {
+                context->geometryCache->FinishUsingSubceneGeometry(pinned);
+            }
+            if(calculated == false) {
                 return;
             }
 
@@ -74,18 +235,7 @@ namespace Selas
                                                   reversePdfW);
 
                 float weight = 1.0f;// ImportanceSampling::BalanceHeuristic(1, lightSample.pdfW, 1, forwardPdfW);
-
-                float3 sample = weight * reflectance * lightSample.radiance * (1.0f / lightSample.pdfW);
-                if(Dot(sample, float3::One_) > 0) {
-                    float3 offset = OffsetRayOrigin(surface, lightSample.direction, 0.1f);
-
-                    OcclusionRay occlusionRay;
-                    occlusionRay.ray = MakeRay(offset, lightSample.direction);
-                    occlusionRay.distance = lightSample.distance;
-                    occlusionRay.index = hit.index;
-                    occlusionRay.value = sample * hit.throughput;
-                    ptBatcher->AddUnsortedOcclusionRay(occlusionRay);
-                }
+                AddLightSample(ptBatcher, staging, hit, surface, lightSample, reflectance, weight);
             }
 
             LightDirectSample skySample;
@@ -96,199 +246,338 @@ namespace Selas
                 float3 reflectance = EvaluateBsdf(surface, hit.view, skySample.direction, forwardPdfW, reversePdfW);
 
                 float misWeight = ImportanceSampling::BalanceHeuristic(1, skySample.pdfW, 1, forwardPdfW);
+                AddLightSample(ptBatcher, staging, hit, surface, skySample, reflectance, misWeight);
+            }
+
+            AddBounceRay(context, ptBatcher, staging, hit, surface);
+        }
+
+        //=========================================================================================================================
+        // -- Shades up to DisneySimdWidth_ hits whose surfaces were filled by the batched CalculateSurfaceParams. Follows the same
+        // -- steps as ShadeHitPosition except that both next event estimation BSDF evaluations of the Disney surfaces in the
+        // -- group are done with EvaluateDisney8.
+        static void ShadeHitGroup(GIIntegratorContext* __restrict context, PathTracingBatcher* ptBatcher,
+                                  RayStagingBuffer* staging, const HitParameters* hits, const SurfaceParameters* surfaces,
+                                  uint hitCount)
+        {
+            Assert_(hitCount <= DisneySimdWidth_);
 
-                float3 sample = misWeight * reflectance * skySample.radiance * (1.0f / skySample.pdfW);
-                if(Dot(sample, float3::One_) > 0) {
-                    float3 offset = OffsetRayOrigin(surface, skySample.direction, 0.1f);
+            LightDirectSample lightSamples[DisneySimdWidth_];
+            LightDirectSample skySamples[DisneySimdWidth_];
+            float3 lightReflectance[DisneySimdWidth_];
+            float3 skyReflectance[DisneySimdWidth_];
+            float skyForwardPdfW[DisneySimdWidth_];
 
-                    OcclusionRay occlusionRay;
-                    occlusionRay.ray = MakeRay(offset, skySample.direction);
-                    occlusionRay.distance = skySample.distance;
-                    occlusionRay.index = hit.index;
-                    occlusionRay.value = sample * hit.throughput;
-                    ptBatcher->AddUnsortedOcclusionRay(occlusionRay);
+            const SurfaceParameters* disneySurfaces[DisneySimdWidth_];
+            float3 disneyViews[DisneySimdWidth_];
+            float3 disneyLightDirections[DisneySimdWidth_];
+            float3 disneySkyDirections[DisneySimdWidth_];
+            uint disneyLanes[DisneySimdWidth_];
+            uint disneyCount = 0;
+
+            for(uint scan = 0; scan < hitCount; ++scan) {
+                const HitParameters& hit = hits[scan];
+                const SurfaceParameters& surface = surfaces[scan];
+
+                NextEventEstimation(context, surface.lightSetIndex, hit.position, GeometricNormal(surface), lightSamples[scan]);
+                SampleBackground(context, skySamples[scan]);
+
+                // -- Directions of samples that will be discarded are swapped for the view so every lane stays finite
+                bool hasLight = Dot(lightSamples[scan].radiance, float3::One_) > 0;
+                bool hasSky = Dot(skySamples[scan].radiance, float3::One_) > 0;
+                float3 lightDirection = hasLight ? lightSamples[scan].direction : hit.view;
+                float3 skyDirection = hasSky ? skySamples[scan].direction : hit.view;
+
+                if(surface.shader == eDisneyThin || surface.shader == eDisneySolid) {
+                    disneySurfaces[disneyCount] = &surface;
+                    disneyViews[disneyCount] = hit.view;
+                    disneyLightDirections[disneyCount] = lightDirection;
+                    disneySkyDirections[disneyCount] = skyDirection;
+                    disneyLanes[disneyCount] = scan;
+                    ++disneyCount;
+                }
+                else {
+                    float forwardPdfW;
+                    float reversePdfW;
+                    lightReflectance[scan] = EvaluateBsdf(surface, hit.view, lightDirection, forwardPdfW, reversePdfW);
+                    skyReflectance[scan] = EvaluateBsdf(surface, hit.view, skyDirection, skyForwardPdfW[scan], reversePdfW);
                 }
             }
 
-            {
-                // - sample the bsdf
-                BsdfSample bsdfSample;
-                if(SampleBsdfFunction(&context->sampler, surface, hit.view, bsdfSample) == false) {
-                    return;
-                }
+            if(disneyCount > 0) {
+                DisneySurface8 soa;
+                DisneySurface8_Load(disneySurfaces, disneyCount, &soa);
 
-                float skyPdfW = BackgroundLightingPdf(context, bsdfSample.wi);
-                float misWeight = ImportanceSampling::BalanceHeuristic(1, bsdfSample.forwardPdfW, 1, skyPdfW);
+                float3 reflectance[DisneySimdWidth_];
+                float forwardPdfW[DisneySimdWidth_];
+                float reversePdfW[DisneySimdWidth_];
 
-                float3 throughput = misWeight * hit.throughput * bsdfSample.reflectance;
-                if(LengthSquared(throughput) == 0.0f) {
-                    return;
+                EvaluateDisney8(&soa, disneyViews, disneyLightDirections, reflectance, forwardPdfW, reversePdfW);
+                for(uint scan = 0; scan < disneyCount; ++scan) {
+                    lightReflectance[disneyLanes[scan]] = reflectance[scan];
                 }
 
-                // --Russian roulette path termination
-                if(hit.trackedBounces >= MaxTrackedBounces_) {
-                    float continuationProb = Max<float>(Max<float>(throughput.x, throughput.y), throughput.z);
-                    if(context->sampler.UniformFloat() >= continuationProb) {
-                        return;
-                    }
-                    Assert_(continuationProb > 0.0f);
-                    throughput = throughput * (1.0f / continuationProb);
+                EvaluateDisney8(&soa, disneyViews, disneySkyDirections, reflectance, forwardPdfW, reversePdfW);
+                for(uint scan = 0; scan < disneyCount; ++scan) {
+                    skyReflectance[disneyLanes[scan]] = reflectance[scan];
+                    skyForwardPdfW[disneyLanes[scan]] = forwardPdfW[scan];
+                }
+            }
+
+            for(uint scan = 0; scan < hitCount; ++scan) {
+                const HitParameters& hit = hits[scan];
+                const SurfaceParameters& surface = surfaces[scan];
+
+                if(Dot(lightSamples[scan].radiance, float3::One_) > 0) {
+                    AddLightSample(ptBatcher, staging, hit, surface, lightSamples[scan], lightReflectance[scan], 1.0f);
                 }
 
-                float3 offsetOrigin = OffsetRayOrigin(surface, bsdfSample.wi, 1.0f);
+                if(Dot(skySamples[scan].radiance, float3::One_) > 0) {
+                    float misWeight = ImportanceSampling::BalanceHeuristic(1, skySamples[scan].pdfW, 1, skyForwardPdfW[scan]);
+                    AddLightSample(ptBatcher, staging, hit, surface, skySamples[scan], skyReflectance[scan], misWeight);
+                }
 
-                DeferredRay bounceRay;
-                bounceRay.error = hit.error;
-                bounceRay.index = hit.index;
-                bounceRay.diracScatterOnly = hit.diracScatterOnly && bsdfSample.flags & SurfaceEventFlags::eDiracEvent;
-                bounceRay.ray = MakeRay(offsetOrigin, bsdfSample.wi);
-                bounceRay.throughput = throughput;
-                bounceRay.trackedBounces = Min<uint32>(MaxTrackedBounces_, hit.trackedBounces + 1);
-                ptBatcher->AddUnsortedDeferredRay(bounceRay);
+                AddBounceRay(context, ptBatcher, staging, hit, surface);
             }
         }
 
+        static void DeferredPathTracerKernel(void* userData);
+
         //=========================================================================================================================
-        static void TraceRayBatch(GIIntegratorContext* __restrict context, PathTracingBatcher* ptBatcher,
-                                  DeferredRay* rays, uint rayCount)
+        // -- Starts a kernel for each ready batch that does not have a thread working on it, up to one kernel per thread.
+        static void WakeIdleWorkers(KernelData* __restrict kernelData)
         {
-            #define BatchSize_ 8
-            uint batchCount = (rayCount + BatchSize_ - 1) / BatchSize_;
+            while(kernelData->ptBatcher->HasReadyBatches()) {
+                int64 activeKernels = kernelData->activeKernels;
+                if(activeKernels >= kernelData->workerCount) {
+                    break;
+                }
 
-            const float kErr = 32.0f * 1.19209e-07f;
+                if(Atomic::CompareExchange64(&kernelData->activeKernels, activeKernels + 1, activeKernels)) {
+                    JobSystem_Submit(&kernelData->kernelGroup, DeferredPathTracerKernel, kernelData);
+                }
+            }
+        }
 
-            for(uint batchScan = 0; batchScan < batchCount; ++batchScan) {
-                DeferredRay* startRay = rays + BatchSize_ * batchScan;
+        //=========================================================================================================================
+        // -- Moves the rays and hits parked on subscenes that have become resident back into the batcher. A subscene can be
+        // -- evicted again before its rays get here so any that are not resident are requested again.
+        static void ResumeParkedRays(KernelData* __restrict kernelData, RayStagingBuffer* staging)
+        {
+            if(kernelData->parkedRayCount == 0) {
+                return;
+            }
 
-                uint batchSize = Min<uint>(rayCount - batchScan * BatchSize_, BatchSize_);
+            int64 resumedCount = 0;
 
-                RTCIntersectContext rtcContext;
-                rtcInitIntersectContext(&rtcContext);
+            for(uint scan = 0; scan < kernelData->parkedQueueCount; ++scan) {
+                ParkedRayQueue* queue = &kernelData->parkedQueues[scan];
+                if(queue->rays.Count() == 0 && queue->occlusionRays.Count() == 0 && queue->hits.Count() == 0) {
+                    continue;
+                }
 
-                Align_(64) int32 valid[BatchSize_];
+                SubsceneResource* subscene = kernelData->scene->subscenes[scan];
+                if(subscene->geometryLoaded == 0) {
+                    kernelData->geometryCache->RequestSubsceneGeometry(subscene);
+                    continue;
+                }
 
-                Align_(64) RTCRayHit8 rayhit;
-                for(uint scan = 0; scan < batchSize; ++scan) {
-                    rayhit.ray.org_x[scan] = startRay[scan].ray.origin.x;
-                    rayhit.ray.org_y[scan] = startRay[scan].ray.origin.y;
-                    rayhit.ray.org_z[scan] = startRay[scan].ray.origin.z;
-                    rayhit.ray.dir_x[scan] = startRay[scan].ray.direction.x;
-                    rayhit.ray.dir_y[scan] = startRay[scan].ray.direction.y;
-                    rayhit.ray.dir_z[scan] = startRay[scan].ray.direction.z;
-                    rayhit.ray.tnear[scan] = 0.0f;
-                    rayhit.ray.tfar[scan] = FloatMax_;
+                // -- Another worker is already parking or resuming rays on this queue
+                if(TryEnterSpinLock(queue->spinlock) == false) {
+                    continue;
+                }
 
-                    rayhit.hit.geomID[scan] = RTC_INVALID_GEOMETRY_ID;
-                    rayhit.hit.primID[scan] = RTC_INVALID_GEOMETRY_ID;
-                    rayhit.hit.instID[0][scan] = RTC_INVALID_GEOMETRY_ID;
-                    rayhit.hit.instID[1][scan] = RTC_INVALID_GEOMETRY_ID;
-                    valid[scan] = -1;
+                for(uint rayIndex = 0, rayCount = (uint)queue->rays.Count(); rayIndex < rayCount; ++rayIndex) {
+                    kernelData->ptBatcher->AddUnsortedDeferredRay(staging, queue->rays[rayIndex]);
+                }
+                for(uint rayIndex = 0, rayCount = (uint)queue->occlusionRays.Count(); rayIndex < rayCount; ++rayIndex) {
+                    kernelData->ptBatcher->AddUnsortedOcclusionRay(staging, queue->occlusionRays[rayIndex]);
                 }
-                for(uint scan = batchSize; scan < BatchSize_; ++scan) {
-                    valid[scan] = 0;
+                for(uint hitIndex = 0, hitCount = (uint)queue->hits.Count(); hitIndex < hitCount; ++hitIndex) {
+                    kernelData->ptBatcher->AddUnsortedHit(staging, queue->hits[hitIndex]);
                 }
+                resumedCount += (int64)(queue->rays.Count() + queue->occlusionRays.Count() + queue->hits.Count());
 
-                rtcIntersect8(valid, context->rtcScene, &rtcContext, &rayhit);
+                queue->rays.Clear();
+                queue->occlusionRays.Clear();
+                queue->hits.Clear();
+                LeaveSpinLock(queue->spinlock);
+            }
+
+            if(resumedCount > 0) {
+                // -- Published before the parked count drops so the rays are never invisible to RenderPass
+                kernelData->ptBatcher->FlushStaging(staging);
+                Atomic::Add64(&kernelData->parkedRayCount, -resumedCount);
+                WakeIdleWorkers(kernelData);
+            }
+        }
 
-                for(uint scan = 0; scan < BatchSize_; ++scan) {
-                    float3 Ld[OutputLayers_];
-                    Memory::Zero(Ld, sizeof(Ld));
+        //=========================================================================================================================
+        static void TraceRayBatch(KernelData* __restrict kernelData, GIIntegratorContext* __restrict context,
+                                  PathTracingBatcher* ptBatcher, RayStagingBuffer* staging, RayStream* stream,
+                                  RayPacketWidth packetWidth, HitShadingMode shadingMode, DeferredRay* rays, uint rayCount)
+        {
+            const float kErr = 32.0f * 1.19209e-07f;
 
-                    if(valid[scan] == 0 || rayhit.hit.geomID[scan] == RTC_INVALID_GEOMETRY_ID) {
+            for(uint chunkStart = 0; chunkStart < rayCount; chunkStart += RayStreamChunkSize_) {
+                DeferredRay* chunkRays = rays + chunkStart;
+                uint chunkSize = Min<uint>(rayCount - chunkStart, RayStreamChunkSize_);
+
+                for(uint scan = 0; scan < chunkSize; ++scan) {
+                    RayStream_SetRay(stream, scan, chunkRays[scan].ray, FloatMax_);
+                }
+
+                RayStream_Intersect(stream, chunkSize, context->rtcScene, packetWidth, DeferNonResidentRays_ != 0);
+
+                for(uint scan = 0; scan < chunkSize; ++scan) {
+                    const DeferredRay& dray = chunkRays[scan];
+
+                    // -- Any hit found past a skipped subscene may not be the closest so the whole ray is traced again
+                    if(stream->missingInstId[scan] != RTC_INVALID_GEOMETRY_ID) {
+                        ParkRay(kernelData, stream->missingInstId[scan], dray);
+                        continue;
+                    }
+
+                    if(stream->geomId[scan] == RTC_INVALID_GEOMETRY_ID) {
+                        float3 Ld[OutputLayers_];
+                        Memory::Zero(Ld, sizeof(Ld));
 
                         float3 sample;
-                        if(startRay[scan].diracScatterOnly)
-                            sample = EvaluateBackgroundMiss(context, startRay[scan].ray.direction);
+                        if(dray.diracScatterOnly)
+                            sample = EvaluateBackgroundMiss(context, dray.ray.direction);
                         else
-                            sample = EvaluateBackground(context, startRay[scan].ray.direction);
+                            sample = EvaluateBackground(context, dray.ray.direction);
 
-                        Ld[0] += sample * startRay[scan].throughput;
-                        FramebufferWriter_Write(&context->frameWriter, Ld, OutputLayers_, startRay[scan].index);
+                        Ld[0] += sample * dray.throughput;
+                        FramebufferWriter_Write(&context->frameWriter, Ld, OutputLayers_, dray.index);
                         continue;
                     }
 
+                    float tfar = stream->tfar[scan];
+
                     HitParameters hit;
-                    hit.position.x = rayhit.ray.org_x[scan] + rayhit.ray.tfar[scan] * rayhit.ray.dir_x[scan];
-                    hit.position.y = rayhit.ray.org_y[scan] + rayhit.ray.tfar[scan] * rayhit.ray.dir_y[scan];
-                    hit.position.z = rayhit.ray.org_z[scan] + rayhit.ray.tfar[scan] * rayhit.ray.dir_z[scan];
-                    hit.normal = float3(rayhit.hit.Ng_x[scan], rayhit.hit.Ng_y[scan], rayhit.hit.Ng_z[scan]);
-                    hit.view = -startRay[scan].ray.direction;
-                    hit.error = kErr * Max(Max(Math::Absf(hit.position.x), Math::Absf(hit.position.y)), Max(Math::Absf(hit.position.z), rayhit.ray.tfar[scan]));
-                    hit.baryCoords = { rayhit.hit.u[scan], rayhit.hit.v[scan] };
-                    hit.geomId = rayhit.hit.geomID[scan];
-                    hit.primId = rayhit.hit.primID[scan];
-                    hit.instId[0] = rayhit.hit.instID[0][scan];
-                    hit.instId[1] = rayhit.hit.instID[1][scan];
-                    hit.index = startRay[scan].index;
-                    hit.diracScatterOnly = startRay[scan].diracScatterOnly;
-                    hit.trackedBounces = startRay[scan].trackedBounces;
-                    hit.throughput = startRay[scan].throughput;
-
-                    //ptBatcher->AddUnsortedHit(hit);
-                    ShadeHitPosition(context, ptBatcher, hit);
+                    hit.position = dray.ray.origin + tfar * dray.ray.direction;
+                    hit.normal = float3(stream->ngX[scan], stream->ngY[scan], stream->ngZ[scan]);
+                    hit.view = -dray.ray.direction;
+                    hit.error = kErr * Max(Max(Math::Absf(hit.position.x), Math::Absf(hit.position.y)), Max(Math::Absf(hit.position.z), tfar));
+                    hit.baryCoords = { stream->u[scan], stream->v[scan] };
+                    hit.cone.width = RayConeWidth(dray.cone, tfar);
+                    hit.cone.spread = dray.cone.spread;
+                    hit.geomId = stream->geomId[scan];
+                    hit.primId = stream->primId[scan];
+                    hit.instId[0] = stream->instId[0][scan];
+                    hit.instId[1] = stream->instId[1][scan];
+                    hit.index = dray.index;
+                    hit.diracScatterOnly = dray.diracScatterOnly;
+                    hit.trackedBounces = dray.trackedBounces;
+                    hit.throughput = dray.throughput;
+                    hit.materialKey = 0;
+                    hit.textureKey = 0;
+
+                    if(shadingMode == eShadeHitsSorted) {
+                        float4x4 localToWorld;
+                        ModelGeometryUserData* modelData;
+                        ModelDataFromRayIds(context->scene, hit.instId, hit.geomId, localToWorld, modelData);
+
+                        hit.materialKey = (uint64)modelData->material;
+                        hit.textureKey = modelData->baseColorTextureHandle.Key();
+
+                        ptBatcher->AddUnsortedHit(staging, hit);
+                    }
+                    else {
+                        ShadeHitPosition(kernelData, context, ptBatcher, staging, hit);
+                    }
                 }
             }
         }
 
         //=========================================================================================================================
-        static void TraceOcclusionBatch(GIIntegratorContext* __restrict context, OcclusionRay* rays, uint rayCount)
+        static void TraceOcclusionBatch(KernelData* __restrict kernelData, GIIntegratorContext* __restrict context,
+                                        RayStream* stream, RayPacketWidth packetWidth, OcclusionRay* rays, uint rayCount)
         {
-            #define BatchSize_ 8
-            uint batchCount = (rayCount + BatchSize_ - 1) / BatchSize_;
-
-            for(uint batchScan = 0; batchScan < batchCount; ++batchScan) {
-                OcclusionRay* startRay = rays + BatchSize_ * batchScan;
-
-                uint batchSize = Min<uint>(rayCount - batchScan * BatchSize_, BatchSize_);
-
-                RTCIntersectContext rtcContext;
-                rtcInitIntersectContext(&rtcContext);
-
-                Align_(64) int32 valid[BatchSize_];
+            for(uint chunkStart = 0; chunkStart < rayCount; chunkStart += RayStreamChunkSize_) {
+                OcclusionRay* chunkRays = rays + chunkStart;
+                uint chunkSize = Min<uint>(rayCount - chunkStart, RayStreamChunkSize_);
 
-                Align_(64) RTCRay8 ray;
-                for(uint scan = 0; scan < batchSize; ++scan) {
-                    ray.org_x[scan] = startRay[scan].ray.origin.x;
-                    ray.org_y[scan] = startRay[scan].ray.origin.y;
-                    ray.org_z[scan] = startRay[scan].ray.origin.z;
-                    ray.dir_x[scan] = startRay[scan].ray.direction.x;
-                    ray.dir_y[scan] = startRay[scan].ray.direction.y;
-                    ray.dir_z[scan] = startRay[scan].ray.direction.z;
-                    ray.tnear[scan] = 0.0f;
-                    ray.tfar[scan]  = startRay[scan].distance;
-
-                    valid[scan] = -1;
-                }
-                for(uint scan = batchSize; scan < BatchSize_; ++scan) {
-                    valid[scan] = 0;
+                for(uint scan = 0; scan < chunkSize; ++scan) {
+                    RayStream_SetRay(stream, scan, chunkRays[scan].ray, chunkRays[scan].distance);
                 }
 
-                rtcOccluded8(valid, context->rtcScene, &rtcContext, &ray);
+                RayStream_Occluded(stream, chunkSize, context->rtcScene, packetWidth, DeferNonResidentRays_ != 0);
 
-                for(uint scan = 0; scan < BatchSize_; ++scan) {
-                    if(valid[scan] == -1 && ray.tfar[scan] >= 0.0f) {
+                for(uint scan = 0; scan < chunkSize; ++scan) {
+                    if(stream->tfar[scan] >= 0.0f) {
+                        // -- Unoccluded only counts when no subscene was skipped. Occluded rays are final either way.
+                        if(stream->missingInstId[scan] != RTC_INVALID_GEOMETRY_ID) {
+                            ParkRay(kernelData, stream->missingInstId[scan], chunkRays[scan]);
+                            continue;
+                        }
 
                         float3 Ld[OutputLayers_];
                         Memory::Zero(Ld, sizeof(Ld));
 
-                        Ld[0] = startRay[scan].value;
-                        FramebufferWriter_Write(&context->frameWriter, Ld, OutputLayers_, startRay[scan].index);
+                        Ld[0] = chunkRays[scan].value;
+                        FramebufferWriter_Write(&context->frameWriter, Ld, OutputLayers_, chunkRays[scan].index);
                     }
                 }
             }
         }
 
         //=========================================================================================================================
-        static void ShadeHitBatch(GIIntegratorContext* __restrict context, PathTracingBatcher* ptBatcher,
-                                  HitParameters* hits, uint hitCount)
+        static void ShadeHitBatch(KernelData* __restrict kernelData, GIIntegratorContext* __restrict context,
+                                  PathTracingBatcher* ptBatcher, RayStagingBuffer* staging, HitParameters* hits,
+                                  uint hitCount)
         {
-            for(uint scan = 0; scan < hitCount; ++scan) {
-                ShadeHitPosition(context, ptBatcher, hits[scan]);
-            }
+            #if SimdShading_
+                SurfaceParameters surfaces[SurfaceBatchSize_];
+                SubsceneResource* pinned[SurfaceBatchSize_];
+
+                for(uint chunk = 0; chunk < hitCount; chunk += SurfaceBatchSize_) {
+                    uint chunkCount = Min<uint>(SurfaceBatchSize_, hitCount - chunk);
+                    HitParameters* chunkHits = hits + chunk;
+
+                    // -- Park the hits whose geometry has been evicted and compact the rest. Sorted hits mostly share a
+                    // -- subscene with their neighbor so each run of them is only pinned once.
+                    uint shadedCount = 0;
+                    uint pinnedCount = 0;
+                    for(uint scan = 0; scan < chunkCount; ++scan) {
+                        SubsceneResource* subscene;
+                        if(PinSurfaceGeometry(context, &chunkHits[scan], subscene) == false) {
+                            ParkHit(kernelData, chunkHits[scan]);
+                            continue;
+                        }
+
+                        if(subscene != nullptr) {
+                            if(pinnedCount > 0 && pinned[pinnedCount - 1] == subscene) {
+                                context->geometryCache->FinishUsingSubceneGeometry(subscene);
+                            }
+                            else {
+                                pinned[pinnedCount++] = subscene;
+                            }
+                        }
+
+                        chunkHits[shadedCount++] = chunkHits[scan];
+                    }
+
+                    CalculateSurfaceParams(context, chunkHits, shadedCount, surfaces);
+                    for(uint scan = 0; scan < pinnedCount; ++scan) {
+                        context->geometryCache->FinishUsingSubceneGeometry(pinned[scan]);
+                    }
+
+                    for(uint scan = 0; scan < shadedCount; scan += DisneySimdWidth_) {
+                        ShadeHitGroup(context, ptBatcher, staging, chunkHits + scan, surfaces + scan,
+                                      Min<uint>(DisneySimdWidth_, shadedCount - scan));
+                    }
+                }
+            #else
+                for(uint scan = 0; scan < hitCount; ++scan) {
+                    ShadeHitPosition(kernelData, context, ptBatcher, staging, hits[scan]);
+                }
+            #endif
         }
 
         //=========================================================================================================================
-        static void GeneratePrimaryRays(CSampler* sampler, KernelData* __restrict kernelData)
+        static void GeneratePrimaryRays(CSampler* sampler, KernelData* __restrict kernelData, RayStagingBuffer* staging)
         {
             uint width = kernelData->camera->width;
             uint height = kernelData->camera->height;
@@ -304,114 +593,451 @@ namespace Selas
                 uint y = index / width;
                 uint x = index - (y * width);
 
+                if(FrameBuffer_PixelActive(kernelData->frame, (uint32)(y * width + x)) == false) {
+                    continue;
+                }
+
                 uint sampleCount = SamplesPerPixelX_ * SamplesPerPixelY_;
+                // -- Each pass uses a different jitter pattern for the pixel
+                int32 pattern = (int32)(uint32)(kernelData->passIndex * endIndex + index);
 
                 for(uint scan = 0; scan < sampleCount; ++scan) {
 
                     DeferredRay dr;
                     dr.ray              = JitteredCameraRay(kernelData->camera, (int32)x, (int32)y, (int32)scan,
-                                                            SamplesPerPixelX_, SamplesPerPixelY_, (int32)index);
+                                                            SamplesPerPixelX_, SamplesPerPixelY_, pattern);
                     dr.error            = 0.0f;
+                    dr.cone             = CameraRayCone(kernelData->camera);
                     dr.index            = (uint32)(y * width + x);
                     dr.diracScatterOnly = 1;
                     dr.throughput       = float3::One_;
                     dr.trackedBounces   = 0;
-                    kernelData->ptBatcher->AddUnsortedDeferredRay(dr);
+                    kernelData->ptBatcher->AddUnsortedDeferredRay(staging, dr);
                 }
             }
         }
 
         //=========================================================================================================================
+        static void InitializeKernelStates(KernelData* __restrict kernelData)
+        {
+            for(uint scan = 0; scan < (uint)kernelData->workerCount; ++scan) {
+                KernelState* state = PlacementNew_(KernelState, &kernelData->kernelStates[scan]);
+                state->inUse = 0;
+
+                GIIntegratorContext& context = state->context;
+                context.geometryCache = kernelData->geometryCache;
+                context.textureCache  = kernelData->textureCache;
+                context.rtcScene      = kernelData->scene->rtcScene;
+                context.scene         = kernelData->scene;
+                context.camera        = kernelData->camera;
+                context.sampler.Initialize(kernelData->samplerType,
+                                           (uint32)(kernelData->passIndex * kernelData->workerCount + scan));
+                context.maxPathLength = 1;
+                FramebufferWriter_Initialize(&context.frameWriter, kernelData->frame);
+                PtexFilterCache_Initialize(&context.ptexFilters, kernelData->textureCache);
+
+                state->staging = New_(RayStagingBuffer);
+                RayStream_Initialize(&state->stream, RayStreamChunkSize_);
+            }
+        }
+
+        //=========================================================================================================================
+        static void ShutdownKernelStates(KernelData* __restrict kernelData)
+        {
+            for(uint scan = 0; scan < (uint)kernelData->workerCount; ++scan) {
+                KernelState* state = &kernelData->kernelStates[scan];
+                Assert_(state->inUse == 0);
+
+                RayStream_Shutdown(&state->stream);
+                Delete_(state->staging);
+
+                GIIntegratorContext& context = state->context;
+                PtexFilterCache_Shutdown(&context.ptexFilters);
+                PtexFilterCache_AccumulateStats(&context.ptexFilters, &kernelData->ptexStats);
+
+                context.sampler.Shutdown();
+                FramebufferWriter_Shutdown(&context.frameWriter);
+
+                PlacementDelete_(KernelState, state);
+            }
+        }
+
+        //=========================================================================================================================
+        static KernelState* AcquireKernelState(KernelData* __restrict kernelData)
+        {
+            // -- A free state always exists since each running kernel holds at most one and activeKernels never exceeds
+            // -- workerCount.
+            for(uint scan = 0; scan < (uint)kernelData->workerCount; ++scan) {
+                KernelState* state = &kernelData->kernelStates[scan];
+                if(state->inUse == 0 && Atomic::CompareExchange32(&state->inUse, 1, 0)) {
+                    return state;
+                }
+            }
+
+            AssertMsg_(false, "More deferred kernels are running than there are kernel states.");
+            return nullptr;
+        }
+
+        //=========================================================================================================================
+        // -- Processes ready batches until there are none left and then returns the thread to the job system. Idle kernels never
+        // -- block; RenderPass flushes partially filled batches once every kernel has returned since at that point nothing else
+        // -- can add to them.
         static void DeferredPathTracerKernel(void* userData)
         {
             KernelData* __restrict kernelData = (KernelData*)userData;
-            
-            int64 kernelIndex = Atomic::Increment64(&kernelData->kernelCounter);
+            PathTracingBatcher* ptBatcher = kernelData->ptBatcher;
 
-            GIIntegratorContext context;
-            context.geometryCache = kernelData->geometryCache;
-            context.textureCache  = kernelData->textureCache;
-            context.rtcScene      = kernelData->scene->rtcScene;
-            context.scene         = kernelData->scene;
-            context.camera        = kernelData->camera;
-            context.sampler.Initialize((uint32)kernelIndex);
-            context.maxPathLength = 1;
-            FramebufferWriter_Initialize(&context.frameWriter, kernelData->frame);
-
-            GeneratePrimaryRays(&context.sampler, kernelData);
-
-            // JSTODO -- Change stop condition to be that this is empty and that all worker kernels report as idle
-            //        -- so no threads exit when they could be useful later.
-            while(kernelData->ptBatcher->Empty() == false) {
-                
+            KernelState* state = AcquireKernelState(kernelData);
+            GIIntegratorContext* context = &state->context;
+            RayStagingBuffer* staging = state->staging;
+
+            GeneratePrimaryRays(&context->sampler, kernelData, staging);
+            ptBatcher->FlushStaging(staging);
+
+            while(true) {
                 DeferredRay* deferredRays;
                 OcclusionRay* occlusionRays;
                 HitParameters* hitParams;
                 uint rayCount;
                 uint hitCount;
 
-                if(kernelData->ptBatcher->GetSortedHits(hitParams, hitCount)) {
-                    ShadeHitBatch(&context, kernelData->ptBatcher, hitParams, hitCount);
-                    kernelData->ptBatcher->FreeHits(hitParams);
+                ResumeParkedRays(kernelData, staging);
+
+                if(ptBatcher->GetSortedHits(hitParams, hitCount)) {
+                    auto shadingTimer = SystemTime::Now();
+                    ShadeHitBatch(kernelData, context, ptBatcher, staging, hitParams, hitCount);
+                    Atomic::Add64(&kernelData->shadingMicroseconds, (int64)SystemTime::ElapsedMicrosecondsF(shadingTimer));
+                    Atomic::Add64(&kernelData->shadedHitCount, (int64)hitCount);
+                    ptBatcher->FlushStaging(staging);
+                    ptBatcher->FreeHits(hitParams);
+                    WakeIdleWorkers(kernelData);
+                    continue;
                 }
-                else if(kernelData->ptBatcher->GetSortedBatch(occlusionRays, rayCount)) {
-                    TraceOcclusionBatch(&context, occlusionRays, rayCount);
-                    kernelData->ptBatcher->FreeRays(occlusionRays);
+
+                if(ptBatcher->GetSortedBatch(occlusionRays, rayCount)) {
+                    TraceOcclusionBatch(kernelData, context, &state->stream, kernelData->packetWidth, occlusionRays, rayCount);
+                    ptBatcher->FreeRays(occlusionRays);
+                    continue;
                 }
-                else if(kernelData->ptBatcher->GetSortedBatch(deferredRays, rayCount)) {
-                    TraceRayBatch(&context, kernelData->ptBatcher, deferredRays, rayCount);
-                    kernelData->ptBatcher->FreeRays(deferredRays);
+
+                if(ptBatcher->GetSortedBatch(deferredRays, rayCount)) {
+                    TraceRayBatch(kernelData, context, ptBatcher, staging, &state->stream, kernelData->packetWidth,
+                                  kernelData->shadingMode, deferredRays, rayCount);
+                    ptBatcher->FlushStaging(staging);
+                    ptBatcher->FreeRays(deferredRays);
+                    WakeIdleWorkers(kernelData);
+                    continue;
                 }
-                else {
-                    kernelData->ptBatcher->Flush();
+
+                break;
+            }
+
+            state->inUse = 0;
+            Atomic::Decrement64(&kernelData->activeKernels);
+
+            // -- A batch may have become ready after our last check and found every other kernel busy
+            WakeIdleWorkers(kernelData);
+        }
+
+        //=========================================================================================================================
+        struct PacketBenchmarkData
+        {
+            RTCScene       rtcScene;
+            const Ray*     rays;
+            uint           rayCount;
+            RayPacketWidth packetWidth;
+            volatile int64 chunkIndex;
+        };
+
+        //=========================================================================================================================
+        static void PacketBenchmarkKernel(void* userData)
+        {
+            PacketBenchmarkData* data = (PacketBenchmarkData*)userData;
+
+            RayStream stream;
+            RayStream_Initialize(&stream, RayStreamChunkSize_);
+
+            while(true) {
+                uint start = (uint)Atomic::Increment64(&data->chunkIndex) * RayStreamChunkSize_;
+                if(start >= data->rayCount) {
+                    break;
+                }
+
+                uint count = Min<uint>(data->rayCount - start, RayStreamChunkSize_);
+                for(uint scan = 0; scan < count; ++scan) {
+                    RayStream_SetRay(&stream, scan, data->rays[start + scan], FloatMax_);
+                }
+
+                RayStream_Intersect(&stream, count, data->rtcScene, data->packetWidth);
+            }
+
+            RayStream_Shutdown(&stream);
+        }
+
+        //=========================================================================================================================
+        static float MeasureRaysPerSecond(RTCScene rtcScene, const Ray* rays, uint rayCount, RayPacketWidth packetWidth)
+        {
+            PacketBenchmarkData data;
+            data.rtcScene = rtcScene;
+            data.rays = rays;
+            data.rayCount = rayCount;
+            data.packetWidth = packetWidth;
+            data.chunkIndex = 0;
+
+            auto timer = SystemTime::Now();
+
+            TaskGroup group;
+            for(uint scan = 0, threadCount = JobSystem_ThreadCount(); scan < threadCount; ++scan) {
+                JobSystem_Submit(&group, PacketBenchmarkKernel, &data);
+            }
+            TaskGroup_Wait(&group);
+
+            float elapsedSeconds = SystemTime::ElapsedSecondsF(timer);
+            return rayCount / elapsedSeconds;
+        }
+
+        //=========================================================================================================================
+        void BenchmarkPacketWidths(SceneResource* scene, const RayCastCameraSettings& camera)
+        {
+            uint width = camera.width;
+            uint height = camera.height;
+            uint rayCount = width * height;
+
+            // -- Primary rays are generated in scanline order so they are fairly coherent.
+            Ray* primaryRays = AllocArray_(Ray, rayCount);
+            for(uint y = 0; y < height; ++y) {
+                for(uint x = 0; x < width; ++x) {
+                    uint index = y * width + x;
+                    primaryRays[index] = JitteredCameraRay(&camera, (int32)x, (int32)y, 0, SamplesPerPixelX_,
+                                                           SamplesPerPixelY_, (int32)index);
+                }
+            }
+
+            // -- Warm up the geometry cache and find hit points to spawn diffuse secondary rays from.
+            CSampler sampler;
+            sampler.Initialize(0);
+
+            Ray* secondaryRays = AllocArray_(Ray, rayCount);
+            uint secondaryCount = 0;
+
+            RayStream stream;
+            RayStream_Initialize(&stream, RayStreamChunkSize_);
+            for(uint start = 0; start < rayCount; start += RayStreamChunkSize_) {
+                uint count = Min<uint>(rayCount - start, RayStreamChunkSize_);
+                for(uint scan = 0; scan < count; ++scan) {
+                    RayStream_SetRay(&stream, scan, primaryRays[start + scan], FloatMax_);
+                }
+
+                RayStream_Intersect(&stream, count, scene->rtcScene, ePacketStream);
+
+                for(uint scan = 0; scan < count; ++scan) {
+                    if(stream.geomId[scan] == RTC_INVALID_GEOMETRY_ID) {
+                        continue;
+                    }
+
+                    const Ray& primary = primaryRays[start + scan];
+                    float3 position = primary.origin + stream.tfar[scan] * primary.direction;
+                    float3 normal = Normalize(float3(stream.ngX[scan], stream.ngY[scan], stream.ngZ[scan]));
+                    if(Dot(normal, primary.direction) > 0.0f) {
+                        normal = -normal;
+                    }
+
+                    float3 direction = sampler.UniformSphere();
+                    if(Dot(direction, normal) < 0.0f) {
+                        direction = -direction;
+                    }
+
+                    float offset = 32.0f * 1.19209e-07f * Max(Max(Math::Absf(position.x), Math::Absf(position.y)),
+                                                              Max(Math::Absf(position.z), stream.tfar[scan]));
+                    secondaryRays[secondaryCount++] = MakeRay(position + offset * normal, direction);
                 }
             }
+            RayStream_Shutdown(&stream);
+            sampler.Shutdown();
+
+            for(uint scan = 0; scan < RayPacketWidthCount; ++scan) {
+                RayPacketWidth packetWidth = (RayPacketWidth)scan;
+
+                float primaryRate = MeasureRaysPerSecond(scene->rtcScene, primaryRays, rayCount, packetWidth);
+                float secondaryRate = MeasureRaysPerSecond(scene->rtcScene, secondaryRays, secondaryCount, packetWidth);
+
+                WriteDebugInfo_("%s: primary %.3f Mrays/s, diffuse secondary %.3f Mrays/s", RayPacketWidthName(packetWidth),
+                                primaryRate * 1e-6f, secondaryRate * 1e-6f);
+            }
+
+            Free_(secondaryRays);
+            Free_(primaryRays);
+        }
+
+        //=========================================================================================================================
+        // -- Returns once at least one subscene with parked work is resident. Subscenes evicted since their rays were parked are
+        // -- requested again so there is always a load in flight to wake us.
+        static void WaitForParkedSubscenes(KernelData* __restrict kernelData)
+        {
+            GeometryCache* geometryCache = kernelData->geometryCache;
+
+            while(true) {
+                uint64 completedLoadCount = geometryCache->CompletedLoadCount();
+
+                for(uint scan = 0; scan < kernelData->parkedQueueCount; ++scan) {
+                    const ParkedRayQueue* queue = &kernelData->parkedQueues[scan];
+                    if(queue->rays.Count() == 0 && queue->occlusionRays.Count() == 0 && queue->hits.Count() == 0) {
+                        continue;
+                    }
+
+                    SubsceneResource* subscene = kernelData->scene->subscenes[scan];
+                    if(subscene->geometryLoaded) {
+                        return;
+                    }
+                    geometryCache->RequestSubsceneGeometry(subscene);
+                }
 
-            context.sampler.Shutdown();
-            FramebufferWriter_Shutdown(&context.frameWriter);
+                geometryCache->WaitForLoadCompletion(completedLoadCount);
+            }
+        }
+
+        //=========================================================================================================================
+        static void RenderPass(KernelData* kernelData)
+        {
+            kernelData->pixelIndex = 0;
+            InitializeKernelStates(kernelData);
+
+            while(true) {
+                // -- One kernel per job system thread. Kernels start more of themselves as batches become ready and all of
+                // -- them have returned once the group is done.
+                kernelData->activeKernels = kernelData->workerCount;
+                for(uint scan = 0; scan < (uint)kernelData->workerCount; ++scan) {
+                    JobSystem_Submit(&kernelData->kernelGroup, DeferredPathTracerKernel, kernelData);
+                }
+                TaskGroup_Wait(&kernelData->kernelGroup);
+                Assert_(kernelData->activeKernels == 0);
+
+                if(kernelData->ptBatcher->HasReadyBatches()) {
+                    continue;
+                }
+
+                if(kernelData->ptBatcher->Empty()) {
+                    if(kernelData->parkedRayCount == 0) {
+                        break;
+                    }
+
+                    // -- Everything left is waiting on the loader threads so sleep until they finish something
+                    WaitForParkedSubscenes(kernelData);
+                    continue;
+                }
+
+                kernelData->ptBatcher->Flush();
+                ++kernelData->partialFlushCount;
+            }
+
+            ShutdownKernelStates(kernelData);
+        }
+
+        //=========================================================================================================================
+        void DefaultSettings(Settings* settings)
+        {
+            settings->spillMode = eSpillToDiskInPlace;
+            settings->sortMode = eSortMortonRadix;
+            settings->sortThreadCount = JobSystem_ThreadCount();
+            settings->packetWidth = ePacketWidth8;
+            settings->shadingMode = eShadeHitsSorted;
+            settings->samplerType = eSamplerPcg32;
+            ProgressiveSettings_Default(&settings->progressive);
         }
 
         //=========================================================================================================================
         void GenerateImage(GeometryCache* geometryCache, TextureCache* textureCache, SceneResource* scene,
-                           const RayCastCameraSettings& camera, cpointer imageName)
+                           const RayCastCameraSettings& camera, const Settings& settings, cpointer imageName)
         {
             PathTracingBatcher ptBatcher;
-            ptBatcher.Initialize(camera.width * camera.height, 256 Kb_);
+            ptBatcher.Initialize(camera.width * camera.height, 256 Kb_, settings.spillMode);
+            ptBatcher.SetSortMode(settings.sortMode, scene->aaBox, settings.sortThreadCount);
 
             Framebuffer frame;
             FrameBuffer_Initialize(&frame, (uint32)camera.viewportWidth, (uint32)camera.viewportHeight, OutputLayers_);
 
             KernelData kernelData;
             kernelData.camera = &camera;
-            kernelData.kernelCounter = 0;
-            kernelData.pixelIndex = 0;
             kernelData.ptBatcher = &ptBatcher;
             kernelData.frame = &frame;
             kernelData.geometryCache = geometryCache;
             kernelData.textureCache = textureCache;
             kernelData.scene = scene;
+            kernelData.packetWidth = settings.packetWidth;
+            kernelData.shadingMode = settings.shadingMode;
+            kernelData.samplerType = settings.samplerType;
+            if(kernelData.samplerType == eSamplerSobol || kernelData.samplerType == eSamplerOwenSobol) {
+                // -- Deferred rays don't carry a sample index to drive a low discrepancy sequence with
+                WriteDebugInfo_("Deferred path tracer does not support the %s sampler; using %s instead",
+                                SamplerTypeName(kernelData.samplerType), SamplerTypeName(eSamplerPcg32));
+                kernelData.samplerType = eSamplerPcg32;
+            }
+            kernelData.workerCount = JobSystem_ThreadCount();
+            kernelData.kernelStates = AllocArray_(KernelState, kernelData.workerCount);
+            kernelData.partialFlushCount = 0;
+            kernelData.shadedHitCount = 0;
+            kernelData.shadingMicroseconds = 0;
+            Memory::Zero(&kernelData.ptexStats, sizeof(kernelData.ptexStats));
+
+            // -- Zeroed CArrays are empty
+            kernelData.parkedQueueCount = (uint)scene->data->subsceneNames.Count();
+            kernelData.parkedQueues = AllocArray_(ParkedRayQueue, kernelData.parkedQueueCount);
+            Memory::Zero(kernelData.parkedQueues, kernelData.parkedQueueCount * sizeof(ParkedRayQueue));
+            for(uint scan = 0; scan < kernelData.parkedQueueCount; ++scan) {
+                kernelData.parkedQueues[scan].spinlock = CreateSpinLock();
+            }
+            kernelData.parkedRayCount = 0;
+            kernelData.totalParkedRays = 0;
 
-            #if WorkerThreadCount_ > 0
-                ThreadHandle threadHandles[WorkerThreadCount_];
+            ProgressiveState progressiveState;
+            Progressive_Begin(&progressiveState, settings.progressive, &frame, imageName,
+                              SamplesPerPixelX_ * SamplesPerPixelY_, 0);
 
-                // -- fork threads
-                for(uint scan = 0; scan < WorkerThreadCount_; ++scan) {
-                    threadHandles[scan] = CreateThread(DeferredPathTracerKernel, &kernelData);
-                }
-            #endif
+            while(Progressive_BeginPass(&progressiveState, &kernelData.passIndex)) {
+                RenderPass(&kernelData);
+                Progressive_EndPass(&progressiveState);
+            }
 
-            DeferredPathTracerKernel(&kernelData);
+            Free_(kernelData.kernelStates);
 
-            #if WorkerThreadCount_ > 0
-                for(uint scan = 0; scan < WorkerThreadCount_; ++scan) {
-                    ShutdownThread(threadHandles[scan]);
-                }
-            #endif
+            Assert_(kernelData.parkedRayCount == 0);
+            for(uint scan = 0; scan < kernelData.parkedQueueCount; ++scan) {
+                kernelData.parkedQueues[scan].rays.Shutdown();
+                kernelData.parkedQueues[scan].occlusionRays.Shutdown();
+                kernelData.parkedQueues[scan].hits.Shutdown();
+                CloseSpinlock(kernelData.parkedQueues[scan].spinlock);
+            }
+            Free_(kernelData.parkedQueues);
+
+            WriteDebugInfo_("Partial ray batch flushes: %lld", kernelData.partialFlushCount);
+            WriteDebugInfo_("Rays and hits parked on non-resident subscenes: %lld", kernelData.totalParkedRays);
+            if(kernelData.shadedHitCount > 0) {
+                WriteDebugInfo_("Shaded %lld sorted hits in %lldus (%.1fns per hit)", kernelData.shadedHitCount,
+                                kernelData.shadingMicroseconds,
+                                1000.0f * (float)kernelData.shadingMicroseconds / kernelData.shadedHitCount);
+            }
+            PtexFilterCache_LogStats(&kernelData.ptexStats);
 
-            FrameBuffer_Scale(&frame, (1.0f / (SamplesPerPixelX_ * SamplesPerPixelY_)));
-            FrameBuffer_Save(&frame, imageName);
+            if(frame.flushCount > 0) {
+                WriteDebugInfo_("Framebuffer writers flushed %lld samples in %lld flushes taking %lldus (avg %.1fus per flush)",
+                                frame.flushedSamples, frame.flushCount, frame.flushMicroseconds,
+                                (float)frame.flushMicroseconds / frame.flushCount);
+            }
+
+            Progressive_Finish(&progressiveState);
             FrameBuffer_Shutdown(&frame);
 
+            PathTracingBatcherStats batcherStats;
+            ptBatcher.GetStats(&batcherStats);
+            WriteDebugInfo_("Ray batches spilled %llu bytes and re-read %llu bytes", batcherStats.bytesSpilled,
+                            batcherStats.bytesReread);
+            if(batcherStats.sortedBatchCount > 0) {
+                WriteDebugInfo_("Sorted %llu ray batches in %lluus (avg %lluus, max %lluus per batch)",
+                                batcherStats.sortedBatchCount, batcherStats.sortMicroseconds,
+                                batcherStats.sortMicroseconds / batcherStats.sortedBatchCount,
+                                batcherStats.maxSortMicroseconds);
+            }
+
             ptBatcher.Shutdown();
         }
     }
@@ -4,6 +4,10 @@
 // Joe Schutte
 //=================================================================================================================================
 
+#include "ProgressiveRender.h"
+#include "Shading/PathTracingBatcher.h"
+#include "Shading/RayStream.h"
+#include "MathLib/Sampler.h"
 #include "UtilityLib/Color.h"
 #include "MathLib/FloatStructs.h"
 #include "SystemLib/BasicTypes.h"
@@ -17,7 +21,35 @@ namespace Selas
 
     namespace DeferredPathTracer
     {
+        enum HitShadingMode
+        {
+            // -- Hits are shaded by the thread that traced them as soon as the packet returns
+            eShadeHitsImmediately,
+
+            // -- Hits are queued and shaded in batches sorted by instance, geometry, material and texture
+            eShadeHitsSorted
+        };
+
+        struct Settings
+        {
+            RaySpillMode spillMode;
+            RaySortMode sortMode;
+            // -- Chunks each radix sort is split across with ParallelFor. Threads that have no batch of their own pick the chunks
+            // -- up while busy threads leave them to the sorting kernel.
+            uint sortThreadCount;
+            RayPacketWidth packetWidth;
+            HitShadingMode shadingMode;
+            // -- Deferred rays don't carry a sample index so the low discrepancy types are logged and replaced by PCG32 streams
+            SamplerType samplerType;
+            ProgressiveSettings progressive;
+        };
+
+        void DefaultSettings(Settings* settings);
+
         void GenerateImage(GeometryCache* geometryCache, TextureCache* textureCache, SceneResource* scene,
-                           const RayCastCameraSettings& camera, cpointer imageName);
+                           const RayCastCameraSettings& camera, const Settings& settings, cpointer imageName);
+
+        // -- Logs the intersection throughput of each RayPacketWidth for primary and diffuse secondary rays from camera.
+        void BenchmarkPacketWidths(SceneResource* scene, const RayCastCameraSettings& camera);
     }
 }
\ No newline at end of file
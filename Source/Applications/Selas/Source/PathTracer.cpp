@@ -4,8 +4,10 @@
 //=================================================================================================================================
 
 #include "PathTracer.h"
+#include "ProgressiveRender.h"
 #include "SceneLib/SceneResource.h"
 #include "SceneLib/GeometryCache.h"
+#include "SceneLib/SceneIntersectContext.h"
 #include "Shading/SurfaceScattering.h"
 #include "Shading/VolumetricScattering.h"
 #include "Shading/SurfaceParameters.h"
@@ -13,6 +15,7 @@
 #include "Shading/AreaLighting.h"
 #include "TextureLib/TextureFiltering.h"
 #include "TextureLib/TextureResource.h"
+#include "TextureLib/PtexFilterCache.h"
 #include "GeometryLib/Camera.h"
 #include "GeometryLib/Ray.h"
 #include "GeometryLib/SurfaceDifferentials.h"
@@ -25,11 +28,13 @@
 #include "MathLib/Projection.h"
 #include "MathLib/Quaternion.h"
 #include "ContainersLib/Rect.h"
-#include "ThreadingLib/Thread.h"
+#include "StringLib/FixedString.h"
+#include "ThreadingLib/JobSystem.h"
 #include "SystemLib/OSThreading.h"
 #include "SystemLib/Atomic.h"
 #include "SystemLib/MemoryAllocation.h"
 #include "SystemLib/Memory.h"
+#include "SystemLib/JsAssert.h"
 #include "SystemLib/BasicTypes.h"
 #include "SystemLib/MinMax.h"
 #include "SystemLib/SystemTime.h"
@@ -41,9 +46,10 @@
 
 #define MaxBounceCount_         2048
 
-#define AdditionalThreadCount_  6
 #define PathsPerPixel_          16
 #define LayerCount_             2
+#define TileSize_               16
+#define HotTileLogCount_        8
 
 namespace Selas
 {
@@ -58,22 +64,39 @@ namespace Selas
             RayCastCameraSettings camera;
             uint pathsPerPixel;
             uint maxBounceCount;
-            std::chrono::high_resolution_clock::time_point integrationStartTime;
+            uint64 passIndex;
+            SamplerType samplerType;
 
-            volatile uint64* pixelIndex;
-            volatile int64* completedThreads;
-            volatile int64* kernelIndices;
+            GIIntegratorContext* threadContexts;
+
+            uint tileCountX;
+            uint tileCountY;
+            uint32* tileOrder;
+            float* tileMicroseconds;
+
+            // -- Tiles the kernels render; either tileOrder or the parked tiles that are ready to be rendered again
+            const uint32* renderTiles;
+
+            // -- Tiles that reached a non-resident subscene are abandoned and parked here until its geometry is loaded
+            uint32* parkedTiles;
+            volatile int64 parkedTileCount;
+            uint32* readyTiles;
+            SubsceneResource** tileMissingSubscenes;
 
             Framebuffer* frame;
         };
 
         //=========================================================================================================================
-        static bool OcclusionRay(const RTCScene& rtcScene, const SurfaceParameters& surface, float3 direction, float distance)
+        // -- Returns true when the ray is unoccluded. Occlusion is final but an unoccluded ray may have skipped a non-resident
+        // -- subscene, in which case missingInstanceId is set and the result doesn't count.
+        static bool OcclusionRay(const RTCScene& rtcScene, const SurfaceParameters& surface, float3 direction, float distance,
+                                 uint32& missingInstanceId)
         {
             float3 origin = OffsetRayOrigin(surface, direction, 0.1f);
 
-            RTCIntersectContext context;
-            rtcInitIntersectContext(&context);
+            missingInstanceId = RTC_INVALID_GEOMETRY_ID;
+            SceneIntersectContext context;
+            InitializeSceneIntersectContext(&context, &missingInstanceId);
 
             Align_(16) RTCRay ray;
             ray.org_x = origin.x;
@@ -84,19 +107,26 @@ namespace Selas
             ray.dir_z = direction.z;
             ray.tnear = surface.error;
             ray.tfar = distance;
+            ray.id = 0;
 
-            rtcOccluded1(rtcScene, &context, &ray);
+            rtcOccluded1(rtcScene, &context.rtc, &ray);
 
             // -- ray.tfar == -inf when hit occurs
-            return (ray.tfar >= 0.0f);
+            if(ray.tfar < 0.0f) {
+                missingInstanceId = RTC_INVALID_GEOMETRY_ID;
+                return false;
+            }
+
+            return missingInstanceId == RTC_INVALID_GEOMETRY_ID;
         }
 
         //=========================================================================================================================
-        static bool RayPick(const RTCScene& rtcScene, const Ray& ray, float tfar, HitParameters& hit)
+        // -- Any hit found past a non-resident subscene may not be the closest one so the pick fails and missingInstanceId is set
+        static bool RayPick(const RTCScene& rtcScene, const Ray& ray, float tfar, HitParameters& hit, uint32& missingInstanceId)
         {
-
-            RTCIntersectContext context;
-            rtcInitIntersectContext(&context);
+            missingInstanceId = RTC_INVALID_GEOMETRY_ID;
+            SceneIntersectContext context;
+            InitializeSceneIntersectContext(&context, &missingInstanceId);
 
             Align_(16) RTCRayHit rayhit;
             rayhit.ray.org_x = ray.origin.x;
@@ -107,15 +137,16 @@ namespace Selas
             rayhit.ray.dir_z = ray.direction.z;
             rayhit.ray.tnear = 0.0f;
             rayhit.ray.tfar = tfar;
+            rayhit.ray.id = 0;
 
             rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
             rayhit.hit.primID = RTC_INVALID_GEOMETRY_ID;
             rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
             rayhit.hit.instID[1] = RTC_INVALID_GEOMETRY_ID;
 
-            rtcIntersect1(rtcScene, &context, &rayhit);
+            rtcIntersect1(rtcScene, &context.rtc, &rayhit);
 
-            if(rayhit.hit.geomID == -1)
+            if(rayhit.hit.geomID == -1 || missingInstanceId != RTC_INVALID_GEOMETRY_ID)
                 return false;
 
             hit.position.x = rayhit.ray.org_x + rayhit.ray.tfar * ray.direction.x;
@@ -139,7 +170,10 @@ namespace Selas
         }
 
         //=========================================================================================================================
-        static void EvaluatePath(GIIntegratorContext* __restrict context, Ray ray, uint x, uint y)
+        // -- Returns false without accumulating anything if the path reaches a subscene that is not resident. missingInstanceId
+        // -- is then the instance whose subscene has been requested from the loader threads.
+        static bool EvaluatePath(GIIntegratorContext* __restrict context, Ray ray, float3* __restrict accumulation,
+                                 uint32& missingInstanceId)
         {
             float3 Ld[LayerCount_];
             Memory::Zero(Ld, sizeof(Ld));
@@ -153,6 +187,8 @@ namespace Selas
 
             float isDeltaOnly = true;
 
+            RayCone cone = CameraRayCone(context->camera);
+
             uint bounceCount = 0;
             while (bounceCount < context->maxPathLength) {
                 
@@ -160,17 +196,32 @@ namespace Selas
                 rayDistance = SampleDistance(&context->sampler, currentMedium, &pdf);
 
                 HitParameters hit;
-                bool rayCastHit = RayPick(context->rtcScene, ray, rayDistance, hit);
+                bool rayCastHit = RayPick(context->rtcScene, ray, rayDistance, hit, missingInstanceId);
+                if(missingInstanceId != RTC_INVALID_GEOMETRY_ID) {
+                    return false;
+                }
 
                 if(rayCastHit) {
                     rayDistance = Length(hit.position - ray.origin);
+                    hit.cone.width = RayConeWidth(cone, rayDistance);
+                    hit.cone.spread = cone.spread;
                 }
                 float3 transmission = Transmission(currentMedium, rayDistance);
                 throughput = throughput * transmission;
 
                 if(rayCastHit) {
+                    SubsceneResource* pinned;
+                    if(PinSurfaceGeometry(context, &hit, pinned) == false) {
+                        missingInstanceId = (uint32)hit.instId[0];
+                        return false;
+                    }
+
                     SurfaceParameters surface;
-                    if(CalculateSurfaceParams(context, &hit, surface) == false) {
+                    bool calculated = CalculateSurfaceParams(context, &hit, surface);
+                    if(pinned != nullptr) {
+                        context->geometryCache->FinishUsingSubceneGeometry(pinned);
+                    }
+                    if(calculated == false) {
                         break;
                     }
 
@@ -185,11 +236,15 @@ namespace Selas
                                                           reversePdfW);
                         if(Dot(reflectance, float3::One_) > 0) {
 
-                            if(OcclusionRay(context->scene->rtcScene, surface, lightSample.direction, lightSample.distance)) {
+                            if(OcclusionRay(context->scene->rtcScene, surface, lightSample.direction, lightSample.distance,
+                                            missingInstanceId)) {
 
                                 float3 sample = reflectance * lightSample.radiance * (1.0f / lightSample.pdfW);
                                 Ld[1] += sample * throughput;
                             }
+                            if(missingInstanceId != RTC_INVALID_GEOMETRY_ID) {
+                                return false;
+                            }
                         }
                     }
 
@@ -219,6 +274,8 @@ namespace Selas
 
                         float3 offsetOrigin = OffsetRayOrigin(surface, bsdfSample.wi, 1.0f);
                         ray = MakeRay(offsetOrigin, bsdfSample.wi);
+                        cone = BounceRayCone(hit, (bsdfSample.flags & SurfaceEventFlags::eDiracEvent) != 0,
+                                             bsdfSample.forwardPdfW);
 
                         if(bounceCount == 0) {
                             Ld[0] = bsdfSample.reflectance;
@@ -230,6 +287,7 @@ namespace Selas
                     float mediumPdf;
                     float3 direction = SampleScatterDirection(&context->sampler, currentMedium, ray.direction, &mediumPdf);
                     ray = MakeRay(origin, direction);
+                    cone.width = RayConeWidth(cone, rayDistance);
                 }
                 else {
                     float3 sample;
@@ -254,60 +312,241 @@ namespace Selas
                 }
             }
 
-            FramebufferWriter_Write(&context->frameWriter, Ld, LayerCount_, (uint32)x, (uint32)y);
+            for(uint layer = 0; layer < LayerCount_; ++layer) {
+                accumulation[layer] += Ld[layer];
+            }
+
+            return true;
         }
 
         //=========================================================================================================================
-        static void PathTracerKernel(void* userData)
+        static uint32 CompactBits(uint32 v)
         {
-            PathTracingKernelData* integratorContext = static_cast<PathTracingKernelData*>(userData);
-            int64 kernelIndex = Atomic::Increment64(integratorContext->kernelIndices);
+            v &= 0x55555555;
+            v = (v | (v >> 1)) & 0x33333333;
+            v = (v | (v >> 2)) & 0x0F0F0F0F;
+            v = (v | (v >> 4)) & 0x00FF00FF;
+            v = (v | (v >> 8)) & 0x0000FFFF;
+            return v;
+        }
 
-            uint pathsPerPixel = integratorContext->pathsPerPixel;
+        //=========================================================================================================================
+        // -- Walks the Morton curve over the power of two square that covers the tile grid and keeps the tiles inside the grid so
+        // -- consecutive tiles, and therefore the tiles threads are working on at the same time, stay close to each other.
+        static void BuildMortonTileOrder(uint tileCountX, uint tileCountY, uint32* tileOrder)
+        {
+            uint32 extent = 1;
+            while(extent < tileCountX || extent < tileCountY) {
+                extent <<= 1;
+            }
+
+            uint tileIndex = 0;
+            for(uint32 code = 0, codeCount = extent * extent; code < codeCount; ++code) {
+                uint32 tileX = CompactBits(code);
+                uint32 tileY = CompactBits(code >> 1);
+                if(tileX < tileCountX && tileY < tileCountY) {
+                    tileOrder[tileIndex++] = tileY * (uint32)tileCountX + tileX;
+                }
+            }
+
+            Assert_(tileIndex == tileCountX * tileCountY);
+        }
+
+        //=========================================================================================================================
+        // -- Returns false when a path reached a non-resident subscene. Nothing has been added to the frame at that point and
+        // -- the samplers restart from the pass and tile so the tile can simply be rendered again once the geometry is loaded.
+        static bool RenderTile(PathTracingKernelData* integratorContext, GIIntegratorContext* context, uint tileIndex,
+                               uint32& missingInstanceId)
+        {
+            auto tileStart = SystemTime::Now();
 
             uint width = integratorContext->camera.width;
             uint height = integratorContext->camera.height;
-            uint64 totalPixelCount = width * height;
-
-            GIIntegratorContext context;
-            context.geometryCache    = integratorContext->geometryCache;
-            context.textureCache     = integratorContext->textureCache;
-            context.rtcScene         = integratorContext->scene->rtcScene;
-            context.scene            = integratorContext->scene;
-            context.camera           = &integratorContext->camera;
-            context.sampler.Initialize((uint32)kernelIndex);
-            context.maxPathLength    = integratorContext->maxBounceCount;
-            FramebufferWriter_Initialize(&context.frameWriter, integratorContext->frame);
-
-            while(*integratorContext->pixelIndex < totalPixelCount) {
-
-                uint64 pixelIndex = Atomic::AddU64(integratorContext->pixelIndex, 1llu) % totalPixelCount;
-                uint y = pixelIndex / width;
-                uint x = pixelIndex - y * width;
-
-                for(uint scan = 0; scan < pathsPerPixel; ++scan) {
-                    Ray ray = JitteredCameraRay(context.camera, &context.sampler, (float)x, (float)y);
-                    EvaluatePath(&context, ray, x, y);
+            uint pathsPerPixel = integratorContext->pathsPerPixel;
+
+            uint tileX = tileIndex % integratorContext->tileCountX;
+            uint tileY = tileIndex / integratorContext->tileCountX;
+            uint startX = tileX * TileSize_;
+            uint startY = tileY * TileSize_;
+            uint endX = Min<uint>(startX + TileSize_, width);
+            uint endY = Min<uint>(startY + TileSize_, height);
+
+            // -- Seeding from the pass and tile rather than the thread keeps every pass reproducible regardless of which
+            // -- thread renders the tile, which is what lets a resumed render continue the original sample sequence. The other
+            // -- sampler types derive every sample from the pixel and sample index instead.
+            if(integratorContext->samplerType == eSamplerMersenneTwister) {
+                uint tileCount = integratorContext->tileCountX * integratorContext->tileCountY;
+                context->sampler.Reseed((uint32)(integratorContext->passIndex * tileCount + tileIndex));
+            }
+            uint32 firstSample = (uint32)(integratorContext->passIndex * pathsPerPixel);
+
+            // -- Tiles are disjoint so each thread accumulates its tile locally and adds it to the frame once without locking.
+            float3 accumulation[TileSize_ * TileSize_][LayerCount_];
+            Memory::Zero(accumulation, sizeof(accumulation));
+
+            Framebuffer* frame = integratorContext->frame;
+            for(uint y = startY; y < endY; ++y) {
+                for(uint x = startX; x < endX; ++x) {
+                    if(FrameBuffer_PixelActive(frame, y * frame->width + x) == false) {
+                        continue;
+                    }
+
+                    float3* pixel = accumulation[(y - startY) * TileSize_ + (x - startX)];
+                    for(uint scan = 0; scan < pathsPerPixel; ++scan) {
+                        context->sampler.StartSample(y * width + x, firstSample + scan);
+                        Ray ray = JitteredCameraRay(context->camera, &context->sampler, (float)x, (float)y);
+                        if(EvaluatePath(context, ray, pixel, missingInstanceId) == false) {
+                            integratorContext->tileMicroseconds[tileIndex] += SystemTime::ElapsedMicrosecondsF(tileStart);
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            for(uint y = startY; y < endY; ++y) {
+                for(uint x = startX; x < endX; ++x) {
+                    float3* pixel = accumulation[(y - startY) * TileSize_ + (x - startX)];
+                    uint index = y * frame->width + x;
+                    for(uint layer = 0; layer < LayerCount_; ++layer) {
+                        frame->buffers[layer][index] += pixel[layer];
+                    }
+                }
+            }
+
+            integratorContext->tileMicroseconds[tileIndex] += SystemTime::ElapsedMicrosecondsF(tileStart);
+            return true;
+        }
+
+        //=========================================================================================================================
+        static void PathTracerKernel(void* userData, uint start, uint end, uint threadIndex)
+        {
+            PathTracingKernelData* integratorContext = static_cast<PathTracingKernelData*>(userData);
+            GIIntegratorContext* context = &integratorContext->threadContexts[threadIndex];
+
+            for(uint scan = start; scan < end; ++scan) {
+                uint tileIndex = integratorContext->renderTiles[scan];
+
+                uint32 missingInstanceId;
+                if(RenderTile(integratorContext, context, tileIndex, missingInstanceId) == false) {
+                    // -- Each tile is rendered by one thread at a time so it takes at most one slot
+                    SubsceneResource* subscene = SubsceneFromInstanceId(integratorContext->scene, missingInstanceId);
+                    integratorContext->tileMissingSubscenes[tileIndex] = subscene;
+                    int64 slot = Atomic::Increment64(&integratorContext->parkedTileCount);
+                    integratorContext->parkedTiles[slot] = tileIndex;
                 }
             }
+        }
 
-            context.sampler.Shutdown();
+        //=========================================================================================================================
+        // -- Renders the parked tiles whose subscenes have been loaded, sleeping on the loader threads whenever none of them are.
+        // -- Tiles are parked again if they reach another non-resident subscene.
+        static void RenderParkedTiles(PathTracingKernelData* integratorContext)
+        {
+            GeometryCache* geometryCache = integratorContext->geometryCache;
+
+            while(integratorContext->parkedTileCount > 0) {
+                uint64 completedLoadCount = geometryCache->CompletedLoadCount();
+
+                uint readyCount = 0;
+                uint waitingCount = 0;
+                for(uint scan = 0, count = (uint)integratorContext->parkedTileCount; scan < count; ++scan) {
+                    uint32 tileIndex = integratorContext->parkedTiles[scan];
+                    SubsceneResource* subscene = integratorContext->tileMissingSubscenes[tileIndex];
+                    if(subscene->geometryLoaded) {
+                        integratorContext->readyTiles[readyCount++] = tileIndex;
+                    }
+                    else {
+                        // -- Requested again in case it was evicted since the tile was parked
+                        geometryCache->RequestSubsceneGeometry(subscene);
+                        integratorContext->parkedTiles[waitingCount++] = tileIndex;
+                    }
+                }
+                integratorContext->parkedTileCount = waitingCount;
+
+                if(readyCount == 0) {
+                    geometryCache->WaitForLoadCompletion(completedLoadCount);
+                    continue;
+                }
 
-            FramebufferWriter_Shutdown(&context.frameWriter);
-            Atomic::Increment64(integratorContext->completedThreads);
+                // -- Tiles that get parked again are appended after the ones still waiting
+                integratorContext->renderTiles = integratorContext->readyTiles;
+                ParallelFor(readyCount, 1, PathTracerKernel, integratorContext);
+            }
+
+            integratorContext->renderTiles = integratorContext->tileOrder;
+        }
+
+        //=========================================================================================================================
+        static void ReportTileTimings(const PathTracingKernelData* integratorContext, cpointer imageName)
+        {
+            uint tileCountX = integratorContext->tileCountX;
+            uint tileCount = tileCountX * integratorContext->tileCountY;
+            const float* tileMicroseconds = integratorContext->tileMicroseconds;
+
+            float totalMicroseconds = 0.0f;
+            for(uint scan = 0; scan < tileCount; ++scan) {
+                totalMicroseconds += tileMicroseconds[scan];
+            }
+            float averageMicroseconds = totalMicroseconds / tileCount;
+
+            // -- Selection of the slowest tiles
+            uint hottest[HotTileLogCount_];
+            uint hottestCount = 0;
+            for(uint scan = 0; scan < tileCount; ++scan) {
+                uint insert = hottestCount;
+                while(insert > 0 && tileMicroseconds[hottest[insert - 1]] < tileMicroseconds[scan]) {
+                    if(insert < HotTileLogCount_) {
+                        hottest[insert] = hottest[insert - 1];
+                    }
+                    --insert;
+                }
+                if(insert < HotTileLogCount_) {
+                    hottest[insert] = scan;
+                    hottestCount = Min<uint>(hottestCount + 1, HotTileLogCount_);
+                }
+            }
+
+            WriteDebugInfo_("%u %ux%u tiles averaged %.0fus", tileCount, TileSize_, TileSize_, averageMicroseconds);
+            for(uint scan = 0; scan < hottestCount; ++scan) {
+                uint tileIndex = hottest[scan];
+                WriteDebugInfo_("    Tile (%u, %u) at pixel (%u, %u): %.0fus (%.1fx average)", tileIndex % tileCountX,
+                                tileIndex / tileCountX, (tileIndex % tileCountX) * TileSize_,
+                                (tileIndex / tileCountX) * TileSize_, tileMicroseconds[tileIndex],
+                                tileMicroseconds[tileIndex] / averageMicroseconds);
+            }
+
+            // -- Heatmap of render time relative to the average tile with the same dimensions as the image
+            Framebuffer heatmap;
+            FrameBuffer_Initialize(&heatmap, integratorContext->frame->width, integratorContext->frame->height, 1);
+            for(uint y = 0; y < integratorContext->camera.height; ++y) {
+                for(uint x = 0; x < integratorContext->camera.width; ++x) {
+                    uint tileIndex = (y / TileSize_) * tileCountX + (x / TileSize_);
+                    float relative = tileMicroseconds[tileIndex] / averageMicroseconds;
+                    heatmap.buffers[0][y * heatmap.width + x] = float3(relative);
+                }
+            }
+
+            FixedString128 heatmapName;
+            FixedStringSprintf(heatmapName, "%s_TileTimes", imageName);
+            FrameBuffer_Save(&heatmap, heatmapName.Ascii());
+            FrameBuffer_Shutdown(&heatmap);
+        }
+
+        //=========================================================================================================================
+        void DefaultSettings(Settings* settings)
+        {
+            settings->samplerType = eSamplerOwenSobol;
+            ProgressiveSettings_Default(&settings->progressive);
         }
 
         //=========================================================================================================================
         void GenerateImage(GeometryCache* geometryCache, TextureCache* textureCache, SceneResource* scene,
-                           const RayCastCameraSettings& camera, cpointer imageName)
+                           const RayCastCameraSettings& camera, const Settings& settings, cpointer imageName)
         {
             Framebuffer frame;
             FrameBuffer_Initialize(&frame, (uint32)camera.viewportWidth, (uint32)camera.viewportHeight, LayerCount_);
 
-            int64 completedThreads = 0;
-            int64 kernelIndex = 0;
-            //uint64 pixelIndex = 409600;
-            uint64 pixelIndex = 0;
+            uint threadCount = JobSystem_ThreadCount();
 
             PathTracingKernelData integratorContext;
             integratorContext.geometryCache          = geometryCache;
@@ -316,36 +555,72 @@ namespace Selas
             integratorContext.camera                 = camera;
             integratorContext.maxBounceCount         = MaxBounceCount_;
             integratorContext.pathsPerPixel          = PathsPerPixel_;
-            integratorContext.integrationStartTime   = SystemTime::Now();
-            integratorContext.pixelIndex             = &pixelIndex;
-            integratorContext.completedThreads       = &completedThreads;
-            integratorContext.kernelIndices          = &kernelIndex;
             integratorContext.frame                  = &frame;
+            integratorContext.samplerType            = settings.samplerType;
+            integratorContext.threadContexts         = AllocArray_(GIIntegratorContext, threadCount);
+
+            for(uint scan = 0; scan < threadCount; ++scan) {
+                PlacementNew_(GIIntegratorContext, &integratorContext.threadContexts[scan]);
+
+                GIIntegratorContext& context = integratorContext.threadContexts[scan];
+                context.geometryCache    = geometryCache;
+                context.textureCache     = textureCache;
+                context.rtcScene         = scene->rtcScene;
+                context.scene            = scene;
+                context.camera           = &integratorContext.camera;
+                // -- Counter based samplers share one seed so a pixel's samples don't depend on the thread that renders it
+                uint32 seed = (settings.samplerType == eSamplerMersenneTwister) ? (uint32)scan : 0;
+                context.sampler.Initialize(settings.samplerType, seed);
+                context.maxPathLength    = MaxBounceCount_;
+                PtexFilterCache_Initialize(&context.ptexFilters, textureCache);
+            }
 
-            #if AdditionalThreadCount_ > 0
-                ThreadHandle threadHandles[AdditionalThreadCount_];
-
-                // -- fork threads
-                for(uint scan = 0; scan < AdditionalThreadCount_; ++scan) {
-                    threadHandles[scan] = CreateThread(PathTracerKernel, &integratorContext);
-                }
-            #endif
-
-            // -- do work on the main thread too
-            PathTracerKernel(&integratorContext);
+            integratorContext.tileCountX = (camera.width + TileSize_ - 1) / TileSize_;
+            integratorContext.tileCountY = (camera.height + TileSize_ - 1) / TileSize_;
+            uint tileCount = integratorContext.tileCountX * integratorContext.tileCountY;
+            integratorContext.tileOrder = AllocArray_(uint32, tileCount);
+            integratorContext.tileMicroseconds = AllocArray_(float, tileCount);
+            Memory::Zero(integratorContext.tileMicroseconds, sizeof(float) * tileCount);
+            BuildMortonTileOrder(integratorContext.tileCountX, integratorContext.tileCountY, integratorContext.tileOrder);
+            integratorContext.renderTiles = integratorContext.tileOrder;
+
+            integratorContext.parkedTiles = AllocArray_(uint32, tileCount);
+            integratorContext.parkedTileCount = 0;
+            integratorContext.readyTiles = AllocArray_(uint32, tileCount);
+            integratorContext.tileMissingSubscenes = AllocArray_(SubsceneResource*, tileCount);
+
+            ProgressiveState progressiveState;
+            // -- Layer 1 holds radiance, layer 0 first bounce reflectance
+            Progressive_Begin(&progressiveState, settings.progressive, &frame, imageName, PathsPerPixel_, 1);
+
+            while(Progressive_BeginPass(&progressiveState, &integratorContext.passIndex)) {
+                ParallelFor(tileCount, 1, PathTracerKernel, &integratorContext);
+                RenderParkedTiles(&integratorContext);
+                Progressive_EndPass(&progressiveState);
+            }
 
-            #if AdditionalThreadCount_ > 0
-                // -- wait for any other threads to finish
-                while(*integratorContext.completedThreads != *integratorContext.kernelIndices);
+            PtexFilterCacheStats ptexStats;
+            Memory::Zero(&ptexStats, sizeof(ptexStats));
 
-                for(uint scan = 0; scan < AdditionalThreadCount_; ++scan) {
-                    ShutdownThread(threadHandles[scan]);
-                }
-            #endif
+            for(uint scan = 0; scan < threadCount; ++scan) {
+                PtexFilterCache_Shutdown(&integratorContext.threadContexts[scan].ptexFilters);
+                PtexFilterCache_AccumulateStats(&integratorContext.threadContexts[scan].ptexFilters, &ptexStats);
+                integratorContext.threadContexts[scan].sampler.Shutdown();
+                PlacementDelete_(GIIntegratorContext, &integratorContext.threadContexts[scan]);
+            }
+            Free_(integratorContext.threadContexts);
+            PtexFilterCache_LogStats(&ptexStats);
 
-            FrameBuffer_Scale(&frame, (1.0f / PathsPerPixel_));
+            if(progressiveState.completedPasses > progressiveState.resumedPasses) {
+                ReportTileTimings(&integratorContext, imageName);
+            }
+            Free_(integratorContext.tileMissingSubscenes);
+            Free_(integratorContext.readyTiles);
+            Free_(integratorContext.parkedTiles);
+            Free_(integratorContext.tileMicroseconds);
+            Free_(integratorContext.tileOrder);
 
-            FrameBuffer_Save(&frame, imageName);
+            Progressive_Finish(&progressiveState);
             FrameBuffer_Shutdown(&frame);
         }
     }
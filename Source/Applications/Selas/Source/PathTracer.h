@@ -4,6 +4,8 @@
 // Joe Schutte
 //=================================================================================================================================
 
+#include "ProgressiveRender.h"
+#include "MathLib/Sampler.h"
 #include "UtilityLib/Color.h"
 #include "MathLib/FloatStructs.h"
 #include "SystemLib/BasicTypes.h"
@@ -17,7 +19,15 @@ namespace Selas
 
     namespace PathTracer
     {
+        struct Settings
+        {
+            SamplerType samplerType;
+            ProgressiveSettings progressive;
+        };
+
+        void DefaultSettings(Settings* settings);
+
         void GenerateImage(GeometryCache* geometryCache, TextureCache* textureCache, SceneResource* scene,
-                           const RayCastCameraSettings& camera, cpointer imageName);
+                           const RayCastCameraSettings& camera, const Settings& settings, cpointer imageName);
     }
 }
\ No newline at end of file
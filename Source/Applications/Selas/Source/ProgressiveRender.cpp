@@ -0,0 +1,160 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "ProgressiveRender.h"
+#include "TextureLib/Framebuffer.h"
+#include "StringLib/FixedString.h"
+#include "SystemLib/Logging.h"
+
+namespace Selas
+{
+    //=============================================================================================================================
+    static float ImageScale(ProgressiveState* state)
+    {
+        // -- Pass counts vary per pixel so FrameBuffer_Save divides by them
+        if(state->settings.adaptive) {
+            return 1.0f / state->samplesPerPass;
+        }
+
+        uint64 sampleCount = state->completedPasses * state->samplesPerPass;
+        return sampleCount > 0 ? 1.0f / sampleCount : 1.0f;
+    }
+
+    //=============================================================================================================================
+    static void WriteCheckpoint(ProgressiveState* state)
+    {
+        Error err = FrameBuffer_WriteCheckpoint(state->frame, state->imageName, state->completedPasses, state->samplesPerPass);
+        if(Failed_(err)) {
+            WriteDebugInfo_("Failed to write checkpoint: %s", err.Message());
+        }
+    }
+
+    //=============================================================================================================================
+    void ProgressiveSettings_Default(ProgressiveSettings* settings)
+    {
+        settings->maxPassCount              = 1;
+        settings->timeBudgetSeconds         = 0.0f;
+        settings->intermediateImageInterval = 0;
+        settings->checkpointInterval        = 0;
+        settings->resumeFromCheckpoint      = false;
+        settings->adaptive                  = false;
+        settings->adaptiveErrorThreshold    = 0.02f;
+        settings->adaptiveMinPassCount      = 4;
+    }
+
+    //=============================================================================================================================
+    void Progressive_Begin(ProgressiveState* state, const ProgressiveSettings& settings, Framebuffer* frame,
+                           cpointer imageName, uint samplesPerPass, uint statisticsLayer)
+    {
+        state->settings        = settings;
+        state->frame           = frame;
+        state->imageName       = imageName;
+        state->samplesPerPass  = samplesPerPass;
+        state->completedPasses = 0;
+        state->resumedPasses   = 0;
+        state->activePixelCount = frame->width * frame->height;
+        state->lastPassSeconds = 0.0f;
+        state->startTime       = SystemTime::Now();
+        state->passStartTime   = state->startTime;
+
+        if(settings.adaptive) {
+            FrameBuffer_EnableStatistics(frame, statisticsLayer);
+        }
+
+        if(settings.resumeFromCheckpoint) {
+            uint64 completedPasses;
+            Error err = FrameBuffer_ReadCheckpoint(frame, imageName, samplesPerPass, &completedPasses);
+            if(Successful_(err)) {
+                state->completedPasses = completedPasses;
+                state->resumedPasses = completedPasses;
+                if(settings.adaptive) {
+                    state->activePixelCount = 0;
+                    for(uint scan = 0, count = frame->width * frame->height; scan < count; ++scan) {
+                        state->activePixelCount += FrameBuffer_PixelActive(frame, scan) ? 1 : 0;
+                    }
+                }
+                WriteDebugInfo_("Resuming %s from pass %llu", imageName, completedPasses);
+            }
+            else {
+                WriteDebugInfo_("Not resuming %s: %s", imageName, err.Message());
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    bool Progressive_BeginPass(ProgressiveState* state, uint64* passIndex)
+    {
+        if(state->completedPasses >= state->settings.maxPassCount) {
+            return false;
+        }
+
+        if(state->activePixelCount == 0) {
+            WriteDebugInfo_("Every pixel of %s converged after %llu passes", state->imageName, state->completedPasses);
+            return false;
+        }
+
+        // -- Always render at least one pass per process so a tight budget still makes progress
+        if(state->settings.timeBudgetSeconds > 0.0f && state->completedPasses > state->resumedPasses) {
+            float elapsedSeconds = SystemTime::ElapsedSecondsF(state->startTime);
+            if(elapsedSeconds + state->lastPassSeconds > state->settings.timeBudgetSeconds) {
+                WriteDebugInfo_("Time budget of %.0fs reached after %.0fs", state->settings.timeBudgetSeconds, elapsedSeconds);
+                return false;
+            }
+        }
+
+        state->passStartTime = SystemTime::Now();
+        *passIndex = state->completedPasses;
+        return true;
+    }
+
+    //=============================================================================================================================
+    void Progressive_EndPass(ProgressiveState* state)
+    {
+        state->lastPassSeconds = SystemTime::ElapsedSecondsF(state->passStartTime);
+        ++state->completedPasses;
+
+        if(state->settings.adaptive) {
+            uint pixelCount = state->frame->width * state->frame->height;
+            uint passPixelCount = state->activePixelCount;
+            state->activePixelCount = FrameBuffer_UpdateStatistics(state->frame, state->samplesPerPass,
+                                                                   state->settings.adaptiveErrorThreshold,
+                                                                   state->settings.adaptiveMinPassCount);
+
+            WriteDebugInfo_("Pass %llu/%u of %s took %.2fs over %u pixels (%.1f%%), %u remain active", state->completedPasses,
+                            state->settings.maxPassCount, state->imageName, state->lastPassSeconds, passPixelCount,
+                            100.0f * passPixelCount / pixelCount, state->activePixelCount);
+        }
+        else {
+            WriteDebugInfo_("Pass %llu/%u of %s took %.2fs", state->completedPasses, state->settings.maxPassCount,
+                            state->imageName, state->lastPassSeconds);
+        }
+
+        // -- The final pass is written by Progressive_Finish
+        if(state->completedPasses == state->settings.maxPassCount) {
+            return;
+        }
+
+        uint imageInterval = state->settings.intermediateImageInterval;
+        if(imageInterval > 0 && (state->completedPasses % imageInterval) == 0) {
+            FixedString256 name;
+            FixedStringSprintf(name, "%s_pass%llu", state->imageName, state->completedPasses);
+            FrameBuffer_Save(state->frame, name.Ascii(), ImageScale(state));
+        }
+
+        uint checkpointInterval = state->settings.checkpointInterval;
+        if(checkpointInterval > 0 && (state->completedPasses % checkpointInterval) == 0) {
+            WriteCheckpoint(state);
+        }
+    }
+
+    //=============================================================================================================================
+    void Progressive_Finish(ProgressiveState* state)
+    {
+        FrameBuffer_Save(state->frame, state->imageName, ImageScale(state));
+
+        if(state->settings.checkpointInterval > 0 && state->completedPasses > state->resumedPasses) {
+            WriteCheckpoint(state);
+        }
+    }
+}
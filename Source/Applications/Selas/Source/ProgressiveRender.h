@@ -0,0 +1,64 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "SystemLib/SystemTime.h"
+#include "SystemLib/BasicTypes.h"
+
+namespace Selas
+{
+    struct Framebuffer;
+
+    struct ProgressiveSettings
+    {
+        // -- Number of sample passes to render. Each pass adds the integrator's full per-pixel sample count.
+        uint  maxPassCount;
+        // -- Wall clock budget for this process in seconds. No new pass is started if it would likely exceed the budget. Zero
+        // -- disables the budget.
+        float timeBudgetSeconds;
+        // -- Write the current image every N passes. Zero disables intermediate images.
+        uint  intermediateImageInterval;
+        // -- Write a checkpoint every N passes. Zero disables checkpoints.
+        uint  checkpointInterval;
+        // -- Continue from <image>.checkpoint when one exists that matches the frame and sample settings
+        bool  resumeFromCheckpoint;
+
+        // -- Adaptive sampling. After adaptiveMinPassCount passes a pixel only receives further passes while the standard
+        // -- error of its mean luminance is above adaptiveErrorThreshold relative to the mean. Rendering stops early once no
+        // -- pixel is left.
+        bool  adaptive;
+        float adaptiveErrorThreshold;
+        uint  adaptiveMinPassCount;
+    };
+
+    struct ProgressiveState
+    {
+        ProgressiveSettings settings;
+        Framebuffer* frame;
+        cpointer imageName;
+        uint samplesPerPass;
+
+        uint64 completedPasses;
+        uint64 resumedPasses;
+        uint   activePixelCount;
+        float lastPassSeconds;
+
+        std::chrono::high_resolution_clock::time_point startTime;
+        std::chrono::high_resolution_clock::time_point passStartTime;
+    };
+
+    void ProgressiveSettings_Default(ProgressiveSettings* settings);
+
+    // -- frame must be freshly initialized. Passes always add into frame. statisticsLayer is the frame layer whose luminance
+    // -- drives adaptive sampling. Integrators must skip pixels for which FrameBuffer_PixelActive returns false.
+    void Progressive_Begin(ProgressiveState* state, const ProgressiveSettings& settings, Framebuffer* frame,
+                           cpointer imageName, uint samplesPerPass, uint statisticsLayer);
+    // -- Returns false once the pass count or time budget has been reached. Otherwise returns the index of the next pass which
+    // -- integrators use to seed their samplers so a resumed render continues the same sample sequence.
+    bool  Progressive_BeginPass(ProgressiveState* state, uint64* passIndex);
+    void  Progressive_EndPass(ProgressiveState* state);
+    // -- Saves the final image scaled by the total sample count and writes a final checkpoint.
+    void  Progressive_Finish(ProgressiveState* state);
+}
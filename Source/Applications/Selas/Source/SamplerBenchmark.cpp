@@ -0,0 +1,159 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "SamplerBenchmark.h"
+#include "MathLib/Sampler.h"
+#include "MathLib/FloatFuncs.h"
+#include "MathLib/Trigonometric.h"
+#include "SystemLib/BasicTypes.h"
+#include "SystemLib/CountOf.h"
+#include "SystemLib/SystemTime.h"
+#include "SystemLib/Logging.h"
+
+#define ThroughputSampleCount_    (1024 * 1024)
+#define ThroughputDimensionCount_ 32
+#define ConvergencePixelCount_    256
+#define ProductDimensionCount_    8
+
+namespace Selas
+{
+    namespace SamplerBenchmark
+    {
+        enum Integrand
+        {
+            // -- Indicator of the unit quarter disk. Discontinuous.
+            eQuarterDisk,
+            // -- exp(-x^2 - y^2). Smooth.
+            eGaussian,
+            // -- Product of (1.5 - x_i) over ProductDimensionCount_ dimensions. Exercises the padded dimensions.
+            eProduct,
+
+            IntegrandCount
+        };
+
+        static cpointer IntegrandNames[] = {
+            "QuarterDisk",
+            "Gaussian",
+            "Product8D"
+        };
+        static_assert(CountOf_(IntegrandNames) == IntegrandCount, "Missing integrand name");
+
+        //=========================================================================================================================
+        static float ReferenceValue(Integrand integrand)
+        {
+            switch(integrand) {
+            case eQuarterDisk:
+                return Math::Pi_ * 0.25f;
+            case eGaussian:
+                // -- (sqrt(pi) / 2 * erf(1))^2
+                return 0.557746285f;
+            default:
+                return 1.0f;
+            }
+        }
+
+        //=========================================================================================================================
+        static float Evaluate(Integrand integrand, CSampler* sampler)
+        {
+            switch(integrand) {
+            case eQuarterDisk:
+            {
+                float x = sampler->UniformFloat();
+                float y = sampler->UniformFloat();
+                return (x * x + y * y < 1.0f) ? 1.0f : 0.0f;
+            }
+            case eGaussian:
+            {
+                float x = sampler->UniformFloat();
+                float y = sampler->UniformFloat();
+                return Math::Expf(-x * x - y * y);
+            }
+            default:
+            {
+                float product = 1.0f;
+                for(uint scan = 0; scan < ProductDimensionCount_; ++scan) {
+                    product *= 1.5f - sampler->UniformFloat();
+                }
+                return product;
+            }
+            }
+        }
+
+        //=========================================================================================================================
+        static float RmsError(SamplerType type, Integrand integrand, uint sampleCount)
+        {
+            float reference = ReferenceValue(integrand);
+
+            double squaredError = 0.0;
+            for(uint pixel = 0; pixel < ConvergencePixelCount_; ++pixel) {
+                CSampler sampler;
+                sampler.Initialize(type, type == eSamplerMersenneTwister ? pixel : 0);
+
+                double sum = 0.0;
+                for(uint sample = 0; sample < sampleCount; ++sample) {
+                    sampler.StartSample(pixel, sample);
+                    sum += Evaluate(integrand, &sampler);
+                }
+
+                sampler.Shutdown();
+
+                double error = sum / sampleCount - reference;
+                squaredError += error * error;
+            }
+
+            return Math::Sqrtf((float)(squaredError / ConvergencePixelCount_));
+        }
+
+        //=========================================================================================================================
+        void MeasureThroughput()
+        {
+            for(uint type = 0; type < SamplerTypeCount; ++type) {
+                CSampler sampler;
+                sampler.Initialize((SamplerType)type, 0);
+
+                auto timer = SystemTime::Now();
+
+                float sum = 0.0f;
+                for(uint sample = 0; sample < ThroughputSampleCount_; ++sample) {
+                    sampler.StartSample(sample & 0xFFFF, sample >> 16);
+                    for(uint dimension = 0; dimension < ThroughputDimensionCount_; ++dimension) {
+                        sum += sampler.UniformFloat();
+                    }
+                }
+
+                float elapsedSeconds = SystemTime::ElapsedSecondsF(timer);
+                sampler.Shutdown();
+
+                float samplesPerSecond = (float)ThroughputSampleCount_ * ThroughputDimensionCount_ / elapsedSeconds;
+                WriteDebugInfo_("%-16s %8.1fM samples/s (mean %f)", SamplerTypeName((SamplerType)type), samplesPerSecond / 1e6f,
+                                sum / ((float)ThroughputSampleCount_ * ThroughputDimensionCount_));
+            }
+        }
+
+        //=========================================================================================================================
+        void MeasureConvergence()
+        {
+            static const uint sampleCounts[] = { 16, 64, 256, 1024, 4096 };
+
+            for(uint integrand = 0; integrand < IntegrandCount; ++integrand) {
+                WriteDebugInfo_("%s RMS error over %u pixels", IntegrandNames[integrand], ConvergencePixelCount_);
+
+                for(uint countIndex = 0; countIndex < CountOf_(sampleCounts); ++countIndex) {
+                    uint sampleCount = sampleCounts[countIndex];
+                    float baseline = RmsError(eSamplerMersenneTwister, (Integrand)integrand, sampleCount);
+
+                    for(uint type = 0; type < SamplerTypeCount; ++type) {
+                        float error = baseline;
+                        if(type != eSamplerMersenneTwister) {
+                            error = RmsError((SamplerType)type, (Integrand)integrand, sampleCount);
+                        }
+
+                        WriteDebugInfo_("    %5u spp %-16s %.6f (%.2fx Mersenne Twister)", sampleCount,
+                                        SamplerTypeName((SamplerType)type), error, error / baseline);
+                    }
+                }
+            }
+        }
+    }
+}
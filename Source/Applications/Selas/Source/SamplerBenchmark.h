@@ -0,0 +1,18 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+namespace Selas
+{
+    namespace SamplerBenchmark
+    {
+        // -- Logs samples per second for each SamplerType when drawing 32 dimensional samples.
+        void MeasureThroughput();
+
+        // -- Logs the RMS error of each SamplerType over many pixels for a few integrands with known values at increasing sample
+        // -- counts alongside the ratio to the Mersenne Twister error.
+        void MeasureConvergence();
+    }
+}
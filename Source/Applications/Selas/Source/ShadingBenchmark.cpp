@@ -0,0 +1,160 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "ShadingBenchmark.h"
+#include "Shading/Disney.h"
+#include "Shading/DisneySimd.h"
+#include "Shading/SurfaceParameters.h"
+#include "MathLib/Sampler.h"
+#include "MathLib/FloatFuncs.h"
+#include "MathLib/Trigonometric.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/BasicTypes.h"
+#include "SystemLib/MinMax.h"
+#include "SystemLib/SystemTime.h"
+#include "SystemLib/Logging.h"
+
+#define BenchmarkSurfaceCount_ (64 * 1024)
+#define BenchmarkIterations_   16
+
+namespace Selas
+{
+    namespace ShadingBenchmark
+    {
+        //=========================================================================================================================
+        static float3 RandomDirection(CSampler* sampler)
+        {
+            float cosTheta = 2.0f * sampler->UniformFloat() - 1.0f;
+            float sinTheta = Math::Sqrtf(Max(0.0f, 1.0f - cosTheta * cosTheta));
+            float phi = Math::TwoPi_ * sampler->UniformFloat();
+
+            return float3(sinTheta * Math::Cosf(phi), cosTheta, sinTheta * Math::Sinf(phi));
+        }
+
+        //=========================================================================================================================
+        static float RandomLobe(CSampler* sampler)
+        {
+            // -- Half of the surfaces skip each optional lobe so the branches in the scalar path are exercised
+            return sampler->UniformFloat() < 0.5f ? 0.0f : sampler->UniformFloat();
+        }
+
+        //=========================================================================================================================
+        static void RandomSurface(CSampler* sampler, SurfaceParameters& surface)
+        {
+            float3 n = RandomDirection(sampler);
+            float3 t = Normalize(Cross(n, Math::Absf(n.x) < 0.9f ? float3::XAxis_ : float3::YAxis_));
+            float3 b = Cross(n, t);
+            surface.worldToTangent = MatrixTranspose(MakeFloat3x3(t, n, b));
+
+            surface.baseColor          = float3(sampler->UniformFloat(), sampler->UniformFloat(), sampler->UniformFloat());
+            surface.transmittanceColor = surface.baseColor;
+            surface.sheen              = RandomLobe(sampler);
+            surface.sheenTint          = sampler->UniformFloat();
+            surface.clearcoat          = RandomLobe(sampler);
+            surface.clearcoatGloss     = sampler->UniformFloat();
+            surface.metallic           = RandomLobe(sampler);
+            surface.specTrans          = RandomLobe(sampler);
+            surface.diffTrans          = 0.5f * sampler->UniformFloat();
+            surface.flatness           = sampler->UniformFloat();
+            surface.anisotropic        = sampler->UniformFloat();
+            surface.ior                = 1.2f + sampler->UniformFloat();
+            surface.relativeIOR        = sampler->UniformFloat() < 0.5f ? surface.ior : 1.0f / surface.ior;
+            surface.specularTint       = sampler->UniformFloat();
+            surface.roughness          = 0.05f + 0.95f * sampler->UniformFloat();
+            surface.scatterDistance    = 1.0f;
+            surface.shader             = sampler->UniformFloat() < 0.5f ? eDisneyThin : eDisneySolid;
+        }
+
+        //=========================================================================================================================
+        static float RelativeDifference(float a, float b)
+        {
+            return Math::Absf(a - b) / Max(1e-3f, Math::Absf(a));
+        }
+
+        //=========================================================================================================================
+        void MeasureDisneyThroughput()
+        {
+            uint count = BenchmarkSurfaceCount_;
+
+            SurfaceParameters* surfaces = AllocArray_(SurfaceParameters, count);
+            float3* views = AllocArray_(float3, count);
+            float3* lights = AllocArray_(float3, count);
+            float3* scalarReflectance = AllocArray_(float3, count);
+            float3* simdReflectance = AllocArray_(float3, count);
+            float* scalarPdfs = AllocArray_(float, 2 * count);
+            float* simdPdfs = AllocArray_(float, 2 * count);
+
+            CSampler sampler;
+            sampler.Initialize(eSamplerPcg32, 0);
+            for(uint scan = 0; scan < count; ++scan) {
+                sampler.StartSample(scan, 0);
+                RandomSurface(&sampler, surfaces[scan]);
+                views[scan] = RandomDirection(&sampler);
+                lights[scan] = RandomDirection(&sampler);
+            }
+            sampler.Shutdown();
+
+            auto timer = SystemTime::Now();
+            for(uint iteration = 0; iteration < BenchmarkIterations_; ++iteration) {
+                for(uint scan = 0; scan < count; ++scan) {
+                    const SurfaceParameters& surface = surfaces[scan];
+                    scalarReflectance[scan] = EvaluateDisney(surface, views[scan], lights[scan], surface.shader == eDisneyThin,
+                                                             scalarPdfs[2 * scan + 0], scalarPdfs[2 * scan + 1]);
+                }
+            }
+            float scalarSeconds = SystemTime::ElapsedSecondsF(timer);
+
+            // -- Includes the cost of transposing into DisneySurface8 since the deferred integrator pays it for every group
+            timer = SystemTime::Now();
+            for(uint iteration = 0; iteration < BenchmarkIterations_; ++iteration) {
+                for(uint scan = 0; scan < count; scan += DisneySimdWidth_) {
+                    const SurfaceParameters* group[DisneySimdWidth_];
+                    for(uint lane = 0; lane < DisneySimdWidth_; ++lane) {
+                        group[lane] = &surfaces[scan + lane];
+                    }
+
+                    float forwardPdfs[DisneySimdWidth_];
+                    float reversePdfs[DisneySimdWidth_];
+
+                    DisneySurface8 soa;
+                    DisneySurface8_Load(group, DisneySimdWidth_, &soa);
+                    EvaluateDisney8(&soa, views + scan, lights + scan, simdReflectance + scan, forwardPdfs, reversePdfs);
+
+                    for(uint lane = 0; lane < DisneySimdWidth_; ++lane) {
+                        simdPdfs[2 * (scan + lane) + 0] = forwardPdfs[lane];
+                        simdPdfs[2 * (scan + lane) + 1] = reversePdfs[lane];
+                    }
+                }
+            }
+            float simdSeconds = SystemTime::ElapsedSecondsF(timer);
+
+            float maxReflectanceDifference = 0.0f;
+            float maxPdfDifference = 0.0f;
+            for(uint scan = 0; scan < count; ++scan) {
+                maxReflectanceDifference = Max(maxReflectanceDifference,
+                                               RelativeDifference(scalarReflectance[scan].x, simdReflectance[scan].x));
+                maxReflectanceDifference = Max(maxReflectanceDifference,
+                                               RelativeDifference(scalarReflectance[scan].y, simdReflectance[scan].y));
+                maxReflectanceDifference = Max(maxReflectanceDifference,
+                                               RelativeDifference(scalarReflectance[scan].z, simdReflectance[scan].z));
+                maxPdfDifference = Max(maxPdfDifference, RelativeDifference(scalarPdfs[2 * scan + 0], simdPdfs[2 * scan + 0]));
+                maxPdfDifference = Max(maxPdfDifference, RelativeDifference(scalarPdfs[2 * scan + 1], simdPdfs[2 * scan + 1]));
+            }
+
+            float evaluations = (float)count * BenchmarkIterations_;
+            WriteDebugInfo_("Disney scalar  %8.2fM evaluations/s", evaluations / scalarSeconds / 1e6f);
+            WriteDebugInfo_("Disney %s %8.2fM evaluations/s (%.2fx)", DisneySimdAvailable_ ? "AVX2   " : "no AVX2",
+                            evaluations / simdSeconds / 1e6f, scalarSeconds / simdSeconds);
+            WriteDebugInfo_("Max relative difference: reflectance %f pdf %f", maxReflectanceDifference, maxPdfDifference);
+
+            Free_(simdPdfs);
+            Free_(scalarPdfs);
+            Free_(simdReflectance);
+            Free_(scalarReflectance);
+            Free_(lights);
+            Free_(views);
+            Free_(surfaces);
+        }
+    }
+}
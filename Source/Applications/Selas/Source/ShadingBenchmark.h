@@ -0,0 +1,15 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+namespace Selas
+{
+    namespace ShadingBenchmark
+    {
+        // -- Logs Disney BSDF evaluations per second for the scalar EvaluateDisney and the 8-wide EvaluateDisney8 over a set of
+        // -- random surfaces and directions along with the largest relative difference between the two.
+        void MeasureDisneyThroughput();
+    }
+}
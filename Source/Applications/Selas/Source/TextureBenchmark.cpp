@@ -0,0 +1,142 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "TextureBenchmark.h"
+#include "BuildCommon/BuildTexture.h"
+#include "TextureLib/TextureResource.h"
+#include "TextureLib/TextureFiltering.h"
+#include "MathLib/Sampler.h"
+#include "MathLib/FloatFuncs.h"
+#include "MathLib/Trigonometric.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/Memory.h"
+#include "SystemLib/BasicTypes.h"
+#include "SystemLib/CountOf.h"
+#include "SystemLib/SystemTime.h"
+#include "SystemLib/Logging.h"
+
+#define BenchmarkTextureSize_ 1024
+#define BenchmarkLookupCount_ (1024 * 1024)
+#define BenchmarkMaxLod_      4.0f
+
+namespace Selas
+{
+    namespace TextureBenchmark
+    {
+        struct BenchmarkFormat
+        {
+            TextureResourceData::TextureDataType format;
+            cpointer name;
+        };
+
+        static const BenchmarkFormat Formats[] =
+        {
+            { TextureResourceData::Float4,   "Float4"   },
+            { TextureResourceData::Float3,   "Float3"   },
+            { TextureResourceData::Float,    "Float"    },
+            { TextureResourceData::Half4,    "Half4"    },
+            { TextureResourceData::Half3,    "Half3"    },
+            { TextureResourceData::Half,     "Half"     },
+            { TextureResourceData::UNorm8x4, "UNorm8x4" },
+            { TextureResourceData::UNorm8x3, "UNorm8x3" },
+            { TextureResourceData::UNorm8,   "UNorm8"   },
+            { TextureResourceData::BC1,      "BC1"      },
+            { TextureResourceData::BC5,      "BC5"      },
+            { TextureResourceData::BC4,      "BC4"      },
+        };
+
+        //=========================================================================================================================
+        static void ProceduralImage(CSampler* sampler, float4* image)
+        {
+            // -- Smooth gradients with a little per texel noise so the block formats have something to lose
+            for(uint y = 0; y < BenchmarkTextureSize_; ++y) {
+                for(uint x = 0; x < BenchmarkTextureSize_; ++x) {
+                    float s = (float)x / BenchmarkTextureSize_;
+                    float t = (float)y / BenchmarkTextureSize_;
+                    float noise = 0.1f * sampler->UniformFloat();
+
+                    float r = 0.5f + 0.4f * Math::Sinf(Math::TwoPi_ * 3.0f * s);
+                    float g = 0.5f + 0.4f * Math::Cosf(Math::TwoPi_ * 5.0f * t);
+                    float b = s * t;
+                    image[y * BenchmarkTextureSize_ + x] = float4(r + noise, g + noise, b + noise, 1.0f - 0.5f * t);
+                }
+            }
+        }
+
+        //=========================================================================================================================
+        void MeasureFilteringThroughput()
+        {
+            uint texelCount = BenchmarkTextureSize_ * BenchmarkTextureSize_;
+            uint lookupCount = BenchmarkLookupCount_;
+
+            float4* image = AllocArray_(float4, texelCount);
+            float2* uvs = AllocArray_(float2, lookupCount);
+            float* lods = AllocArray_(float, lookupCount);
+            float4* reference = AllocArray_(float4, lookupCount);
+            float4* results = AllocArray_(float4, lookupCount);
+
+            CSampler sampler;
+            sampler.Initialize(eSamplerPcg32, 0);
+            sampler.StartSample(0, 0);
+            ProceduralImage(&sampler, image);
+            for(uint scan = 0; scan < lookupCount; ++scan) {
+                uvs[scan] = float2(sampler.UniformFloat(), sampler.UniformFloat());
+                lods[scan] = BenchmarkMaxLod_ * sampler.UniformFloat();
+            }
+            sampler.Shutdown();
+
+            for(uint formatScan = 0; formatScan < CountOf_(Formats); ++formatScan) {
+                const BenchmarkFormat& format = Formats[formatScan];
+
+                TextureResourceData data;
+                TextureResource texture;
+                Error err = BuildTextureData(Box, image, BenchmarkTextureSize_, BenchmarkTextureSize_, format.format, &data);
+                if(Failed_(err)) {
+                    WriteDebugInfo_("%-9s failed to build: %s", format.name, err.Message());
+                    continue;
+                }
+                err = InitializeTextureResource(&data, &texture);
+                if(Failed_(err)) {
+                    WriteDebugInfo_("%-9s failed to initialize: %s", format.name, err.Message());
+                    Free_(data.texture);
+                    continue;
+                }
+
+                auto timer = SystemTime::Now();
+                for(uint scan = 0; scan < lookupCount; ++scan) {
+                    TextureFiltering::TrilinearLod(&texture, lods[scan], uvs[scan], results[scan]);
+                }
+                float seconds = SystemTime::ElapsedSecondsF(timer);
+
+                if(formatScan == 0) {
+                    Memory::Copy(reference, results, sizeof(float4) * lookupCount);
+                }
+
+                // -- Only the channels the format stores are compared
+                uint32 channelCount = TextureChannelCount(format.format);
+                float errorSum = 0.0f;
+                for(uint scan = 0; scan < lookupCount; ++scan) {
+                    float4 d = results[scan] - reference[scan];
+                    float channels[4] = { d.x, d.y, d.z, d.w };
+                    for(uint32 channel = 0; channel < channelCount; ++channel) {
+                        errorSum += channels[channel] * channels[channel];
+                    }
+                }
+                float rmsError = Math::Sqrtf(errorSum / (lookupCount * channelCount));
+
+                WriteDebugInfo_("%-9s %7.2f MB %8.2fM lookups/s  RMS error %f", format.name, data.dataSize / (1024.0f * 1024.0f),
+                                lookupCount / seconds / 1e6f, rmsError);
+
+                SafeFree_(texture.tiles);
+                Free_(data.texture);
+            }
+
+            Free_(results);
+            Free_(reference);
+            Free_(lods);
+            Free_(uvs);
+            Free_(image);
+        }
+    }
+}
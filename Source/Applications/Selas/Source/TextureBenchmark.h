@@ -0,0 +1,15 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+namespace Selas
+{
+    namespace TextureBenchmark
+    {
+        // -- Builds the same procedural image in every texel format and logs its size, trilinear lookups per second, and the RMS
+        // -- error of its lookups against the Float4 texture.
+        void MeasureFilteringThroughput();
+    }
+}
@@ -6,6 +6,9 @@
 #include "PathTracer.h"
 #include "DeferredPathTracer.h"
 #include "VCM.h"
+#include "SamplerBenchmark.h"
+#include "ShadingBenchmark.h"
+#include "TextureBenchmark.h"
 
 #include "BuildCommon/ImageBasedLightBuildProcessor.h"
 #include "BuildCommon/TextureBuildProcessor.h"
@@ -22,6 +25,7 @@
 #include "TextureLib/TextureCache.h"
 #include "TextureLib/Framebuffer.h"
 #include "TextureLib/TextureFiltering.h"
+#include "ThreadingLib/JobSystem.h"
 #include "IoLib/Environment.h"
 #include "StringLib/FixedString.h"
 #include "SystemLib/Error.h"
@@ -37,7 +41,18 @@
 #include <stdio.h>
 
 #define TextureCacheSize_   4 * 1024 * 1024 * 1024ull
+#define PtexCacheSize_      4 * 1024 * 1024 * 1024ull
+// -- The island references thousands of ptex files. Keep most of them open so lookups do not reopen and reparse them.
+#define PtexMaxOpenFiles_   4096
 #define GeometryCacheSize_ 18 * 1024 * 1024 * 1024ull
+// -- When enabled each camera logs ray throughput for every packet width instead of rendering an image
+#define PacketWidthBenchmark_ 0
+// -- When enabled the sampler throughput and convergence diagnostics are logged and no scene is loaded
+#define SamplerBenchmark_ 0
+// -- When enabled the scalar and 8-wide Disney BSDF evaluation throughput is logged and no scene is loaded
+#define ShadingBenchmark_ 0
+// -- When enabled the size, filtered lookup throughput, and error of every texel format are logged and no scene is loaded
+#define TextureBenchmark_ 0
 
 using namespace Selas;
 
@@ -85,18 +100,39 @@ int main(int argc, char *argv[])
     _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
     Environment_Initialize(ProjectRootName_, argv[0]);
+    JobSystem_Initialize();
+
+    #if SamplerBenchmark_
+        SamplerBenchmark::MeasureThroughput();
+        SamplerBenchmark::MeasureConvergence();
+        JobSystem_Shutdown();
+        return 0;
+    #endif
+
+    #if ShadingBenchmark_
+        ShadingBenchmark::MeasureDisneyThroughput();
+        JobSystem_Shutdown();
+        return 0;
+    #endif
+
+    #if TextureBenchmark_
+        TextureBenchmark::MeasureFilteringThroughput();
+        JobSystem_Shutdown();
+        return 0;
+    #endif
 
     TextureCache textureCache;
-    textureCache.Initialize(TextureCacheSize_);
+    textureCache.Initialize(TextureCacheSize_, PtexMaxOpenFiles_, PtexCacheSize_);
 
     GeometryCache geometryCache;
-    geometryCache.Initialize(GeometryCacheSize_);
+    geometryCache.Initialize(GeometryCacheSize_, &textureCache);
 
     TextureFiltering::InitializeEWAFilterWeights();
 
     ExitMainOnError_(ValidateAssetsAreBuilt());
 
     RTCDevice rtcDevice = rtcNewDevice(nullptr/*"verbose=3"*/);
+    geometryCache.MonitorDeviceMemory(rtcDevice);
 
     SceneResource sceneResource;
 
@@ -121,24 +157,41 @@ int main(int argc, char *argv[])
     Selas::uint width = 1024;
     Selas::uint height = 429;
 
+    PathTracer::Settings pathTracerSettings;
+    PathTracer::DefaultSettings(&pathTracerSettings);
+
+    DeferredPathTracer::Settings deferredSettings;
+    DeferredPathTracer::DefaultSettings(&deferredSettings);
+
     for(uint scan = 0, count = sceneResource.data->cameras.Count(); scan < count; ++scan) {
         RayCastCameraSettings camera;
         SetupSceneCamera(&sceneResource, scan, width, height, camera);
 
-        timer = SystemTime::Now();
-        //PathTracer::GenerateImage(&geometryCache, &textureCache, &sceneResource, camera, "UnidirectionalPT");
-        DeferredPathTracer::GenerateImage(&geometryCache, &textureCache, &sceneResource, camera,
-                                          sceneResource.data->cameras[scan].name.Ascii());
-        //VCM::GenerateImage(&sceneResource, camera, "VCM");
-        elapsedMs = SystemTime::ElapsedMillisecondsF(timer);
-        WriteDebugInfo_("Scene render time %fms", elapsedMs);
+        #if PacketWidthBenchmark_
+            DeferredPathTracer::BenchmarkPacketWidths(&sceneResource, camera);
+        #else
+            timer = SystemTime::Now();
+            //PathTracer::GenerateImage(&geometryCache, &textureCache, &sceneResource, camera, pathTracerSettings,
+            //                          "UnidirectionalPT");
+            DeferredPathTracer::GenerateImage(&geometryCache, &textureCache, &sceneResource, camera, deferredSettings,
+                                              sceneResource.data->cameras[scan].name.Ascii());
+            //VCM::GenerateImage(&sceneResource, camera, "VCM");
+            elapsedMs = SystemTime::ElapsedMillisecondsF(timer);
+            WriteDebugInfo_("Scene render time %fms", elapsedMs);
+            textureCache.LogStats();
+            geometryCache.LogStats();
+        #endif
     }
 
+    // -- Stops the loader threads before the subscenes they load are released
+    geometryCache.Shutdown();
+
     ShutdownSceneResource(&sceneResource, &textureCache);
     rtcReleaseDevice(rtcDevice);
 
-    geometryCache.Shutdown();
     textureCache.Shutdown();
 
+    JobSystem_Shutdown();
+
     return 0;
 }
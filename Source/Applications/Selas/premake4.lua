@@ -13,4 +13,12 @@ else
 	Platform = "Win64"
 end
 
-SetupConsoleApplication(SolutionName, Architecture, Platform, ExtraDefines, ExtraLibraries)
\ No newline at end of file
+SetupConsoleApplication(SolutionName, Architecture, Platform, ExtraDefines, ExtraLibraries)
+
+-- the 8-wide shading in Shading/DisneySimd.cpp needs AVX2. The application includes DisneySimd.h too so it is built the
+-- same way to keep DisneySimdAvailable_ in agreement with the library. Every other library keeps the default target.
+project "Shading"
+  vectorextensions "AVX2"
+
+project "Application"
+  vectorextensions "AVX2"
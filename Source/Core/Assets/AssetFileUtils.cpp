@@ -8,10 +8,22 @@
 #include "IoLib/Environment.h"
 #include "IoLib/Directory.h"
 #include "IoLib/Serializer.h"
+#include "IoLib/File.h"
+#include "IoLib/MemoryMappedFile.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/JsAssert.h"
 
 #define AssetsDirectoryName_ "_Assets"
 #define ContentDirectoryName_ "Content"
 
+// -- Map built assets copy-on-write rather than reading them into an allocation. Only the pages patched by AttachToBinary get
+// -- copied; everything else stays shared with the OS file cache and with other processes loading the same assets.
+#define MapAssetFiles_ 1
+// -- Embree may read up to 16 bytes past the end of the last shared geometry buffer. Files ending that close to a page
+// -- boundary are read instead of mapped so the overread can never touch an unmapped page.
+#define MappedTailPadding_ 16
+#define MappedPageSize_ 4096
+
 namespace Selas
 {
     //=============================================================================================================================
@@ -134,6 +146,38 @@ namespace Selas
                                 AssetsDirectoryName_, ps, typeStr, ps, version, ps, nameStr);
         }
 
+        //=========================================================================================================================
+        Error LoadAssetFile(cpointer filepath, MemoryMappedFile* mapping, void** fileData, uint64* fileSize)
+        {
+            Assert_(!MemoryMappedFile_IsOpen(mapping));
+
+            #if MapAssetFiles_
+                if(Successful_(MemoryMappedFile_OpenCopyOnWrite(filepath, mapping))) {
+                    uint64 tail = mapping->size % MappedPageSize_;
+                    if(tail != 0 && tail + MappedTailPadding_ <= MappedPageSize_) {
+                        *fileData = mapping->memory;
+                        *fileSize = mapping->size;
+                        return Success_;
+                    }
+                    MemoryMappedFile_Close(mapping);
+                }
+            #endif
+
+            return File::ReadWholeFile(filepath, fileData, fileSize);
+        }
+
+        //=========================================================================================================================
+        void UnloadAssetFile(MemoryMappedFile* mapping, void* fileData)
+        {
+            if(MemoryMappedFile_IsOpen(mapping)) {
+                Assert_(fileData == mapping->memory);
+                MemoryMappedFile_Close(mapping);
+            }
+            else if(fileData != nullptr) {
+                FreeAligned_(fileData);
+            }
+        }
+
         //=========================================================================================================================
         //void AssetFilePath(AssetId id, uint64 version, FilePathString& filepath)
         //{
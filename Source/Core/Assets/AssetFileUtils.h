@@ -6,11 +6,13 @@
 
 #include "UtilityLib/MurmurHash.h"
 #include "StringLib/FixedString.h"
+#include "SystemLib/Error.h"
 #include "SystemLib/BasicTypes.h"
 
 namespace Selas
 {
     class CSerializer;
+    struct MemoryMappedFile;
 
     #define InvalidAsset_ 0xFFFFFFFF
     #define PlatformIndependentPathSep_ '~'
@@ -81,6 +83,11 @@ namespace Selas
 
         void EnsureAssetDirectory(cpointer typeStr, uint64 version);
 
+        // -- Loads a built asset so it can be attached to in place. The file is mapped copy-on-write into mapping when possible
+        // -- and otherwise read into an aligned allocation, leaving mapping closed. Release it with UnloadAssetFile.
+        Error LoadAssetFile(cpointer filepath, MemoryMappedFile* mapping, void** fileData, uint64* fileSize);
+        void UnloadAssetFile(MemoryMappedFile* mapping, void* fileData);
+
         template<typename Type_>
         void EnsureAssetDirectory()
         {
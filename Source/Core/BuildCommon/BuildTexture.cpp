@@ -6,6 +6,7 @@
 #include "BuildCore/BuildContext.h"
 #include "TextureLib/StbImage.h"
 #include "TextureLib/TextureResource.h"
+#include "TextureLib/TextureEncoding.h"
 #include "UtilityLib/Color.h"
 #include "StringLib/FixedString.h"
 #include "StringLib/StringUtil.h"
@@ -20,6 +21,9 @@
 
 #include <stdio.h>
 
+// -- When enabled 8 bit source images are stored block compressed. Otherwise they are stored as 8 bit UNORM.
+#define BlockCompressTextures_ 1
+
 namespace Selas
 {
     //=============================================================================================================================
@@ -79,12 +83,17 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    static Error ConvertToLinearFloatData(void* rawData, uint width, uint height, float*& output)
+    static Error ConvertToLinearFloatData(void* rawData, uint width, uint height, bool floatData, float*& output)
     {
         uint count = width * height;
         output = AllocArray_(float, count);
 
-        Uint8ToLinearFloat(true, width, height, (uint8*)rawData, output);
+        if(floatData) {
+            Memory::Copy(output, rawData, sizeof(float) * width * height);
+        }
+        else {
+            Uint8ToLinearFloat(true, width, height, (uint8*)rawData, output);
+        }
 
         return Success_;
     }
@@ -213,6 +222,180 @@ namespace Selas
         return true;
     }
 
+    //=============================================================================================================================
+    template <typename Type_>
+    static void TileMipMaps(const Type_* mipmaps, TextureResourceData* texture, Type_*& tiled)
+    {
+        uint64 texelCount = 0;
+        uint32 tileCount = 0;
+        for(uint32 level = 0; level < texture->mipCount; ++level) {
+            uint32 tileWidth, tileHeight, tilesX, tilesY;
+            TextureTileDimensions(texture, level, tileWidth, tileHeight, tilesX, tilesY);
+
+            tileCount += tilesX * tilesY;
+            texelCount += (uint64)tilesX * tilesY * tileWidth * tileHeight;
+        }
+
+        tiled = AllocArray_(Type_, texelCount);
+
+        uint64 tiledIndex = 0;
+        for(uint32 level = 0; level < texture->mipCount; ++level) {
+            uint32 tileWidth, tileHeight, tilesX, tilesY;
+            TextureTileDimensions(texture, level, tileWidth, tileHeight, tilesX, tilesY);
+
+            uint32 mipWidth  = texture->mipWidths[level];
+            uint32 mipHeight = texture->mipHeights[level];
+            const uint8* mipBytes = reinterpret_cast<const uint8*>(mipmaps) + texture->mipOffsets[level];
+            const Type_* mip = reinterpret_cast<const Type_*>(mipBytes);
+
+            texture->mipOffsets[level] = sizeof(Type_) * tiledIndex;
+
+            for(uint32 tileY = 0; tileY < tilesY; ++tileY) {
+                for(uint32 tileX = 0; tileX < tilesX; ++tileX) {
+                    for(uint32 y = 0; y < tileHeight; ++y) {
+                        // -- Edge tiles repeat the last row and column of the mip
+                        uint32 srcY = Min<uint32>(tileY * tileHeight + y, mipHeight - 1);
+                        for(uint32 x = 0; x < tileWidth; ++x) {
+                            uint32 srcX = Min<uint32>(tileX * tileWidth + x, mipWidth - 1);
+                            tiled[tiledIndex++] = mip[srcY * mipWidth + srcX];
+                        }
+                    }
+                }
+            }
+        }
+
+        Assert_(tiledIndex == texelCount);
+        texture->tileCount = tileCount;
+        texture->dataSize = (uint32)(sizeof(Type_) * texelCount);
+    }
+
+    //=============================================================================================================================
+    static float4 ToFloat4(float value)  { return float4(value, 0.0f, 0.0f, 1.0f); }
+    static float4 ToFloat4(float3 value) { return float4(value, 1.0f); }
+    static float4 ToFloat4(float4 value) { return value; }
+
+    //=============================================================================================================================
+    template <typename Type_>
+    static void EncodeTiles(const Type_* tiled, TextureResourceData::TextureDataType format, TextureResourceData* texture)
+    {
+        uint64 dataSize = 0;
+        for(uint32 level = 0; level < texture->mipCount; ++level) {
+            uint32 tileWidth, tileHeight, tilesX, tilesY;
+            TextureTileDimensions(texture, level, tileWidth, tileHeight, tilesX, tilesY);
+
+            dataSize += tilesX * tilesY * TextureTileByteSize(texture, level);
+        }
+
+        uint8* encoded = AllocArray_(uint8, dataSize);
+
+        uint32 blockDimension = TextureBlockDimension(format);
+        uint32 blockByteSize = TextureBlockByteSize(format);
+
+        uint64 offset = 0;
+        for(uint32 level = 0; level < texture->mipCount; ++level) {
+            uint32 tileWidth, tileHeight, tilesX, tilesY;
+            TextureTileDimensions(texture, level, tileWidth, tileHeight, tilesX, tilesY);
+
+            texture->mipOffsets[level] = offset;
+
+            for(uint32 tileScan = 0, tileCount = tilesX * tilesY; tileScan < tileCount; ++tileScan) {
+                const Type_* tile = tiled;
+                tiled += tileWidth * tileHeight;
+
+                if(blockDimension == 1) {
+                    for(uint32 texel = 0, texelCount = tileWidth * tileHeight; texel < texelCount; ++texel) {
+                        TextureEncoding::EncodeTexel(format, ToFloat4(tile[texel]), encoded + offset);
+                        offset += blockByteSize;
+                    }
+                    continue;
+                }
+
+                // -- Blocks hanging off the edge of a tile smaller than the block repeat the last row and column
+                for(uint32 blockY = 0; blockY < tileHeight; blockY += blockDimension) {
+                    for(uint32 blockX = 0; blockX < tileWidth; blockX += blockDimension) {
+                        float4 block[TextureEncoding::BlockTexelCount];
+                        for(uint32 y = 0; y < blockDimension; ++y) {
+                            uint32 srcY = Min<uint32>(blockY + y, tileHeight - 1);
+                            for(uint32 x = 0; x < blockDimension; ++x) {
+                                uint32 srcX = Min<uint32>(blockX + x, tileWidth - 1);
+                                block[y * blockDimension + x] = ToFloat4(tile[srcY * tileWidth + srcX]);
+                            }
+                        }
+
+                        TextureEncoding::EncodeBlock(format, block, encoded + offset);
+                        offset += blockByteSize;
+                    }
+                }
+            }
+        }
+
+        Assert_(offset == dataSize);
+        texture->format = format;
+        texture->dataSize = (uint32)dataSize;
+        texture->texture = encoded;
+    }
+
+    //=============================================================================================================================
+    template <typename Type_>
+    static Error GenerateTiledMipMaps(TextureMipFilters prefilter, Type_* linear, uint width, uint height,
+                                      TextureResourceData::TextureDataType format, TextureResourceData* texture)
+    {
+        Type_* mipmaps = nullptr;
+        texture->dataSize = 0;
+        if(GenerateMipMaps<Type_>(prefilter, linear, width, height, texture->mipOffsets, texture->mipWidths,
+                                  texture->mipHeights, mipmaps, texture->mipCount, texture->dataSize) == false) {
+            return Error_("Texture of size %llux%llu needs more than %llu mips", width, height,
+                          TextureResourceData::MaxMipCount);
+        }
+
+        Type_* tiled = nullptr;
+        TileMipMaps<Type_>(mipmaps, texture, tiled);
+        Free_(mipmaps);
+
+        // -- Tile byte sizes depend on the format so it has to be set before encoding
+        texture->format = format;
+        EncodeTiles<Type_>(tiled, format, texture);
+        Free_(tiled);
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error BuildTextureData(TextureMipFilters prefilter, const float4* linear, uint width, uint height,
+                           TextureResourceData::TextureDataType format, TextureResourceData* texture)
+    {
+        float4* copy = AllocArray_(float4, width * height);
+        Memory::Copy(copy, linear, sizeof(float4) * width * height);
+
+        Error err = GenerateTiledMipMaps<float4>(prefilter, copy, width, height, format, texture);
+        Free_(copy);
+
+        return err;
+    }
+
+    //=============================================================================================================================
+    static TextureResourceData::TextureDataType SelectTextureFormat(uint channels, bool floatData, bool isNormalMap)
+    {
+        if(floatData) {
+            return channels == 1 ? TextureResourceData::Half : (channels == 3 ? TextureResourceData::Half3
+                                                                              : TextureResourceData::Half4);
+        }
+
+        // -- No BC7 encoder yet so images with alpha stay uncompressed
+        if(channels == 4) {
+            return TextureResourceData::UNorm8x4;
+        }
+
+        #if BlockCompressTextures_
+            if(channels == 1) {
+                return TextureResourceData::BC4;
+            }
+            return isNormalMap ? TextureResourceData::BC5 : TextureResourceData::BC1;
+        #else
+            return channels == 1 ? TextureResourceData::UNorm8 : TextureResourceData::UNorm8x3;
+        #endif
+    }
+
     //=============================================================================================================================
     bool IsNormalMapTexture(const FilePathString& str)
     {
@@ -245,18 +428,14 @@ namespace Selas
         void* rawData;
         ReturnError_(StbImageRead(filepath.Ascii(), NoComponentCountRequest_, 8, width, height, channels, floatData, rawData));
 
-        bool result;
+        TextureResourceData::TextureDataType format = SelectTextureFormat(channels, floatData, IsNormalMapTexture(filepath));
+
+        Error err;
         if(channels == 1) {
             float* linear = nullptr;
-            ReturnError_(ConvertToLinearFloatData(rawData, width, height, linear));
-
-            float* textureData;
-            texture->dataSize = 0;
-            result = GenerateMipMaps<float>(prefilter, linear, width, height,
-                                     texture->mipOffsets, texture->mipWidths, texture->mipHeights, textureData, texture->mipCount,
-                                    texture->dataSize);
-            texture->texture = reinterpret_cast<uint8*>(textureData);
-            texture->format = TextureResourceData::Float;
+            ReturnError_(ConvertToLinearFloatData(rawData, width, height, floatData, linear));
+
+            err = GenerateTiledMipMaps<float>(prefilter, linear, width, height, format, texture);
             Free_(linear);
         }
         else if (channels == 3) {
@@ -266,13 +445,7 @@ namespace Selas
             float3* linear = nullptr;
             ReturnError_(ConvertToLinearFloat3Data(rawData, width, height, floatData, isSrcSrgb, linear));
 
-            float3* textureData;
-            texture->dataSize = 0;
-            result = GenerateMipMaps<float3>(prefilter, linear, width, height,
-                                     texture->mipOffsets, texture->mipWidths, texture->mipHeights, textureData, texture->mipCount,
-                                     texture->dataSize);
-            texture->texture = reinterpret_cast<uint8*>(textureData);
-            texture->format = TextureResourceData::Float3;
+            err = GenerateTiledMipMaps<float3>(prefilter, linear, width, height, format, texture);
             Free_(linear);
         }
         else if(channels == 4) {
@@ -282,21 +455,16 @@ namespace Selas
             float4* linear = nullptr;
             ReturnError_(ConvertToLinearFloat4Data(rawData, width, height, floatData, isSrcSrgb, linear));
 
-            float4* textureData;
-            texture->dataSize = 0;
-            result = GenerateMipMaps<float4>(prefilter, linear, width, height,
-                                             texture->mipOffsets, texture->mipWidths, texture->mipHeights, textureData,
-                                             texture->mipCount, texture->dataSize);
-            texture->texture = reinterpret_cast<uint8*>(textureData);
-            texture->format = TextureResourceData::Float4;
+            err = GenerateTiledMipMaps<float4>(prefilter, linear, width, height, format, texture);
             Free_(linear);
         }
         else {
+            Free_(rawData);
             return Error_("NYI - Unsupported (or NYI) channel texture format for texture '%s'.", filepath.Ascii());
         }
 
         Free_(rawData);
 
-        return Success_;
+        return err;
     }
 }
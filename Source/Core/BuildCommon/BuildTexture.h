@@ -4,13 +4,13 @@
 // Joe Schutte
 //=================================================================================================================================
 
+#include "TextureLib/TextureResource.h"
 #include "MathLib/FloatStructs.h"
 #include "SystemLib/Error.h"
 #include "SystemLib/BasicTypes.h"
 
 namespace Selas
 {
-    struct TextureResourceData;
     struct BuildProcessorContext;
 
     enum TextureMipFilters
@@ -21,4 +21,8 @@ namespace Selas
     };
 
     Error ImportTexture(BuildProcessorContext* context, TextureMipFilters prefilter, TextureResourceData* texture);
+    // -- Builds the tiled mip chain of an in memory image stored in the given format. Channels past the format's channel
+    // -- count are dropped.
+    Error BuildTextureData(TextureMipFilters prefilter, const float4* linear, uint width, uint height,
+                           TextureResourceData::TextureDataType format, TextureResourceData* texture);
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "UtilityLib/MurmurHash.h"
 #include "StringLib/StringUtil.h"
 #include "ContainersLib/QueueList.h"
+#include "ThreadingLib/JobSystem.h"
 #include "SystemLib/OSThreading.h"
 #include "SystemLib/JsAssert.h"
 #include "SystemLib/MemoryAllocation.h"
@@ -16,8 +17,6 @@
 
 #include <map>
 
-#include <tbb/task.h>
-
 #define RunMultiThreaded_ true
 
 namespace Selas
@@ -53,30 +52,25 @@ namespace Selas
     };
 
     //=============================================================================================================================
-    class BuildCoreTask : public tbb::task
+    static void BuildCoreTask(void* userData)
     {
-    public:
-        BuildCoreTaskData* data;
-
-        tbb::task* execute()
-        {
-            Error result = data->processor->Process(&data->context);
+        BuildCoreTaskData* data = static_cast<BuildCoreTaskData*>(userData);
 
-            if(Successful_(result)) {
-                EnterSpinLock(data->coreData->mtQueuesSpinlock);
-                QueueList_Push(&data->coreData->completedQueue, data);
-                LeaveSpinLock(data->coreData->mtQueuesSpinlock);
-            }
-            else {
-                EnterSpinLock(data->coreData->mtQueuesSpinlock);
-                QueueList_Push(&data->coreData->failedQueue, data);
-                LeaveSpinLock(data->coreData->mtQueuesSpinlock);
-            }
+        Error result = data->processor->Process(&data->context);
 
-            Atomic::Decrement64(&data->coreData->activeTaskCount);
-            return nullptr;
+        if(Successful_(result)) {
+            EnterSpinLock(data->coreData->mtQueuesSpinlock);
+            QueueList_Push(&data->coreData->completedQueue, data);
+            LeaveSpinLock(data->coreData->mtQueuesSpinlock);
+        }
+        else {
+            EnterSpinLock(data->coreData->mtQueuesSpinlock);
+            QueueList_Push(&data->coreData->failedQueue, data);
+            LeaveSpinLock(data->coreData->mtQueuesSpinlock);
         }
-    };
+
+        Atomic::Decrement64(&data->coreData->activeTaskCount);
+    }
 
     //=============================================================================================================================
     static BuildCoreTaskData* AllocateTaskData(BuildCoreData* coreData)
@@ -305,15 +299,20 @@ namespace Selas
             return true;
         }
 
-        BuildCoreTask& task = *new(tbb::task::allocate_root()) BuildCoreTask();
-        task.data = AllocateTaskData(_coreData);
-
-        task.data->processor = processor;
-        task.data->deps = next;
-        task.data->coreData = _coreData;
-        task.data->context.Initialize(next->source, next->id);
+        BuildCoreTaskData* taskData = AllocateTaskData(_coreData);
+        taskData->processor = processor;
+        taskData->deps = next;
+        taskData->coreData = _coreData;
+        taskData->context.Initialize(next->source, next->id);
 
-        tbb::task::enqueue(task);
+        // -- The main thread never waits on the job system while building so the build would stall if it were the only
+        // -- thread the job system owns.
+        if(RunMultiThreaded_ && JobSystem_ThreadCount() > 1) {
+            JobSystem_Submit(nullptr, BuildCoreTask, taskData);
+        }
+        else {
+            BuildCoreTask(taskData);
+        }
 
         return true;
     }
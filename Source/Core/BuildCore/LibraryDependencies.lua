@@ -1,4 +1,2 @@
 
 local platform = ...
-
-loadfile(RootDirectory .. "ProjectGen\\Middlewares\\tbb.lua")(platform)
@@ -125,6 +125,38 @@ namespace Selas
             return Success_;
         }
 
+        //=========================================================================================================================
+        Error Delete(cpointer filepath)
+        {
+            #if IsWindows_
+                if(DeleteFileA(filepath) == 0) {
+                    return Error_("Failed to delete file: %s", filepath);
+                }
+            #else
+                if(unlink(filepath) != 0) {
+                    return Error_("Failed to delete file: %s", filepath);
+                }
+            #endif
+
+            return Success_;
+        }
+
+        //=========================================================================================================================
+        Error Rename(cpointer source, cpointer destination)
+        {
+            #if IsWindows_
+                if(MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == 0) {
+                    return Error_("Failed to rename file %s to %s", source, destination);
+                }
+            #else
+                if(rename(source, destination) != 0) {
+                    return Error_("Failed to rename file %s to %s", source, destination);
+                }
+            #endif
+
+            return Success_;
+        }
+
         //=========================================================================================================================
         bool Exists(cpointer filepath)
         {
@@ -19,6 +19,9 @@ namespace Selas
         Error WriteWholeFile(cpointer filepath, const void* data, uint64 size);
 
         Error Size(cpointer filepath, uint64& size);
+        Error Delete(cpointer filepath);
+        // -- Replaces destination if it exists. The replacement is atomic when both paths are on the same volume.
+        Error Rename(cpointer source, cpointer destination);
 
         bool Exists(cpointer filepath);
     };
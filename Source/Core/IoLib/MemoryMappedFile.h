@@ -0,0 +1,51 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "SystemLib/Error.h"
+#include "SystemLib/BasicTypes.h"
+
+namespace Selas
+{
+    //=============================================================================================================================
+    struct MemoryMappedFile
+    {
+        MemoryMappedFile()
+            : memory(nullptr)
+            , size(0)
+            , fileHandle(InvalidIndex64)
+            , mappingHandle(InvalidIndex64)
+        {
+
+        }
+
+        void*  memory;
+        uint64 size;
+
+        // -- Platform handles. Anonymous and read only mappings have no file handle.
+        uint64 fileHandle;
+        uint64 mappingHandle;
+    };
+
+    // -- Creates (or truncates) the file at filepath, resizes it to size bytes and maps it read/write.
+    Error MemoryMappedFile_Create(cpointer filepath, uint64 size, MemoryMappedFile* file);
+
+    // -- Maps an existing file read/write without sharing writes. Untouched pages come straight from the OS file cache and are
+    // -- shared with every other process mapping the file. Pages are only copied when first written.
+    Error MemoryMappedFile_OpenCopyOnWrite(cpointer filepath, MemoryMappedFile* file);
+
+    // -- Maps an existing file read only. The handles are closed as soon as the view exists so keeping many of these open
+    // -- doesn't use up the process's file descriptors.
+    Error MemoryMappedFile_OpenReadOnly(cpointer filepath, MemoryMappedFile* file);
+
+    // -- Maps size bytes of memory that is not backed by any file.
+    Error MemoryMappedFile_CreateAnonymous(uint64 size, MemoryMappedFile* file);
+
+    // -- Hints to the OS that the mapping will be read and written front to back.
+    void MemoryMappedFile_AdviseSequential(MemoryMappedFile* file);
+
+    void MemoryMappedFile_Close(MemoryMappedFile* file);
+    bool MemoryMappedFile_IsOpen(const MemoryMappedFile* file);
+}
@@ -0,0 +1,158 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#if !IsWindows_
+
+#include "IoLib/MemoryMappedFile.h"
+#include "SystemLib/JsAssert.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Selas
+{
+    //=============================================================================================================================
+    Error MemoryMappedFile_Create(cpointer filepath, uint64 size, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        int fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if(fd == -1) {
+            return Error_("Failed to create file: %s", filepath);
+        }
+
+        if(ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+            return Error_("Failed to resize file %s to %llu bytes", filepath, size);
+        }
+
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(memory == MAP_FAILED) {
+            close(fd);
+            return Error_("Failed to map file: %s", filepath);
+        }
+
+        file->memory = memory;
+        file->size = size;
+        file->fileHandle = (uint64)fd;
+        file->mappingHandle = InvalidIndex64;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_OpenCopyOnWrite(cpointer filepath, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        int fd = open(filepath, O_RDONLY);
+        if(fd == -1) {
+            return Error_("Failed to open file: %s", filepath);
+        }
+
+        struct stat status;
+        if(fstat(fd, &status) != 0 || status.st_size == 0) {
+            close(fd);
+            return Error_("Failed to map empty or unreadable file: %s", filepath);
+        }
+
+        uint64 size = (uint64)status.st_size;
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if(memory == MAP_FAILED) {
+            close(fd);
+            return Error_("Failed to map file: %s", filepath);
+        }
+
+        file->memory = memory;
+        file->size = size;
+        file->fileHandle = (uint64)fd;
+        file->mappingHandle = InvalidIndex64;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_OpenReadOnly(cpointer filepath, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        int fd = open(filepath, O_RDONLY);
+        if(fd == -1) {
+            return Error_("Failed to open file: %s", filepath);
+        }
+
+        struct stat status;
+        if(fstat(fd, &status) != 0 || status.st_size == 0) {
+            close(fd);
+            return Error_("Failed to map empty or unreadable file: %s", filepath);
+        }
+
+        uint64 size = (uint64)status.st_size;
+        void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        // -- The mapping keeps its own reference to the file
+        close(fd);
+        if(memory == MAP_FAILED) {
+            return Error_("Failed to map file: %s", filepath);
+        }
+
+        file->memory = memory;
+        file->size = size;
+        file->fileHandle = InvalidIndex64;
+        file->mappingHandle = InvalidIndex64;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_CreateAnonymous(uint64 size, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if(memory == MAP_FAILED) {
+            return Error_("Failed to map %llu bytes of anonymous memory", size);
+        }
+
+        file->memory = memory;
+        file->size = size;
+        file->fileHandle = InvalidIndex64;
+        file->mappingHandle = InvalidIndex64;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    void MemoryMappedFile_AdviseSequential(MemoryMappedFile* file)
+    {
+        if(file->memory != nullptr) {
+            madvise(file->memory, file->size, MADV_SEQUENTIAL);
+        }
+    }
+
+    //=============================================================================================================================
+    void MemoryMappedFile_Close(MemoryMappedFile* file)
+    {
+        if(file->memory != nullptr) {
+            munmap(file->memory, file->size);
+        }
+        if(file->fileHandle != InvalidIndex64) {
+            close((int)file->fileHandle);
+        }
+
+        file->memory = nullptr;
+        file->size = 0;
+        file->fileHandle = InvalidIndex64;
+        file->mappingHandle = InvalidIndex64;
+    }
+
+    //=============================================================================================================================
+    bool MemoryMappedFile_IsOpen(const MemoryMappedFile* file)
+    {
+        return file->memory != nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,185 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#if IsWindows_
+
+#include "IoLib/MemoryMappedFile.h"
+#include "SystemLib/JsAssert.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+namespace Selas
+{
+    //=============================================================================================================================
+    static Error MapView(HANDLE fileHandle, uint64 size, MemoryMappedFile* file)
+    {
+        DWORD sizeHigh = (DWORD)(size >> 32);
+        DWORD sizeLow = (DWORD)(size & 0xFFFFFFFF);
+
+        HANDLE mappingHandle = ::CreateFileMappingA(fileHandle, nullptr, PAGE_READWRITE, sizeHigh, sizeLow, nullptr);
+        if(mappingHandle == nullptr) {
+            return Error_("Failed to create a file mapping of %llu bytes", size);
+        }
+
+        void* memory = ::MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+        if(memory == nullptr) {
+            ::CloseHandle(mappingHandle);
+            return Error_("Failed to map a view of %llu bytes", size);
+        }
+
+        file->memory = memory;
+        file->size = size;
+        file->mappingHandle = (uint64)mappingHandle;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_Create(cpointer filepath, uint64 size, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        HANDLE fileHandle = ::CreateFileA(filepath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, 0,
+                                          nullptr);
+        if(fileHandle == INVALID_HANDLE_VALUE) {
+            return Error_("Failed to create file: %s", filepath);
+        }
+
+        Error err = MapView(fileHandle, size, file);
+        if(Failed_(err)) {
+            ::CloseHandle(fileHandle);
+            return err;
+        }
+
+        file->fileHandle = (uint64)fileHandle;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_OpenCopyOnWrite(cpointer filepath, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        HANDLE fileHandle = ::CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                          FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(fileHandle == INVALID_HANDLE_VALUE) {
+            return Error_("Failed to open file: %s", filepath);
+        }
+
+        LARGE_INTEGER fileSize;
+        if(::GetFileSizeEx(fileHandle, &fileSize) == 0 || fileSize.QuadPart == 0) {
+            ::CloseHandle(fileHandle);
+            return Error_("Failed to map empty or unreadable file: %s", filepath);
+        }
+
+        // -- PAGE_WRITECOPY lets a read only file handle back a view whose pages are copied on write
+        HANDLE mappingHandle = ::CreateFileMappingA(fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if(mappingHandle == nullptr) {
+            ::CloseHandle(fileHandle);
+            return Error_("Failed to create a file mapping for %s", filepath);
+        }
+
+        void* memory = ::MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+        if(memory == nullptr) {
+            ::CloseHandle(mappingHandle);
+            ::CloseHandle(fileHandle);
+            return Error_("Failed to map a view of %s", filepath);
+        }
+
+        file->memory = memory;
+        file->size = (uint64)fileSize.QuadPart;
+        file->fileHandle = (uint64)fileHandle;
+        file->mappingHandle = (uint64)mappingHandle;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_OpenReadOnly(cpointer filepath, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        HANDLE fileHandle = ::CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                          FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(fileHandle == INVALID_HANDLE_VALUE) {
+            return Error_("Failed to open file: %s", filepath);
+        }
+
+        LARGE_INTEGER fileSize;
+        if(::GetFileSizeEx(fileHandle, &fileSize) == 0 || fileSize.QuadPart == 0) {
+            ::CloseHandle(fileHandle);
+            return Error_("Failed to map empty or unreadable file: %s", filepath);
+        }
+
+        HANDLE mappingHandle = ::CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mappingHandle == nullptr) {
+            ::CloseHandle(fileHandle);
+            return Error_("Failed to create a file mapping for %s", filepath);
+        }
+
+        void* memory = ::MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+        // -- The view keeps the mapping and file open until it is unmapped
+        ::CloseHandle(mappingHandle);
+        ::CloseHandle(fileHandle);
+        if(memory == nullptr) {
+            return Error_("Failed to map a view of %s", filepath);
+        }
+
+        file->memory = memory;
+        file->size = (uint64)fileSize.QuadPart;
+        file->fileHandle = InvalidIndex64;
+        file->mappingHandle = InvalidIndex64;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error MemoryMappedFile_CreateAnonymous(uint64 size, MemoryMappedFile* file)
+    {
+        Assert_(file->memory == nullptr);
+
+        // -- Mappings of INVALID_HANDLE_VALUE are backed by the system paging file rather than a file on disk.
+        ReturnError_(MapView(INVALID_HANDLE_VALUE, size, file));
+        file->fileHandle = InvalidIndex64;
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    void MemoryMappedFile_AdviseSequential(MemoryMappedFile* file)
+    {
+        // -- No equivalent hint exists for views of a file mapping on Windows.
+        Unused_(file);
+    }
+
+    //=============================================================================================================================
+    void MemoryMappedFile_Close(MemoryMappedFile* file)
+    {
+        if(file->memory != nullptr) {
+            ::UnmapViewOfFile(file->memory);
+        }
+        if(file->mappingHandle != InvalidIndex64) {
+            ::CloseHandle((HANDLE)file->mappingHandle);
+        }
+        if(file->fileHandle != InvalidIndex64) {
+            ::CloseHandle((HANDLE)file->fileHandle);
+        }
+
+        file->memory = nullptr;
+        file->size = 0;
+        file->fileHandle = InvalidIndex64;
+        file->mappingHandle = InvalidIndex64;
+    }
+
+    //=============================================================================================================================
+    bool MemoryMappedFile_IsOpen(const MemoryMappedFile* file)
+    {
+        return file->memory != nullptr;
+    }
+}
+
+#endif
@@ -5,37 +5,289 @@
 #include "MathLib/Sampler.h"
 #include "MathLib/Trigonometric.h"
 #include "SystemLib/MinMax.h"
+#include "SystemLib/CountOf.h"
+#include "SystemLib/JsAssert.h"
 
 namespace Selas
 {
+    static cpointer SamplerTypeNames[] = {
+        "MersenneTwister",
+        "PCG32",
+        "Philox4x32",
+        "Sobol",
+        "OwenSobol"
+    };
+    static_assert(CountOf_(SamplerTypeNames) == SamplerTypeCount, "Missing sampler type name");
+
+    // -- Direction numbers of the first four Sobol dimensions from Joe & Kuo's new-joe-kuo-6.21201 table
+    static const uint32 SobolDirections[4][32] = {
+        {
+            0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+            0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+            0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+            0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001
+        },
+        {
+            0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+            0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+            0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+            0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff
+        },
+        {
+            0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+            0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+            0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+            0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555
+        },
+        {
+            0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+            0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+            0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+            0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093
+        }
+    };
+
     //=============================================================================================================================
-    void CSampler::Initialize(uint32 seed)
+    // -- Integer hash from https://nullprogram.com/blog/2018/07/31/
+    static uint32 Hash(uint32 x)
     {
-        Random::MersenneTwisterInitialize(&twister, seed);
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+        return x;
+    }
+
+    //=============================================================================================================================
+    static uint32 HashCombine(uint32 seed, uint32 v)
+    {
+        return seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+    }
+
+    //=============================================================================================================================
+    static uint32 ReverseBits(uint32 x)
+    {
+        x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+        x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+        x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+        x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    //=============================================================================================================================
+    // -- Hash based Owen scramble from "Practical Hash-based Owen Scrambling" (Burley 2020)
+    static uint32 NestedUniformScramble(uint32 x, uint32 seed)
+    {
+        x = ReverseBits(x);
+
+        x += seed;
+        x ^= x * 0x6c50b47c;
+        x ^= x * 0xb82f1e52;
+        x ^= x * 0xc7afe638;
+        x ^= x * 0x8d22f6e6;
+
+        return ReverseBits(x);
+    }
+
+    //=============================================================================================================================
+    // -- XOR of the direction numbers selected by every value of each byte of the index so a sample costs four lookups
+    // -- rather than a loop over 32 bits.
+    struct SobolByteTables
+    {
+        uint32 table[4][4][256];
+
+        SobolByteTables()
+        {
+            for(uint32 dimension = 0; dimension < 4; ++dimension) {
+                for(uint32 byteIndex = 0; byteIndex < 4; ++byteIndex) {
+                    for(uint32 value = 0; value < 256; ++value) {
+                        uint32 result = 0;
+                        for(uint32 bit = 0; bit < 8; ++bit) {
+                            if(value & (1 << bit)) {
+                                result ^= SobolDirections[dimension][byteIndex * 8 + bit];
+                            }
+                        }
+                        table[dimension][byteIndex][value] = result;
+                    }
+                }
+            }
+        }
+    };
+    static const SobolByteTables sobolByteTables;
+
+    //=============================================================================================================================
+    static uint32 Sobol(uint32 index, uint32 dimension)
+    {
+        const uint32 (*table)[256] = sobolByteTables.table[dimension];
+        return table[0][index & 0xFF] ^ table[1][(index >> 8) & 0xFF] ^ table[2][(index >> 16) & 0xFF] ^ table[3][index >> 24];
+    }
+
+    //=============================================================================================================================
+    static uint32 Pcg32(uint64& state, uint64 increment)
+    {
+        uint64 old = state;
+        state = old * 6364136223846793005ull + increment;
+        uint32 xorshifted = (uint32)(((old >> 18) ^ old) >> 27);
+        uint32 rotation = (uint32)(old >> 59);
+        return (xorshifted >> rotation) | (xorshifted << ((0u - rotation) & 31));
+    }
+
+    //=============================================================================================================================
+    static void Philox4x32(const uint32 counter[4], uint32 key0, uint32 key1, uint32 result[4])
+    {
+        uint32 c0 = counter[0];
+        uint32 c1 = counter[1];
+        uint32 c2 = counter[2];
+        uint32 c3 = counter[3];
+
+        for(uint round = 0; round < 10; ++round) {
+            uint64 product0 = (uint64)0xD2511F53 * c0;
+            uint64 product1 = (uint64)0xCD9E8D57 * c2;
+
+            uint32 next0 = (uint32)(product1 >> 32) ^ c1 ^ key0;
+            uint32 next2 = (uint32)(product0 >> 32) ^ c3 ^ key1;
+            c1 = (uint32)product1;
+            c3 = (uint32)product0;
+            c0 = next0;
+            c2 = next2;
+
+            key0 += 0x9E3779B9;
+            key1 += 0xBB67AE85;
+        }
+
+        result[0] = c0;
+        result[1] = c1;
+        result[2] = c2;
+        result[3] = c3;
+    }
+
+    //=============================================================================================================================
+    cpointer SamplerTypeName(SamplerType type)
+    {
+        return SamplerTypeNames[type];
+    }
+
+    //=============================================================================================================================
+    CSampler::CSampler()
+        : type(eSamplerMersenneTwister)
+        , seed(0)
+        , pixel(0)
+        , sample(0)
+        , dimension(0)
+        , pixelSeed(0)
+        , sobolIndex(0)
+        , pcgState(0)
+        , pcgIncrement(1)
+        , philoxBlockIndex(4)
+    {
+
+    }
+
+    //=============================================================================================================================
+    void CSampler::Initialize(uint32 seed_)
+    {
+        Initialize(eSamplerMersenneTwister, seed_);
+    }
+
+    //=============================================================================================================================
+    void CSampler::Initialize(SamplerType type_, uint32 seed_)
+    {
+        type = type_;
+        if(type == eSamplerMersenneTwister) {
+            Random::MersenneTwisterInitialize(&twister, seed_);
+        }
+
+        Reseed(seed_);
     }
 
     //=============================================================================================================================
     void CSampler::Shutdown()
     {
-        Random::MersenneTwisterShutdown(&twister);
+        if(type == eSamplerMersenneTwister) {
+            Random::MersenneTwisterShutdown(&twister);
+        }
     }
 
     //=============================================================================================================================
-    void CSampler::Reseed(uint32 seed)
+    void CSampler::Reseed(uint32 seed_)
     {
-        Random::MersenneTwisterReseed(&twister, seed);
+        seed = seed_;
+        if(type == eSamplerMersenneTwister) {
+            Random::MersenneTwisterReseed(&twister, seed_);
+        }
+
+        StartSample(0, 0);
     }
 
     //=============================================================================================================================
-    float CSampler::UniformFloat()
+    void CSampler::StartSample(uint32 pixel_, uint32 sample_)
     {
-        return Random::MersenneTwisterFloat(&twister);
+        pixel = pixel_;
+        sample = sample_;
+        dimension = 0;
+        philoxBlockIndex = 4;
+        pixelSeed = HashCombine(Hash(pixel), seed);
+
+        if(type == eSamplerPcg32) {
+            // -- Standard PCG32 seeding with the render seed selecting the stream
+            pcgIncrement = ((uint64)seed << 1) | 1;
+            pcgState = 0;
+            Pcg32(pcgState, pcgIncrement);
+            pcgState += ((uint64)Hash(pixel) << 32) | sample;
+            Pcg32(pcgState, pcgIncrement);
+        }
     }
 
     //=============================================================================================================================
     uint32 CSampler::UniformUInt32()
     {
-        return Random::MersenneTwisterUint32(&twister);
+        switch(type) {
+        case eSamplerPcg32:
+            ++dimension;
+            return Pcg32(pcgState, pcgIncrement);
+        case eSamplerPhilox:
+        {
+            if(philoxBlockIndex == 4) {
+                uint32 counter[4] = { sample, dimension, pixel, 0 };
+                Philox4x32(counter, seed, 0x5E1A5, philoxBlock);
+                philoxBlockIndex = 0;
+            }
+            ++dimension;
+            return philoxBlock[philoxBlockIndex++];
+        }
+        case eSamplerSobol:
+        case eSamplerOwenSobol:
+        {
+            // -- Dimensions are consumed in groups of four Sobol dimensions. Each group sees the sample indices in a
+            // -- different per-pixel order which decorrelates the groups from each other and pixels from their neighbours.
+            if((dimension & 3) == 0) {
+                sobolIndex = NestedUniformScramble(sample, Hash(HashCombine(pixelSeed, dimension >> 2)));
+            }
+
+            uint32 value = Sobol(sobolIndex, dimension & 3);
+            uint32 dimensionSeed = Hash(HashCombine(pixelSeed, dimension + 0x10000));
+            ++dimension;
+
+            if(type == eSamplerOwenSobol) {
+                return NestedUniformScramble(value, dimensionSeed);
+            }
+            return value ^ dimensionSeed;
+        }
+        default:
+            return Random::MersenneTwisterUint32(&twister);
+        }
+    }
+
+    //=============================================================================================================================
+    float CSampler::UniformFloat()
+    {
+        if(type == eSamplerMersenneTwister) {
+            return Random::MersenneTwisterFloat(&twister);
+        }
+
+        // -- Top 24 bits so the result is exactly representable and strictly below 1
+        return (UniformUInt32() >> 8) * (1.0f / (1 << 24));
     }
 
     //=========================================================================================================================
@@ -56,4 +308,4 @@ namespace Selas
     {
         return Math::Inv4Pi_;
     }
-}
\ No newline at end of file
+}
@@ -10,19 +10,59 @@
 
 namespace Selas
 {
-    // -- Currently just a wrapper around a Mersenne Twister but will be replaced with a better PRNG
-    // -- algorithm in the not too distance future.
+    enum SamplerType
+    {
+        // -- std::mt19937 stream. StartSample is ignored so samples depend on everything drawn before them.
+        eSamplerMersenneTwister,
+        // -- PCG32 stream restarted from a hash of (pixel, sample) by StartSample
+        eSamplerPcg32,
+        // -- Philox4x32-10 evaluated directly from the (pixel, sample, dimension) counter
+        eSamplerPhilox,
+        // -- 4D Sobol padded to any dimension count with random digit scrambling and per-pixel index shuffling
+        eSamplerSobol,
+        // -- Same as eSamplerSobol with hash based Owen scrambling (Burley 2020) in place of random digit scrambling
+        eSamplerOwenSobol,
+
+        SamplerTypeCount
+    };
+
+    cpointer SamplerTypeName(SamplerType type);
+
     class CSampler
     {
     private:
         Random::MersenneTwister twister;
 
+        SamplerType type;
+        uint32 seed;
+
+        // -- Counter state set by StartSample. Every draw advances dimension.
+        uint32 pixel;
+        uint32 sample;
+        uint32 dimension;
+        uint32 pixelSeed;
+        // -- Shuffled sample index of the current group of four Sobol dimensions
+        uint32 sobolIndex;
+
+        uint64 pcgState;
+        uint64 pcgIncrement;
+
+        uint32 philoxBlock[4];
+        uint32 philoxBlockIndex;
+
     public:
 
+        CSampler();
+
         void Initialize(uint32 seed);
+        void Initialize(SamplerType type, uint32 seed);
         void Shutdown();
         void Reseed(uint32 seed);
 
+        // -- Positions the sampler at the first dimension of the given sample of the given pixel. For every type other than
+        // -- eSamplerMersenneTwister the values returned afterwards depend only on (seed, pixel, sample, dimension).
+        void StartSample(uint32 pixel, uint32 sample);
+
         float   UniformFloat();
         uint32  UniformUInt32();
 
@@ -30,4 +70,4 @@ namespace Selas
         static float UniformSpherePdf();
     };
 
-}
\ No newline at end of file
+}
@@ -5,64 +5,333 @@
 #include "SceneLib/GeometryCache.h"
 #include "SceneLib/SubsceneResource.h"
 #include "SystemLib/OSThreading.h"
+#include "SystemLib/SystemTime.h"
 #include "SystemLib/Atomic.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/Memory.h"
+#include "SystemLib/JsAssert.h"
+#include "SystemLib/MinMax.h"
 #include "SystemLib/Logging.h"
 
+#include "embree3/rtcore.h"
+
+// -- When enabled the thread that loads a subscene's geometry also prefetches the ptex files its meshes sample
+#define PrefetchSubscenePtex_ 1
+// -- Threads dedicated to reading subscene geometry from disk and building its BVH
+#define GeometryLoaderThreadCount_ 2
+// -- Reference count a subscene is swapped to while it is being evicted
+#define EvictingRefCount_ (-(1ll << 62))
+
 namespace Selas
 {
     //=============================================================================================================================
-    int64 GeometryCache::GetAccessDt()
+    static bool DeviceMemoryMonitor(void* userPtr, ssize_t bytes, bool post)
     {
-        return (int64)SystemTime::ElapsedMillisecondsF(startTime);
+        Unused_(post);
+
+        volatile int64* deviceBytes = (volatile int64*)userPtr;
+        Atomic::Add64(deviceBytes, (int64)bytes);
+        return true;
     }
 
     //=============================================================================================================================
-    void GeometryCache::UnloadLruSubscene()
+    void GeometryCache::LinkResident(SubsceneResource* subscene)
     {
-        int64 lruTimestamp = GetAccessDt();
-        int64 lruIndex = -1;
+        // -- New subscenes go just behind the hand so they are the last ones it reaches
+        if(clockHand == nullptr) {
+            subscene->clockNext = subscene;
+            subscene->clockPrev = subscene;
+            clockHand = subscene;
+        }
+        else {
+            subscene->clockNext = clockHand;
+            subscene->clockPrev = clockHand->clockPrev;
+            clockHand->clockPrev->clockNext = subscene;
+            clockHand->clockPrev = subscene;
+        }
 
-        for(uint scan = 0, count = subscenes.Count(); scan < count; ++scan) {
-            if(subscenes[scan]->geometryLoaded && subscenes[scan]->refCount == 0) {
-                if(subscenes[scan]->lastAccessDt < lruTimestamp) {
-                    lruTimestamp = subscenes[scan]->lastAccessDt;
-                    lruIndex = scan;
-                }
+        ++residentCount;
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::UnlinkResident(SubsceneResource* subscene)
+    {
+        if(subscene->clockNext == subscene) {
+            clockHand = nullptr;
+        }
+        else {
+            subscene->clockPrev->clockNext = subscene->clockNext;
+            subscene->clockNext->clockPrev = subscene->clockPrev;
+            if(clockHand == subscene) {
+                clockHand = subscene->clockNext;
+            }
+        }
+
+        subscene->clockNext = nullptr;
+        subscene->clockPrev = nullptr;
+        --residentCount;
+    }
+
+    //=============================================================================================================================
+    // -- Advances the CLOCK hand until it finds a subscene that is neither referenced nor pinned and unloads it. Returns false
+    // -- if every resident subscene is pinned.
+    bool GeometryCache::EvictClockSubscene()
+    {
+        // -- The first sweep clears every reference bit so a second one is enough to reach each unpinned subscene
+        for(uint64 step = 0, stepCount = 2 * residentCount; step < stepCount; ++step) {
+            SubsceneResource* subscene = clockHand;
+            clockHand = subscene->clockNext;
+
+            if(subscene->referenced) {
+                subscene->referenced = 0;
+                continue;
+            }
+
+            // -- Only claims the subscene if nothing has it pinned. Pins attempted after this see a negative count and fail.
+            if(Atomic::CompareExchange64(&subscene->refCount, EvictingRefCount_, 0) == false) {
+                Atomic::AddU64(&pinnedSkipCount, 1);
+                continue;
+            }
+
+            WriteDebugInfo_("Unloading subscene %s: ", subscene->data->name.Ascii());
+
+            UnlinkResident(subscene);
+            subscene->geometryLoaded = 0;
+            UnloadSubsceneGeometry(subscene);
+            loadedGeometrySize -= subscene->geometrySizeEstimate;
+
+            Atomic::Add64(&subscene->refCount, -EvictingRefCount_);
+            Atomic::AddU64(&evictionCount, 1);
+            return true;
+        }
+
+        return false;
+    }
+
+    //=============================================================================================================================
+    // -- Called with the spinlock held. The count is raised under the lock so whoever changes the state we are waiting on,
+    // -- which also happens under the lock, is sure to see it.
+    void GeometryCache::WaitForLoaderWake()
+    {
+        Atomic::Increment64(&waitingLoaderCount);
+        LeaveSpinLock(spinlock);
+        WaitForSemaphore(loaderWakeSemaphore, InfiniteWait_);
+        EnterSpinLock(spinlock);
+        Atomic::Decrement64(&waitingLoaderCount);
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::WakeWaitingLoaders()
+    {
+        // -- Every waiter checks its condition again so waking ones that are waiting on something else is harmless
+        int64 waiterCount = waitingLoaderCount;
+        if(waiterCount > 0) {
+            PostSemaphore(loaderWakeSemaphore, (uint32)waiterCount);
+        }
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::LoaderThreadFunction(void* userData)
+    {
+        GeometryCache* cache = (GeometryCache*)userData;
+        cache->ProcessLoadRequests();
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::ProcessLoadRequests()
+    {
+        while(true) {
+            WaitForSemaphore(loadSemaphore, InfiniteWait_);
+            if(shuttingDown) {
+                break;
+            }
+
+            EnterSpinLock(spinlock);
+            Assert_(loadQueue.Count() > 0);
+            SubsceneResource* subscene = loadQueue[0];
+            // -- Queues only ever hold a handful of subscenes so keeping them in request order is cheap
+            for(uint scan = 1, count = loadQueue.Count(); scan < count; ++scan) {
+                loadQueue[scan - 1] = loadQueue[scan];
+            }
+            loadQueue.Resize(loadQueue.Count() - 1);
+            LeaveSpinLock(spinlock);
+
+            LoadSubscene(subscene);
+        }
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::LoadSubscene(SubsceneResource* subscene)
+    {
+        auto timer = SystemTime::Now();
+
+        bool measure = subscene->geometrySizeMeasured == false && monitoredDevice != nullptr;
+
+        EnterSpinLock(spinlock);
+
+        // -- Embree's task workers build every BVH so its allocations can't be attributed to a load by thread. Instead the
+        // -- first load of a subscene runs alone and is charged for however much the device grows over it.
+        while(measuringLoad) {
+            WaitForLoaderWake();
+        }
+        if(measure) {
+            // -- Raised before waiting so no other loads start in the meantime
+            measuringLoad = true;
+            while(activeLoadCount > 0) {
+                WaitForLoaderWake();
+            }
+        }
+        ++activeLoadCount;
+
+        uint64 subsceneSizeEstimate = subscene->geometrySizeEstimate;
+        Assert_(subsceneSizeEstimate <= loadedGeometryCapacity);
+        while(loadedGeometrySize + subsceneSizeEstimate > loadedGeometryCapacity) {
+            // -- Counted before the attempt so a subscene unpinned after the hand passes it always wakes us
+            Atomic::Increment64(&waitingLoaderCount);
+            if(EvictClockSubscene() == false) {
+                // -- Everything resident is pinned. Tracing threads only hold pins briefly.
+                LeaveSpinLock(spinlock);
+                WaitForSemaphore(loaderWakeSemaphore, InfiniteWait_);
+                EnterSpinLock(spinlock);
+            }
+            Atomic::Decrement64(&waitingLoaderCount);
+        }
+        loadedGeometrySize += subsceneSizeEstimate;
+        LeaveSpinLock(spinlock);
+
+        WriteDebugInfo_("Loading subscene: %s", subscene->data->name.Ascii());
+
+        int64 deviceBytesBefore = deviceBytes;
+        LoadSubsceneGeometry(subscene);
+        int64 embreeBytes = deviceBytes - deviceBytesBefore;
+
+        // -- Our own allocations are the model geometry files which are read into memory whole
+        uint64 measuredSize = subscene->geometryFileSize + (uint64)Max<int64>(embreeBytes, 0);
+        if(measure) {
+            Error error = SaveMeasuredSubsceneSize(subscene, measuredSize);
+            if(Failed_(error)) {
+                WriteDebugInfo_("Failed to save the measured size of subscene %s: %s", subscene->data->name.Ascii(),
+                                error.Message());
             }
         }
 
-        if(lruIndex != -1) {
-            subscenes[lruIndex]->geometryLoaded = 0;
+        EnterSpinLock(spinlock);
 
-            // -- This case sucks but we will wait if any threads raised the refcount between when we decided to unload this
-            // -- subscene and now.
-            while(subscenes[lruIndex]->refCount != 0) {}
+        if(measure) {
+            loadedGeometrySize = loadedGeometrySize - subsceneSizeEstimate + measuredSize;
+            subscene->geometrySizeEstimate = measuredSize;
+            subscene->geometrySizeMeasured = true;
 
-            // -- Now we can safely unload it
-            WriteDebugInfo_("Unloading subscene %s: ", subscenes[lruIndex]->data->name.Ascii());
+            // -- An underestimate can leave the cache over budget. Anything pinned is left for later loads to evict.
+            while(loadedGeometrySize > loadedGeometryCapacity && EvictClockSubscene()) { }
 
-            UnloadSubsceneGeometry(subscenes[lruIndex]);
+            measuringLoad = false;
+            Atomic::AddU64(&measuredLoadCount, 1);
+        }
+        --activeLoadCount;
+        WakeWaitingLoaders();
+
+        // -- Start referenced so the hand gives new subscenes a full sweep before they can be evicted
+        subscene->referenced = 1;
+        LinkResident(subscene);
+        subscene->geometryLoaded = 1;
+        subscene->geometryLoading = 0;
+        LeaveSpinLock(spinlock);
+
+        Atomic::AddU64(&loadMicroseconds, (uint64)SystemTime::ElapsedMicrosecondsF(timer));
+        Atomic::AddU64(&loadCount, 1);
 
-            loadedGeometrySize -= subscenes[lruIndex]->geometrySizeEstimate;
+        // -- Waiters register before checking the count so either they see this load or we see them
+        int64 waiterCount = loadWaiterCount;
+        if(waiterCount > 0) {
+            PostSemaphore(loadCompleteSemaphore, (uint32)waiterCount);
         }
+
+        // -- Tracing threads can use the geometry while this one warms the subscene's textures
+        #if PrefetchSubscenePtex_
+            if(textureCache != nullptr) {
+                PrefetchSubscenePtex(subscene, textureCache);
+            }
+        #endif
     }
 
     //=============================================================================================================================
-    void GeometryCache::Initialize(uint64 cacheSize)
+    void GeometryCache::Initialize(uint64 cacheSize, TextureCache* textureCache_)
     {
+        textureCache = textureCache_;
         loadedGeometrySize = 0;
         loadedGeometryCapacity = cacheSize;
         spinlock = CreateSpinLock();
-        startTime = SystemTime::Now();
+
+        clockHand = nullptr;
+        residentCount = 0;
+
+        monitoredDevice = nullptr;
+        activeLoadCount = 0;
+        measuringLoad = false;
+        measuredLoadCount = 0;
+        deviceBytes = 0;
+
+        hitCount = 0;
+        missCount = 0;
+        loadCount = 0;
+        loadMicroseconds = 0;
+        evictionCount = 0;
+        pinnedSkipCount = 0;
+        Memory::Zero(&loggedStats, sizeof(loggedStats));
+
+        shuttingDown = 0;
+        loadSemaphore = CreateOSSemaphore(0, 0x7FFFFFFF);
+        loadCompleteSemaphore = CreateOSSemaphore(0, 0x7FFFFFFF);
+        loadWaiterCount = 0;
+        loaderWakeSemaphore = CreateOSSemaphore(0, 0x7FFFFFFF);
+        waitingLoaderCount = 0;
+        loaderThreadCount = GeometryLoaderThreadCount_;
+        loaderThreads = AllocArray_(ThreadHandle, loaderThreadCount);
+        for(uint scan = 0; scan < loaderThreadCount; ++scan) {
+            loaderThreads[scan] = CreateThread(LoaderThreadFunction, this);
+        }
     }
 
     //=============================================================================================================================
     void GeometryCache::Shutdown()
     {
+        // -- Loads already in flight are finished but anything still queued is dropped
+        shuttingDown = 1;
+        PostSemaphore(loadSemaphore, (uint32)loaderThreadCount);
+        for(uint scan = 0; scan < loaderThreadCount; ++scan) {
+            ShutdownThread(loaderThreads[scan]);
+        }
+        SafeFree_(loaderThreads);
+        loaderThreadCount = 0;
+
+        CloseOSSemaphore(loadSemaphore);
+        loadSemaphore = nullptr;
+        CloseOSSemaphore(loadCompleteSemaphore);
+        loadCompleteSemaphore = nullptr;
+        CloseOSSemaphore(loaderWakeSemaphore);
+        loaderWakeSemaphore = nullptr;
+
+        loadQueue.Shutdown();
+
+        if(monitoredDevice != nullptr) {
+            rtcSetDeviceMemoryMonitorFunction(monitoredDevice, nullptr, nullptr);
+            monitoredDevice = nullptr;
+        }
+
         CloseSpinlock(spinlock);
         spinlock = nullptr;
     }
 
+    //=============================================================================================================================
+    void GeometryCache::MonitorDeviceMemory(RTCDevice rtcDevice)
+    {
+        Assert_(monitoredDevice == nullptr);
+
+        monitoredDevice = rtcDevice;
+        rtcSetDeviceMemoryMonitorFunction(rtcDevice, DeviceMemoryMonitor, (void*)&deviceBytes);
+    }
+
     //=============================================================================================================================
     void GeometryCache::RegisterSubscenes(SubsceneResource** subscenes_, uint64 subsceneCount)
     {
@@ -87,54 +356,142 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    void GeometryCache::EnsureSubsceneGeometryLoaded(SubsceneResource* subscene)
+    void GeometryCache::RequestSubsceneGeometry(SubsceneResource* subscene)
     {
-        Atomic::Increment64(&subscene->refCount);
+        if(subscene->geometryLoaded || subscene->geometryLoading) {
+            return;
+        }
 
-        while(subscene->geometryLoading == 1) { }
+        bool queued = false;
 
-        if(subscene->geometryLoaded == 0) {
-            Atomic::Decrement64(&subscene->refCount);
+        EnterSpinLock(spinlock);
+        if(subscene->geometryLoaded == 0 && subscene->geometryLoading == 0) {
+            subscene->geometryLoading = 1;
+            loadQueue.Add(subscene);
+            queued = true;
+        }
+        LeaveSpinLock(spinlock);
 
-            uint64 subsceneSizeEstimate = subscene->geometrySizeEstimate;
+        if(queued) {
+            PostSemaphore(loadSemaphore, 1);
+        }
+    }
 
-            EnterSpinLock(spinlock);
+    //=============================================================================================================================
+    bool GeometryCache::PinSubscene(SubsceneResource* subscene)
+    {
+        int64 prevCount = Atomic::Increment64(&subscene->refCount);
 
-            if(subscene->geometryLoaded == 0 && subscene->geometryLoading == 0) {
-                Assert_(subsceneSizeEstimate <= loadedGeometryCapacity);
-                while(loadedGeometrySize + subsceneSizeEstimate > loadedGeometryCapacity) {
-                    UnloadLruSubscene();
-                }
+        // -- Once the count is raised the CLOCK hand cannot claim the subscene so a resident subscene stays resident until
+        // -- FinishUsingSubceneGeometry.
+        if(prevCount < 0 || subscene->geometryLoaded == 0) {
+            Atomic::Decrement64(&subscene->refCount);
+            return false;
+        }
 
-                loadedGeometrySize += subsceneSizeEstimate;
-                Atomic::Increment64(&subscene->refCount);
+        // -- Avoid writing the shared cache line when the bit is already set
+        if(subscene->referenced == 0) {
+            subscene->referenced = 1;
+        }
 
-                subscene->geometryLoading = 1;
-                LeaveSpinLock(spinlock);
+        return true;
+    }
 
-                WriteDebugInfo_("Loading subscene: %s", subscene->data->name.Ascii());
-                LoadSubsceneGeometry(subscene);
+    //=============================================================================================================================
+    bool GeometryCache::TryUseSubsceneGeometry(SubsceneResource* subscene)
+    {
+        if(PinSubscene(subscene)) {
+            Atomic::AddU64(&hitCount, 1);
+            return true;
+        }
 
-                EnterSpinLock(spinlock);
-                subscene->geometryLoading = 0;
-            }
+        Atomic::AddU64(&missCount, 1);
+        RequestSubsceneGeometry(subscene);
+        return false;
+    }
 
-            Atomic::Increment64(&subscene->refCount);
-            LeaveSpinLock(spinlock);
+    //=============================================================================================================================
+    void GeometryCache::EnsureSubsceneGeometryLoaded(SubsceneResource* subscene)
+    {
+        if(TryUseSubsceneGeometry(subscene)) {
+            return;
         }
 
-        while(subscene->geometryLoading == 1) { }
-        Assert_(subscene->geometryLoaded == 1);
+        // -- Requested again on each attempt in case the subscene is evicted between its load and our pin
+        while(true) {
+            uint64 completedLoadCount = CompletedLoadCount();
+            if(PinSubscene(subscene)) {
+                break;
+            }
 
-        // -- Try to update the last access timestamp. No big deal if we fail though.
-        int64 prevTime = subscene->lastAccessDt;
-        int64 updateTime = GetAccessDt();
-        Atomic::CompareExchange64(&subscene->lastAccessDt, updateTime, prevTime);
+            RequestSubsceneGeometry(subscene);
+            WaitForLoadCompletion(completedLoadCount);
+        }
     }
 
     //=============================================================================================================================
     void GeometryCache::FinishUsingSubceneGeometry(SubsceneResource* subscene)
     {
-        Atomic::Decrement64(&subscene->refCount);
+        // -- A loader waiting for room raises its count before trying to evict so either it sees this unpin or we see it
+        if(Atomic::Decrement64(&subscene->refCount) == 1) {
+            WakeWaitingLoaders();
+        }
+    }
+
+    //=============================================================================================================================
+    uint64 GeometryCache::CompletedLoadCount()
+    {
+        return loadCount;
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::WaitForLoadCompletion(uint64 completedLoadCount)
+    {
+        Atomic::Increment64(&loadWaiterCount);
+        // -- Posts meant for earlier waiters can wake us early so the count is checked again each time
+        while(loadCount == completedLoadCount) {
+            WaitForSemaphore(loadCompleteSemaphore, InfiniteWait_);
+        }
+        Atomic::Decrement64(&loadWaiterCount);
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::GetStats(GeometryCacheStats* stats)
+    {
+        stats->hits              = hitCount;
+        stats->misses            = missCount;
+        stats->loads             = loadCount;
+        stats->loadMicroseconds  = loadMicroseconds;
+        stats->evictions         = evictionCount;
+        stats->pinnedSkips       = pinnedSkipCount;
+        stats->residentSubscenes = residentCount;
+        stats->residentBytes     = loadedGeometrySize;
+        stats->measuredLoads     = measuredLoadCount;
+        stats->deviceBytes       = (uint64)Max<int64>((int64)deviceBytes, 0);
+    }
+
+    //=============================================================================================================================
+    void GeometryCache::LogStats()
+    {
+        GeometryCacheStats stats;
+        GetStats(&stats);
+
+        // -- Not synchronized with other callers; only the main thread logs
+        GeometryCacheStats& last = loggedStats;
+        const float mb = 1.0f / (1024.0f * 1024.0f);
+
+        uint64 hits = stats.hits - last.hits;
+        uint64 misses = stats.misses - last.misses;
+        uint64 loads = stats.loads - last.loads;
+        if(hits != 0 || misses != 0 || loads != 0) {
+            WriteDebugInfo_("Geometry cache %llu hits, %llu misses: %llu loads (%llu measured) on %u threads (avg %.1fms), "
+                            "%llu evictions, %llu pinned skips, %llu subscenes resident (%.2fMB charged, %.2fMB embree)",
+                            hits, misses, loads, stats.measuredLoads - last.measuredLoads, (uint32)loaderThreadCount,
+                            loads ? 0.001f * (float)(stats.loadMicroseconds - last.loadMicroseconds) / loads : 0.0f,
+                            stats.evictions - last.evictions, stats.pinnedSkips - last.pinnedSkips,
+                            stats.residentSubscenes, stats.residentBytes * mb, stats.deviceBytes * mb);
+        }
+
+        last = stats;
     }
 }
\ No newline at end of file
@@ -4,38 +4,124 @@
 // Joe Schutte
 //=================================================================================================================================
 
+#include "SceneLib/EmbreeUtils.h"
 #include "ContainersLib/CArray.h"
-#include "SystemLib/SystemTime.h"
+#include "ThreadingLib/Thread.h"
+#include "SystemLib/OSThreading.h"
 #include "SystemLib/BasicTypes.h"
 
 namespace Selas
 {
     struct SubsceneResource;
+    class TextureCache;
+
+    struct GeometryCacheStats
+    {
+        // -- Pin attempts that found the subscene resident and those that had to request it
+        uint64 hits;
+        uint64 misses;
+        uint64 loads;
+        uint64 loadMicroseconds;
+        // -- Subscenes unloaded by the CLOCK hand and subscenes it passed over because they were pinned
+        uint64 evictions;
+        uint64 pinnedSkips;
+        uint64 residentSubscenes;
+        // -- Includes the space reserved for loads in flight
+        uint64 residentBytes;
+        // -- Loads whose memory use was measured and persisted and the memory currently allocated by the monitored device
+        uint64 measuredLoads;
+        uint64 deviceBytes;
+    };
 
     //=============================================================================================================================
+    // -- Subscene geometry is loaded and committed by a small pool of loader threads. Tracing threads try to use a subscene and
+    // -- defer their work when it is not resident. Whoever schedules the deferred work sleeps on the loaders when nothing else
+    // -- is left to do.
     class GeometryCache
     {
     private:
 
         void* spinlock;
+        TextureCache* textureCache;
         uint64 loadedGeometrySize;
         uint64 loadedGeometryCapacity;
-        std::chrono::high_resolution_clock::time_point startTime;
 
         CArray<SubsceneResource*> subscenes;
 
-        int64 GetAccessDt();
-        void UnloadLruSubscene();
+        // -- Resident subscenes are linked into a ring swept by the CLOCK hand. Both are only touched under the spinlock.
+        SubsceneResource* clockHand;
+        uint64 residentCount;
+
+        // -- Loads in flight and whether one of them is being measured, in which case it is the only one
+        RTCDevice monitoredDevice;
+        uint64 activeLoadCount;
+        bool measuringLoad;
+
+        CArray<SubsceneResource*> loadQueue;
+        void* loadSemaphore;
+        ThreadHandle* loaderThreads;
+        uint loaderThreadCount;
+        volatile int64 shuttingDown;
+
+        // -- Threads sleeping in WaitForLoadCompletion. Each finished load posts the semaphore once per waiter.
+        void* loadCompleteSemaphore;
+        volatile int64 loadWaiterCount;
+
+        // -- Loaders waiting for another load to finish or, when everything resident is pinned, for a subscene to be
+        // -- unpinned. Kept on its own line since FinishUsingSubceneGeometry reads it.
+        void* loaderWakeSemaphore;
+        Align_(CacheLineSize_) volatile int64 waitingLoaderCount;
+
+        Align_(CacheLineSize_) volatile uint64 hitCount;
+        Align_(CacheLineSize_) volatile uint64 missCount;
+        Align_(CacheLineSize_) volatile uint64 loadCount;
+        volatile uint64 loadMicroseconds;
+        volatile uint64 evictionCount;
+        volatile uint64 pinnedSkipCount;
+        volatile uint64 measuredLoadCount;
+        Align_(CacheLineSize_) volatile int64 deviceBytes;
+        GeometryCacheStats loggedStats;
+
+        void LinkResident(SubsceneResource* subscene);
+        void UnlinkResident(SubsceneResource* subscene);
+        bool EvictClockSubscene();
+        bool PinSubscene(SubsceneResource* subscene);
+
+        void WaitForLoaderWake();
+        void WakeWaitingLoaders();
+
+        static void LoaderThreadFunction(void* userData);
+        void ProcessLoadRequests();
+        void LoadSubscene(SubsceneResource* subscene);
 
     public:
 
-        void Initialize(uint64 cacheSize);
+        // -- When textureCache is given the ptex files of each subscene are prefetched as soon as its geometry is loaded
+        void Initialize(uint64 cacheSize, TextureCache* textureCache);
         void Shutdown();
 
+        // -- Tracks the memory Embree allocates on the device so each subscene can be charged for its actual size. Must be the
+        // -- device the registered subscenes are built on.
+        void MonitorDeviceMemory(RTCDevice rtcDevice);
+
         void RegisterSubscenes(SubsceneResource** subscenes, uint64 subsceneCount);
         void PreloadSubscene(cpointer name);
 
+        // -- Queues the subscene on the loader threads if it is neither resident nor already queued. Never blocks on disk.
+        void RequestSubsceneGeometry(SubsceneResource* subscene);
+        // -- Pins the subscene and returns true when it is resident. Otherwise requests it and returns false.
+        bool TryUseSubsceneGeometry(SubsceneResource* subscene);
+        // -- Pins the subscene, waiting on the loader threads if it is not resident. Only for callers with no work to defer.
         void EnsureSubsceneGeometryLoaded(SubsceneResource* subscene);
         void FinishUsingSubceneGeometry(SubsceneResource* subscene);
+
+        // -- Read the count before checking whether the subscenes some deferred work is waiting on are resident. If none of
+        // -- them are, WaitForLoadCompletion with that count returns as soon as any load finishes after it was read.
+        uint64 CompletedLoadCount();
+        void WaitForLoadCompletion(uint64 completedLoadCount);
+
+        void GetStats(GeometryCacheStats* stats);
+        // -- Logs the stats accumulated since the previous call
+        void LogStats();
     };
-}
\ No newline at end of file
+}
@@ -458,7 +458,7 @@ namespace Selas
 
         void* fileData = nullptr;
         uint64 fileSize = 0;
-        ReturnError_(File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize));
+        ReturnError_(AssetFileUtils::LoadAssetFile(filepath.Ascii(), &model->geometryFile, &fileData, &fileSize));
 
         AttachToBinary(model->geometry, (uint8*)fileData, fileSize);
 
@@ -482,7 +482,8 @@ namespace Selas
         }
         model->rtcScene = nullptr;
 
-        SafeFreeAligned_(model->geometry);
+        AssetFileUtils::UnloadAssetFile(&model->geometryFile, model->geometry);
+        model->geometry = nullptr;
     }
 
     //=============================================================================================================================
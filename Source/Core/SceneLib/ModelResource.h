@@ -12,6 +12,7 @@
 #include "UtilityLib/MurmurHash.h"
 #include "StringLib/FixedString.h"
 #include "MathLib/FloatStructs.h"
+#include "IoLib/MemoryMappedFile.h"
 #include "ContainersLib/CArray.h"
 #include "SystemLib/Error.h"
 #include "SystemLib/BasicTypes.h"
@@ -176,6 +177,8 @@ namespace Selas
 
         ModelResourceData* data;
         ModelGeometryData* geometry;
+        // -- Open when geometry points into a mapping of the geometry file. Embree's shared buffers then read the mapped pages.
+        MemoryMappedFile geometryFile;
 
         FixedString256 name;
         uint64 geometrySize;
@@ -0,0 +1,31 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "SystemLib/BasicTypes.h"
+
+#include "embree3/rtcore.h"
+
+namespace Selas
+{
+    //=============================================================================================================================
+    // -- Every trace against a SceneResource's rtcScene must pass one of these as its intersect context since the subscene
+    // -- instance callbacks read it back from the RTCIntersectContext pointer Embree hands them.
+    struct SceneIntersectContext
+    {
+        RTCIntersectContext rtc;
+
+        // -- When null the instance callbacks wait for non-resident subscenes to load. Otherwise those instances are skipped
+        // -- and the instance id is written at the index given by the ray's id so the caller can retrace the ray later.
+        uint32* missingInstanceIds;
+    };
+
+    //=============================================================================================================================
+    inline void InitializeSceneIntersectContext(SceneIntersectContext* context, uint32* missingInstanceIds)
+    {
+        rtcInitIntersectContext(&context->rtc);
+        context->missingInstanceIds = missingInstanceIds;
+    }
+}
@@ -6,6 +6,7 @@
 #include "SceneLib/ModelResource.h"
 #include "SceneLib/ImageBasedLightResource.h"
 #include "SceneLib/GeometryCache.h"
+#include "SceneLib/SceneIntersectContext.h"
 #include "Assets/AssetFileUtils.h"
 #include "MathLib/Trigonometric.h"
 #include "MathLib/FloatFuncs.h"
@@ -83,6 +84,33 @@ namespace Selas
         bounds->upper_z = data->aaBox.max.z;
     }
 
+    //=============================================================================================================================
+    // -- Pins the instance's subscene. When the context allows deferral a non-resident subscene is requested from the loader
+    // -- threads and the valid rays are marked as missing it instead. Only the packet benchmarks trace without deferral; the
+    // -- integrators never wait on disk here.
+    template<typename Arguments_>
+    static bool UseInstanceSubscene(const Arguments_* args, RTCRayN* rays, const SubsceneInstanceUserData* instance)
+    {
+        SceneIntersectContext* context = (SceneIntersectContext*)args->context;
+
+        if(context->missingInstanceIds == nullptr) {
+            instance->geometryCache->EnsureSubsceneGeometryLoaded(instance->subscene);
+            return true;
+        }
+
+        if(instance->geometryCache->TryUseSubsceneGeometry(instance->subscene)) {
+            return true;
+        }
+
+        for(uint32 scan = 0; scan < args->N; ++scan) {
+            if(args->valid[scan] != 0) {
+                context->missingInstanceIds[RTCRayN_id(rays, args->N, scan)] = instance->instanceID;
+            }
+        }
+
+        return false;
+    }
+
     //=============================================================================================================================
     static void SceneInstanceIntersectFunction(const RTCIntersectFunctionNArguments* args)
     {
@@ -94,7 +122,9 @@ namespace Selas
 
         const uint32 N = args->N;
 
-        instance->geometryCache->EnsureSubsceneGeometryLoaded(instance->subscene);
+        if(UseInstanceSubscene(args, rays, instance) == false) {
+            return;
+        }
 
         for(uint32 scan = 0; scan < N; ++scan) {
             if(args->valid[scan] == 0)
@@ -151,7 +181,10 @@ namespace Selas
 
         const uint32 N = args->N;
 
-        instance->geometryCache->EnsureSubsceneGeometryLoaded(instance->subscene);
+        if(UseInstanceSubscene(args, rays, instance) == false) {
+            return;
+        }
+
         for(uint32 scan = 0; scan < N; ++scan) {
             if(args->valid[scan] == 0)
                 continue;
@@ -275,7 +308,7 @@ namespace Selas
 
         void* fileData = nullptr;
         uint64 fileSize = 0;
-        ReturnError_(File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize));
+        ReturnError_(AssetFileUtils::LoadAssetFile(filepath.Ascii(), &data->dataFile, &fileData, &fileSize));
 
         AttachToBinary(data->data, (uint8*)fileData, fileSize);
 
@@ -329,7 +362,8 @@ namespace Selas
       
         SafeFree_(scene->subsceneInstanceUserDatas);
         SafeFree_(scene->subscenes);
-        SafeFreeAligned_(scene->data);
+        AssetFileUtils::UnloadAssetFile(&scene->dataFile, scene->data);
+        scene->data = nullptr;
     }
 
     //=============================================================================================================================
@@ -376,4 +410,19 @@ namespace Selas
         ModelDataFromRayIds(scene->subscenes[sceneIndex], subsceneID, geomId, localToWorld, modelData);
         localToWorld = MatrixMultiply(localToWorld, scene->data->subsceneInstances[sceneID].localToWorld);
     }
+
+    //=============================================================================================================================
+    SubsceneResource* SubsceneFromRayIds(const SceneResource* scene, const int32 instIds[MaxInstanceLevelCount_])
+    {
+        Assert_(instIds[0] != RTC_INVALID_GEOMETRY_ID);
+
+        return SubsceneFromInstanceId(scene, (uint32)instIds[0]);
+    }
+
+    //=============================================================================================================================
+    SubsceneResource* SubsceneFromInstanceId(const SceneResource* scene, uint32 instanceId)
+    {
+        uint sceneIndex = scene->data->subsceneInstances[instanceId].index;
+        return scene->subscenes[sceneIndex];
+    }
 }
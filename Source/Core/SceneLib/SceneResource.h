@@ -12,6 +12,7 @@
 #include "GeometryLib/Camera.h"
 #include "UtilityLib/MurmurHash.h"
 #include "MathLib/FloatStructs.h"
+#include "IoLib/MemoryMappedFile.h"
 #include "ContainersLib/CArray.h"
 #include "SystemLib/Error.h"
 #include "SystemLib/BasicTypes.h"
@@ -71,6 +72,8 @@ namespace Selas
         static const uint64 kDataVersion;
 
         SceneResourceData* data;
+        // -- Open when data points into a mapping of the asset file rather than an allocation
+        MemoryMappedFile dataFile;
 
         RTCScene rtcScene;
 
@@ -96,4 +99,8 @@ namespace Selas
 
     void ModelDataFromRayIds(const SceneResource* scene, const int32 instIds[MaxInstanceLevelCount_], int32 geomId,
                             float4x4& localToWorld, ModelGeometryUserData*& modelData);
+    // -- The subscene owning the geometry of a hit. Its geometry must be pinned with the GeometryCache before reading vertex data.
+    SubsceneResource* SubsceneFromRayIds(const SceneResource* scene, const int32 instIds[MaxInstanceLevelCount_]);
+    // -- The subscene of a top level instance, such as one a deferring SceneIntersectContext reported missing
+    SubsceneResource* SubsceneFromInstanceId(const SceneResource* scene, uint32 instanceId);
 }
@@ -4,10 +4,12 @@
 
 #include "SceneLib/SubsceneResource.h"
 #include "SceneLib/ModelResource.h"
+#include "TextureLib/TextureCache.h"
 #include "Assets/AssetFileUtils.h"
 #include "MathLib/Trigonometric.h"
 #include "MathLib/FloatFuncs.h"
 #include "IoLib/BinaryStreamSerializer.h"
+#include "IoLib/File.h"
 #include "SystemLib/BasicTypes.h"
 
 #include "embree3/rtcore.h"
@@ -18,16 +20,61 @@ namespace Selas
     cpointer SubsceneResource::kDataType = "SubsceneResource";
     const uint64 SubsceneResource::kDataVersion = 1539129606ul;
 
+    // -- Persisted next to the subscene asset once the memory its geometry takes up has been measured
+    struct MeasuredSubsceneSize
+    {
+        // -- The measurement is discarded when the model geometry it was taken with is rebuilt to a different size
+        uint64 geometryFileSize;
+        uint64 measuredSize;
+    };
+
     //=============================================================================================================================
-    static uint64 EstimateSubsceneSize(SubsceneResource* subscene)
+    static uint64 SubsceneGeometryFileSize(SubsceneResource* subscene)
     {
-        uint64 estimate = 0;
+        uint64 size = 0;
         for(uint scan = 0, count = subscene->data->modelNames.Count(); scan < count; ++scan) {
-            estimate += subscene->models[scan]->geometrySize;
+            size += subscene->models[scan]->geometrySize;
+        }
+
+        return size;
+    }
+
+    //=============================================================================================================================
+    static void MeasuredSizeFilePath(const SubsceneResource* subscene, FilePathString& filepath)
+    {
+        FilePathString assetpath;
+        AssetFileUtils::AssetFilePath(SubsceneResource::kDataType, SubsceneResource::kDataVersion,
+                                      subscene->data->name.Ascii(), assetpath);
+        FixedStringSprintf(filepath, "%s.memory", assetpath.Ascii());
+    }
+
+    //=============================================================================================================================
+    static void EstimateSubsceneSize(SubsceneResource* subscene)
+    {
+        subscene->geometryFileSize = SubsceneGeometryFileSize(subscene);
+
+        FilePathString filepath;
+        MeasuredSizeFilePath(subscene, filepath);
+
+        void* fileData = nullptr;
+        uint64 fileSize = 0;
+        if(File::Exists(filepath.Ascii()) && Successful_(File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize))) {
+            const MeasuredSubsceneSize* measured = (const MeasuredSubsceneSize*)fileData;
+            bool valid = fileSize == sizeof(MeasuredSubsceneSize) && measured->geometryFileSize == subscene->geometryFileSize;
+            if(valid) {
+                subscene->geometrySizeEstimate = measured->measuredSize;
+                subscene->geometrySizeMeasured = true;
+            }
+            FreeAligned_(fileData);
+
+            if(valid) {
+                return;
+            }
         }
 
-        // Doubling our estimate to approximate the cost for embree's BVH data.
-        return estimate * 2;
+        // -- Doubling the file size to approximate the cost for embree's BVH data until the first load measures it
+        subscene->geometrySizeEstimate = subscene->geometryFileSize * 2;
+        subscene->geometrySizeMeasured = false;
     }
 
     //=============================================================================================================================
@@ -82,11 +129,16 @@ namespace Selas
     SubsceneResource::SubsceneResource()
         : data(nullptr)
         , rtcScene(nullptr)
+        , geometrySizeEstimate(0)
+        , geometryFileSize(0)
+        , geometrySizeMeasured(false)
         , models(nullptr)
         , refCount(0)
         , geometryLoaded(0)
         , geometryLoading()
-        , lastAccessDt(0)
+        , referenced(0)
+        , clockNext(nullptr)
+        , clockPrev(nullptr)
     {
 
     }
@@ -106,7 +158,7 @@ namespace Selas
 
         void* fileData = nullptr;
         uint64 fileSize = 0;
-        ReturnError_(File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize));
+        ReturnError_(AssetFileUtils::LoadAssetFile(filepath.Ascii(), &data->dataFile, &fileData, &fileSize));
 
         AttachToBinary(data->data, (uint8*)fileData, fileSize);
 
@@ -130,7 +182,7 @@ namespace Selas
         }
 
         subscene->rtcDevice = rtcDevice;
-        subscene->geometrySizeEstimate = EstimateSubsceneSize(subscene);
+        EstimateSubsceneSize(subscene);
 
         CalculateSubsceneBoundingBox(subscene);
 
@@ -154,6 +206,19 @@ namespace Selas
         subscene->geometryLoaded = 1;
     }
 
+    //=============================================================================================================================
+    Error SaveMeasuredSubsceneSize(const SubsceneResource* subscene, uint64 measuredSize)
+    {
+        MeasuredSubsceneSize measured;
+        measured.geometryFileSize = subscene->geometryFileSize;
+        measured.measuredSize = measuredSize;
+
+        FilePathString filepath;
+        MeasuredSizeFilePath(subscene, filepath);
+
+        return File::WriteWholeFile(filepath.Ascii(), &measured, sizeof(measured));
+    }
+
     //=============================================================================================================================
     void UnloadSubsceneGeometry(SubsceneResource* subscene)
     {
@@ -168,6 +233,20 @@ namespace Selas
         subscene->geometryLoaded = 0;
     }
 
+    //=============================================================================================================================
+    void PrefetchSubscenePtex(SubsceneResource* subscene, TextureCache* textureCache)
+    {
+        for(uint scan = 0, modelCount = subscene->data->modelNames.Count(); scan < modelCount; ++scan) {
+            ModelResource* model = subscene->models[scan];
+            for(uint geomScan = 0, geomCount = model->userDatas.Count(); geomScan < geomCount; ++geomScan) {
+                const ModelGeometryUserData& userData = model->userDatas[geomScan];
+                if(userData.material->flags & eUsesPtex) {
+                    textureCache->PrefetchPtex(userData.baseColorTextureHandle);
+                }
+            }
+        }
+    }
+
     //=============================================================================================================================
     void ShutdownSubsceneResource(SubsceneResource* subscene, TextureCache* textureCache)
     {
@@ -179,7 +258,8 @@ namespace Selas
         }
 
         SafeFree_(subscene->models);
-        SafeFreeAligned_(subscene->data);
+        AssetFileUtils::UnloadAssetFile(&subscene->dataFile, subscene->data);
+        subscene->data = nullptr;
     }
 
     //=============================================================================================================================
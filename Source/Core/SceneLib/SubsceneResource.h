@@ -12,6 +12,7 @@
 #include "UtilityLib/MurmurHash.h"
 #include "MathLib/FloatStructs.h"
 #include "MathLib/FloatFuncs.h"
+#include "IoLib/MemoryMappedFile.h"
 #include "ContainersLib/CArray.h"
 #include "SystemLib/Error.h"
 #include "SystemLib/BasicTypes.h"
@@ -54,20 +55,30 @@ namespace Selas
         static const uint64 kDataVersion;
 
         SubsceneResourceData* data;
+        // -- Open when data points into a mapping of the asset file rather than an allocation
+        MemoryMappedFile dataFile;
 
         RTCDevice rtcDevice;
         RTCScene rtcScene;
 
         AxisAlignedBox aaBox;
         float4 boundingSphere;
+        // -- Bytes charged against the GeometryCache while the geometry is resident. A heuristic until the subscene has been
+        // -- loaded once and then the measured size, which is persisted next to the asset.
         uint64 geometrySizeEstimate;
+        // -- Combined size of the model geometry files
+        uint64 geometryFileSize;
+        bool geometrySizeMeasured;
 
         ModelResource** models;
 
+        // -- Owned by the GeometryCache. A negative refCount means the subscene is being evicted and cannot be pinned.
         Align_(CacheLineSize_) volatile int64 refCount;
         Align_(CacheLineSize_) volatile int64 geometryLoaded;
         Align_(CacheLineSize_) volatile int64 geometryLoading;
-        Align_(CacheLineSize_) volatile int64 lastAccessDt;
+        Align_(CacheLineSize_) volatile int64 referenced;
+        SubsceneResource* clockNext;
+        SubsceneResource* clockPrev;
 
         SubsceneResource();
         ~SubsceneResource();
@@ -79,7 +90,9 @@ namespace Selas
 
     Error InitializeSubsceneResource(SubsceneResource* subscene, RTCDevice rtcDevice, TextureCache* textureCache);
     void LoadSubsceneGeometry(SubsceneResource* subscene);
+    Error SaveMeasuredSubsceneSize(const SubsceneResource* subscene, uint64 measuredSize);
     void UnloadSubsceneGeometry(SubsceneResource* subscene);
+    void PrefetchSubscenePtex(SubsceneResource* subscene, TextureCache* textureCache);
     void ShutdownSubsceneResource(SubsceneResource* scene, TextureCache* textureCache);
 
     void ModelDataFromRayIds(const SubsceneResource* scene, int32 modelID, int32 geomId,
@@ -23,8 +23,8 @@ namespace Selas
     // https://schuttejoe.github.io/post/DisneyBsdf/
 
     //=============================================================================================================================
-    static void CalculateLobePdfs(const SurfaceParameters& surface,
-                                  float& pSpecular, float& pDiffuse, float& pClearcoat, float& pSpecTrans)
+    void CalculateLobePdfs(const SurfaceParameters& surface,
+                           float& pSpecular, float& pDiffuse, float& pClearcoat, float& pSpecTrans)
     {
         float metallicBRDF   = surface.metallic;
         float specularBSDF   = (1.0f - surface.metallic) * surface.specTrans;
@@ -44,7 +44,7 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    static float ThinTransmissionRoughness(float ior, float roughness)
+    float ThinTransmissionRoughness(float ior, float roughness)
     {
         // -- Disney scales by (.65 * eta - .35) based on figure 15 of the 2015 PBR course notes. Based on their figure the results
         // -- match a geometrically thin solid fairly well but it is odd to me that roughness is decreased until an IOR of just
@@ -53,7 +53,7 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    static void CalculateAnisotropicParams(float roughness, float anisotropic, float& ax, float& ay)
+    void CalculateAnisotropicParams(float roughness, float anisotropic, float& ax, float& ay)
     {
         float aspect = Sqrtf(1.0f - 0.9f * anisotropic);
         ax = Max(0.001f, Square(roughness) / aspect);
@@ -61,7 +61,7 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    static float3 CalculateTint(float3 baseColor)
+    float3 CalculateTint(float3 baseColor)
     {
         // -- The color tint is never mentioned in the SIGGRAPH presentations as far as I recall but it was done in the BRDF
         // -- Explorer so I'll replicate that here.
@@ -18,4 +18,11 @@ namespace Selas
 
     // -- Shaders
     bool SampleDisney(CSampler* sampler, const SurfaceParameters& surface, float3 v, bool thin, BsdfSample& sample);
+
+    // -- Per-surface lobe terms shared with the 8-wide evaluation in DisneySimd.cpp
+    void CalculateLobePdfs(const SurfaceParameters& surface,
+                           float& pSpecular, float& pDiffuse, float& pClearcoat, float& pSpecTrans);
+    float ThinTransmissionRoughness(float ior, float roughness);
+    void CalculateAnisotropicParams(float roughness, float anisotropic, float& ax, float& ay);
+    float3 CalculateTint(float3 baseColor);
 }
\ No newline at end of file
@@ -0,0 +1,420 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "Shading/DisneySimd.h"
+#include "Shading/Disney.h"
+#include "Shading/SurfaceParameters.h"
+
+#include "Shading/Fresnel.h"
+#include "MathLib/FloatFuncs.h"
+#include "MathLib/Trigonometric.h"
+#include "SystemLib/JsAssert.h"
+#include "SystemLib/CountOf.h"
+#include "SystemLib/MinMax.h"
+
+#if DisneySimdAvailable_
+    #include <immintrin.h>
+#endif
+
+namespace Selas
+{
+    using namespace Math;
+
+    //=============================================================================================================================
+    void DisneySurface8_Load(const SurfaceParameters* const* surfaces, uint count, DisneySurface8* soa)
+    {
+        Assert_(count > 0 && count <= DisneySimdWidth_);
+
+        soa->count = (uint32)count;
+
+        for(uint lane = 0; lane < DisneySimdWidth_; ++lane) {
+            const SurfaceParameters& surface = *surfaces[Min<uint>(lane, count - 1)];
+            Assert_(surface.shader == eDisneyThin || surface.shader == eDisneySolid);
+
+            bool thin = surface.shader == eDisneyThin;
+
+            soa->surfaces[lane] = &surface;
+
+            const float3* rows[] = { &surface.worldToTangent.r0, &surface.worldToTangent.r1, &surface.worldToTangent.r2 };
+            for(uint row = 0; row < 3; ++row) {
+                soa->worldToTangent[row * 3 + 0][lane] = rows[row]->x;
+                soa->worldToTangent[row * 3 + 1][lane] = rows[row]->y;
+                soa->worldToTangent[row * 3 + 2][lane] = rows[row]->z;
+            }
+
+            float3 tint = CalculateTint(surface.baseColor);
+            float3 transmissionColor = thin ? Sqrt(surface.baseColor) : surface.baseColor;
+            float3 sheenColor = surface.sheen > 0.0f ? surface.sheen * Lerp(float3(1.0f), tint, surface.sheenTint)
+                                                     : float3::Zero_;
+
+            // -- Same as DisneyFresnel in Disney.cpp
+            float3 R0 = Fresnel::SchlickR0FromRelativeIOR(surface.relativeIOR) * Lerp(float3(1.0f), tint, surface.specularTint);
+                   R0 = Lerp(R0, surface.baseColor, surface.metallic);
+
+            const float3* colors[] = { &surface.baseColor, &transmissionColor, &sheenColor, &R0 };
+            float (*targets[])[DisneySimdWidth_] = { soa->baseColor, soa->transmissionColor, soa->sheenColor, soa->specularR0 };
+            for(uint scan = 0; scan < CountOf_(colors); ++scan) {
+                targets[scan][0][lane] = colors[scan]->x;
+                targets[scan][1][lane] = colors[scan]->y;
+                targets[scan][2][lane] = colors[scan]->z;
+            }
+
+            soa->metallic[lane]         = surface.metallic;
+            soa->ior[lane]              = surface.ior;
+            soa->relativeIOR[lane]      = surface.relativeIOR;
+            soa->roughnessSquared[lane] = surface.roughness * surface.roughness;
+            soa->flatness[lane]         = thin ? surface.flatness : 0.0f;
+
+            CalculateAnisotropicParams(surface.roughness, surface.anisotropic, soa->ax[lane], soa->ay[lane]);
+
+            float rscaled = thin ? ThinTransmissionRoughness(surface.ior, surface.roughness) : surface.roughness;
+            CalculateAnisotropicParams(rscaled, surface.anisotropic, soa->transmissionAx[lane], soa->transmissionAy[lane]);
+
+            float alpha = Lerp(0.1f, 0.001f, surface.clearcoatGloss);
+            float a2 = alpha * alpha;
+            soa->clearcoat[lane]      = surface.clearcoat;
+            soa->clearcoatScale[lane] = alpha >= 1.0f ? InvPi_ : (a2 - 1.0f) / (Pi_ * Log2(a2));
+            soa->clearcoatA2m1[lane]  = alpha >= 1.0f ? 0.0f : a2 - 1.0f;
+
+            soa->diffuseWeight[lane]      = (1.0f - surface.metallic) * (1.0f - surface.specTrans);
+            soa->transmissionWeight[lane] = (1.0f - surface.metallic) * surface.specTrans;
+
+            float pDiffuse;
+            CalculateLobePdfs(surface, soa->pSpecular[lane], pDiffuse, soa->pClearcoat[lane], soa->pSpecTrans[lane]);
+            soa->pDiffuse[lane] = pDiffuse * (1.0f - surface.diffTrans);
+        }
+    }
+
+    #if DisneySimdAvailable_
+
+    typedef __m256 float8;
+
+    struct float8x3
+    {
+        float8 x;
+        float8 y;
+        float8 z;
+    };
+
+    //=============================================================================================================================
+    static ForceInline_ float8 Set8(float value)                     { return _mm256_set1_ps(value); }
+    static ForceInline_ float8 Load8(const float* values)            { return _mm256_load_ps(values); }
+    static ForceInline_ float8 Add8(float8 a, float8 b)              { return _mm256_add_ps(a, b); }
+    static ForceInline_ float8 Sub8(float8 a, float8 b)              { return _mm256_sub_ps(a, b); }
+    static ForceInline_ float8 Mul8(float8 a, float8 b)              { return _mm256_mul_ps(a, b); }
+    static ForceInline_ float8 Div8(float8 a, float8 b)              { return _mm256_div_ps(a, b); }
+    // -- Kept as a separate multiply and add since vectorextensions "AVX2" does not enable FMA for gcc and clang
+    static ForceInline_ float8 Madd8(float8 a, float8 b, float8 c)   { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+    static ForceInline_ float8 Sqrt8(float8 a)                       { return _mm256_sqrt_ps(a); }
+    static ForceInline_ float8 Min8(float8 a, float8 b)              { return _mm256_min_ps(a, b); }
+    static ForceInline_ float8 Max8(float8 a, float8 b)              { return _mm256_max_ps(a, b); }
+    static ForceInline_ float8 Abs8(float8 a)                        { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static ForceInline_ float8 Square8(float8 a)                     { return _mm256_mul_ps(a, a); }
+    static ForceInline_ float8 Greater8(float8 a, float8 b)          { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static ForceInline_ float8 GreaterEqual8(float8 a, float8 b)     { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static ForceInline_ float8 Less8(float8 a, float8 b)             { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static ForceInline_ float8 And8(float8 a, float8 b)              { return _mm256_and_ps(a, b); }
+    // -- Lanes where mask is clear become 0. Unlike a multiply this also clears the NaNs and infs of inactive lanes.
+    static ForceInline_ float8 Mask8(float8 mask, float8 a)          { return _mm256_and_ps(mask, a); }
+    static ForceInline_ float8 Select8(float8 mask, float8 a, float8 b) { return _mm256_blendv_ps(b, a, mask); }
+
+    //=============================================================================================================================
+    static ForceInline_ float8 Dot8(const float8x3& a, const float8x3& b)
+    {
+        return Madd8(a.x, b.x, Madd8(a.y, b.y, Mul8(a.z, b.z)));
+    }
+
+    //=============================================================================================================================
+    static ForceInline_ float8x3 Normalize8(const float8x3& a)
+    {
+        float8 invLength = Div8(Set8(1.0f), Sqrt8(Dot8(a, a)));
+
+        float8x3 result = { Mul8(a.x, invLength), Mul8(a.y, invLength), Mul8(a.z, invLength) };
+        return result;
+    }
+
+    //=============================================================================================================================
+    static ForceInline_ float8x3 ToTangent8(const DisneySurface8* soa, const float8x3& w)
+    {
+        float8x3 result;
+        result.x = Madd8(w.x, Load8(soa->worldToTangent[0]), Madd8(w.y, Load8(soa->worldToTangent[3]),
+                                                                   Mul8(w.z, Load8(soa->worldToTangent[6]))));
+        result.y = Madd8(w.x, Load8(soa->worldToTangent[1]), Madd8(w.y, Load8(soa->worldToTangent[4]),
+                                                                   Mul8(w.z, Load8(soa->worldToTangent[7]))));
+        result.z = Madd8(w.x, Load8(soa->worldToTangent[2]), Madd8(w.y, Load8(soa->worldToTangent[5]),
+                                                                   Mul8(w.z, Load8(soa->worldToTangent[8]))));
+        return result;
+    }
+
+    //=============================================================================================================================
+    static ForceInline_ float8 SchlickWeight8(float8 u)
+    {
+        float8 m = Min8(Max8(Sub8(Set8(1.0f), u), Set8(0.0f)), Set8(1.0f));
+        float8 m2 = Mul8(m, m);
+        return Mul8(m, Mul8(m2, m2));
+    }
+
+    //=============================================================================================================================
+    // -- Fresnel::Dielectric with ni = 1 and the swap for rays leaving the surface done with blends.
+    static float8 Dielectric8(float8 cosThetaI, float8 ior)
+    {
+        float8 one = Set8(1.0f);
+
+        cosThetaI = Min8(Max8(cosThetaI, Set8(-1.0f)), one);
+
+        float8 exiting = Less8(cosThetaI, Set8(0.0f));
+        float8 ni = Select8(exiting, ior, one);
+        float8 nt = Select8(exiting, one, ior);
+        cosThetaI = Abs8(cosThetaI);
+
+        float8 sinThetaI = Sqrt8(Max8(Set8(0.0f), Sub8(one, Square8(cosThetaI))));
+        float8 sinThetaT = Mul8(Div8(ni, nt), sinThetaI);
+        float8 totalInternalReflection = GreaterEqual8(sinThetaT, one);
+
+        float8 cosThetaT = Sqrt8(Max8(Set8(0.0f), Sub8(one, Square8(sinThetaT))));
+
+        float8 ntCosI = Mul8(nt, cosThetaI);
+        float8 niCosT = Mul8(ni, cosThetaT);
+        float8 niCosI = Mul8(ni, cosThetaI);
+        float8 ntCosT = Mul8(nt, cosThetaT);
+
+        float8 rParallel      = Div8(Sub8(ntCosI, niCosT), Add8(ntCosI, niCosT));
+        float8 rPerpendicular = Div8(Sub8(niCosI, ntCosT), Add8(niCosI, ntCosT));
+        float8 fresnel = Mul8(Set8(0.5f), Add8(Square8(rParallel), Square8(rPerpendicular)));
+
+        return Select8(totalInternalReflection, one, fresnel);
+    }
+
+    //=============================================================================================================================
+    static ForceInline_ float8 GgxAnisotropicD8(const float8x3& wm, float8 ax, float8 ay)
+    {
+        float8 sum = Add8(Add8(Div8(Square8(wm.x), Square8(ax)), Div8(Square8(wm.z), Square8(ay))), Square8(wm.y));
+        return Div8(Set8(1.0f), Mul8(Mul8(Set8(Pi_), Mul8(ax, ay)), Square8(sum)));
+    }
+
+    //=============================================================================================================================
+    // -- Bsdf::SeparableSmithGGXG1 with tan^2(theta) * (cos^2(phi) ax^2 + sin^2(phi) ay^2) written out in cartesian terms.
+    // -- Grazing directions divide by zero, push lambda to infinity and return 0 like the IsInf check of the scalar version.
+    static ForceInline_ float8 SeparableSmithGGXG1_8(const float8x3& w, float8 ax, float8 ay)
+    {
+        float8 a2Tan2Theta = Div8(Madd8(Square8(w.x), Square8(ax), Mul8(Square8(w.z), Square8(ay))), Square8(w.y));
+        float8 lambda = Mul8(Set8(0.5f), Sub8(Sqrt8(Add8(Set8(1.0f), a2Tan2Theta)), Set8(1.0f)));
+        return Div8(Set8(1.0f), Add8(Set8(1.0f), lambda));
+    }
+
+    //=============================================================================================================================
+    // -- Bsdf::SeparableSmithGGXG1(w, 0.25f) used by the clearcoat lobe
+    static ForceInline_ float8 ClearcoatG1_8(const float8x3& w)
+    {
+        float a2 = 0.25f * 0.25f;
+        return Div8(Set8(2.0f), Add8(Set8(1.0f), Sqrt8(Madd8(Set8(1.0f - a2), Square8(w.y), Set8(a2)))));
+    }
+
+    //=============================================================================================================================
+    void EvaluateDisney8(const DisneySurface8* soa, const float3* v, const float3* l, float3* reflectance, float* forwardPdf,
+                         float* reversePdf)
+    {
+        Align_(32) float lanes[6][DisneySimdWidth_];
+        for(uint lane = 0; lane < DisneySimdWidth_; ++lane) {
+            uint source = Min<uint>(lane, soa->count - 1);
+            lanes[0][lane] = v[source].x;
+            lanes[1][lane] = v[source].y;
+            lanes[2][lane] = v[source].z;
+            lanes[3][lane] = l[source].x;
+            lanes[4][lane] = l[source].y;
+            lanes[5][lane] = l[source].z;
+        }
+
+        float8 zero = Set8(0.0f);
+        float8 one = Set8(1.0f);
+
+        float8x3 worldV = { Load8(lanes[0]), Load8(lanes[1]), Load8(lanes[2]) };
+        float8x3 worldL = { Load8(lanes[3]), Load8(lanes[4]), Load8(lanes[5]) };
+
+        float8x3 wo = Normalize8(ToTangent8(soa, worldV));
+        float8x3 wi = Normalize8(ToTangent8(soa, worldL));
+        float8x3 sum = { Add8(wo.x, wi.x), Add8(wo.y, wi.y), Add8(wo.z, wi.z) };
+        float8x3 wm = Normalize8(sum);
+
+        float8 dotNV = wo.y;
+        float8 dotNL = wi.y;
+        float8 absDotNV = Abs8(dotNV);
+        float8 absDotNL = Abs8(dotNL);
+        float8 dotHL = Dot8(wm, wi);
+        float8 dotHV = Dot8(wm, wo);
+        float8 absDotHL = Abs8(dotHL);
+        float8 absDotHV = Abs8(dotHV);
+
+        float8 upperHemisphere = And8(Greater8(dotNL, zero), Greater8(dotNV, zero));
+
+        float8 baseColorR = Load8(soa->baseColor[0]);
+        float8 baseColorG = Load8(soa->baseColor[1]);
+        float8 baseColorB = Load8(soa->baseColor[2]);
+
+        float8 reflectanceR = zero;
+        float8 reflectanceG = zero;
+        float8 reflectanceB = zero;
+        float8 fPdf = zero;
+        float8 rPdf = zero;
+
+        // -- Clearcoat
+        {
+            float8 clearcoat = Load8(soa->clearcoat);
+            float8 mask = And8(upperHemisphere, Greater8(clearcoat, zero));
+
+            float8 d = Div8(Load8(soa->clearcoatScale), Madd8(Load8(soa->clearcoatA2m1), Square8(wm.y), one));
+            float8 f = Madd8(Set8(0.04f), SchlickWeight8(dotHL), Set8(0.96f));
+            float8 gl = ClearcoatG1_8(wi);
+            float8 gv = ClearcoatG1_8(wo);
+
+            float8 value = Mask8(mask, Mul8(Mul8(Mul8(Set8(0.25f), clearcoat), Mul8(d, f)), Mul8(gl, gv)));
+            reflectanceR = Add8(reflectanceR, value);
+            reflectanceG = Add8(reflectanceG, value);
+            reflectanceB = Add8(reflectanceB, value);
+
+            float8 pClearcoat = Load8(soa->pClearcoat);
+            fPdf = Add8(fPdf, Mask8(mask, Div8(Mul8(pClearcoat, d), Mul8(Set8(4.0f), absDotHV))));
+            rPdf = Add8(rPdf, Mask8(mask, Div8(Mul8(pClearcoat, d), Mul8(Set8(4.0f), absDotHL))));
+        }
+
+        // -- Diffuse and sheen
+        {
+            float8 diffuseWeight = Load8(soa->diffuseWeight);
+            float8 mask = Greater8(diffuseWeight, zero);
+
+            float8 fl = SchlickWeight8(absDotNL);
+            float8 fv = SchlickWeight8(absDotNV);
+            float8 roughness = Load8(soa->roughnessSquared);
+
+            // -- Hanrahan-Krueger subsurface approximation for thin surfaces
+            float8 flatness = Load8(soa->flatness);
+            float8 fss90 = Mul8(Square8(dotHL), roughness);
+            float8 fss = Mul8(Madd8(fl, Sub8(fss90, one), one), Madd8(fv, Sub8(fss90, one), one));
+            float8 ss = Mul8(Set8(1.25f), Madd8(fss, Sub8(Div8(one, Add8(absDotNL, absDotNV)), Set8(0.5f)), Set8(0.5f)));
+            float8 hanrahanKrueger = Mask8(Greater8(flatness, zero), ss);
+
+            float8 rr = Madd8(Mul8(Set8(2.0f), Square8(absDotNL)), roughness, Set8(0.5f));
+            float8 retro = Mul8(rr, Add8(Add8(fl, fv), Mul8(Mul8(fl, fv), Sub8(rr, one))));
+
+            float8 subsurfaceApprox = Madd8(flatness, hanrahanKrueger, Sub8(one, flatness));
+            float8 halfFl = Madd8(Set8(-0.5f), fl, one);
+            float8 halfFv = Madd8(Set8(-0.5f), fv, one);
+            float8 diffuse = Mul8(Set8(InvPi_), Madd8(subsurfaceApprox, Mul8(halfFl, halfFv), retro));
+
+            float8 sheen = SchlickWeight8(absDotHL);
+
+            float8 weight = Mask8(mask, diffuseWeight);
+            reflectanceR = Madd8(weight, Madd8(diffuse, baseColorR, Mul8(sheen, Load8(soa->sheenColor[0]))), reflectanceR);
+            reflectanceG = Madd8(weight, Madd8(diffuse, baseColorG, Mul8(sheen, Load8(soa->sheenColor[1]))), reflectanceG);
+            reflectanceB = Madd8(weight, Madd8(diffuse, baseColorB, Mul8(sheen, Load8(soa->sheenColor[2]))), reflectanceB);
+
+            float8 pDiffuse = Mask8(mask, Load8(soa->pDiffuse));
+            fPdf = Madd8(pDiffuse, absDotNL, fPdf);
+            rPdf = Madd8(pDiffuse, absDotNV, rPdf);
+        }
+
+        // -- Transmission
+        {
+            float8 transmissionWeight = Load8(soa->transmissionWeight);
+            float8 mask = Greater8(transmissionWeight, zero);
+
+            float8 tax = Load8(soa->transmissionAx);
+            float8 tay = Load8(soa->transmissionAy);
+            float8 relativeIor = Load8(soa->relativeIOR);
+
+            float8 d = GgxAnisotropicD8(wm, tax, tay);
+            float8 gl = SeparableSmithGGXG1_8(wi, tax, tay);
+            float8 gv = SeparableSmithGGXG1_8(wo, tax, tay);
+            float8 f = Dielectric8(dotHV, Load8(soa->ior));
+
+            float8 forwardDenominator = Square8(Madd8(relativeIor, dotHV, dotHL));
+            float8 reverseDenominator = Square8(Madd8(relativeIor, dotHL, dotHV));
+
+            float8 c = Div8(Mul8(absDotHL, absDotHV), Mul8(absDotNL, absDotNV));
+            float8 t = Div8(Square8(relativeIor), forwardDenominator);
+            float8 value = Mul8(Mul8(Mul8(c, t), Sub8(one, f)), Mul8(Mul8(gl, gv), d));
+            value = Mask8(mask, Mul8(transmissionWeight, value));
+
+            reflectanceR = Madd8(value, Load8(soa->transmissionColor[0]), reflectanceR);
+            reflectanceG = Madd8(value, Load8(soa->transmissionColor[1]), reflectanceG);
+            reflectanceB = Madd8(value, Load8(soa->transmissionColor[2]), reflectanceB);
+
+            float8 forward = Div8(Mul8(Mul8(gv, absDotHL), d), absDotNL);
+            float8 reverse = Div8(Mul8(Mul8(gl, absDotHV), d), absDotNV);
+
+            float8 pSpecTrans = Load8(soa->pSpecTrans);
+            fPdf = Add8(fPdf, Mask8(mask, Div8(Mul8(pSpecTrans, forward), forwardDenominator)));
+            rPdf = Add8(rPdf, Mask8(mask, Div8(Mul8(pSpecTrans, reverse), reverseDenominator)));
+        }
+
+        // -- Specular
+        {
+            float8 ax = Load8(soa->ax);
+            float8 ay = Load8(soa->ay);
+
+            float8 d = GgxAnisotropicD8(wm, ax, ay);
+            float8 gl = SeparableSmithGGXG1_8(wi, ax, ay);
+            float8 gv = SeparableSmithGGXG1_8(wo, ax, ay);
+
+            float8 metallic = Load8(soa->metallic);
+            float8 dielectric = Mul8(Sub8(one, metallic), Dielectric8(dotHV, Load8(soa->ior)));
+
+            float8 m = Sub8(one, dotHL);
+            float8 m2 = Mul8(m, m);
+            float8 schlick = Mul8(m, Mul8(m2, m2));
+
+            float8 scale = Div8(Mul8(Mul8(d, gl), gv), Mul8(Set8(4.0f), Mul8(dotNL, dotNV)));
+            scale = Mask8(upperHemisphere, scale);
+
+            float8 r0R = Load8(soa->specularR0[0]);
+            float8 r0G = Load8(soa->specularR0[1]);
+            float8 r0B = Load8(soa->specularR0[2]);
+            float8 fresnelR = Madd8(metallic, Madd8(Sub8(one, r0R), schlick, r0R), dielectric);
+            float8 fresnelG = Madd8(metallic, Madd8(Sub8(one, r0G), schlick, r0G), dielectric);
+            float8 fresnelB = Madd8(metallic, Madd8(Sub8(one, r0B), schlick, r0B), dielectric);
+
+            reflectanceR = Madd8(scale, fresnelR, reflectanceR);
+            reflectanceG = Madd8(scale, fresnelG, reflectanceG);
+            reflectanceB = Madd8(scale, fresnelB, reflectanceB);
+
+            // -- The 1 / (4 |dot(w, wm)|) jacobian is applied twice to match EvaluateDisney.
+            float8 forwardJacobian = Square8(Mul8(Set8(4.0f), absDotHV));
+            float8 reverseJacobian = Square8(Mul8(Set8(4.0f), absDotHL));
+            float8 forward = Div8(Mul8(Mul8(gv, absDotHL), d), Mul8(absDotNL, forwardJacobian));
+            float8 reverse = Div8(Mul8(Mul8(gl, absDotHV), d), Mul8(absDotNV, reverseJacobian));
+
+            float8 pSpecular = Load8(soa->pSpecular);
+            fPdf = Add8(fPdf, Mask8(upperHemisphere, Mul8(pSpecular, forward)));
+            rPdf = Add8(rPdf, Mask8(upperHemisphere, Mul8(pSpecular, reverse)));
+        }
+
+        Align_(32) float results[5][DisneySimdWidth_];
+        _mm256_store_ps(results[0], Mul8(reflectanceR, absDotNL));
+        _mm256_store_ps(results[1], Mul8(reflectanceG, absDotNL));
+        _mm256_store_ps(results[2], Mul8(reflectanceB, absDotNL));
+        _mm256_store_ps(results[3], fPdf);
+        _mm256_store_ps(results[4], rPdf);
+
+        for(uint lane = 0; lane < soa->count; ++lane) {
+            reflectance[lane] = float3(results[0][lane], results[1][lane], results[2][lane]);
+            forwardPdf[lane] = results[3][lane];
+            reversePdf[lane] = results[4][lane];
+        }
+    }
+
+    #else
+
+    //=============================================================================================================================
+    void EvaluateDisney8(const DisneySurface8* soa, const float3* v, const float3* l, float3* reflectance, float* forwardPdf,
+                         float* reversePdf)
+    {
+        for(uint lane = 0; lane < soa->count; ++lane) {
+            const SurfaceParameters& surface = *soa->surfaces[lane];
+            reflectance[lane] = EvaluateDisney(surface, v[lane], l[lane], surface.shader == eDisneyThin, forwardPdf[lane],
+                                               reversePdf[lane]);
+        }
+    }
+
+    #endif
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "MathLib/FloatStructs.h"
+#include "SystemLib/BasicTypes.h"
+
+// -- The 8-wide path needs the compiler to target AVX2 (see vectorextensions in the Selas premake4.lua). Without it
+// -- EvaluateDisney8 loops over the lanes with the scalar EvaluateDisney so callers do not need to special case it.
+#if defined(__AVX2__)
+    #define DisneySimdAvailable_ 1
+#else
+    #define DisneySimdAvailable_ 0
+#endif
+
+#define DisneySimdWidth_ 8
+
+namespace Selas
+{
+    struct SurfaceParameters;
+
+    // -- Structure of arrays layout of up to 8 Disney surfaces. Everything that only depends on the material (lobe weights,
+    // -- anisotropic roughness, fresnel and tint colors) is computed once by DisneySurface8_Load so the evaluation only does
+    // -- the direction dependent math.
+    struct DisneySurface8
+    {
+        Align_(32) float worldToTangent[9][DisneySimdWidth_];
+
+        Align_(32) float baseColor[3][DisneySimdWidth_];
+        Align_(32) float transmissionColor[3][DisneySimdWidth_];
+        Align_(32) float sheenColor[3][DisneySimdWidth_];
+        Align_(32) float specularR0[3][DisneySimdWidth_];
+
+        Align_(32) float metallic[DisneySimdWidth_];
+        Align_(32) float ior[DisneySimdWidth_];
+        Align_(32) float relativeIOR[DisneySimdWidth_];
+        Align_(32) float roughnessSquared[DisneySimdWidth_];
+        Align_(32) float flatness[DisneySimdWidth_];
+        Align_(32) float ax[DisneySimdWidth_];
+        Align_(32) float ay[DisneySimdWidth_];
+        Align_(32) float transmissionAx[DisneySimdWidth_];
+        Align_(32) float transmissionAy[DisneySimdWidth_];
+
+        // -- GTR1 is written as clearcoatScale / (1 + clearcoatA2m1 * dotNH^2) with the log2 folded into the scale.
+        Align_(32) float clearcoat[DisneySimdWidth_];
+        Align_(32) float clearcoatScale[DisneySimdWidth_];
+        Align_(32) float clearcoatA2m1[DisneySimdWidth_];
+
+        Align_(32) float diffuseWeight[DisneySimdWidth_];
+        Align_(32) float transmissionWeight[DisneySimdWidth_];
+
+        Align_(32) float pSpecular[DisneySimdWidth_];
+        Align_(32) float pDiffuse[DisneySimdWidth_];
+        Align_(32) float pClearcoat[DisneySimdWidth_];
+        Align_(32) float pSpecTrans[DisneySimdWidth_];
+
+        const SurfaceParameters* surfaces[DisneySimdWidth_];
+        uint32 count;
+    };
+
+    // -- All surfaces must use one of the Disney shaders. Lanes past count are padded with the last surface.
+    void DisneySurface8_Load(const SurfaceParameters* const* surfaces, uint count, DisneySurface8* soa);
+
+    // -- Equivalent to calling EvaluateDisney for each lane. v and l are world space and hold soa->count entries.
+    void EvaluateDisney8(const DisneySurface8* soa, const float3* v, const float3* l, float3* reflectance, float* forwardPdf,
+                         float* reversePdf);
+}
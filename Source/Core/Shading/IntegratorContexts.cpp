@@ -5,10 +5,45 @@
 
 #include "Shading/IntegratorContexts.h"
 #include "Shading/SurfaceParameters.h"
+#include "GeometryLib/Camera.h"
 #include "MathLib/FloatFuncs.h"
+#include "MathLib/Trigonometric.h"
+#include "SystemLib/MinMax.h"
 
 namespace Selas
 {
+    //=============================================================================================================================
+    RayCone CameraRayCone(const RayCastCameraSettings* __restrict camera)
+    {
+        RayCone cone;
+        cone.width = 0.0f;
+        cone.spread = Math::Atanf(1.0f / camera->virtualImagePlaneDistance);
+        return cone;
+    }
+
+    //=============================================================================================================================
+    RayCone BounceRayCone(const HitParameters& hit, bool diracEvent, float pdfW)
+    {
+        RayCone cone;
+        cone.width = hit.cone.width;
+        cone.spread = hit.cone.spread;
+
+        if(diracEvent == false && pdfW > 0.0f) {
+            // -- A lobe sampled with density pdfW covers roughly 1 / pdfW steradians. Treat that as a cone of the same solid
+            // -- angle (pi * halfAngle^2) and add its full angle to the spread.
+            float halfAngle = Math::Sqrtf(1.0f / (Math::Pi_ * pdfW));
+            cone.spread = Min<float>(cone.spread + 2.0f * halfAngle, Math::Pi_);
+        }
+
+        return cone;
+    }
+
+    //=============================================================================================================================
+    float RayConeWidth(RayCone cone, float distance)
+    {
+        return cone.width + cone.spread * distance;
+    }
+
     //=============================================================================================================================
     Ray CreateReflectionBounceRay(const SurfaceParameters& surface, const HitParameters& hit, float3 wi, float3 reflectance)
     {
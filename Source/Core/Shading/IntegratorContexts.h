@@ -7,6 +7,7 @@
 #include "SceneLib/ModelResource.h"
 #include "SceneLib/ImageBasedLightResource.h"
 #include "TextureLib/Framebuffer.h"
+#include "TextureLib/PtexFilterCache.h"
 #include "GeometryLib/Camera.h"
 #include "GeometryLib/Ray.h"
 #include "MathLib/Sampler.h"
@@ -37,11 +38,21 @@ namespace Selas
         const RayCastCameraSettings* __restrict camera;
         CSampler                                sampler;
         FramebufferWriter                       frameWriter;
+        PtexFilterCache                         ptexFilters;
         uint                                    maxPathLength;
     };
 
     #define MaxTrackedBounces_ ((1 << 3) - 1)
 
+    //=============================================================================================================================
+    // -- Ray cone used to choose texture mip levels. width is the diameter of the cone where the ray starts (or at the hit point
+    // -- for HitParameters) and spread is the angle in radians by which it widens per unit of distance.
+    struct RayCone
+    {
+        float width;
+        float spread;
+    };
+
     //=============================================================================================================================
     struct HitParameters
     {
@@ -58,8 +69,20 @@ namespace Selas
         uint32 diracScatterOnly :  1;
         uint32 unused           :  2;
         float2 baryCoords;
+        RayCone cone;
+
+        // -- Identify the material and base color texture of the hit so batches can be shaded in coherent groups.
+        uint64 materialKey;
+        uint32 textureKey;
     };
 
+    // -- Cone of a primary ray. The spread is the angle subtended by one pixel.
+    RayCone CameraRayCone(const RayCastCameraSettings* __restrict camera);
+    // -- Cone of the ray leaving the surface of hit in a direction sampled with the given pdf. Dirac events keep the incoming
+    // -- spread, other events widen the cone to the solid angle the pdf covers.
+    RayCone BounceRayCone(const HitParameters& hit, bool diracEvent, float pdfW);
+    float RayConeWidth(RayCone cone, float distance);
+
     // -- generation of differential rays
     Ray CreateReflectionBounceRay(const SurfaceParameters& surface, const HitParameters& hit, float3 wi, float3 reflectance);
     Ray CreateRefractionBounceRay(const SurfaceParameters& surface, const HitParameters& hit, float3 wi, float3 reflectance, float iorRatio);
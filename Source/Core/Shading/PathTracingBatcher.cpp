@@ -5,18 +5,21 @@
 
 #include "Shading/PathTracingBatcher.h"
 #include "UtilityLib/QuickSort.h"
+#include "UtilityLib/RadixSort.h"
 #include "StringLib/FixedString.h"
 #include "StringLib/StringUtil.h"
 #include "MathLib/Trigonometric.h"
 #include "MathLib/FloatFuncs.h"
+#include "IoLib/MemoryMappedFile.h"
 #include "IoLib/Directory.h"
 #include "IoLib/Environment.h"
+#include "IoLib/File.h"
 #include "SystemLib/Atomic.h"
+#include "SystemLib/Memory.h"
 #include "SystemLib/OSThreading.h"
 #include "SystemLib/MinMax.h"
-
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#include "SystemLib/SystemTime.h"
+#include "SystemLib/MemoryAllocation.h"
 
 namespace Selas
 {
@@ -56,27 +59,21 @@ namespace Selas
     struct DeferredBatch
     {
         DeferredBatch()
-            : fileHandle(INVALID_HANDLE_VALUE)
-            , mappingHandle(INVALID_HANDLE_VALUE)
+            : rays(nullptr)
         {
 
         }
 
         ~DeferredBatch()
         {
-            if(fileHandle != INVALID_HANDLE_VALUE) {
-                UnmapViewOfFile(rays);
-                CloseHandle(fileHandle);
-                CloseHandle(mappingHandle);
-            }
+            MemoryMappedFile_Close(&mapping);
         }
 
         volatile int64 batchHead;
         volatile int64 batchTail;
         int64 batchIndex;
         RayBatchCategory category;
-        HANDLE fileHandle;
-        HANDLE mappingHandle;
+        MemoryMappedFile mapping;
         DeferredRay* rays;
     };
 
@@ -84,54 +81,41 @@ namespace Selas
     struct OcclusionBatch
     {
         OcclusionBatch()
-            : fileHandle(INVALID_HANDLE_VALUE)
-            , mappingHandle(INVALID_HANDLE_VALUE)
+            : rays(nullptr)
         {
 
         }
 
         ~OcclusionBatch()
         {
-            if(fileHandle != INVALID_HANDLE_VALUE) {
-                UnmapViewOfFile(rays);
-                CloseHandle(fileHandle);
-                CloseHandle(mappingHandle);
-            }
+            MemoryMappedFile_Close(&mapping);
         }
 
         volatile int64 batchHead;
         volatile int64 batchTail;
         int64 batchIndex;
         RayBatchCategory category;
-        HANDLE fileHandle;
-        HANDLE mappingHandle;
+        MemoryMappedFile mapping;
         OcclusionRay* rays;
     };
 
     struct HitBatch
     {
         HitBatch()
-            : fileHandle(INVALID_HANDLE_VALUE)
-            , mappingHandle(INVALID_HANDLE_VALUE)
+            : hits(nullptr)
         {
 
         }
 
         ~HitBatch()
         {
-            if(fileHandle != INVALID_HANDLE_VALUE) {
-                UnmapViewOfFile(hits);
-                CloseHandle(fileHandle);
-                CloseHandle(mappingHandle);
-            }
+            MemoryMappedFile_Close(&mapping);
         }
 
         volatile int64 batchHead;
         volatile int64 batchTail;
-
         int64 batchIndex;
-        HANDLE fileHandle;
-        HANDLE mappingHandle;
+        MemoryMappedFile mapping;
         HitParameters* hits;
     };
 
@@ -209,43 +193,225 @@ namespace Selas
     }
 
     //=================================================================================================================================
-    static bool operator<(const HitParameters& lhs, const HitParameters& rhs)
+    // -- Spreads the low 16 bits of v so there are two zero bits between each of them
+    static uint64 SpreadBits3(uint64 v)
+    {
+        v &= 0xFFFF;
+        v = (v | (v << 16)) & 0x0000FF0000FF;
+        v = (v | (v << 8))  & 0x00F00F00F00F;
+        v = (v | (v << 4))  & 0x0C30C30C30C3;
+        v = (v | (v << 2))  & 0x249249249249;
+        return v;
+    }
+
+    //=================================================================================================================================
+    static uint64 QuantizeAxis(float value, float min, float invExtent)
+    {
+        float t = Saturate((value - min) * invExtent);
+        return (uint64)(t * 65535.0f);
+    }
+
+    //=================================================================================================================================
+    static uint64 OctahedralDirectionBin(float3 d)
+    {
+        float invL1 = 1.0f / (Math::Absf(d.x) + Math::Absf(d.y) + Math::Absf(d.z));
+        float u = d.x * invL1;
+        float v = d.y * invL1;
+        if(d.z < 0.0f) {
+            float fu = (1.0f - Math::Absf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+            float fv = (1.0f - Math::Absf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+            u = fu;
+            v = fv;
+        }
+
+        uint64 ub = (uint64)(Saturate(u * 0.5f + 0.5f) * 255.0f);
+        uint64 vb = (uint64)(Saturate(v * 0.5f + 0.5f) * 255.0f);
+        return (ub << 8) | vb;
+    }
+
+    //=================================================================================================================================
+    // -- 48 bits of origin Morton order within the scene bounds followed by 16 bits of octahedral direction
+    template<typename Type_>
+    static void SortRaysMortonRadix(Type_* rays, uint count, const AxisAlignedBox& bounds, uint threadCount)
+    {
+        if(count < 2) {
+            return;
+        }
+
+        float3 extent = bounds.max - bounds.min;
+        float3 invExtent = float3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                                  extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                                  extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+        uint64* keys = AllocArray_(uint64, 2 * count);
+        uint32* indices = AllocArray_(uint32, 2 * count);
+
+        for(uint scan = 0; scan < count; ++scan) {
+            const Ray& ray = rays[scan].ray;
+
+            uint64 morton = (SpreadBits3(QuantizeAxis(ray.origin.x, bounds.min.x, invExtent.x)) << 2)
+                          | (SpreadBits3(QuantizeAxis(ray.origin.y, bounds.min.y, invExtent.y)) << 1)
+                          | (SpreadBits3(QuantizeAxis(ray.origin.z, bounds.min.z, invExtent.z)));
+
+            keys[scan] = (morton << 16) | OctahedralDirectionBin(ray.direction);
+            indices[scan] = (uint32)scan;
+        }
+
+        RadixSort64(keys, indices, keys + count, indices + count, count, threadCount);
+
+        Type_* sorted = AllocArray_(Type_, count);
+        for(uint scan = 0; scan < count; ++scan) {
+            sorted[scan] = rays[indices[scan]];
+        }
+        Memory::Copy(rays, sorted, count * sizeof(Type_));
+
+        Free_(sorted);
+        Free_(indices);
+        Free_(keys);
+    }
+
+    //=================================================================================================================================
+    // -- Lexicographic ordering on (instance, geometry, material, texture, primitive) so hits that share shading state and
+    // -- texture data end up adjacent.
+    static int32 CompareHits(const HitParameters& lhs, const HitParameters& rhs)
     {
         for(uint scan = 0; scan < MaxInstanceLevelCount_; ++scan) {
-            if(lhs.instId[scan] < rhs.instId[scan]) {
-                return true;
+            if(lhs.instId[scan] != rhs.instId[scan]) {
+                return lhs.instId[scan] < rhs.instId[scan] ? -1 : 1;
             }
         }
-        
-        if(lhs.geomId < rhs.geomId) {
-            return true;
+
+        if(lhs.geomId != rhs.geomId) {
+            return lhs.geomId < rhs.geomId ? -1 : 1;
+        }
+
+        if(lhs.materialKey != rhs.materialKey) {
+            return lhs.materialKey < rhs.materialKey ? -1 : 1;
+        }
+
+        if(lhs.textureKey != rhs.textureKey) {
+            return lhs.textureKey < rhs.textureKey ? -1 : 1;
         }
 
-        if(lhs.primId < rhs.primId) {
-            return true;
+        if(lhs.primId != rhs.primId) {
+            return lhs.primId < rhs.primId ? -1 : 1;
         }
 
-        return false;
+        return 0;
+    }
+
+    //=================================================================================================================================
+    static bool operator<(const HitParameters& lhs, const HitParameters& rhs)
+    {
+        return CompareHits(lhs, rhs) < 0;
     }
 
     //=================================================================================================================================
     static bool operator>(const HitParameters& lhs, const HitParameters& rhs)
     {
-        for(uint scan = 0; scan < MaxInstanceLevelCount_; ++scan) {
-            if(lhs.instId[scan] > rhs.instId[scan]) {
-                return true;
-            }
+        return CompareHits(lhs, rhs) > 0;
+    }
+
+    //=================================================================================================================================
+    static bool IsDiskBacked(RaySpillMode spillMode)
+    {
+        return spillMode == eSpillToDisk || spillMode == eSpillToDiskInPlace;
+    }
+
+    //=================================================================================================================================
+    static void* MapBatchMemory(RaySpillMode spillMode, int64 batchIndex, uint64 size, MemoryMappedFile* mapping)
+    {
+        if(IsDiskBacked(spillMode)) {
+            FilePathString path = CreateBatchFilePath(batchIndex);
+            Directory::EnsureDirectoryExists(path.Ascii());
+
+            Error err = MemoryMappedFile_Create(path.Ascii(), size, mapping);
+            Assert_(Successful_(err));
+        }
+        else {
+            Error err = MemoryMappedFile_CreateAnonymous(size, mapping);
+            Assert_(Successful_(err));
         }
 
-        if(lhs.geomId > rhs.geomId) {
-            return true;
+        // -- Batches are filled front to back and consumed front to back
+        MemoryMappedFile_AdviseSequential(mapping);
+
+        return mapping->memory;
+    }
+
+    //=================================================================================================================================
+    static void* LoadBatchMemory(RaySpillMode spillMode, int64 batchIndex, MemoryMappedFile* mapping, uint64* bytesReread)
+    {
+        if(spillMode != eSpillToDisk) {
+            // -- The mapping stays alive until the batch is freed so the rays are consumed directly from it.
+            Assert_(MemoryMappedFile_IsOpen(mapping));
+            return mapping->memory;
+        }
+
+        FilePathString filepath = CreateBatchFilePath(batchIndex);
+
+        void* fileData;
+        uint64 fileSize;
+        Error err = File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize);
+        Assert_(Successful_(err));
+
+        File::Delete(filepath.Ascii());
+
+        *bytesReread = fileSize;
+        return fileData;
+    }
+
+    //=================================================================================================================================
+    static void FreeBatchMemory(RaySpillMode spillMode, int64 batchIndex, void* data, MemoryMappedFile* mapping)
+    {
+        if(spillMode == eSpillToDisk) {
+            FreeAligned_(data);
+            return;
         }
 
-        if(lhs.primId > rhs.primId) {
-            return true;
+        Assert_(mapping->memory == data);
+        MemoryMappedFile_Close(mapping);
+
+        if(spillMode == eSpillToDiskInPlace) {
+            // -- The file can only be removed once the view is unmapped.
+            FilePathString filepath = CreateBatchFilePath(batchIndex);
+            File::Delete(filepath.Ascii());
+        }
+    }
+
+    //=================================================================================================================================
+    template<typename Batch_>
+    static void DeleteBatch(RaySpillMode spillMode, Batch_* batch)
+    {
+        int64 index = batch->batchIndex;
+
+        // -- Closes the mapping first since the file can only be removed once the view is unmapped
+        Delete_(batch);
+
+        if(IsDiskBacked(spillMode)) {
+            // -- Consumed batches already removed their file. Current batches and ready batches that were never claimed
+            // -- still have one.
+            FilePathString filepath = CreateBatchFilePath(index);
+            if(File::Exists(filepath.Ascii())) {
+                File::Delete(filepath.Ascii());
+            }
+        }
+    }
+
+    //=================================================================================================================================
+    template<typename Batch_, typename Type_>
+    static Batch_* RemoveActiveBatch(CArray<Batch_*>& activeBatches, Type_* data, Type_* Batch_::* member)
+    {
+        for(uint scan = 0, count = activeBatches.Count(); scan < count; ++scan) {
+            Batch_* batch = activeBatches[scan];
+            if(batch->*member == data) {
+                activeBatches.RemoveFast(scan);
+                return batch;
+            }
         }
 
-        return false;
+        AssertMsg_(false, "Freeing batch data that was not claimed from this batcher");
+        return nullptr;
     }
 
     //=================================================================================================================================
@@ -258,23 +424,8 @@ namespace Selas
         batch->batchTail = 0;
         batch->category = category;
 
-        FilePathString path = CreateBatchFilePath(batch->batchIndex);
-
-        Directory::EnsureDirectoryExists(path.Ascii());
-
-        batch->fileHandle = CreateFileA(path.Ascii(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, 0, NULL);
-        Assert_(batch->fileHandle != INVALID_HANDLE_VALUE);
-
-        Assert_(rayBatchCapacity * sizeof(DeferredRay) < 0xFFFFFFFF);
-        DWORD size = (DWORD)(rayBatchCapacity * sizeof(DeferredRay));
-
-        batch->mappingHandle = CreateFileMapping(batch->fileHandle, NULL, PAGE_READWRITE, 0, size, NULL);
-        Assert_(batch->mappingHandle != INVALID_HANDLE_VALUE);
-
-        void* memory = MapViewOfFile(batch->mappingHandle, FILE_MAP_WRITE, 0, 0, 0);
-        Assert_(memory != nullptr);
-
-        batch->rays = (DeferredRay*)memory;
+        uint64 size = rayBatchCapacity * sizeof(DeferredRay);
+        batch->rays = (DeferredRay*)MapBatchMemory(spillMode, batch->batchIndex, size, &batch->mapping);
 
         deferredBatches.Add(batch);
 
@@ -294,12 +445,14 @@ namespace Selas
             currentDeferred[batch->category] = AllocateRayBatch(batch->category);
         }
 
-        UnmapViewOfFile((void*)batch->rays);
-        CloseHandle(batch->fileHandle);
-        CloseHandle(batch->mappingHandle);
+        if(IsDiskBacked(spillMode)) {
+            Atomic::AddU64(&bytesSpilled, (uint64)batch->batchTail * sizeof(DeferredRay));
+        }
 
-        batch->fileHandle = INVALID_HANDLE_VALUE;
-        batch->mappingHandle = INVALID_HANDLE_VALUE;
+        if(spillMode == eSpillToDisk) {
+            MemoryMappedFile_Close(&batch->mapping);
+            batch->rays = nullptr;
+        }
 
         readyDeferredBatches.Add(batch);
     }
@@ -307,16 +460,9 @@ namespace Selas
     //=================================================================================================================================
     void PathTracingBatcher::LoadBatch(DeferredBatch* batch)
     {
-        FilePathString filepath = CreateBatchFilePath(batch->batchIndex);
-
-        void* fileData;
-        uint64 fileSize;
-        Error err = File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize);
-        Assert_(Successful_(err));
-
-        DeleteFileA(filepath.Ascii());
-
-        batch->rays = (DeferredRay*)fileData;
+        uint64 reread = 0;
+        batch->rays = (DeferredRay*)LoadBatchMemory(spillMode, batch->batchIndex, &batch->mapping, &reread);
+        Atomic::AddU64(&bytesReread, reread);
     }
 
     //=================================================================================================================================
@@ -329,23 +475,8 @@ namespace Selas
         batch->batchTail = 0;
         batch->category = category;
 
-        FilePathString path = CreateBatchFilePath(batch->batchIndex);
-
-        Directory::EnsureDirectoryExists(path.Ascii());
-
-        batch->fileHandle = CreateFileA(path.Ascii(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, 0, NULL);
-        Assert_(batch->fileHandle != INVALID_HANDLE_VALUE);
-
-        Assert_(rayBatchCapacity * sizeof(OcclusionRay) < 0xFFFFFFFF);
-        DWORD size = (DWORD)(rayBatchCapacity * sizeof(OcclusionRay));
-
-        batch->mappingHandle = CreateFileMapping(batch->fileHandle, NULL, PAGE_READWRITE, 0, size, NULL);
-        Assert_(batch->mappingHandle != INVALID_HANDLE_VALUE);
-
-        void* memory = MapViewOfFile(batch->mappingHandle, FILE_MAP_WRITE, 0, 0, 0);
-        Assert_(memory != nullptr);
-
-        batch->rays = (OcclusionRay*)memory;
+        uint64 size = rayBatchCapacity * sizeof(OcclusionRay);
+        batch->rays = (OcclusionRay*)MapBatchMemory(spillMode, batch->batchIndex, size, &batch->mapping);
 
         occlusionBatches.Add(batch);
 
@@ -365,12 +496,14 @@ namespace Selas
             currentOcclusion[batch->category] = AllocateOcclusionBatch(batch->category);
         }
 
-        UnmapViewOfFile((void*)batch->rays);
-        CloseHandle(batch->fileHandle);
-        CloseHandle(batch->mappingHandle);
+        if(IsDiskBacked(spillMode)) {
+            Atomic::AddU64(&bytesSpilled, (uint64)batch->batchTail * sizeof(OcclusionRay));
+        }
 
-        batch->fileHandle = INVALID_HANDLE_VALUE;
-        batch->mappingHandle = INVALID_HANDLE_VALUE;
+        if(spillMode == eSpillToDisk) {
+            MemoryMappedFile_Close(&batch->mapping);
+            batch->rays = nullptr;
+        }
 
         readyOcclusionBatches.Add(batch);
     }
@@ -378,16 +511,9 @@ namespace Selas
     //=================================================================================================================================
     void PathTracingBatcher::LoadBatch(OcclusionBatch* batch)
     {
-        FilePathString filepath = CreateBatchFilePath(batch->batchIndex);
-
-        void* fileData;
-        uint64 fileSize;
-        Error err = File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize);
-        Assert_(Successful_(err));
-
-        DeleteFileA(filepath.Ascii());
-
-        batch->rays = (OcclusionRay*)fileData;
+        uint64 reread = 0;
+        batch->rays = (OcclusionRay*)LoadBatchMemory(spillMode, batch->batchIndex, &batch->mapping, &reread);
+        Atomic::AddU64(&bytesReread, reread);
     }
 
     //=================================================================================================================================
@@ -399,23 +525,8 @@ namespace Selas
         batch->batchHead = 0;
         batch->batchTail = 0;
 
-        FilePathString path = CreateBatchFilePath(batch->batchIndex);
-
-        Directory::EnsureDirectoryExists(path.Ascii());
-
-        batch->fileHandle = CreateFileA(path.Ascii(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, 0, NULL);
-        Assert_(batch->fileHandle != INVALID_HANDLE_VALUE);
-
-        Assert_(hitBatchCapacity * sizeof(HitParameters) < 0xFFFFFFFF);
-        DWORD size = (DWORD)(hitBatchCapacity * sizeof(HitParameters));
-
-        batch->mappingHandle = CreateFileMapping(batch->fileHandle, NULL, PAGE_READWRITE, 0, size, NULL);
-        Assert_(batch->mappingHandle != INVALID_HANDLE_VALUE);
-
-        void* memory = MapViewOfFile(batch->mappingHandle, FILE_MAP_WRITE, 0, 0, 0);
-        Assert_(memory != nullptr);
-
-        batch->hits = (HitParameters*)memory;
+        uint64 size = hitBatchCapacity * sizeof(HitParameters);
+        batch->hits = (HitParameters*)MapBatchMemory(spillMode, batch->batchIndex, size, &batch->mapping);
 
         hitBatches.Add(batch);
 
@@ -435,12 +546,14 @@ namespace Selas
             currentHits = AllocateHitBatch();
         }
 
-        UnmapViewOfFile((void*)batch->hits);
-        CloseHandle(batch->fileHandle);
-        CloseHandle(batch->mappingHandle);
+        if(IsDiskBacked(spillMode)) {
+            Atomic::AddU64(&bytesSpilled, (uint64)batch->batchTail * sizeof(HitParameters));
+        }
 
-        batch->fileHandle = INVALID_HANDLE_VALUE;
-        batch->mappingHandle = INVALID_HANDLE_VALUE;
+        if(spillMode == eSpillToDisk) {
+            MemoryMappedFile_Close(&batch->mapping);
+            batch->hits = nullptr;
+        }
 
         readyHitBatches.Add(batch);
     }
@@ -448,16 +561,9 @@ namespace Selas
     //=================================================================================================================================
     void PathTracingBatcher::LoadBatch(HitBatch* batch)
     {
-        FilePathString filepath = CreateBatchFilePath(batch->batchIndex);
-
-        void* fileData;
-        uint64 fileSize;
-        Error err = File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize);
-        Assert_(Successful_(err));
-
-        DeleteFileA(filepath.Ascii());
-
-        batch->hits = (HitParameters*)fileData;
+        uint64 reread = 0;
+        batch->hits = (HitParameters*)LoadBatchMemory(spillMode, batch->batchIndex, &batch->mapping, &reread);
+        Atomic::AddU64(&bytesReread, reread);
     }
 
     //=================================================================================================================================
@@ -466,9 +572,18 @@ namespace Selas
         , batchIndex(0)
         , rayBatchCapacity(0)
         , hitBatchCapacity(0)
+        , spillMode(eSpillToDisk)
         , totalEntriesAdded(0)
         , totalEntriesConsumed(0)
+        , bytesSpilled(0)
+        , bytesReread(0)
+        , sortMode(eSortQuickSort)
+        , sortThreadCount(1)
+        , sortedBatchCount(0)
+        , sortMicroseconds(0)
+        , maxSortMicroseconds(0)
     {
+        MakeInvalid(&sceneBounds);
 
     }
 
@@ -479,10 +594,16 @@ namespace Selas
     }
 
     //=================================================================================================================================
-    void PathTracingBatcher::Initialize(uint rayBatchCapacity_, uint hitBatchCapacity_)
+    void PathTracingBatcher::Initialize(uint rayBatchCapacity_, uint hitBatchCapacity_, RaySpillMode spillMode_)
     {
         rayBatchCapacity = rayBatchCapacity_;
         hitBatchCapacity = hitBatchCapacity_;
+        spillMode = spillMode_;
+        bytesSpilled = 0;
+        bytesReread = 0;
+        sortedBatchCount = 0;
+        sortMicroseconds = 0;
+        maxSortMicroseconds = 0;
         lock = CreateSpinLock();
 
         for(uint scan = 0; scan < RayBatchCategoryCount; ++scan) {
@@ -497,199 +618,254 @@ namespace Selas
     void PathTracingBatcher::Shutdown()
     {
         for(uint scan = 0, count = deferredBatches.Count(); scan < count; ++scan) {
-            Delete_(deferredBatches[scan]);
+            DeleteBatch(spillMode, deferredBatches[scan]);
         }
         deferredBatches.Shutdown();
 
         for(uint scan = 0, count = occlusionBatches.Count(); scan < count; ++scan) {
-            Delete_(occlusionBatches[scan]);
+            DeleteBatch(spillMode, occlusionBatches[scan]);
         }
         occlusionBatches.Shutdown();
 
         for(uint scan = 0, count = hitBatches.Count(); scan < count; ++scan) {
-            Delete_(hitBatches[scan]);
+            DeleteBatch(spillMode, hitBatches[scan]);
         }
         hitBatches.Shutdown();
 
+        readyDeferredBatches.Shutdown();
+        readyOcclusionBatches.Shutdown();
+        readyHitBatches.Shutdown();
+        activeDeferredBatches.Shutdown();
+        activeOcclusionBatches.Shutdown();
+        activeHitBatches.Shutdown();
+
         Assert_(lock != nullptr);
         CloseSpinlock(lock);
         lock = nullptr;
     }
 
     //=================================================================================================================================
-    void PathTracingBatcher::AddUnsortedDeferredRay(const DeferredRay& dray)
+    void PathTracingBatcher::SetSortMode(RaySortMode sortMode_, const AxisAlignedBox& sceneBounds_, uint sortThreadCount_)
     {
-        Atomic::AddU64(&totalEntriesAdded, 1);
-
-        RayBatchCategory category = DetermineRayCategory(dray);
-
-        while(true) {
-            DeferredBatch* batch = currentDeferred[category];
-
-            int64 head = batch->batchHead;
-            if(head >= rayBatchCapacity) {
-                // -- we need to wait for the last thread writing to this batch to replace it.
-                continue;
-            }
+        sortMode = sortMode_;
+        sceneBounds = sceneBounds_;
+        sortThreadCount = sortThreadCount_;
+    }
 
-            if(Atomic::CompareExchange64(&batch->batchHead, head + 1, head)) {
-                
-                batch->rays[head] = dray;
+    //=================================================================================================================================
+    void PathTracingBatcher::RecordSortTime(float microseconds)
+    {
+        uint64 elapsed = (uint64)microseconds;
 
-                int64 after = Atomic::Add64(&batch->batchTail, 1) + 1;
-                if(after == rayBatchCapacity) {
-                    EnterSpinLock(lock);
-                    FlushCompletedBatch(batch);
-                    LeaveSpinLock(lock);
-                }
+        Atomic::AddU64(&sortedBatchCount, 1);
+        Atomic::AddU64(&sortMicroseconds, elapsed);
 
+        while(true) {
+            int64 currentMax = maxSortMicroseconds;
+            if((int64)elapsed <= currentMax || Atomic::CompareExchange64(&maxSortMicroseconds, (int64)elapsed, currentMax)) {
                 break;
             }
         }
     }
 
     //=================================================================================================================================
-    void PathTracingBatcher::AddUnsortedOcclusionRay(const OcclusionRay& oray)
+    void PathTracingBatcher::GetStats(PathTracingBatcherStats* stats)
     {
-        Atomic::AddU64(&totalEntriesAdded, 1);
+        stats->bytesSpilled = bytesSpilled;
+        stats->bytesReread = bytesReread;
+        stats->sortedBatchCount = sortedBatchCount;
+        stats->sortMicroseconds = sortMicroseconds;
+        stats->maxSortMicroseconds = (uint64)maxSortMicroseconds;
+    }
 
-        RayBatchCategory category = DetermineRayCategory(oray);
+    //=================================================================================================================================
+    template<typename Batch_, typename Type_>
+    void PathTracingBatcher::PublishEntries(Batch_* volatile* current, Type_* Batch_::* member, int64 capacity,
+                                            const Type_* entries, uint count)
+    {
+        Atomic::AddU64(&totalEntriesAdded, count);
 
-        while(true) {
-            OcclusionBatch* batch = currentOcclusion[category];
+        while(count > 0) {
+            Batch_* batch = *current;
 
             int64 head = batch->batchHead;
-            if(head >= rayBatchCapacity) {
-                // -- we need to wait for the last thread writing to this batch to replace it.
+            if(head >= capacity) {
+                // -- we need to wait for the last thread writing to this batch to replace it. current is volatile so the
+                // -- replacement is picked up on the next pass.
                 continue;
             }
 
-            if(Atomic::CompareExchange64(&batch->batchHead, head + 1, head)) {
+            // -- Claim as much of the remaining batch as we need with a single reservation
+            int64 claimed = Min<int64>((int64)count, capacity - head);
+            if(Atomic::CompareExchange64(&batch->batchHead, head + claimed, head)) {
 
-                batch->rays[head] = oray;
+                Memory::Copy(batch->*member + head, entries, (uint)claimed * sizeof(Type_));
 
-                int64 after = Atomic::Add64(&batch->batchTail, 1) + 1;
-                if(after == rayBatchCapacity) {
+                int64 after = Atomic::Add64(&batch->batchTail, claimed) + claimed;
+                if(after == capacity) {
                     EnterSpinLock(lock);
                     FlushCompletedBatch(batch);
                     LeaveSpinLock(lock);
                 }
 
-                break;
+                entries += claimed;
+                count -= (uint)claimed;
             }
         }
     }
 
     //=================================================================================================================================
-    void PathTracingBatcher::AddUnsortedHit(const HitParameters& hit)
+    void PathTracingBatcher::PublishRays(RayBatchCategory category, const DeferredRay* rays, uint count)
     {
-        Atomic::AddU64(&totalEntriesAdded, 1);
-
-        while(true) {
-            HitBatch* batch = currentHits;
+        PublishEntries(&currentDeferred[category], &DeferredBatch::rays, rayBatchCapacity, rays, count);
+    }
 
-            int64 head = batch->batchHead;
-            if(head >= hitBatchCapacity) {
-                // -- we need to wait for the last thread writing to this batch to replace it.
-                continue;
-            }
+    //=================================================================================================================================
+    void PathTracingBatcher::PublishRays(RayBatchCategory category, const OcclusionRay* rays, uint count)
+    {
+        PublishEntries(&currentOcclusion[category], &OcclusionBatch::rays, rayBatchCapacity, rays, count);
+    }
 
-            if(Atomic::CompareExchange64(&batch->batchHead, head + 1, head)) {
+    //=================================================================================================================================
+    void PathTracingBatcher::AddUnsortedDeferredRay(const DeferredRay& dray)
+    {
+        PublishRays(DetermineRayCategory(dray), &dray, 1);
+    }
 
-                batch->hits[head] = hit;
+    //=================================================================================================================================
+    void PathTracingBatcher::AddUnsortedOcclusionRay(const OcclusionRay& oray)
+    {
+        PublishRays(DetermineRayCategory(oray), &oray, 1);
+    }
 
-                int64 after = Atomic::Add64(&batch->batchTail, 1) + 1;
-                if(after == hitBatchCapacity) {
-                    EnterSpinLock(lock);
-                    FlushCompletedBatch(batch);
-                    LeaveSpinLock(lock);
-                }
+    //=================================================================================================================================
+    void PathTracingBatcher::AddUnsortedDeferredRay(RayStagingBuffer* staging, const DeferredRay& dray)
+    {
+        RayBatchCategory category = DetermineRayCategory(dray);
 
-                break;
-            }
+        uint32& count = staging->deferredCount[category];
+        staging->deferredRays[category][count++] = dray;
+        if(count == RayStagingCapacity_) {
+            PublishRays(category, staging->deferredRays[category], count);
+            count = 0;
         }
     }
 
     //=================================================================================================================================
-    void PathTracingBatcher::Flush()
+    void PathTracingBatcher::AddUnsortedOcclusionRay(RayStagingBuffer* staging, const OcclusionRay& oray)
     {
-        EnterSpinLock(lock);
-       
-        for(uint scan = 0; scan < RayBatchCategoryCount; ++scan) {
-            while(true) {
-                DeferredBatch* batch = currentDeferred[scan];
-                int64 currentHead = batch->batchHead;
-                int64 diff = rayBatchCapacity - currentHead;
-
-                if(diff == 0) {
-
-                    // -- Another thread has already filled this batch so we just wait for that thread to finish the copy.
-                    // -- That thread will also call FlushCompletedBatch after we release the lock
-                    while(batch->batchTail != rayBatchCapacity) {}
-                    break;
-                }
-
-                // -- Update head so this batch claims to be at capacity and we know that no other thread will claim space
-                if(Atomic::CompareExchange64(&batch->batchHead, currentHead + diff, currentHead)) {
+        RayBatchCategory category = DetermineRayCategory(oray);
 
-                    // -- Wait until any other threads finish copying their rays into this batch
-                    while(batch->batchTail != rayBatchCapacity - diff) {}
+        uint32& count = staging->occlusionCount[category];
+        staging->occlusionRays[category][count++] = oray;
+        if(count == RayStagingCapacity_) {
+            PublishRays(category, staging->occlusionRays[category], count);
+            count = 0;
+        }
+    }
 
-                    FlushCompletedBatch(batch);
-                    break;
-                }
+    //=================================================================================================================================
+    void PathTracingBatcher::FlushStaging(RayStagingBuffer* staging)
+    {
+        for(uint scan = 0; scan < RayBatchCategoryCount; ++scan) {
+            if(staging->deferredCount[scan] > 0) {
+                PublishRays((RayBatchCategory)scan, staging->deferredRays[scan], staging->deferredCount[scan]);
+                staging->deferredCount[scan] = 0;
+            }
+            if(staging->occlusionCount[scan] > 0) {
+                PublishRays((RayBatchCategory)scan, staging->occlusionRays[scan], staging->occlusionCount[scan]);
+                staging->occlusionCount[scan] = 0;
             }
         }
 
-        for(uint scan = 0; scan < RayBatchCategoryCount; ++scan) {
-            while(true) {
-                OcclusionBatch* batch = currentOcclusion[scan];
-                int64 currentHead = batch->batchHead;
-                int64 diff = rayBatchCapacity - currentHead;
-
-                if(diff == 0) {
-                    // -- Another thread has already filled this batch so we just wait for that thread to finish the copy.
-                    // -- That thread will also call FlushCompletedBatch after we release the lock
-                    while(batch->batchTail != rayBatchCapacity) {}
-                    break;
-                }
+        if(staging->hitCount > 0) {
+            PublishHits(staging->hits, staging->hitCount);
+            staging->hitCount = 0;
+        }
+    }
 
-                // -- Update head so this batch claims to be at capacity and we know that no other thread will claim space
-                if(Atomic::CompareExchange64(&batch->batchHead, currentHead + diff, currentHead)) {
+    //=================================================================================================================================
+    void PathTracingBatcher::PublishHits(const HitParameters* hits, uint count)
+    {
+        PublishEntries(&currentHits, &HitBatch::hits, hitBatchCapacity, hits, count);
+    }
 
-                    // -- Wait until any other threads finish copying their rays into this batch
-                    while(batch->batchTail != rayBatchCapacity - diff) {}
+    //=================================================================================================================================
+    void PathTracingBatcher::AddUnsortedHit(const HitParameters& hit)
+    {
+        PublishHits(&hit, 1);
+    }
 
-                    FlushCompletedBatch(batch);
-                    break;
-                }
-            }
+    //=================================================================================================================================
+    void PathTracingBatcher::AddUnsortedHit(RayStagingBuffer* staging, const HitParameters& hit)
+    {
+        staging->hits[staging->hitCount++] = hit;
+        if(staging->hitCount == RayStagingCapacity_) {
+            PublishHits(staging->hits, staging->hitCount);
+            staging->hitCount = 0;
         }
+    }
 
+    //=================================================================================================================================
+    // -- Called with the lock held. Claims the rest of the current batch so no other thread can add to it and flushes it once
+    // -- the threads already copying into it are done.
+    template<typename Batch_>
+    void PathTracingBatcher::FlushCurrentBatch(Batch_* volatile* current, int64 capacity)
+    {
         while(true) {
-            HitBatch* batch = currentHits;
+            Batch_* batch = *current;
             int64 currentHead = batch->batchHead;
-            int64 diff = hitBatchCapacity - currentHead;
+            int64 diff = capacity - currentHead;
 
             if(diff == 0) {
                 // -- Another thread has already filled this batch so we just wait for that thread to finish the copy.
                 // -- That thread will also call FlushCompletedBatch after we release the lock
-                while(batch->batchTail != hitBatchCapacity) {}
+                while(batch->batchTail != capacity) {}
                 break;
             }
 
             // -- Update head so this batch claims to be at capacity and we know that no other thread will claim space
             if(Atomic::CompareExchange64(&batch->batchHead, currentHead + diff, currentHead)) {
 
-                // -- Wait until any other threads finish copying their rays into this batch
-                while(batch->batchTail != hitBatchCapacity - diff) {}
+                // -- Wait until any other threads finish copying their entries into this batch
+                while(batch->batchTail != capacity - diff) {}
 
                 FlushCompletedBatch(batch);
                 break;
             }
         }
+    }
+
+    //=================================================================================================================================
+    void PathTracingBatcher::Flush()
+    {
+        EnterSpinLock(lock);
+
+        for(uint scan = 0; scan < RayBatchCategoryCount; ++scan) {
+            FlushCurrentBatch(&currentDeferred[scan], rayBatchCapacity);
+        }
+        for(uint scan = 0; scan < RayBatchCategoryCount; ++scan) {
+            FlushCurrentBatch(&currentOcclusion[scan], rayBatchCapacity);
+        }
+        FlushCurrentBatch(&currentHits, hitBatchCapacity);
+
+        LeaveSpinLock(lock);
+    }
 
+    //=================================================================================================================================
+    template<typename Batch_, typename Type_>
+    void PathTracingBatcher::FreeEntries(CArray<Batch_*>& activeBatches, Type_* entries, Type_* Batch_::* member)
+    {
+        EnterSpinLock(lock);
+        Batch_* batch = RemoveActiveBatch(activeBatches, entries, member);
         LeaveSpinLock(lock);
+
+        FreeBatchMemory(spillMode, batch->batchIndex, entries, &batch->mapping);
+        batch->*member = nullptr;
+
+        // -- Entries are only counted as consumed once the caller is done with them so that Empty() stays false while the
+        // -- work they generate is still being staged.
+        Atomic::AddU64(&totalEntriesConsumed, (uint64)batch->batchTail);
     }
 
     //=================================================================================================================================
@@ -710,6 +886,7 @@ namespace Selas
 
         DeferredBatch* batch = readyDeferredBatches[readyDeferredBatches.Count() - 1];
         readyDeferredBatches.RemoveFast(readyDeferredBatches.Count() - 1);
+        activeDeferredBatches.Add(batch);
 
         LeaveSpinLock(lock);
 
@@ -718,7 +895,12 @@ namespace Selas
         rays = batch->rays;
         rayCount = (uint)batch->batchTail;
 
-        if(batch->category == PositiveX || batch->category == NegativeX) {
+        auto sortStart = SystemTime::Now();
+
+        if(sortMode == eSortMortonRadix) {
+            SortRaysMortonRadix(rays, rayCount, sceneBounds, sortThreadCount);
+        }
+        else if(batch->category == PositiveX || batch->category == NegativeX) {
             SortRaysInternal((DeferredRaySortX*)rays, rayCount);
         }
         else if(batch->category == PositiveY || batch->category == NegativeY) {
@@ -728,7 +910,8 @@ namespace Selas
             SortRaysInternal((DeferredRaySortZ*)rays, rayCount);
         }
 
-        Atomic::AddU64(&totalEntriesConsumed, rayCount);
+        RecordSortTime(SystemTime::ElapsedMicrosecondsF(sortStart));
+
 
         return true;
     }
@@ -736,7 +919,7 @@ namespace Selas
     //=================================================================================================================================
     void PathTracingBatcher::FreeRays(DeferredRay* rays)
     {
-        FreeAligned_(rays);
+        FreeEntries(activeDeferredBatches, rays, &DeferredBatch::rays);
     }
 
     //=================================================================================================================================
@@ -757,6 +940,7 @@ namespace Selas
 
         OcclusionBatch* batch = readyOcclusionBatches[readyOcclusionBatches.Count() - 1];
         readyOcclusionBatches.RemoveFast(readyOcclusionBatches.Count() - 1);
+        activeOcclusionBatches.Add(batch);
 
         LeaveSpinLock(lock);
 
@@ -765,7 +949,12 @@ namespace Selas
         rays = batch->rays;
         rayCount = (uint)batch->batchTail;
 
-        if(batch->category == PositiveX || batch->category == NegativeX) {
+        auto sortStart = SystemTime::Now();
+
+        if(sortMode == eSortMortonRadix) {
+            SortRaysMortonRadix(rays, rayCount, sceneBounds, sortThreadCount);
+        }
+        else if(batch->category == PositiveX || batch->category == NegativeX) {
             SortRaysInternal((OcclusionRaySortX*)rays, rayCount);
         }
         else if(batch->category == PositiveY || batch->category == NegativeY) {
@@ -775,7 +964,8 @@ namespace Selas
             SortRaysInternal((OcclusionRaySortZ*)rays, rayCount);
         }
 
-        Atomic::AddU64(&totalEntriesConsumed, rayCount);
+        RecordSortTime(SystemTime::ElapsedMicrosecondsF(sortStart));
+
 
         return true;
     }
@@ -783,7 +973,7 @@ namespace Selas
     //=================================================================================================================================
     void PathTracingBatcher::FreeRays(OcclusionRay* rays)
     {
-        FreeAligned_(rays);
+        FreeEntries(activeOcclusionBatches, rays, &OcclusionBatch::rays);
     }
 
     //=================================================================================================================================
@@ -804,6 +994,7 @@ namespace Selas
 
         HitBatch* batch = readyHitBatches[readyHitBatches.Count() - 1];
         readyHitBatches.RemoveFast(readyHitBatches.Count() - 1);
+        activeHitBatches.Add(batch);
 
         LeaveSpinLock(lock);
 
@@ -812,9 +1003,9 @@ namespace Selas
         hits = batch->hits;
         hitCount = (uint)batch->batchTail;
 
+        auto sortStart = SystemTime::Now();
         QuickSort(hits, hitCount);
-
-        Atomic::AddU64(&totalEntriesConsumed, hitCount);
+        RecordSortTime(SystemTime::ElapsedMicrosecondsF(sortStart));
 
         return true;
     }
@@ -822,7 +1013,7 @@ namespace Selas
     //=================================================================================================================================
     void PathTracingBatcher::FreeHits(HitParameters* hits)
     {
-        FreeAligned_(hits);
+        FreeEntries(activeHitBatches, hits, &HitBatch::hits);
     }
 
     //=================================================================================================================================
@@ -830,4 +1021,10 @@ namespace Selas
     {
         return (totalEntriesConsumed == totalEntriesAdded);
     }
+
+    //=================================================================================================================================
+    bool PathTracingBatcher::HasReadyBatches()
+    {
+        return readyDeferredBatches.Count() > 0 || readyOcclusionBatches.Count() > 0 || readyHitBatches.Count() > 0;
+    }
 }
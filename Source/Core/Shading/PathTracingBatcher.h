@@ -6,8 +6,10 @@
 
 #include "Shading/IntegratorContexts.h"
 #include "GeometryLib/Ray.h"
+#include "GeometryLib/AxisAlignedBox.h"
 #include "ContainersLib/CArray.h"
 #include "MathLib/FloatStructs.h"
+#include "SystemLib/Memory.h"
 #include "SystemLib/BasicTypes.h"
 
 namespace Selas
@@ -29,6 +31,7 @@ namespace Selas
         uint32 unused           : 2;
 
         float  error;
+        RayCone cone;
     };
 
     struct OcclusionRay
@@ -51,14 +54,70 @@ namespace Selas
         RayBatchCategoryCount
     };
 
+    enum RaySpillMode
+    {
+        // -- Batches are backed by memory mapped files in the _Temp directory and are re-read when consumed.
+        eSpillToDisk,
+
+        // -- Batches are backed by memory mapped files in the _Temp directory that stay mapped until the rays are freed. Rays
+        // -- are sorted and traced directly from the mapping and the OS pages them out under memory pressure.
+        eSpillToDiskInPlace,
+
+        // -- Batches are backed by anonymous memory and never touch the filesystem. Only usable when the ray queue fits in RAM.
+        eSpillToMemory
+    };
+
+    enum RaySortMode
+    {
+        // -- Recursive quicksort on the origin along the dominant axis of the batch category, or on direction for small batches.
+        eSortQuickSort,
+
+        // -- Parallel radix sort on a 64 bit key of origin Morton code within the scene bounds plus octahedral direction bin.
+        eSortMortonRadix
+    };
+
+    #define RayStagingCapacity_ 256
+
+    // -- Per-thread buffer used to publish rays and hits into the shared batches in chunks rather than one atomic reservation
+    // -- per entry. Must be flushed with FlushStaging before the thread frees the batch that produced the entries.
+    struct RayStagingBuffer
+    {
+        RayStagingBuffer()
+            : hitCount(0)
+        {
+            Memory::Zero(deferredCount, sizeof(deferredCount));
+            Memory::Zero(occlusionCount, sizeof(occlusionCount));
+        }
+
+        DeferredRay   deferredRays[RayBatchCategoryCount][RayStagingCapacity_];
+        OcclusionRay  occlusionRays[RayBatchCategoryCount][RayStagingCapacity_];
+        HitParameters hits[RayStagingCapacity_];
+        uint32        deferredCount[RayBatchCategoryCount];
+        uint32        occlusionCount[RayBatchCategoryCount];
+        uint32        hitCount;
+    };
+
+    struct PathTracingBatcherStats
+    {
+        // -- Bytes written into file backed batches
+        uint64 bytesSpilled;
+        // -- Bytes copied back from disk into heap memory when batches are consumed
+        uint64 bytesReread;
+
+        uint64 sortedBatchCount;
+        uint64 sortMicroseconds;
+        uint64 maxSortMicroseconds;
+    };
+
     class PathTracingBatcher
     {
     private:
         void* lock;
         int64 batchIndex;
-        Align_(64) DeferredBatch* currentDeferred[RayBatchCategoryCount];
-        Align_(64) OcclusionBatch* currentOcclusion[RayBatchCategoryCount];
-        Align_(64) HitBatch* currentHits;
+        // -- Replaced by the thread that fills each batch while other threads spin waiting for the replacement
+        Align_(64) DeferredBatch* volatile currentDeferred[RayBatchCategoryCount];
+        Align_(64) OcclusionBatch* volatile currentOcclusion[RayBatchCategoryCount];
+        Align_(64) HitBatch* volatile currentHits;
 
         CArray<DeferredBatch*>  deferredBatches;
         CArray<DeferredBatch*>  readyDeferredBatches;
@@ -67,12 +126,41 @@ namespace Selas
         CArray<HitBatch*>       hitBatches;
         CArray<HitBatch*>       readyHitBatches;
 
+        CArray<DeferredBatch*>  activeDeferredBatches;
+        CArray<OcclusionBatch*> activeOcclusionBatches;
+        CArray<HitBatch*>       activeHitBatches;
+
         int64 rayBatchCapacity;
         int64 hitBatchCapacity;
+        RaySpillMode spillMode;
         
         uint64 totalEntriesAdded;
         uint64 totalEntriesConsumed;
 
+        uint64 bytesSpilled;
+        uint64 bytesReread;
+
+        RaySortMode sortMode;
+        AxisAlignedBox sceneBounds;
+        uint sortThreadCount;
+
+        uint64 sortedBatchCount;
+        uint64 sortMicroseconds;
+        int64 maxSortMicroseconds;
+
+        void RecordSortTime(float microseconds);
+
+        template<typename Batch_, typename Type_>
+        void PublishEntries(Batch_* volatile* current, Type_* Batch_::* member, int64 capacity, const Type_* entries,
+                            uint count);
+        template<typename Batch_>
+        void FlushCurrentBatch(Batch_* volatile* current, int64 capacity);
+        void PublishRays(RayBatchCategory category, const DeferredRay* rays, uint count);
+        void PublishRays(RayBatchCategory category, const OcclusionRay* rays, uint count);
+        void PublishHits(const HitParameters* hits, uint count);
+        template<typename Batch_, typename Type_>
+        void FreeEntries(CArray<Batch_*>& activeBatches, Type_* entries, Type_* Batch_::* member);
+
         DeferredBatch* AllocateRayBatch(RayBatchCategory category);
         void FlushCompletedBatch(DeferredBatch* batch);
         void LoadBatch(DeferredBatch* batch);
@@ -90,13 +178,21 @@ namespace Selas
         PathTracingBatcher();
         ~PathTracingBatcher();
 
-        void Initialize(uint rayBatchCapacity, uint hitBatchCapacity);
+        void Initialize(uint rayBatchCapacity, uint hitBatchCapacity, RaySpillMode spillMode = eSpillToDisk);
         void Shutdown();
 
+        void SetSortMode(RaySortMode sortMode, const AxisAlignedBox& sceneBounds, uint sortThreadCount);
+        void GetStats(PathTracingBatcherStats* stats);
+
         void AddUnsortedDeferredRay(const DeferredRay& ray);
         void AddUnsortedOcclusionRay(const OcclusionRay& ray);
         void AddUnsortedHit(const HitParameters& hit);
 
+        void AddUnsortedDeferredRay(RayStagingBuffer* staging, const DeferredRay& ray);
+        void AddUnsortedOcclusionRay(RayStagingBuffer* staging, const OcclusionRay& ray);
+        void AddUnsortedHit(RayStagingBuffer* staging, const HitParameters& hit);
+        void FlushStaging(RayStagingBuffer* staging);
+
         void Flush();
 
         bool GetSortedBatch(DeferredRay*& rays, uint& rayCount);
@@ -109,5 +205,7 @@ namespace Selas
         void FreeHits(HitParameters* hits);
 
         bool Empty();
+        // -- Unlocked check so the result is only a hint
+        bool HasReadyBatches();
     };
 }
\ No newline at end of file
@@ -0,0 +1,295 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "Shading/RayStream.h"
+#include "SceneLib/SceneIntersectContext.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/MinMax.h"
+#include "SystemLib/OSThreading.h"
+#include "SystemLib/JsAssert.h"
+#include "SystemLib/CountOf.h"
+
+#include "embree3/rtcore.h"
+#include "embree3/rtcore_ray.h"
+
+// -- Number of 32 bit lanes stored per ray
+#define RayStreamLaneCount_     (20 + MaxInstanceLevelCount_)
+
+namespace Selas
+{
+    static_assert(MaxInstanceLevelCount_ == RTC_MAX_INSTANCE_LEVEL_COUNT, "Instance level count mismatch with Embree");
+
+    static cpointer RayPacketWidthNames[] =
+    {
+        "Packet4",
+        "Packet8",
+        "Packet16",
+        "Stream"
+    };
+    static_assert(CountOf_(RayPacketWidthNames) == RayPacketWidthCount, "Missing packet width name");
+
+    //=============================================================================================================================
+    cpointer RayPacketWidthName(RayPacketWidth width)
+    {
+        return RayPacketWidthNames[width];
+    }
+
+    //=============================================================================================================================
+    RayStream::RayStream()
+        : capacity(0)
+        , memory(nullptr)
+    {
+
+    }
+
+    //=============================================================================================================================
+    RayStream::~RayStream()
+    {
+        Assert_(memory == nullptr);
+    }
+
+    //=============================================================================================================================
+    void RayStream_Initialize(RayStream* stream, uint capacity)
+    {
+        // -- Keep each array padded to a full cache line so every lane array starts aligned
+        capacity = (capacity + 15) & ~15ull;
+
+        stream->capacity = capacity;
+        stream->memory = AllocAligned_(capacity * RayStreamLaneCount_ * sizeof(uint32), CacheLineSize_);
+
+        float* lanes = (float*)stream->memory;
+        stream->orgX   = lanes + 0 * capacity;
+        stream->orgY   = lanes + 1 * capacity;
+        stream->orgZ   = lanes + 2 * capacity;
+        stream->tnear  = lanes + 3 * capacity;
+        stream->dirX   = lanes + 4 * capacity;
+        stream->dirY   = lanes + 5 * capacity;
+        stream->dirZ   = lanes + 6 * capacity;
+        stream->time   = lanes + 7 * capacity;
+        stream->tfar   = lanes + 8 * capacity;
+        stream->mask   = (uint32*)(lanes + 9 * capacity);
+        stream->id     = (uint32*)(lanes + 10 * capacity);
+        stream->flags  = (uint32*)(lanes + 11 * capacity);
+        stream->ngX    = lanes + 12 * capacity;
+        stream->ngY    = lanes + 13 * capacity;
+        stream->ngZ    = lanes + 14 * capacity;
+        stream->u      = lanes + 15 * capacity;
+        stream->v      = lanes + 16 * capacity;
+        stream->primId = (uint32*)(lanes + 17 * capacity);
+        stream->geomId = (uint32*)(lanes + 18 * capacity);
+        for(uint scan = 0; scan < MaxInstanceLevelCount_; ++scan) {
+            stream->instId[scan] = (uint32*)(lanes + (19 + scan) * capacity);
+        }
+        stream->missingInstId = (uint32*)(lanes + (19 + MaxInstanceLevelCount_) * capacity);
+    }
+
+    //=============================================================================================================================
+    void RayStream_Shutdown(RayStream* stream)
+    {
+        FreeAligned_(stream->memory);
+        stream->memory = nullptr;
+        stream->capacity = 0;
+    }
+
+    //=============================================================================================================================
+    void RayStream_SetRay(RayStream* stream, uint index, const Ray& ray, float tfar)
+    {
+        Assert_(index < stream->capacity);
+
+        stream->orgX[index]  = ray.origin.x;
+        stream->orgY[index]  = ray.origin.y;
+        stream->orgZ[index]  = ray.origin.z;
+        stream->tnear[index] = 0.0f;
+        stream->dirX[index]  = ray.direction.x;
+        stream->dirY[index]  = ray.direction.y;
+        stream->dirZ[index]  = ray.direction.z;
+        stream->time[index]  = 0.0f;
+        stream->tfar[index]  = tfar;
+        stream->mask[index]  = 0xFFFFFFFF;
+        stream->id[index]    = (uint32)index;
+        stream->flags[index] = 0;
+
+        stream->primId[index] = RTC_INVALID_GEOMETRY_ID;
+        stream->geomId[index] = RTC_INVALID_GEOMETRY_ID;
+        for(uint scan = 0; scan < MaxInstanceLevelCount_; ++scan) {
+            stream->instId[scan][index] = RTC_INVALID_GEOMETRY_ID;
+        }
+        stream->missingInstId[index] = RTC_INVALID_GEOMETRY_ID;
+    }
+
+    //=============================================================================================================================
+    template<typename RayN_>
+    static void LoadPacketRays(RayStream* stream, uint start, uint count, RayN_& ray)
+    {
+        for(uint scan = 0; scan < count; ++scan) {
+            uint index = start + scan;
+            ray.org_x[scan] = stream->orgX[index];
+            ray.org_y[scan] = stream->orgY[index];
+            ray.org_z[scan] = stream->orgZ[index];
+            ray.tnear[scan] = stream->tnear[index];
+            ray.dir_x[scan] = stream->dirX[index];
+            ray.dir_y[scan] = stream->dirY[index];
+            ray.dir_z[scan] = stream->dirZ[index];
+            ray.time[scan]  = stream->time[index];
+            ray.tfar[scan]  = stream->tfar[index];
+            ray.mask[scan]  = stream->mask[index];
+            ray.id[scan]    = stream->id[index];
+            ray.flags[scan] = stream->flags[index];
+        }
+    }
+
+    //=============================================================================================================================
+    template<typename RayHitN_, uint Width_>
+    static void IntersectPackets(RayStream* stream, uint count, RTCScene rtcScene, SceneIntersectContext* context,
+                                 void (*intersect)(const int*, RTCScene, RTCIntersectContext*, RayHitN_*))
+    {
+
+        for(uint start = 0; start < count; start += Width_) {
+            uint packetSize = Min<uint>(count - start, Width_);
+
+            Align_(64) int32 valid[Width_];
+            Align_(64) RayHitN_ rayhit;
+
+            LoadPacketRays(stream, start, packetSize, rayhit.ray);
+            for(uint scan = 0; scan < packetSize; ++scan) {
+                rayhit.hit.geomID[scan] = RTC_INVALID_GEOMETRY_ID;
+                rayhit.hit.primID[scan] = RTC_INVALID_GEOMETRY_ID;
+                for(uint level = 0; level < MaxInstanceLevelCount_; ++level) {
+                    rayhit.hit.instID[level][scan] = RTC_INVALID_GEOMETRY_ID;
+                }
+                valid[scan] = -1;
+            }
+            for(uint scan = packetSize; scan < Width_; ++scan) {
+                valid[scan] = 0;
+            }
+
+            intersect(valid, rtcScene, &context->rtc, &rayhit);
+
+            for(uint scan = 0; scan < packetSize; ++scan) {
+                uint index = start + scan;
+                stream->tfar[index]   = rayhit.ray.tfar[scan];
+                stream->ngX[index]    = rayhit.hit.Ng_x[scan];
+                stream->ngY[index]    = rayhit.hit.Ng_y[scan];
+                stream->ngZ[index]    = rayhit.hit.Ng_z[scan];
+                stream->u[index]      = rayhit.hit.u[scan];
+                stream->v[index]      = rayhit.hit.v[scan];
+                stream->primId[index] = rayhit.hit.primID[scan];
+                stream->geomId[index] = rayhit.hit.geomID[scan];
+                for(uint level = 0; level < MaxInstanceLevelCount_; ++level) {
+                    stream->instId[level][index] = rayhit.hit.instID[level][scan];
+                }
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    template<typename RayN_, uint Width_>
+    static void OccludedPackets(RayStream* stream, uint count, RTCScene rtcScene, SceneIntersectContext* context,
+                                void (*occluded)(const int*, RTCScene, RTCIntersectContext*, RayN_*))
+    {
+
+        for(uint start = 0; start < count; start += Width_) {
+            uint packetSize = Min<uint>(count - start, Width_);
+
+            Align_(64) int32 valid[Width_];
+            Align_(64) RayN_ ray;
+
+            LoadPacketRays(stream, start, packetSize, ray);
+            for(uint scan = 0; scan < packetSize; ++scan) {
+                valid[scan] = -1;
+            }
+            for(uint scan = packetSize; scan < Width_; ++scan) {
+                valid[scan] = 0;
+            }
+
+            occluded(valid, rtcScene, &context->rtc, &ray);
+
+            for(uint scan = 0; scan < packetSize; ++scan) {
+                stream->tfar[start + scan] = ray.tfar[scan];
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    static void MakeStreamRays(RayStream* stream, RTCRayNp& rays)
+    {
+        rays.org_x = stream->orgX;
+        rays.org_y = stream->orgY;
+        rays.org_z = stream->orgZ;
+        rays.tnear = stream->tnear;
+        rays.dir_x = stream->dirX;
+        rays.dir_y = stream->dirY;
+        rays.dir_z = stream->dirZ;
+        rays.time  = stream->time;
+        rays.tfar  = stream->tfar;
+        rays.mask  = stream->mask;
+        rays.id    = stream->id;
+        rays.flags = stream->flags;
+    }
+
+    //=============================================================================================================================
+    void RayStream_Intersect(RayStream* stream, uint count, RTCScene rtcScene, RayPacketWidth width, bool deferNonResident)
+    {
+        Assert_(count <= stream->capacity);
+
+        SceneIntersectContext context;
+        InitializeSceneIntersectContext(&context, deferNonResident ? stream->missingInstId : nullptr);
+
+        if(width == ePacketWidth4) {
+            IntersectPackets<RTCRayHit4, 4>(stream, count, rtcScene, &context, rtcIntersect4);
+        }
+        else if(width == ePacketWidth8) {
+            IntersectPackets<RTCRayHit8, 8>(stream, count, rtcScene, &context, rtcIntersect8);
+        }
+        else if(width == ePacketWidth16) {
+            IntersectPackets<RTCRayHit16, 16>(stream, count, rtcScene, &context, rtcIntersect16);
+        }
+        else {
+            // -- Streams are built from sorted batches so let Embree treat them as coherent
+            context.rtc.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+            RTCRayHitNp rayhit;
+            MakeStreamRays(stream, rayhit.ray);
+            rayhit.hit.Ng_x = stream->ngX;
+            rayhit.hit.Ng_y = stream->ngY;
+            rayhit.hit.Ng_z = stream->ngZ;
+            rayhit.hit.u = stream->u;
+            rayhit.hit.v = stream->v;
+            rayhit.hit.primID = stream->primId;
+            rayhit.hit.geomID = stream->geomId;
+            for(uint scan = 0; scan < MaxInstanceLevelCount_; ++scan) {
+                rayhit.hit.instID[scan] = stream->instId[scan];
+            }
+
+            rtcIntersectNp(rtcScene, &context.rtc, &rayhit, (uint32)count);
+        }
+    }
+
+    //=============================================================================================================================
+    void RayStream_Occluded(RayStream* stream, uint count, RTCScene rtcScene, RayPacketWidth width, bool deferNonResident)
+    {
+        Assert_(count <= stream->capacity);
+
+        SceneIntersectContext context;
+        InitializeSceneIntersectContext(&context, deferNonResident ? stream->missingInstId : nullptr);
+
+        if(width == ePacketWidth4) {
+            OccludedPackets<RTCRay4, 4>(stream, count, rtcScene, &context, rtcOccluded4);
+        }
+        else if(width == ePacketWidth8) {
+            OccludedPackets<RTCRay8, 8>(stream, count, rtcScene, &context, rtcOccluded8);
+        }
+        else if(width == ePacketWidth16) {
+            OccludedPackets<RTCRay16, 16>(stream, count, rtcScene, &context, rtcOccluded16);
+        }
+        else {
+            context.rtc.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+            RTCRayNp rays;
+            MakeStreamRays(stream, rays);
+
+            rtcOccludedNp(rtcScene, &context.rtc, &rays, (uint32)count);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "Shading/IntegratorContexts.h"
+#include "GeometryLib/Ray.h"
+#include "SystemLib/BasicTypes.h"
+
+namespace Selas
+{
+    enum RayPacketWidth
+    {
+        ePacketWidth4,
+        ePacketWidth8,
+        ePacketWidth16,
+
+        // -- The whole stream is handed to Embree in one rtcIntersectNp/rtcOccludedNp call
+        ePacketStream,
+
+        RayPacketWidthCount
+    };
+
+    cpointer RayPacketWidthName(RayPacketWidth width);
+
+    //=============================================================================================================================
+    // -- SoA ray and hit storage that can be traced with any of the Embree packet widths or as a single stream.
+    struct RayStream
+    {
+        RayStream();
+        ~RayStream();
+
+        uint capacity;
+        void* memory;
+
+        float* orgX;
+        float* orgY;
+        float* orgZ;
+        float* tnear;
+        float* dirX;
+        float* dirY;
+        float* dirZ;
+        float* time;
+        float* tfar;
+        uint32* mask;
+        uint32* id;
+        uint32* flags;
+
+        float* ngX;
+        float* ngY;
+        float* ngZ;
+        float* u;
+        float* v;
+        uint32* primId;
+        uint32* geomId;
+        uint32* instId[MaxInstanceLevelCount_];
+
+        // -- Instance whose subscene was not resident when the ray was traced with deferral enabled or invalid when none
+        uint32* missingInstId;
+    };
+
+    void RayStream_Initialize(RayStream* stream, uint capacity);
+    void RayStream_Shutdown(RayStream* stream);
+
+    void RayStream_SetRay(RayStream* stream, uint index, const Ray& ray, float tfar);
+
+    // -- Results are written back into tfar, the hit normal, barycentrics and ids of each ray. With deferNonResident set, rays
+    // -- that reach a subscene whose geometry is not resident record it in missingInstId instead of waiting for it to load.
+    // -- The rest of their results are then incomplete and they must be traced again once the subscene is loaded.
+    void RayStream_Intersect(RayStream* stream, uint count, RTCScene rtcScene, RayPacketWidth width,
+                             bool deferNonResident = false);
+    // -- Occluded rays have their tfar set to -inf. That result holds even when a subscene was skipped.
+    void RayStream_Occluded(RayStream* stream, uint count, RTCScene rtcScene, RayPacketWidth width,
+                            bool deferNonResident = false);
+}
@@ -7,8 +7,10 @@
 
 #include "SceneLib/SceneResource.h"
 #include "SceneLib/ModelResource.h"
+#include "SceneLib/GeometryCache.h"
 #include "TextureLib/TextureFiltering.h"
 #include "TextureLib/TextureResource.h"
+#include "TextureLib/PtexFilterCache.h"
 #include "GeometryLib/Ray.h"
 #include "GeometryLib/CoordinateSystem.h"
 #include "MathLib/FloatFuncs.h"
@@ -17,9 +19,20 @@
 #include "embree3/rtcore.h"
 #include "embree3/rtcore_ray.h"
 
-#define ForceNoMips_ true
+// -- When enabled textures are always sampled from mip 0 instead of the level chosen from the ray cone footprint
+#define ForceNoMips_ false
 #define EnableEWA_ true
 
+// -- Tangent frames of batched hits are computed 8 at a time with AVX2 when the compiler targets it
+#if defined(__AVX2__)
+    #define SurfaceBatchSimd_ 1
+    #include <immintrin.h>
+#else
+    #define SurfaceBatchSimd_ 0
+#endif
+
+#define SurfaceBatchWidth_ 8
+
 namespace Selas
 {
     //=============================================================================================================================
@@ -28,14 +41,21 @@ namespace Selas
         if(texture == nullptr)
             return float3::ZAxis_;
 
-        if(texture->data->format != TextureResourceData::Float3) {
+        uint32 channelCount = TextureChannelCount(texture->data->format);
+        if(channelCount < 2) {
             Assert_(false);
             return float3::ZAxis_;
         }
 
         float3 sample;
-        TextureFiltering::Triangle(texture->data, 0, uvs, sample);
-        return 2.0f * sample - float3(1.0f);
+        TextureFiltering::Triangle(texture, 0, uvs, sample);
+        float3 normal = 2.0f * sample - float3(1.0f);
+
+        // -- Two channel normal maps only store x and y
+        if(channelCount == 2) {
+            normal.z = Math::Sqrtf(Max(0.0f, 1.0f - normal.x * normal.x - normal.y * normal.y));
+        }
+        return normal;
     }
 
     //=============================================================================================================================
@@ -44,25 +64,25 @@ namespace Selas
         if(texture == nullptr)
             return 1.0f;
 
-        if(texture->data->format != TextureResourceData::Float4) {
+        if(TextureChannelCount(texture->data->format) != 4) {
             return 1.0f;
         }
 
         float4 sample;
-        TextureFiltering::Triangle(texture->data, 0, uvs, sample);
+        TextureFiltering::Triangle(texture, 0, uvs, sample);
 
         return sample.w;
     }
 
     //=============================================================================================================================
     template <typename Type_>
-    static Type_ SampleTexture(const TextureResource* texture, float2 uvs, bool sRGB, Type_ defaultValue)
+    static Type_ SampleTexture(const TextureResource* texture, float2 uvs, float lod, bool sRGB, Type_ defaultValue)
     {
         if(texture == nullptr)
             return defaultValue;
 
         Type_ sample;
-        TextureFiltering::Triangle(texture->data, 0, uvs, sample);
+        TextureFiltering::TrilinearLod(texture, lod, uvs, sample);
 
         if(sRGB) {
             sample = Math::SrgbToLinearPrecise(sample);
@@ -72,75 +92,206 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    static float SampleTextureFloat(const TextureResource* texture, float2 uvs, bool sRGB, float defaultValue)
+    static float SampleTextureFloat(const TextureResource* texture, float2 uvs, float lod, bool sRGB, float defaultValue)
     {
-        if(texture == nullptr)
-            return defaultValue;
-
-        if(texture->data->format == TextureResourceData::Float) {
-            return SampleTexture(texture, uvs, sRGB, defaultValue);
-        }
-        else if(texture->data->format == TextureResourceData::Float2) {
-            return SampleTexture(texture, uvs, sRGB, float2(defaultValue, 0.0f)).x;
-        }
-        else if(texture->data->format == TextureResourceData::Float3) {
-            return SampleTexture(texture, uvs, sRGB, float3(defaultValue, 0.0f, 0.0f)).x;
-        }
-        else if(texture->data->format == TextureResourceData::Float4) {
-            return SampleTexture(texture, uvs, sRGB, float4(defaultValue, 0.0f, 0.0f, 0.0f)).x;
-        }
-
-        Assert_(false);
-        return 0.0f;
+        return SampleTexture(texture, uvs, lod, sRGB, defaultValue);
     }
 
     //=============================================================================================================================
-    static float3 SampleTextureFloat3(const TextureResource* texture, float2 uvs, bool sRGB, float3 defaultValue)
+    static float3 SampleTextureFloat3(const TextureResource* texture, float2 uvs, float lod, bool sRGB, float3 defaultValue)
     {
         if(texture == nullptr)
             return defaultValue;
 
-        if(texture->data->format == TextureResourceData::Float) {
+        if(TextureChannelCount(texture->data->format) == 1) {
             float val;
-            val = SampleTexture(texture, uvs, sRGB, 0.0f);
+            val = SampleTexture(texture, uvs, lod, sRGB, 0.0f);
             return float3(val, val, val);
         }
-        else if(texture->data->format == TextureResourceData::Float3) {
-            return SampleTexture(texture, uvs, sRGB, defaultValue);
-        }
-        else if(texture->data->format == TextureResourceData::Float4) {
-            float4 val = SampleTexture(texture, uvs, sRGB, float4(defaultValue, 1.0f));
-            return val.XYZ();
-        }
 
-        Assert_(false);
-        return float3(0.0f);
+        return SampleTexture(texture, uvs, lod, sRGB, defaultValue);
     }
 
     //=============================================================================================================================
-    static float4 SampleTextureFloat4(const TextureResource* texture, float2 uvs, bool sRGB, float defaultValue)
+    static float4 SampleTextureFloat4(const TextureResource* texture, float2 uvs, float lod, bool sRGB, float defaultValue)
     {
         if(texture == nullptr)
             return float4(defaultValue, defaultValue, defaultValue, defaultValue);
 
-        if(texture->data->format == TextureResourceData::Float) {
-            float val = SampleTexture(texture, uvs, sRGB, defaultValue);
+        if(TextureChannelCount(texture->data->format) == 1) {
+            float val = SampleTexture(texture, uvs, lod, sRGB, defaultValue);
             return float4(val, val, val, 1.0f);
         }
-        else if(texture->data->format == TextureResourceData::Float3) {
-            float3 value = SampleTexture(texture, uvs, sRGB, float3(defaultValue, defaultValue, defaultValue));
-            return float4(value, 1.0f);
+
+        // -- Formats without alpha decode it as 1
+        return SampleTexture(texture, uvs, lod, sRGB, float4(defaultValue, defaultValue, defaultValue, defaultValue));
+    }
+
+    //=============================================================================================================================
+    static void FillMaterialParameters(const ModelGeometryUserData* modelData, SurfaceParameters& surface)
+    {
+        const MaterialResourceData* materialResource = modelData->material;
+
+        surface.materialFlags      = materialResource->flags;
+        surface.transmittanceColor = materialResource->transmittanceColor;
+        surface.sheen              = materialResource->scalarAttributeValues[eSheen];
+        surface.sheenTint          = materialResource->scalarAttributeValues[eSheenTint];
+        surface.clearcoat          = materialResource->scalarAttributeValues[eClearcoat];
+        surface.clearcoatGloss     = materialResource->scalarAttributeValues[eClearcoatGloss];
+        surface.specTrans          = Saturate(materialResource->scalarAttributeValues[eSpecTrans]);
+        surface.diffTrans          = Saturate(materialResource->scalarAttributeValues[eDiffuseTrans]);
+        surface.flatness           = materialResource->scalarAttributeValues[eFlatness];
+        surface.anisotropic        = materialResource->scalarAttributeValues[eAnisotropic];
+        surface.specularTint       = materialResource->scalarAttributeValues[eSpecularTint];
+        surface.roughness          = materialResource->scalarAttributeValues[eRoughness];
+        surface.metallic           = Saturate(materialResource->scalarAttributeValues[eMetallic]);
+        surface.scatterDistance    = materialResource->scalarAttributeValues[eScatterDistance];
+        surface.ior                = materialResource->scalarAttributeValues[eIor];
+        surface.lightSetIndex      = modelData->lightSetIndex;
+
+        surface.shader = materialResource->shader;
+    }
+
+    //=============================================================================================================================
+    static bool UsesTextureCoordinates(const ModelGeometryUserData* modelData)
+    {
+        return (modelData->material->flags & eUsesPtex) == 0 && (modelData->flags & HasUvs)
+            && modelData->baseColorTextureHandle.Key() != InvalidTextureHandle_;
+    }
+
+    //=============================================================================================================================
+    static float3 UniformBaseColor(TextureCache* textureCache, const ModelGeometryUserData* modelData)
+    {
+        // -- Without uvs the whole surface maps to one color so use the average from the last mip
+        Align_(16) float2 uvs = float2(0.0f, 0.0f);
+
+        const TextureResource* baseColorTexture = textureCache->FetchTexture(modelData->baseColorTextureHandle);
+        float lod = baseColorTexture ? (float)(baseColorTexture->data->mipCount - 1) : 0.0f;
+        float3 baseColor = SampleTextureFloat3(baseColorTexture, uvs, lod, true, modelData->material->baseColor);
+        textureCache->ReleaseTexture(modelData->baseColorTextureHandle);
+
+        return Pow(baseColor, 2.2f);
+    }
+
+    //=============================================================================================================================
+    // -- Interpolates the uvs of the hit and returns the ratio of uv area to world space area of the surface around it. The
+    // -- subscene geometry must be pinned.
+    static float2 InterpolateTextureCoordinates(const ModelGeometryUserData* modelData, const float4x4& localToWorld,
+                                                const HitParameters* hit, float& uvAreaRatio)
+    {
+        Align_(16) float uvs[2];
+        Align_(16) float dUVdu[2];
+        Align_(16) float dUVdv[2];
+        rtcInterpolate1(modelData->rtcGeometry, hit->primId, hit->baryCoords.x, hit->baryCoords.y,
+                        RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 2, uvs, dUVdu, dUVdv, 2);
+
+        Align_(16) float position[3];
+        Align_(16) float dPdu[3];
+        Align_(16) float dPdv[3];
+        rtcInterpolate1(modelData->rtcGeometry, hit->primId, hit->baryCoords.x, hit->baryCoords.y, RTC_BUFFER_TYPE_VERTEX, 0,
+                        position, dPdu, dPdv, 3);
+
+        float3 worldDPdu = MatrixMultiplyVector(float3(dPdu[0], dPdu[1], dPdu[2]), localToWorld);
+        float3 worldDPdv = MatrixMultiplyVector(float3(dPdv[0], dPdv[1], dPdv[2]), localToWorld);
+
+        // -- Both areas are per unit of the primitive's parameterization so their ratio works for triangles and quads alike
+        float worldArea = Length(Cross(worldDPdu, worldDPdv));
+        float uvArea = Math::Absf(dUVdu[0] * dUVdv[1] - dUVdu[1] * dUVdv[0]);
+        uvAreaRatio = worldArea > 0.0f ? uvArea / worldArea : 0.0f;
+
+        return float2(uvs[0], uvs[1]);
+    }
+
+    //=============================================================================================================================
+    // -- Mip level from the ray cone footprint. See "Texture Level of Detail Strategies for Real-Time Ray Tracing" in Ray
+    // -- Tracing Gems.
+    static float TextureLod(const TextureResource* texture, const HitParameters* hit, float3 n, float uvAreaRatio)
+    {
+        #if ForceNoMips_
+            return 0.0f;
+        #endif
+
+        float texelAreaRatio = uvAreaRatio * texture->data->mipWidths[0] * texture->data->mipHeights[0];
+        float cosTheta = Math::Absf(Dot(n, hit->view));
+        if(texelAreaRatio <= 0.0f || hit->cone.width <= 0.0f || cosTheta <= 0.0f) {
+            return 0.0f;
         }
-        else if(texture->data->format == TextureResourceData::Float4) {
-            return SampleTexture(texture, uvs, sRGB, float4(defaultValue, defaultValue, defaultValue, defaultValue));
+
+        float lod = 0.5f * Math::Log2(texelAreaRatio) + Math::Log2(hit->cone.width / cosTheta);
+        return Max<float>(lod, 0.0f);
+    }
+
+    //=============================================================================================================================
+    static float3 SampleBaseColor(TextureCache* textureCache, const ModelGeometryUserData* modelData, const HitParameters* hit,
+                                  float3 n, float2 uvs, float uvAreaRatio)
+    {
+        const TextureResource* baseColorTexture = textureCache->FetchTexture(modelData->baseColorTextureHandle);
+        float lod = baseColorTexture ? TextureLod(baseColorTexture, hit, n, uvAreaRatio) : 0.0f;
+        float3 baseColor = SampleTextureFloat3(baseColorTexture, uvs, lod, true, modelData->material->baseColor);
+        textureCache->ReleaseTexture(modelData->baseColorTextureHandle);
+
+        return Pow(baseColor, 2.2f);
+    }
+
+    //=============================================================================================================================
+    static float3 TexturedBaseColor(GIIntegratorContext* context, const ModelGeometryUserData* modelData,
+                                    const float4x4& localToWorld, const HitParameters* hit, float3 n)
+    {
+        // -- The caller pinned the subscene with PinSurfaceGeometry
+        float uvAreaRatio;
+        float2 uvs = InterpolateTextureCoordinates(modelData, localToWorld, hit, uvAreaRatio);
+
+        return SampleBaseColor(context->textureCache, modelData, hit, n, uvs, uvAreaRatio);
+    }
+
+    //=============================================================================================================================
+    static float3 EvaluatePtexBaseColor(Ptex::PtexFilter* filter, const HitParameters* hit)
+    {
+        float3 sample;
+        filter->eval(&sample.x, 0, 3, hit->primId, hit->baryCoords.x, hit->baryCoords.y, 0, 0, 0, 0);
+        return Pow(sample, 2.2f);
+    }
+
+    //=============================================================================================================================
+    static void FillHitParameters(const HitParameters* hit, float3 t, float3 n, float3 b, SurfaceParameters& surface)
+    {
+        // -- Calculate tangent space transforms
+        float3x3 tangentToWorld = MakeFloat3x3(t, n, b);
+
+        surface.worldToTangent = MatrixTranspose(tangentToWorld);
+        surface.position       = hit->position;
+        surface.error          = hit->error;
+        surface.view           = hit->view;
+
+        // -- better way to handle this would be for the ray to know what IOR it is within
+        surface.relativeIOR = ((surface.materialFlags & eTransparent) && Dot(hit->view, n) < 0.0f) 
+                            ? surface.ior : 1.0f / surface.ior;
+    }
+
+    //=============================================================================================================================
+    bool PinSurfaceGeometry(GIIntegratorContext* context, const HitParameters* hit, SubsceneResource*& pinned)
+    {
+        pinned = nullptr;
+
+        // -- Only the material and texture handles are read here and those stay in memory when the geometry is evicted
+        float4x4 localToWorld;
+        ModelGeometryUserData* modelData;
+        ModelDataFromRayIds(context->scene, hit->instId, hit->geomId, localToWorld, modelData);
+        if(UsesTextureCoordinates(modelData) == false) {
+            return true;
+        }
+
+        SubsceneResource* subscene = SubsceneFromRayIds(context->scene, hit->instId);
+        if(context->geometryCache->TryUseSubsceneGeometry(subscene) == false) {
+            return false;
         }
 
-        Assert_(false);
-        return float4(0.0f);
+        pinned = subscene;
+        return true;
     }
 
     //=============================================================================================================================
-    bool CalculateSurfaceParams(const GIIntegratorContext* context, const HitParameters* __restrict hit,
+    bool CalculateSurfaceParams(GIIntegratorContext* context, const HitParameters* __restrict hit,
                                 SurfaceParameters& surface)
     {
         float4x4 localToWorld;
@@ -148,7 +299,6 @@ namespace Selas
         ModelDataFromRayIds(context->scene, hit->instId, hit->geomId, localToWorld, modelData);
 
         TextureCache* textureCache = context->textureCache;
-        GeometryCache* geometryCache = context->geometryCache;
         const MaterialResourceData* materialResource = modelData->material;
 
         // JSTODO - Repair all of this.
@@ -179,67 +329,380 @@ namespace Selas
             MakeOrthogonalCoordinateSystem(n, &t, &b);
         //}
 
-        Align_(16) float2 uvs = float2(0.0f, 0.0f);
-        //if(modelData->flags & HasUvs) {
-        //    geometryCache->EnsureSubsceneGeometryLoaded(modelData->subscene);
+        if(materialResource->flags & eUsesPtex) {
+            Ptex::PtexFilter* filter = PtexFilterCache_Fetch(&context->ptexFilters, modelData->baseColorTextureHandle);
+            surface.baseColor = EvaluatePtexBaseColor(filter, hit);
+        }
+        else if(UsesTextureCoordinates(modelData)) {
+            surface.baseColor = TexturedBaseColor(context, modelData, localToWorld, hit, n);
+        }
+        else {
+            surface.baseColor = UniformBaseColor(textureCache, modelData);
+        }
 
-        //    rtcInterpolate0(modelData->rtcGeometry, hit->primId, hit->baryCoords.x, hit->baryCoords.y,
-        //                    RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 2, &uvs.x, 2);
+        FillMaterialParameters(modelData, surface);
+        FillHitParameters(hit, t, n, b, surface);
 
-        //    geometryCache->FinishUsingSubceneGeometry(modelData->subscene);
-        //}
+        return true;
+    }
 
-        if(materialResource->flags & eUsesPtex) {
-            PtexTexture* texture = textureCache->FetchPtex(modelData->baseColorTextureHandle);
+    //=============================================================================================================================
+    static bool SameGeometry(const HitParameters* a, const HitParameters* b)
+    {
+        if(a->geomId != b->geomId) {
+            return false;
+        }
+
+        for(uint scan = 0; scan < MaxInstanceLevelCount_; ++scan) {
+            if(a->instId[scan] != b->instId[scan]) {
+                return false;
+            }
+        }
 
-            Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
-            Ptex::PtexFilter* filter = Ptex::PtexFilter::getFilter(texture, opts);
+        return true;
+    }
 
-            float3 sample;
-            filter->eval(&sample.x, 0, 3, hit->primId, hit->baryCoords.x, hit->baryCoords.y, 0, 0, 0, 0);
-            surface.baseColor = Pow(sample, 2.2f);
+    //=============================================================================================================================
+    // -- Attributes of up to SurfaceBatchWidth_ hits in structure of arrays layout
+    struct TextureCoordinates8
+    {
+        Align_(32) float uv[2][SurfaceBatchWidth_];
+        Align_(32) float dUVdu[2][SurfaceBatchWidth_];
+        Align_(32) float dUVdv[2][SurfaceBatchWidth_];
+        Align_(32) float dPdu[3][SurfaceBatchWidth_];
+        Align_(32) float dPdv[3][SurfaceBatchWidth_];
+    };
 
-            filter->release();
-            texture->release();
+    //=============================================================================================================================
+    // -- Interpolates one attribute buffer for every lane set in mask with a single rtcInterpolateN call and copies those
+    // -- lanes out. Lanes of other geometries are left alone.
+    static void InterpolateLanes(RTCGeometry rtcGeometry, uint32 mask, const uint32* primIds, const float* u, const float* v,
+                                 RTCBufferType bufferType, uint32 bufferSlot, uint32 valueCount, float (*P)[SurfaceBatchWidth_],
+                                 float (*dPdu)[SurfaceBatchWidth_], float (*dPdv)[SurfaceBatchWidth_])
+    {
+        Align_(32) int32 valid[SurfaceBatchWidth_];
+        for(uint lane = 0; lane < SurfaceBatchWidth_; ++lane) {
+            valid[lane] = (mask & (1 << lane)) ? -1 : 0;
         }
-        else {
-            const TextureResource* baseColorTexture = textureCache->FetchTexture(modelData->baseColorTextureHandle);
-            surface.baseColor = SampleTextureFloat3(baseColorTexture, uvs, true, materialResource->baseColor);
-            surface.baseColor = Pow(surface.baseColor, 2.2f);
-            textureCache->ReleaseTexture(modelData->baseColorTextureHandle);
+
+        Align_(32) float values[3][SurfaceBatchWidth_];
+        Align_(32) float valuesDu[3][SurfaceBatchWidth_];
+        Align_(32) float valuesDv[3][SurfaceBatchWidth_];
+        Assert_(valueCount <= 3);
+
+        RTCInterpolateNArguments args;
+        Memory::Zero(&args, sizeof(args));
+        args.geometry   = rtcGeometry;
+        args.valid      = valid;
+        args.primIDs    = primIds;
+        args.u          = u;
+        args.v          = v;
+        args.N          = SurfaceBatchWidth_;
+        args.bufferType = bufferType;
+        args.bufferSlot = bufferSlot;
+        args.P          = P ? &values[0][0] : nullptr;
+        args.dPdu       = &valuesDu[0][0];
+        args.dPdv       = &valuesDv[0][0];
+        args.valueCount = valueCount;
+        rtcInterpolateN(&args);
+
+        for(uint lane = 0; lane < SurfaceBatchWidth_; ++lane) {
+            if((mask & (1 << lane)) == 0) {
+                continue;
+            }
+            for(uint value = 0; value < valueCount; ++value) {
+                if(P) {
+                    P[value][lane] = values[value][lane];
+                }
+                dPdu[value][lane] = valuesDu[value][lane];
+                dPdv[value][lane] = valuesDv[value][lane];
+            }
         }
+    }
 
-        // -- Calculate tangent space transforms
-        float3x3 tangentToWorld = MakeFloat3x3(t, n, b);
+    //=============================================================================================================================
+    // -- Batched InterpolateTextureCoordinates for the lanes set in texturedMask. Lanes that share a geometry, which sorted
+    // -- hits mostly do, are interpolated together. The subscene of every textured lane must be pinned.
+    static void InterpolateTextureCoordinates8(const HitParameters* __restrict hits, uint count, uint32 texturedMask,
+                                               const ModelGeometryUserData* const* laneModels, TextureCoordinates8& coords)
+    {
+        Align_(32) uint32 primIds[SurfaceBatchWidth_];
+        Align_(32) float u[SurfaceBatchWidth_];
+        Align_(32) float v[SurfaceBatchWidth_];
+        for(uint lane = 0; lane < SurfaceBatchWidth_; ++lane) {
+            const HitParameters* hit = &hits[lane < count ? lane : 0];
+            primIds[lane] = hit->primId;
+            u[lane] = hit->baryCoords.x;
+            v[lane] = hit->baryCoords.y;
+        }
 
-        surface.worldToTangent     = MatrixTranspose(tangentToWorld);
-        surface.position           = hit->position;
-        surface.error              = hit->error;
-        surface.materialFlags      = materialResource->flags;
-        surface.transmittanceColor = materialResource->transmittanceColor;
-        surface.sheen              = materialResource->scalarAttributeValues[eSheen];
-        surface.sheenTint          = materialResource->scalarAttributeValues[eSheenTint];
-        surface.clearcoat          = materialResource->scalarAttributeValues[eClearcoat];
-        surface.clearcoatGloss     = materialResource->scalarAttributeValues[eClearcoatGloss];
-        surface.specTrans          = Saturate(materialResource->scalarAttributeValues[eSpecTrans]);
-        surface.diffTrans          = Saturate(materialResource->scalarAttributeValues[eDiffuseTrans]);
-        surface.flatness           = materialResource->scalarAttributeValues[eFlatness];
-        surface.anisotropic        = materialResource->scalarAttributeValues[eAnisotropic];
-        surface.specularTint       = materialResource->scalarAttributeValues[eSpecularTint];
-        surface.roughness          = materialResource->scalarAttributeValues[eRoughness];
-        surface.metallic           = Saturate(materialResource->scalarAttributeValues[eMetallic]);
-        surface.scatterDistance    = materialResource->scalarAttributeValues[eScatterDistance];
-        surface.ior                = materialResource->scalarAttributeValues[eIor];
-        surface.lightSetIndex      = modelData->lightSetIndex;
+        uint32 remaining = texturedMask;
+        while(remaining != 0) {
+            uint first = 0;
+            while((remaining & (1 << first)) == 0) {
+                ++first;
+            }
+
+            RTCGeometry rtcGeometry = laneModels[first]->rtcGeometry;
+            uint32 mask = 0;
+            for(uint lane = first; lane < count; ++lane) {
+                if((remaining & (1 << lane)) && laneModels[lane]->rtcGeometry == rtcGeometry) {
+                    mask |= 1 << lane;
+                }
+            }
+            remaining &= ~mask;
+
+            InterpolateLanes(rtcGeometry, mask, primIds, u, v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 2, 2, coords.uv,
+                             coords.dUVdu, coords.dUVdv);
+            InterpolateLanes(rtcGeometry, mask, primIds, u, v, RTC_BUFFER_TYPE_VERTEX, 0, 3, nullptr, coords.dPdu,
+                             coords.dPdv);
+        }
+    }
 
-        surface.shader = materialResource->shader;
-        surface.view = hit->view;
+    #if SurfaceBatchSimd_
 
-        // -- better way to handle this would be for the ray to know what IOR it is within
-        surface.relativeIOR = ((materialResource->flags & eTransparent) && Dot(hit->view, n) < 0.0f) 
-                            ? surface.ior : 1.0f / surface.ior;
+    //=============================================================================================================================
+    // -- The uv to world space area ratio of InterpolateTextureCoordinates for 8 lanes at once
+    static void CalculateUvAreaRatios(const TextureCoordinates8& coords, const float transform[9][SurfaceBatchWidth_],
+                                      float* uvAreaRatios)
+    {
+        __m256 zero = _mm256_setzero_ps();
+        __m256 signMask = _mm256_set1_ps(-0.0f);
+
+        __m256 world[2][3];
+        const float (*derivatives[2])[SurfaceBatchWidth_] = { coords.dPdu, coords.dPdv };
+        for(uint d = 0; d < 2; ++d) {
+            __m256 x = _mm256_load_ps(derivatives[d][0]);
+            __m256 y = _mm256_load_ps(derivatives[d][1]);
+            __m256 z = _mm256_load_ps(derivatives[d][2]);
+            for(uint axis = 0; axis < 3; ++axis) {
+                world[d][axis] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_load_ps(transform[0 + axis])),
+                                                             _mm256_mul_ps(y, _mm256_load_ps(transform[3 + axis]))),
+                                               _mm256_mul_ps(z, _mm256_load_ps(transform[6 + axis])));
+            }
+        }
 
-        return true;
+        __m256 cx = _mm256_sub_ps(_mm256_mul_ps(world[0][1], world[1][2]), _mm256_mul_ps(world[0][2], world[1][1]));
+        __m256 cy = _mm256_sub_ps(_mm256_mul_ps(world[0][2], world[1][0]), _mm256_mul_ps(world[0][0], world[1][2]));
+        __m256 cz = _mm256_sub_ps(_mm256_mul_ps(world[0][0], world[1][1]), _mm256_mul_ps(world[0][1], world[1][0]));
+        __m256 worldArea = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy)),
+                                                        _mm256_mul_ps(cz, cz)));
+
+        __m256 uvArea = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(coords.dUVdu[0]), _mm256_load_ps(coords.dUVdv[1])),
+                                      _mm256_mul_ps(_mm256_load_ps(coords.dUVdu[1]), _mm256_load_ps(coords.dUVdv[0])));
+        uvArea = _mm256_andnot_ps(signMask, uvArea);
+
+        // -- Lanes with no world space area get a ratio of zero rather than dividing by it
+        __m256 hasArea = _mm256_cmp_ps(worldArea, zero, _CMP_GT_OQ);
+        __m256 ratio = _mm256_div_ps(uvArea, _mm256_blendv_ps(_mm256_set1_ps(1.0f), worldArea, hasArea));
+        _mm256_storeu_ps(uvAreaRatios, _mm256_and_ps(ratio, hasArea));
+    }
+
+    //=============================================================================================================================
+    static void CalculateTangentFrames(const HitParameters* __restrict hits, uint count,
+                                       const float transform[9][SurfaceBatchWidth_], SurfaceParameters* __restrict surfaces)
+    {
+        // -- Gather the normal and view of each hit straight out of the HitParameters array
+        const int32 stride = (int32)(sizeof(HitParameters) / sizeof(float));
+        static_assert(sizeof(HitParameters) % sizeof(float) == 0, "Gather stride must be a whole number of floats");
+
+        __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i indices = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(stride));
+        __m256 mask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32((int32)count), lanes));
+        __m256 zero = _mm256_setzero_ps();
+        __m256 one = _mm256_set1_ps(1.0f);
+
+        __m256 nx = _mm256_mask_i32gather_ps(zero, &hits->normal.x, indices, mask, 4);
+        __m256 ny = _mm256_mask_i32gather_ps(zero, &hits->normal.y, indices, mask, 4);
+        __m256 nz = _mm256_mask_i32gather_ps(zero, &hits->normal.z, indices, mask, 4);
+        __m256 vx = _mm256_mask_i32gather_ps(zero, &hits->view.x, indices, mask, 4);
+        __m256 vy = _mm256_mask_i32gather_ps(zero, &hits->view.y, indices, mask, 4);
+        __m256 vz = _mm256_mask_i32gather_ps(zero, &hits->view.z, indices, mask, 4);
+
+        // -- MatrixMultiplyVector followed by Normalize
+        __m256 wx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_load_ps(transform[0])),
+                                                _mm256_mul_ps(ny, _mm256_load_ps(transform[3]))),
+                                  _mm256_mul_ps(nz, _mm256_load_ps(transform[6])));
+        __m256 wy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_load_ps(transform[1])),
+                                                _mm256_mul_ps(ny, _mm256_load_ps(transform[4]))),
+                                  _mm256_mul_ps(nz, _mm256_load_ps(transform[7])));
+        __m256 wz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_load_ps(transform[2])),
+                                                _mm256_mul_ps(ny, _mm256_load_ps(transform[5]))),
+                                  _mm256_mul_ps(nz, _mm256_load_ps(transform[8])));
+
+        __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, wx), _mm256_mul_ps(wy, wy)), _mm256_mul_ps(wz, wz));
+        __m256 invLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+        wx = _mm256_mul_ps(wx, invLength);
+        wy = _mm256_mul_ps(wy, invLength);
+        wz = _mm256_mul_ps(wz, invLength);
+
+        // -- MakeOrthogonalCoordinateSystem with both branches evaluated and blended
+        __m256 signMask = _mm256_set1_ps(-0.0f);
+        __m256 useX = _mm256_cmp_ps(_mm256_andnot_ps(signMask, wx), _mm256_andnot_ps(signMask, wy), _CMP_GT_OQ);
+
+        __m256 invLengthX = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(wx, wx), _mm256_mul_ps(wz, wz))));
+        __m256 invLengthY = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(wy, wy), _mm256_mul_ps(wz, wz))));
+
+        __m256 tx = _mm256_blendv_ps(zero, _mm256_mul_ps(_mm256_xor_ps(wz, signMask), invLengthX), useX);
+        __m256 ty = _mm256_blendv_ps(_mm256_mul_ps(wz, invLengthY), zero, useX);
+        __m256 tz = _mm256_blendv_ps(_mm256_mul_ps(_mm256_xor_ps(wy, signMask), invLengthY), _mm256_mul_ps(wx, invLengthX), useX);
+
+        __m256 bx = _mm256_sub_ps(_mm256_mul_ps(wy, tz), _mm256_mul_ps(wz, ty));
+        __m256 by = _mm256_sub_ps(_mm256_mul_ps(wz, tx), _mm256_mul_ps(wx, tz));
+        __m256 bz = _mm256_sub_ps(_mm256_mul_ps(wx, ty), _mm256_mul_ps(wy, tx));
+
+        __m256 dotVN = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, wx), _mm256_mul_ps(vy, wy)), _mm256_mul_ps(vz, wz));
+        int32 backfacing = _mm256_movemask_ps(_mm256_cmp_ps(dotVN, zero, _CMP_LT_OQ));
+
+        Align_(32) float frame[9][SurfaceBatchWidth_];
+        _mm256_store_ps(frame[0], tx);
+        _mm256_store_ps(frame[1], ty);
+        _mm256_store_ps(frame[2], tz);
+        _mm256_store_ps(frame[3], wx);
+        _mm256_store_ps(frame[4], wy);
+        _mm256_store_ps(frame[5], wz);
+        _mm256_store_ps(frame[6], bx);
+        _mm256_store_ps(frame[7], by);
+        _mm256_store_ps(frame[8], bz);
+
+        for(uint lane = 0; lane < count; ++lane) {
+            const HitParameters* hit = &hits[lane];
+            SurfaceParameters& surface = surfaces[lane];
+
+            // -- worldToTangent is the transpose of MakeFloat3x3(t, n, b)
+            surface.worldToTangent.r0 = float3(frame[0][lane], frame[3][lane], frame[6][lane]);
+            surface.worldToTangent.r1 = float3(frame[1][lane], frame[4][lane], frame[7][lane]);
+            surface.worldToTangent.r2 = float3(frame[2][lane], frame[5][lane], frame[8][lane]);
+            surface.position          = hit->position;
+            surface.error             = hit->error;
+            surface.view              = hit->view;
+
+            bool inside = (surface.materialFlags & eTransparent) && (backfacing & (1 << lane));
+            surface.relativeIOR = inside ? surface.ior : 1.0f / surface.ior;
+        }
+    }
+
+    #else
+
+    //=============================================================================================================================
+    static void CalculateUvAreaRatios(const TextureCoordinates8& coords, const float transform[9][SurfaceBatchWidth_],
+                                      float* uvAreaRatios)
+    {
+        for(uint lane = 0; lane < SurfaceBatchWidth_; ++lane) {
+            float3 r0 = float3(transform[0][lane], transform[1][lane], transform[2][lane]);
+            float3 r1 = float3(transform[3][lane], transform[4][lane], transform[5][lane]);
+            float3 r2 = float3(transform[6][lane], transform[7][lane], transform[8][lane]);
+
+            float3 worldDPdu = coords.dPdu[0][lane] * r0 + coords.dPdu[1][lane] * r1 + coords.dPdu[2][lane] * r2;
+            float3 worldDPdv = coords.dPdv[0][lane] * r0 + coords.dPdv[1][lane] * r1 + coords.dPdv[2][lane] * r2;
+
+            float worldArea = Length(Cross(worldDPdu, worldDPdv));
+            float uvArea = Math::Absf(coords.dUVdu[0][lane] * coords.dUVdv[1][lane]
+                                      - coords.dUVdu[1][lane] * coords.dUVdv[0][lane]);
+            uvAreaRatios[lane] = worldArea > 0.0f ? uvArea / worldArea : 0.0f;
+        }
+    }
+
+    //=============================================================================================================================
+    static void CalculateTangentFrames(const HitParameters* __restrict hits, uint count,
+                                       const float transform[9][SurfaceBatchWidth_], SurfaceParameters* __restrict surfaces)
+    {
+        for(uint lane = 0; lane < count; ++lane) {
+            const HitParameters* hit = &hits[lane];
+
+            float3 normal = hit->normal.x * float3(transform[0][lane], transform[1][lane], transform[2][lane])
+                          + hit->normal.y * float3(transform[3][lane], transform[4][lane], transform[5][lane])
+                          + hit->normal.z * float3(transform[6][lane], transform[7][lane], transform[8][lane]);
+
+            float3 n = Normalize(normal);
+            float3 t, b;
+            MakeOrthogonalCoordinateSystem(n, &t, &b);
+
+            FillHitParameters(hit, t, n, b, surfaces[lane]);
+        }
+    }
+
+    #endif
+
+    //=============================================================================================================================
+    void CalculateSurfaceParams(GIIntegratorContext* context, const HitParameters* __restrict hits, uint hitCount,
+                                SurfaceParameters* __restrict surfaces)
+    {
+        TextureCache* textureCache = context->textureCache;
+
+        // -- State for the current run of hits on one geometry
+        const HitParameters* runHit = nullptr;
+        ModelGeometryUserData* modelData = nullptr;
+        float4x4 localToWorld;
+        SurfaceParameters material;
+
+        for(uint blockStart = 0; blockStart < hitCount; blockStart += SurfaceBatchWidth_) {
+            uint count = Min<uint>(SurfaceBatchWidth_, hitCount - blockStart);
+
+            Align_(32) float transform[9][SurfaceBatchWidth_];
+            const ModelGeometryUserData* laneModels[SurfaceBatchWidth_];
+            uint32 texturedMask = 0;
+
+            for(uint lane = 0; lane < count; ++lane) {
+                const HitParameters* hit = &hits[blockStart + lane];
+                SurfaceParameters& surface = surfaces[blockStart + lane];
+
+                if(runHit == nullptr || SameGeometry(runHit, hit) == false) {
+                    ModelDataFromRayIds(context->scene, hit->instId, hit->geomId, localToWorld, modelData);
+                    FillMaterialParameters(modelData, material);
+                    if((material.materialFlags & eUsesPtex) == 0 && UsesTextureCoordinates(modelData) == false) {
+                        material.baseColor = UniformBaseColor(textureCache, modelData);
+                    }
+                    runHit = hit;
+                }
+
+                surface = material;
+                laneModels[lane] = modelData;
+
+                const float4* rows[] = { &localToWorld.r0, &localToWorld.r1, &localToWorld.r2 };
+                for(uint row = 0; row < 3; ++row) {
+                    transform[row * 3 + 0][lane] = rows[row]->x;
+                    transform[row * 3 + 1][lane] = rows[row]->y;
+                    transform[row * 3 + 2][lane] = rows[row]->z;
+                }
+
+                if(material.materialFlags & eUsesPtex) {
+                    Ptex::PtexFilter* filter = PtexFilterCache_Fetch(&context->ptexFilters, modelData->baseColorTextureHandle);
+                    surface.baseColor = EvaluatePtexBaseColor(filter, hit);
+                }
+                else if(UsesTextureCoordinates(modelData)) {
+                    texturedMask |= 1 << lane;
+                }
+            }
+
+            // -- Pad the unused lanes with the first lane's transform so every lane does finite math
+            for(uint lane = count; lane < SurfaceBatchWidth_; ++lane) {
+                for(uint element = 0; element < 9; ++element) {
+                    transform[element][lane] = transform[element][0];
+                }
+            }
+
+            CalculateTangentFrames(hits + blockStart, count, transform, surfaces + blockStart);
+
+            if(texturedMask != 0) {
+                TextureCoordinates8 coords;
+                Memory::Zero(&coords, sizeof(coords));
+                InterpolateTextureCoordinates8(hits + blockStart, count, texturedMask, laneModels, coords);
+
+                Align_(32) float uvAreaRatios[SurfaceBatchWidth_];
+                CalculateUvAreaRatios(coords, transform, uvAreaRatios);
+
+                // -- Texture fetches stay per hit. The normal is the one the tangent frame was built from.
+                for(uint lane = 0; lane < count; ++lane) {
+                    if(texturedMask & (1 << lane)) {
+                        SurfaceParameters& surface = surfaces[blockStart + lane];
+                        float2 uvs = float2(coords.uv[0][lane], coords.uv[1][lane]);
+                        surface.baseColor = SampleBaseColor(textureCache, laneModels[lane], &hits[blockStart + lane],
+                                                            GeometricNormal(surface), uvs, uvAreaRatios[lane]);
+                    }
+                }
+            }
+        }
     }
 
     //=============================================================================================================================
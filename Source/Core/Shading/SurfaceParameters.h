@@ -13,6 +13,7 @@ namespace Selas
     struct GIIntegratorContext;
     struct HitParameters;
     struct ModelResource;
+    struct SubsceneResource;
     struct MaterialResourceData;
 
     struct SurfaceParameters
@@ -48,7 +49,16 @@ namespace Selas
         uint32 lightSetIndex;
     };
 
-    bool CalculateSurfaceParams(const GIIntegratorContext* context, const HitParameters* hit, SurfaceParameters& surface);
+    // -- Textured surfaces interpolate the uvs of the hit so the subscene of the hit must be pinned around
+    // -- CalculateSurfaceParams. Returns false when it is needed but not resident, in which case it has been requested and
+    // -- the hit should be deferred. Otherwise pinned is the subscene to pass to FinishUsingSubceneGeometry, or nullptr.
+    bool PinSurfaceGeometry(GIIntegratorContext* context, const HitParameters* hit, SubsceneResource*& pinned);
+    bool CalculateSurfaceParams(GIIntegratorContext* context, const HitParameters* hit, SurfaceParameters& surface);
+    // -- Fills surfaces[i] for each of the hits as CalculateSurfaceParams would. Consecutive hits on the same geometry share
+    // -- the model lookup, transform and material setup so hits should be sorted by material and texture. Tangent frames are
+    // -- computed 8 hits at a time. Every hit needs its subscene pinned just as the single hit version does.
+    void CalculateSurfaceParams(GIIntegratorContext* context, const HitParameters* hits, uint hitCount,
+                                SurfaceParameters* surfaces);
     bool CalculatePassesAlphaTest(const ModelGeometryUserData* geomData, uint32 geomId, uint32 primitiveId, float2 baryCoords);
     float CalculateDisplacement(const ModelGeometryUserData* geomData, RTCGeometry rtcGeometry, uint32 primId, float2 barys);
 
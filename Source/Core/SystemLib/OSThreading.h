@@ -20,6 +20,8 @@ namespace Selas
     // bool     WaitForAllObjects(uint32 handleCount, void** handles, uint32 milliseconds);
 
     // Semaphores
+    #define InfiniteWait_ 0xFFFFFFFF
+
     void*    CreateOSSemaphore(uint32 initialCount, uint32 maxCount);
     void     CloseOSSemaphore(void* semaphore);
     void     PostSemaphore(void* semaphore, uint32 count);
@@ -35,4 +37,7 @@ namespace Selas
 
     // Sleep
     void     Sleep(uint sleepTimeMs);
+
+    // Number of logical processors available to this process
+    uint     ProcessorCount();
 }
\ No newline at end of file
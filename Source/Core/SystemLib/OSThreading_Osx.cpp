@@ -82,7 +82,12 @@ namespace Selas
     //=============================================================================================================================
     bool WaitForSemaphore(void* semaphore, uint32 milliseconds)
     {
-        return (dispatch_semaphore_wait((dispatch_semaphore_t)semaphore, DISPATCH_TIME_FOREVER) == 0);
+        dispatch_time_t timeout = DISPATCH_TIME_FOREVER;
+        if(milliseconds != InfiniteWait_) {
+            timeout = dispatch_time(DISPATCH_TIME_NOW, (int64_t)milliseconds * NSEC_PER_MSEC);
+        }
+
+        return (dispatch_semaphore_wait((dispatch_semaphore_t)semaphore, timeout) == 0);
     }
 
     //=============================================================================================================================
@@ -111,8 +116,8 @@ namespace Selas
     //=============================================================================================================================
     bool TryEnterSpinLock(void* spinlock)
     {
-        volatile int64* atom = reinterpret_cast<volatile int64*>(spinlock);
-        return __sync_val_compare_and_swap(atom, 1, 0) == 1;
+        volatile int32* address = (volatile int32*)(spinlock);
+        return __sync_val_compare_and_swap(address, 0, 1) == 0;
     }
 
     //=============================================================================================================================
@@ -134,6 +139,13 @@ namespace Selas
     {
         usleep((useconds_t)(sleepTimeMs * 1000));
     }
+
+    //=============================================================================================================================
+    uint ProcessorCount()
+    {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count > 0 ? (uint)count : 1;
+    }
 }
 
 #endif
@@ -132,6 +132,13 @@ namespace Selas
     {
         ::Sleep((DWORD)sleepTimeMs);
     }
+
+    //=============================================================================================================================
+    uint ProcessorCount()
+    {
+        // -- Counts across all processor groups so machines with more than 64 logical processors report all of them.
+        return (uint)::GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    }
 }
 
 #endif
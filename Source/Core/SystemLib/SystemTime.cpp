@@ -16,7 +16,7 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    float ElapsedMicrosecondsF(std::chrono::high_resolution_clock::time_point& since)
+    float SystemTime::ElapsedMicrosecondsF(std::chrono::high_resolution_clock::time_point& since)
     {
         auto current = std::chrono::high_resolution_clock::now();
 
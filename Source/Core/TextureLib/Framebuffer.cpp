@@ -9,11 +9,58 @@
 #include "MathLib/FloatFuncs.h"
 #include "IoLib/Environment.h"
 #include "IoLib/Directory.h"
+#include "IoLib/File.h"
 #include "SystemLib/MemoryAllocation.h"
 #include "SystemLib/Memory.h"
+#include "SystemLib/Atomic.h"
+#include "SystemLib/SystemTime.h"
+#include "SystemLib/JsAssert.h"
+#include "SystemLib/MinMax.h"
+
+#define CheckpointMagic_   0x504B4346 // 'FCKP'
+#define CheckpointVersion_ 2
+
+// -- When disabled writers flush through the single framebuffer spinlock in submission order
+#define TiledWriterFlush_  1
 
 namespace Selas
 {
+    struct FramebufferCheckpointHeader
+    {
+        uint32 magic;
+        uint32 version;
+        uint32 width;
+        uint32 height;
+        uint32 layerCount;
+        uint32 hasStatistics;
+        uint64 completedPasses;
+        uint64 samplesPerPass;
+    };
+
+    //=============================================================================================================================
+    static void ImagesDirectory(FilePathString& dirpath)
+    {
+        FixedString128 root = Environment_Root();
+        uint8 pathsep = StringUtil::PathSeperator();
+
+        FixedStringSprintf(dirpath, "%s_Images%c", root.Ascii(), pathsep);
+        Directory::EnsureDirectoryExists(dirpath.Ascii());
+    }
+
+    //=============================================================================================================================
+    static float Luminance(const float3& rgb)
+    {
+        return 0.2126f * rgb.x + 0.7152f * rgb.y + 0.0722f * rgb.z;
+    }
+
+    //=============================================================================================================================
+    // -- Size in bytes of the statistics arrays as they are laid out in checkpoints
+    static uint64 StatisticsSize(const Framebuffer* frame)
+    {
+        uint64 pixelCount = frame->width * frame->height;
+        return pixelCount * (sizeof(float) + sizeof(float) + sizeof(uint32) + sizeof(uint8));
+    }
+
     //=============================================================================================================================
     void FrameBuffer_Initialize(Framebuffer* frame, uint32 width, uint32 height, uint32 layerCount)
     {
@@ -28,6 +75,23 @@ namespace Selas
             frame->buffers[scan] = AllocArrayAligned_(float3, width * height, 16);
             Memory::Zero(frame->buffers[scan], sizeof(float3) * width * height);
         }
+
+        frame->tileCountX = (width + FramebufferTileSize_ - 1) / FramebufferTileSize_;
+        frame->tileCount = frame->tileCountX * ((height + FramebufferTileSize_ - 1) / FramebufferTileSize_);
+        frame->tileLocks = AllocArrayAligned_(FramebufferLock, frame->tileCount, CacheLineSize_);
+        for(uint scan = 0; scan < frame->tileCount; ++scan) {
+            CreateSpinLock(frame->tileLocks[scan].spinlock);
+        }
+
+        frame->statisticsLayer = 0;
+        frame->secondMoments = nullptr;
+        frame->previousLuminance = nullptr;
+        frame->passCounts = nullptr;
+        frame->activePixels = nullptr;
+
+        frame->flushCount = 0;
+        frame->flushedSamples = 0;
+        frame->flushMicroseconds = 0;
     }
 
     //=============================================================================================================================
@@ -37,25 +101,51 @@ namespace Selas
             FreeAligned_(frame->buffers[scan]);
         }
         Free_(frame->buffers);
+        FreeAligned_(frame->tileLocks);
+
+        SafeFreeAligned_(frame->secondMoments);
+        SafeFreeAligned_(frame->previousLuminance);
+        SafeFreeAligned_(frame->passCounts);
+        SafeFreeAligned_(frame->activePixels);
     }
 
     //=============================================================================================================================
-    void FrameBuffer_Save(Framebuffer* frame, cpointer name)
+    void FrameBuffer_Save(Framebuffer* frame, cpointer name, float scale)
     {
-        FixedString128 root = Environment_Root();
-        uint8 pathsep = StringUtil::PathSeperator();
-
         FilePathString dirpath;
-        FixedStringSprintf(dirpath, "%s_Images%c", root.Ascii(), pathsep);
+        ImagesDirectory(dirpath);
 
-        Directory::EnsureDirectoryExists(dirpath.Ascii());
+        uint indexcount = frame->width * frame->height;
+
+        // -- Scaling into a copy keeps the accumulation buffers intact for progressive rendering
+        float3* scaled = nullptr;
+        if(scale != 1.0f || frame->passCounts != nullptr) {
+            scaled = AllocArrayAligned_(float3, indexcount, 16);
+        }
 
         for(uint32 scan = 0, count = frame->layerCount; scan < count; ++scan) {
             FilePathString filepath;
             FixedStringSprintf(filepath, "%s%s_%u.hdr", dirpath.Ascii(), name, scan);
 
-            StbImageWrite(filepath.Ascii(), frame->width, frame->height, 3, HDR, frame->buffers[scan]);
+            float3* buffer = frame->buffers[scan];
+            if(frame->passCounts != nullptr) {
+                for(uint index = 0; index < indexcount; ++index) {
+                    uint32 passCount = frame->passCounts[index];
+                    scaled[index] = passCount > 0 ? buffer[index] * (scale / passCount) : float3::Zero_;
+                }
+                buffer = scaled;
+            }
+            else if(scaled != nullptr) {
+                for(uint index = 0; index < indexcount; ++index) {
+                    scaled[index] = buffer[index] * scale;
+                }
+                buffer = scaled;
+            }
+
+            StbImageWrite(filepath.Ascii(), frame->width, frame->height, 3, HDR, buffer);
         }
+
+        SafeFreeAligned_(scaled);
     }
 
     //=============================================================================================================================
@@ -69,6 +159,186 @@ namespace Selas
         }
     }
 
+    //=============================================================================================================================
+    void FrameBuffer_EnableStatistics(Framebuffer* frame, uint32 statisticsLayer)
+    {
+        Assert_(statisticsLayer < frame->layerCount);
+        Assert_(frame->secondMoments == nullptr);
+
+        uint pixelCount = frame->width * frame->height;
+
+        frame->statisticsLayer = statisticsLayer;
+        frame->secondMoments = AllocArrayAligned_(float, pixelCount, 16);
+        frame->previousLuminance = AllocArrayAligned_(float, pixelCount, 16);
+        frame->passCounts = AllocArrayAligned_(uint32, pixelCount, 16);
+        frame->activePixels = AllocArrayAligned_(uint8, pixelCount, 16);
+
+        Memory::Zero(frame->secondMoments, sizeof(float) * pixelCount);
+        Memory::Zero(frame->previousLuminance, sizeof(float) * pixelCount);
+        Memory::Zero(frame->passCounts, sizeof(uint32) * pixelCount);
+        Memory::Set(frame->activePixels, 1, sizeof(uint8) * pixelCount);
+    }
+
+    //=============================================================================================================================
+    uint FrameBuffer_UpdateStatistics(Framebuffer* frame, uint32 samplesPerPass, float errorThreshold, uint32 minPassCount)
+    {
+        Assert_(frame->secondMoments != nullptr);
+
+        const float3* buffer = frame->buffers[frame->statisticsLayer];
+        float invSamplesPerPass = 1.0f / samplesPerPass;
+
+        uint activeCount = 0;
+        for(uint index = 0, pixelCount = frame->width * frame->height; index < pixelCount; ++index) {
+            if(frame->activePixels[index] == 0) {
+                continue;
+            }
+
+            float luminance = Luminance(buffer[index]);
+            float passEstimate = (luminance - frame->previousLuminance[index]) * invSamplesPerPass;
+            frame->previousLuminance[index] = luminance;
+            frame->secondMoments[index] += passEstimate * passEstimate;
+            uint32 passCount = ++frame->passCounts[index];
+
+            if(passCount < minPassCount || passCount < 2) {
+                ++activeCount;
+                continue;
+            }
+
+            // -- Standard error of the mean of the pass estimates relative to the mean
+            float mean = luminance * invSamplesPerPass / passCount;
+            float variance = Max<float>(frame->secondMoments[index] / passCount - mean * mean, 0.0f) * passCount
+                           / (passCount - 1);
+            float standardError = Math::Sqrtf(variance / passCount);
+
+            if(standardError > errorThreshold * Max<float>(mean, 1e-3f)) {
+                ++activeCount;
+            }
+            else {
+                frame->activePixels[index] = 0;
+            }
+        }
+
+        return activeCount;
+    }
+
+    //=============================================================================================================================
+    Error FrameBuffer_WriteCheckpoint(Framebuffer* frame, cpointer name, uint64 completedPasses, uint64 samplesPerPass)
+    {
+        FilePathString dirpath;
+        ImagesDirectory(dirpath);
+
+        FilePathString filepath;
+        FixedStringSprintf(filepath, "%s%s.checkpoint", dirpath.Ascii(), name);
+        FilePathString temppath;
+        FixedStringSprintf(temppath, "%s%s.checkpoint.tmp", dirpath.Ascii(), name);
+
+        uint64 layerSize = sizeof(float3) * frame->width * frame->height;
+        bool hasStatistics = frame->secondMoments != nullptr;
+        uint64 size = sizeof(FramebufferCheckpointHeader) + layerSize * frame->layerCount;
+        if(hasStatistics) {
+            size += StatisticsSize(frame);
+        }
+
+        uint8* data = (uint8*)AllocAligned_(size, 16);
+
+        FramebufferCheckpointHeader* header = (FramebufferCheckpointHeader*)data;
+        header->magic           = CheckpointMagic_;
+        header->version         = CheckpointVersion_;
+        header->width           = frame->width;
+        header->height          = frame->height;
+        header->layerCount      = frame->layerCount;
+        header->hasStatistics   = hasStatistics ? 1 : 0;
+        header->completedPasses = completedPasses;
+        header->samplesPerPass  = samplesPerPass;
+
+        uint8* layers = data + sizeof(FramebufferCheckpointHeader);
+        for(uint scan = 0; scan < frame->layerCount; ++scan) {
+            Memory::Copy(layers + scan * layerSize, frame->buffers[scan], layerSize);
+        }
+
+        if(hasStatistics) {
+            uint64 pixelCount = frame->width * frame->height;
+            uint8* statistics = layers + layerSize * frame->layerCount;
+            Memory::Copy(statistics, frame->secondMoments, sizeof(float) * pixelCount);
+            statistics += sizeof(float) * pixelCount;
+            Memory::Copy(statistics, frame->previousLuminance, sizeof(float) * pixelCount);
+            statistics += sizeof(float) * pixelCount;
+            Memory::Copy(statistics, frame->passCounts, sizeof(uint32) * pixelCount);
+            statistics += sizeof(uint32) * pixelCount;
+            Memory::Copy(statistics, frame->activePixels, sizeof(uint8) * pixelCount);
+        }
+
+        Error err = File::WriteWholeFile(temppath.Ascii(), data, size);
+        FreeAligned_(data);
+        ReturnError_(err);
+
+        return File::Rename(temppath.Ascii(), filepath.Ascii());
+    }
+
+    //=============================================================================================================================
+    Error FrameBuffer_ReadCheckpoint(Framebuffer* frame, cpointer name, uint64 samplesPerPass, uint64* completedPasses)
+    {
+        FilePathString dirpath;
+        ImagesDirectory(dirpath);
+
+        FilePathString filepath;
+        FixedStringSprintf(filepath, "%s%s.checkpoint", dirpath.Ascii(), name);
+
+        if(File::Exists(filepath.Ascii()) == false) {
+            return Error_("No checkpoint found at %s", filepath.Ascii());
+        }
+
+        void* data;
+        uint64 size;
+        ReturnError_(File::ReadWholeFile(filepath.Ascii(), &data, &size));
+
+        bool hasStatistics = frame->secondMoments != nullptr;
+        uint64 layerSize = sizeof(float3) * frame->width * frame->height;
+        uint64 expectedSize = sizeof(FramebufferCheckpointHeader) + layerSize * frame->layerCount;
+        if(hasStatistics) {
+            expectedSize += StatisticsSize(frame);
+        }
+
+        const FramebufferCheckpointHeader* header = (const FramebufferCheckpointHeader*)data;
+
+        Error err = Success_;
+        if(size < sizeof(FramebufferCheckpointHeader) || header->magic != CheckpointMagic_
+           || header->version != CheckpointVersion_) {
+            err = Error_("Invalid checkpoint %s", filepath.Ascii());
+        }
+        else if(header->width != frame->width || header->height != frame->height || header->layerCount != frame->layerCount
+                || header->samplesPerPass != samplesPerPass || (header->hasStatistics != 0) != hasStatistics) {
+            err = Error_("Checkpoint %s was written with different render settings", filepath.Ascii());
+        }
+        else if(size != expectedSize) {
+            err = Error_("Truncated checkpoint %s", filepath.Ascii());
+        }
+
+        if(Successful_(err)) {
+            const uint8* layers = (const uint8*)data + sizeof(FramebufferCheckpointHeader);
+            for(uint scan = 0; scan < frame->layerCount; ++scan) {
+                Memory::Copy(frame->buffers[scan], layers + scan * layerSize, layerSize);
+            }
+
+            if(hasStatistics) {
+                uint64 pixelCount = frame->width * frame->height;
+                const uint8* statistics = layers + layerSize * frame->layerCount;
+                Memory::Copy(frame->secondMoments, statistics, sizeof(float) * pixelCount);
+                statistics += sizeof(float) * pixelCount;
+                Memory::Copy(frame->previousLuminance, statistics, sizeof(float) * pixelCount);
+                statistics += sizeof(float) * pixelCount;
+                Memory::Copy(frame->passCounts, statistics, sizeof(uint32) * pixelCount);
+                statistics += sizeof(uint32) * pixelCount;
+                Memory::Copy(frame->activePixels, statistics, sizeof(uint8) * pixelCount);
+            }
+
+            *completedPasses = header->completedPasses;
+        }
+
+        FreeAligned_(data);
+        return err;
+    }
+
     //=============================================================================================================================
     void FramebufferWriter_Initialize(FramebufferWriter* writer, Framebuffer* frame, uint32 capacity, uint32 softCapacity)
     {
@@ -79,25 +349,134 @@ namespace Selas
 
         writer->sampleIndices = AllocArrayAligned_(uint32, capacity, 16);
         writer->samples = AllocArrayAligned_(float3, frame->layerCount * capacity, 16);
+
+        writer->tileOffsets = AllocArrayAligned_(uint32, (frame->tileCount + 1), 16);
+        writer->sortedIndices = AllocArrayAligned_(uint32, capacity, 16);
+        writer->sortedSamples = AllocArrayAligned_(float3, frame->layerCount * capacity, 16);
+
+        writer->flushCount = 0;
+        writer->flushedSamples = 0;
+        writer->flushMicroseconds = 0.0f;
+    }
+
+    //=============================================================================================================================
+    static uint32 TileIndex(const Framebuffer* frame, uint32 index)
+    {
+        uint32 y = index / frame->width;
+        uint32 x = index - y * frame->width;
+        return (y / FramebufferTileSize_) * frame->tileCountX + (x / FramebufferTileSize_);
     }
 
     //=============================================================================================================================
-    static void FlushInternal(FramebufferWriter* __restrict writer)
+    static void AccumulateSamples(Framebuffer* __restrict frame, const uint32* indices, const float3* samples, uint count)
     {
-        Assert_(*writer->framebuffer->spinlock == 1);
+        uint layerCount = frame->layerCount;
+        for(uint scan = 0; scan < count; ++scan) {
+            uint32 index = indices[scan];
 
-        uint layerCount = writer->framebuffer->layerCount;
+            for(uint layer = 0; layer < layerCount; ++layer) {
+                frame->buffers[layer][index] += samples[layerCount * scan + layer];
+            }
+        }
+    }
 
+    //=============================================================================================================================
+    // -- Buckets the pending samples by tile with a counting sort and accumulates each bucket under its tile's lock. When
+    // -- blocking is false buckets whose tile is locked by another writer are kept for a later flush.
+    static void FlushTiled(FramebufferWriter* __restrict writer, bool blocking)
+    {
         Framebuffer* frame = writer->framebuffer;
-        for(uint scan = 0, count = writer->count; scan < count; ++scan) {
+        uint layerCount = frame->layerCount;
+        uint count = writer->count;
+
+        uint32* tileOffsets = writer->tileOffsets;
+        Memory::Zero(tileOffsets, sizeof(uint32) * (frame->tileCount + 1));
+
+        for(uint scan = 0; scan < count; ++scan) {
+            ++tileOffsets[TileIndex(frame, writer->sampleIndices[scan]) + 1];
+        }
+        for(uint scan = 0; scan < frame->tileCount; ++scan) {
+            tileOffsets[scan + 1] += tileOffsets[scan];
+        }
+
+        // -- Scatter into the sorted arrays. tileOffsets[tile] ends up at the end of the bucket so the bucket start is
+        // -- recovered from the previous entry.
+        for(uint scan = 0; scan < count; ++scan) {
             uint32 index = writer->sampleIndices[scan];
+            uint32 dst = tileOffsets[TileIndex(frame, index)]++;
 
+            writer->sortedIndices[dst] = index;
             for(uint layer = 0; layer < layerCount; ++layer) {
-                frame->buffers[layer][index] += writer->samples[layerCount * scan + layer];
+                writer->sortedSamples[layerCount * dst + layer] = writer->samples[layerCount * scan + layer];
             }
         }
-        
+
         writer->count = 0;
+
+        uint32 bucketStart = 0;
+        for(uint tile = 0; tile < frame->tileCount; ++tile) {
+            uint32 bucketEnd = tileOffsets[tile];
+            uint32 bucketCount = bucketEnd - bucketStart;
+            if(bucketCount == 0) {
+                continue;
+            }
+
+            void* tileLock = frame->tileLocks[tile].spinlock;
+            bool locked = true;
+            if(blocking) {
+                EnterSpinLock(tileLock);
+            }
+            else {
+                locked = TryEnterSpinLock(tileLock);
+            }
+
+            if(locked) {
+                AccumulateSamples(frame, writer->sortedIndices + bucketStart,
+                                  writer->sortedSamples + layerCount * bucketStart, bucketCount);
+                LeaveSpinLock(tileLock);
+                writer->flushedSamples += bucketCount;
+            }
+            else {
+                Memory::Copy(writer->sampleIndices + writer->count, writer->sortedIndices + bucketStart,
+                             sizeof(uint32) * bucketCount);
+                Memory::Copy(writer->samples + layerCount * writer->count, writer->sortedSamples + layerCount * bucketStart,
+                             sizeof(float3) * layerCount * bucketCount);
+                writer->count += bucketCount;
+            }
+
+            bucketStart = bucketEnd;
+        }
+    }
+
+    //=============================================================================================================================
+    static void FlushInternal(FramebufferWriter* __restrict writer, bool blocking)
+    {
+        auto timer = SystemTime::Now();
+
+        #if TiledWriterFlush_
+            FlushTiled(writer, blocking);
+        #else
+            Framebuffer* frame = writer->framebuffer;
+
+            bool locked = true;
+            if(blocking) {
+                EnterSpinLock(frame->spinlock);
+            }
+            else {
+                locked = TryEnterSpinLock(frame->spinlock);
+            }
+
+            if(locked) {
+                AccumulateSamples(frame, writer->sampleIndices, writer->samples, writer->count);
+                LeaveSpinLock(frame->spinlock);
+
+                writer->flushedSamples += writer->count;
+                writer->count = 0;
+            }
+        #endif
+
+        ++writer->flushCount;
+        writer->flushMicroseconds += SystemTime::ElapsedMicrosecondsF(timer);
     }
 
     //=============================================================================================================================
@@ -124,29 +503,30 @@ namespace Selas
         ++writer->count;
 
         if(writer->count > writer->softCapacity) {
-            bool locked = TryEnterSpinLock(writer->framebuffer->spinlock);
-            if(!locked) {
-                return;
-            }
-
-            FlushInternal(writer);
-            LeaveSpinLock(writer->framebuffer->spinlock);
+            FlushInternal(writer, false);
         }
     }
 
     //=============================================================================================================================
     void FramebufferWriter_Flush(FramebufferWriter* writer)
     {
-        EnterSpinLock(writer->framebuffer->spinlock);
-        FlushInternal(writer);
-        LeaveSpinLock(writer->framebuffer->spinlock);
+        FlushInternal(writer, true);
     }
 
     //=============================================================================================================================
     void FramebufferWriter_Shutdown(FramebufferWriter* writer)
     {
         FramebufferWriter_Flush(writer);
+
+        Framebuffer* frame = writer->framebuffer;
+        Atomic::Add64(&frame->flushCount, (int64)writer->flushCount);
+        Atomic::Add64(&frame->flushedSamples, (int64)writer->flushedSamples);
+        Atomic::Add64(&frame->flushMicroseconds, (int64)writer->flushMicroseconds);
+
+        FreeAligned_(writer->sortedSamples);
+        FreeAligned_(writer->sortedIndices);
+        FreeAligned_(writer->tileOffsets);
         FreeAligned_(writer->samples);
         FreeAligned_(writer->sampleIndices);
     }
-}
\ No newline at end of file
+}
@@ -13,14 +13,38 @@ namespace Selas
 {
     #define DefaultFrameWriterCapacity_     4096
     #define DefaultFrameWriterSoftCapacity_ 3840
+    #define FramebufferTileSize_            32
+
+    struct FramebufferLock
+    {
+        uint8 spinlock[CacheLineSize_];
+    };
 
     struct Framebuffer
     {
         uint32  width;
         uint32  height;
         uint32  layerCount;
+        uint32  tileCountX;
+        uint32  tileCount;
         float3** buffers;
+        // -- One lock per FramebufferTileSize_ square of pixels so writers flushing to different parts of the image don't
+        // -- contend.
+        FramebufferLock* tileLocks;
         uint8 spinlock[CacheLineSize_];
+
+        // -- Optional per-pixel statistics used for adaptive sampling. Each completed pass is one estimate of the pixel and the
+        // -- statistics track the luminance of statisticsLayer across those estimates.
+        uint32  statisticsLayer;
+        float*  secondMoments;
+        float*  previousLuminance;
+        uint32* passCounts;
+        uint8*  activePixels;
+
+        // -- Totals across all writers that have been shut down
+        volatile int64 flushCount;
+        volatile int64 flushedSamples;
+        volatile int64 flushMicroseconds;
     };
 
     struct FramebufferWriter
@@ -32,13 +56,40 @@ namespace Selas
         uint32* sampleIndices;
         float3* samples;
         Framebuffer* framebuffer;
+
+        // -- Scratch used to bucket samples by tile before flushing
+        uint32* tileOffsets;
+        uint32* sortedIndices;
+        float3* sortedSamples;
+
+        uint64 flushCount;
+        uint64 flushedSamples;
+        float  flushMicroseconds;
     };
 
     void FrameBuffer_Initialize(Framebuffer* frame, uint32 width, uint32 height, uint32 layerCount);
     void FrameBuffer_Shutdown(Framebuffer* frame);
-    void FrameBuffer_Save(Framebuffer* frame, cpointer name);
+    // -- When statistics are enabled each pixel is additionally divided by its pass count
+    void FrameBuffer_Save(Framebuffer* frame, cpointer name, float scale = 1.0f);
     void FrameBuffer_Scale(Framebuffer* frame, float value);
 
+    void FrameBuffer_EnableStatistics(Framebuffer* frame, uint32 statisticsLayer);
+    // -- Folds the pass that just completed into the statistics of every active pixel then deactivates pixels that have at
+    // -- least minPassCount passes and a relative standard error of the mean below errorThreshold. Returns the number of
+    // -- pixels still active.
+    uint  FrameBuffer_UpdateStatistics(Framebuffer* frame, uint32 samplesPerPass, float errorThreshold, uint32 minPassCount);
+
+    inline bool FrameBuffer_PixelActive(const Framebuffer* frame, uint32 index)
+    {
+        return frame->activePixels == nullptr || frame->activePixels[index] != 0;
+    }
+
+    // -- Checkpoints hold the unscaled accumulation buffers along with the number of completed passes and the samples per pixel
+    // -- each pass adds. They are written to a temporary file that then replaces the previous checkpoint so a process killed
+    // -- mid-write leaves the last complete checkpoint intact.
+    Error FrameBuffer_WriteCheckpoint(Framebuffer* frame, cpointer name, uint64 completedPasses, uint64 samplesPerPass);
+    Error FrameBuffer_ReadCheckpoint(Framebuffer* frame, cpointer name, uint64 samplesPerPass, uint64* completedPasses);
+
     void FramebufferWriter_Initialize(FramebufferWriter* writer, Framebuffer* frame,
                                       uint32 capacity = DefaultFrameWriterCapacity_,
                                       uint32 softCapacity = DefaultFrameWriterSoftCapacity_);
@@ -0,0 +1,125 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "TextureLib/PtexFilterCache.h"
+#include "SystemLib/Atomic.h"
+#include "SystemLib/Logging.h"
+
+namespace Selas
+{
+    //=============================================================================================================================
+    static void ReleaseEntry(PtexFilterCacheEntry* entry)
+    {
+        if(entry->filter != nullptr) {
+            entry->filter->release();
+        }
+        if(entry->texture != nullptr) {
+            entry->texture->release();
+        }
+
+        entry->filter = nullptr;
+        entry->texture = nullptr;
+    }
+
+    //=============================================================================================================================
+    void PtexFilterCache_Initialize(PtexFilterCache* cache, TextureCache* textureCache)
+    {
+        cache->textureCache = textureCache;
+        cache->entryCount = 0;
+        cache->mostRecent = 0;
+        cache->useCounter = 0;
+        Memory::Zero(&cache->stats, sizeof(cache->stats));
+    }
+
+    //=============================================================================================================================
+    void PtexFilterCache_Shutdown(PtexFilterCache* cache)
+    {
+        for(uint scan = 0; scan < cache->entryCount; ++scan) {
+            ReleaseEntry(&cache->entries[scan]);
+        }
+
+        cache->entryCount = 0;
+        cache->mostRecent = 0;
+    }
+
+    //=============================================================================================================================
+    Ptex::PtexFilter* PtexFilterCache_Fetch(PtexFilterCache* cache, TextureHandle handle)
+    {
+        Hash32 key = handle.Key();
+
+        ++cache->stats.lookups;
+        ++cache->useCounter;
+
+        // -- Sorted hits usually repeat the previous texture so check it before scanning
+        if(cache->entryCount > 0 && cache->entries[cache->mostRecent].key == key) {
+            PtexFilterCacheEntry* entry = &cache->entries[cache->mostRecent];
+            entry->lastUse = cache->useCounter;
+            return entry->filter;
+        }
+
+        for(uint scan = 0; scan < cache->entryCount; ++scan) {
+            PtexFilterCacheEntry* entry = &cache->entries[scan];
+            if(entry->key == key) {
+                entry->lastUse = cache->useCounter;
+                cache->mostRecent = (uint32)scan;
+                return entry->filter;
+            }
+        }
+
+        // -- Miss. Use a free slot or evict the least recently used entry.
+        uint slot = cache->entryCount;
+        if(slot == PtexFilterCacheCapacity_) {
+            slot = 0;
+            for(uint scan = 1; scan < cache->entryCount; ++scan) {
+                if(cache->entries[scan].lastUse < cache->entries[slot].lastUse) {
+                    slot = scan;
+                }
+            }
+
+            ReleaseEntry(&cache->entries[slot]);
+            ++cache->stats.evictions;
+        }
+        else {
+            ++cache->entryCount;
+        }
+
+        PtexFilterCacheEntry* entry = &cache->entries[slot];
+        entry->key = key;
+        entry->lastUse = cache->useCounter;
+        entry->filter = nullptr;
+
+        entry->texture = cache->textureCache->FetchPtex(handle);
+        ++cache->stats.ptexFetches;
+
+        if(entry->texture != nullptr) {
+            Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
+            entry->filter = Ptex::PtexFilter::getFilter(entry->texture, opts);
+            ++cache->stats.filterConstructions;
+        }
+
+        cache->mostRecent = (uint32)slot;
+        return entry->filter;
+    }
+
+    //=============================================================================================================================
+    void PtexFilterCache_AccumulateStats(const PtexFilterCache* cache, PtexFilterCacheStats* total)
+    {
+        Atomic::AddU64(&total->lookups, cache->stats.lookups);
+        Atomic::AddU64(&total->ptexFetches, cache->stats.ptexFetches);
+        Atomic::AddU64(&total->filterConstructions, cache->stats.filterConstructions);
+        Atomic::AddU64(&total->evictions, cache->stats.evictions);
+    }
+
+    //=============================================================================================================================
+    void PtexFilterCache_LogStats(const PtexFilterCacheStats* stats)
+    {
+        if(stats->lookups == 0) {
+            return;
+        }
+
+        float hitRate = 100.0f * (float)(stats->lookups - stats->ptexFetches) / stats->lookups;
+        WriteDebugInfo_("Ptex lookups %llu: %llu texture fetches, %llu filter constructions, %llu evictions (%.2f%% cached)",
+                        stats->lookups, stats->ptexFetches, stats->filterConstructions, stats->evictions, hitRate);
+    }
+}
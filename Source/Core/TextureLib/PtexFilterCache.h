@@ -0,0 +1,63 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "TextureLib/TextureCache.h"
+#include "SystemLib/Memory.h"
+#include "SystemLib/BasicTypes.h"
+
+#define PtexFilterCacheCapacity_ 8
+
+namespace Selas
+{
+    struct PtexFilterCacheStats
+    {
+        volatile uint64 lookups;
+        // -- Lookups that missed and had to call TextureCache::FetchPtex and build a new bspline filter
+        volatile uint64 ptexFetches;
+        volatile uint64 filterConstructions;
+        volatile uint64 evictions;
+    };
+
+    struct PtexFilterCacheEntry
+    {
+        Hash32 key;
+        uint64 lastUse;
+        Ptex::PtexTexture* texture;
+        Ptex::PtexFilter* filter;
+    };
+
+    // -- Small per-thread cache of open ptex textures and their filters. Not thread safe; each integrator thread owns one. The
+    // -- cached textures hold a reference in the shared PtexCache until the entry is evicted or the cache is shut down so it
+    // -- must be shut down before the TextureCache.
+    struct PtexFilterCache
+    {
+        PtexFilterCache()
+            : textureCache(nullptr)
+            , entryCount(0)
+            , mostRecent(0)
+            , useCounter(0)
+        {
+            Memory::Zero(&stats, sizeof(stats));
+        }
+
+        TextureCache*        textureCache;
+        PtexFilterCacheEntry entries[PtexFilterCacheCapacity_];
+        uint32               entryCount;
+        uint32               mostRecent;
+        uint64               useCounter;
+        PtexFilterCacheStats stats;
+    };
+
+    void PtexFilterCache_Initialize(PtexFilterCache* cache, TextureCache* textureCache);
+    void PtexFilterCache_Shutdown(PtexFilterCache* cache);
+
+    // -- Returns the bspline filter for the texture. The filter stays owned by the cache and is valid until the next call.
+    Ptex::PtexFilter* PtexFilterCache_Fetch(PtexFilterCache* cache, TextureHandle handle);
+
+    // -- Atomically adds the counters of the cache to total so worker threads can share one total
+    void PtexFilterCache_AccumulateStats(const PtexFilterCache* cache, PtexFilterCacheStats* total);
+    void PtexFilterCache_LogStats(const PtexFilterCacheStats* stats);
+}
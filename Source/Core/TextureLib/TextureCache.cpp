@@ -4,34 +4,430 @@
 
 #include "TextureLib/TextureCache.h"
 #include "TextureLib/TextureFiltering.h"
+#include "Assets/AssetFileUtils.h"
+#include "IoLib/File.h"
 #include "SystemLib/JsAssert.h"
 #include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/Memory.h"
+#include "SystemLib/OSThreading.h"
 #include "SystemLib/Atomic.h"
+#include "SystemLib/Logging.h"
 
-#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+// -- Faces are warmed by PrefetchPtex at no more than 2^PtexPrefetchResLog2_ texels on a side
+#define PtexPrefetchResLog2_ 3
+#define PtexReadBufferSize_  (64 * 1024)
 
 namespace Selas
 {
+    static_assert((TextureCacheSlotCount_ & (TextureCacheSlotCount_ - 1)) == 0, "Slot count must be a power of two");
+
+    enum TextureResidency
+    {
+        eNotResident,
+        eLoading,
+        eResident,
+        eEvicting
+    };
+
+    struct TextureCacheData;
+
     struct TextureMapEntry
     {
         volatile int64 usageRefCount;
-        uint32 loadRefCount;     
-        FilePathString ptexFilePath;
+        volatile int32 loadRefCount;
+        // -- eResident once the header and page table are loaded. Tiles are paged in individually by PageInTile.
+        volatile int32 residency;
+        uint32 isPtex;
+        // -- Position of the CLOCK hand within this texture's tiles
+        uint32 tileHand;
+        // -- Header, page table and every resident tile
+        volatile uint64 residentSize;
+        TextureCacheData* cache;
+        FilePathString filePath;
         TextureResource resource;
     };
 
-    typedef std::map<Hash32, TextureMapEntry*>           TextureResourceMap;
-    typedef std::pair<Hash32, TextureMapEntry*>          TextureResourceKeyValue;
-    typedef std::map<Hash32, TextureMapEntry*>::iterator TextureResourceIterator;
+    struct TextureCacheSlot
+    {
+        volatile int32 key;
+        uint32 pad;
+        TextureMapEntry* volatile entry;
+    };
+
+    //=============================================================================================================================
+    // -- Reads ptex files through stdio like Ptex's own handler while counting opens and bytes read. One handler is shared by
+    // -- every reader in the PtexCache so each open file carries its own buffer.
+    class PtexCountingInputHandler : public Ptex::PtexInputHandler
+    {
+    private:
+        struct PtexFileHandle
+        {
+            FILE* file;
+            char* buffer;
+        };
+
+    public:
+        volatile uint64 fileOpens;
+        volatile uint64 bytesRead;
+
+        PtexCountingInputHandler() : fileOpens(0), bytesRead(0) { }
+        virtual ~PtexCountingInputHandler() { }
+
+        //=========================================================================================================================
+        virtual Handle open(const char* path) override
+        {
+            FILE* file = nullptr;
+            #if IsWindows_
+                fopen_s(&file, path, "rb");
+            #else
+                file = fopen(path, "rb");
+            #endif
+            if(file == nullptr) {
+                return nullptr;
+            }
+
+            PtexFileHandle* handle = New_(PtexFileHandle);
+            handle->file = file;
+            handle->buffer = AllocArray_(char, PtexReadBufferSize_);
+            setvbuf(file, handle->buffer, _IOFBF, PtexReadBufferSize_);
+
+            Atomic::AddU64(&fileOpens, 1);
+            return handle;
+        }
+
+        //=========================================================================================================================
+        virtual void seek(Handle handle, int64_t pos) override
+        {
+            FILE* file = ((PtexFileHandle*)handle)->file;
+            #if IsWindows_
+                _fseeki64(file, pos, SEEK_SET);
+            #else
+                fseeko(file, (off_t)pos, SEEK_SET);
+            #endif
+        }
+
+        //=========================================================================================================================
+        virtual size_t read(void* buffer, size_t size, Handle handle) override
+        {
+            size_t count = fread(buffer, 1, size, ((PtexFileHandle*)handle)->file);
+            Atomic::AddU64(&bytesRead, count);
+
+            // -- Ptex treats anything short of the full request as an error
+            return count == size ? size : 0;
+        }
+
+        //=========================================================================================================================
+        virtual bool close(Handle handle) override
+        {
+            PtexFileHandle* fileHandle = (PtexFileHandle*)handle;
+            if(fileHandle == nullptr) {
+                return false;
+            }
+
+            bool success = fclose(fileHandle->file) == 0;
+            Free_(fileHandle->buffer);
+            Delete_(fileHandle);
+
+            return success;
+        }
+
+        //=========================================================================================================================
+        virtual const char* lastError() override
+        {
+            return strerror(errno);
+        }
+    };
 
     struct TextureCacheData
     {
-        TextureResourceMap map;
+        TextureCacheSlot* slots;
         uint64 capacity;
 
+        // -- Eviction is rare compared to fetches so the CLOCK hand is serialized with a spinlock. Lookups never take it. The
+        // -- hand visits each texture in slot order and sweeps its tiles, clearing reference bits and evicting unreferenced
+        // -- tiles of textures no thread has pinned.
+        void* evictionLock;
+        uint32 clockHand;
+
+        volatile uint64 residentBytes;
+        volatile uint64 peakResidentBytes;
+        volatile uint64 fetches;
+        volatile uint64 pageIns;
+        volatile uint64 evictions;
+        volatile uint64 bytesRead;
+
         Ptex::PtexCache* ptexCache;
+        PtexCountingInputHandler* ptexInputHandler;
+        volatile uint64 ptexFetches;
+        volatile uint64 ptexPrefetches;
+
+        // -- Totals at the previous LogStats call
+        TextureCacheStats loggedStats;
     };
 
+    //=============================================================================================================================
+    static TextureCacheSlot* FindSlot(TextureCacheData* cacheData, Hash32 hash)
+    {
+        uint32 mask = TextureCacheSlotCount_ - 1;
+        for(uint32 probe = 0; probe < TextureCacheSlotCount_; ++probe) {
+            TextureCacheSlot* slot = &cacheData->slots[(hash + probe) & mask];
+
+            int32 key = slot->key;
+            if(key == (int32)hash) {
+                return slot;
+            }
+            if(key == InvalidTextureHandle_) {
+                return nullptr;
+            }
+        }
+
+        return nullptr;
+    }
+
+    //=============================================================================================================================
+    static TextureCacheSlot* FindOrInsertSlot(TextureCacheData* cacheData, Hash32 hash)
+    {
+        uint32 mask = TextureCacheSlotCount_ - 1;
+        for(uint32 probe = 0; probe < TextureCacheSlotCount_; ++probe) {
+            TextureCacheSlot* slot = &cacheData->slots[(hash + probe) & mask];
+
+            if(slot->key == InvalidTextureHandle_) {
+                Atomic::CompareExchange32(&slot->key, (int32)hash, InvalidTextureHandle_);
+            }
+
+            // -- Either our exchange succeeded, another thread inserted the same key, or the slot belongs to another key
+            if(slot->key == (int32)hash) {
+                return slot;
+            }
+        }
+
+        return nullptr;
+    }
+
+    //=============================================================================================================================
+    static TextureMapEntry* FindEntry(TextureCacheData* cacheData, Hash32 hash)
+    {
+        TextureCacheSlot* slot = FindSlot(cacheData, hash);
+        return slot ? slot->entry : nullptr;
+    }
+
+    //=============================================================================================================================
+    static Error AddEntry(TextureCacheData* cacheData, Hash32 hash, cpointer filePath, bool isPtex)
+    {
+        TextureCacheSlot* slot = FindOrInsertSlot(cacheData, hash);
+        if(slot == nullptr) {
+            return Error_("Texture cache is full. Increase TextureCacheSlotCount_ to load %s", filePath);
+        }
+
+        TextureMapEntry* existing = slot->entry;
+        if(existing != nullptr) {
+            Atomic::Increment32(&existing->loadRefCount);
+            return Success_;
+        }
+
+        TextureMapEntry* entry = New_(TextureMapEntry);
+        entry->usageRefCount = 0;
+        entry->loadRefCount = 1;
+        entry->residency = eNotResident;
+        entry->isPtex = isPtex ? 1 : 0;
+        entry->tileHand = 0;
+        entry->residentSize = 0;
+        entry->cache = cacheData;
+        entry->filePath.Copy(filePath);
+        Memory::Zero(&entry->resource, sizeof(entry->resource));
+
+        if(Atomic::CompareExchange64((volatile int64*)&slot->entry, (int64)entry, 0) == false) {
+            // -- Lost the race to another thread loading the same texture
+            Delete_(entry);
+            Atomic::Increment32(&slot->entry->loadRefCount);
+        }
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    static void UpdatePeakResidency(TextureCacheData* cacheData, uint64 resident)
+    {
+        while(true) {
+            uint64 peak = cacheData->peakResidentBytes;
+            if(resident <= peak || Atomic::CompareExchange64((volatile int64*)&cacheData->peakResidentBytes, (int64)resident,
+                                                             (int64)peak)) {
+                break;
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    static void ChargeResidency(TextureCacheData* cacheData, TextureMapEntry* entry, uint64 size)
+    {
+        Atomic::AddU64(&entry->residentSize, size);
+        uint64 resident = Atomic::AddU64(&cacheData->residentBytes, size) + size;
+        UpdatePeakResidency(cacheData, resident);
+
+        Atomic::AddU64(&cacheData->pageIns, 1);
+        Atomic::AddU64(&cacheData->bytesRead, size);
+    }
+
+    //=============================================================================================================================
+    static void EvictTextureData(TextureCacheData* cacheData, TextureMapEntry* entry)
+    {
+        ShutdownTextureResource(&entry->resource);
+        Atomic::AddU64(&cacheData->residentBytes, (uint64)(-(int64)entry->residentSize));
+        entry->residentSize = 0;
+    }
+
+    //=============================================================================================================================
+    static void SweepTiles(TextureCacheData* cacheData, TextureMapEntry* entry)
+    {
+        TextureResource* texture = &entry->resource;
+
+        for(uint32 scan = 0, count = texture->data->tileCount; scan < count; ++scan) {
+            if(cacheData->residentBytes <= cacheData->capacity) {
+                break;
+            }
+
+            TextureTile* tile = &texture->tiles[entry->tileHand];
+            uint32 tileIndex = entry->tileHand;
+            entry->tileHand = (entry->tileHand + 1) % count;
+
+            if(tile->texels == nullptr) {
+                continue;
+            }
+
+            if(tile->referenced) {
+                tile->referenced = 0;
+                continue;
+            }
+
+            uint64 size = TextureTileByteSize(texture, tileIndex);
+            FreeAligned_(tile->texels);
+            tile->texels = nullptr;
+            tile->state = eTileNotResident;
+
+            Atomic::AddU64(&entry->residentSize, (uint64)(-(int64)size));
+            Atomic::AddU64(&cacheData->residentBytes, (uint64)(-(int64)size));
+            Atomic::AddU64(&cacheData->evictions, 1);
+        }
+    }
+
+    //=============================================================================================================================
+    static void EvictUntilUnderCapacity(TextureCacheData* cacheData)
+    {
+        if(TryEnterSpinLock(cacheData->evictionLock) == false) {
+            // -- Another thread is already moving the hand
+            return;
+        }
+
+        // -- Each visit to a texture sweeps all of its tiles once, so two full sweeps clear every reference bit and then
+        // -- evict every tile that is not in use.
+        uint32 mask = TextureCacheSlotCount_ - 1;
+        for(uint32 step = 0; step < 2 * TextureCacheSlotCount_; ++step) {
+            if(cacheData->residentBytes <= cacheData->capacity) {
+                break;
+            }
+
+            TextureCacheSlot* slot = &cacheData->slots[cacheData->clockHand];
+            cacheData->clockHand = (cacheData->clockHand + 1) & mask;
+
+            TextureMapEntry* entry = slot->entry;
+            if(entry == nullptr || entry->isPtex || entry->residency != eResident || entry->usageRefCount != 0) {
+                continue;
+            }
+
+            if(Atomic::CompareExchange32(&entry->residency, eEvicting, eResident) == false) {
+                continue;
+            }
+
+            // -- Fetches pin the entry before checking the residency so if the pin count is still zero after the state
+            // -- change no other thread can be sampling its tiles.
+            if(entry->usageRefCount == 0) {
+                SweepTiles(cacheData, entry);
+            }
+
+            entry->residency = eResident;
+        }
+
+        LeaveSpinLock(cacheData->evictionLock);
+    }
+
+    //=============================================================================================================================
+    static const uint8* PageInTile(void* userData, const TextureResource* texture, uint32 tileIndex)
+    {
+        TextureMapEntry* entry = (TextureMapEntry*)userData;
+        TextureCacheData* cacheData = entry->cache;
+        TextureTile* tile = &texture->tiles[tileIndex];
+
+        // -- The texture is pinned by the caller so its tiles cannot be evicted while we wait for or read this one
+        while(true) {
+            uint8* texels = tile->texels;
+            if(texels != nullptr) {
+                return texels;
+            }
+
+            if(Atomic::CompareExchange32(&tile->state, eTileLoading, eTileNotResident)) {
+                uint64 size = TextureTileByteSize(texture, tileIndex);
+                texels = (uint8*)AllocAligned_(size, 16);
+
+                Error err = ReadTextureTile(texture, tileIndex, texels);
+                if(Failed_(err)) {
+                    // -- Keep rendering with black texels rather than faulting on every sample
+                    WriteDebugInfo_("Failed to page in tile %u of texture %s", tileIndex, entry->filePath.Ascii());
+                    AssertMsg_(false, "Failed to page in texture tile.");
+                    Memory::Zero(texels, size);
+                }
+
+                tile->referenced = 1;
+                tile->texels = texels;
+                tile->state = eTileResident;
+
+                ChargeResidency(cacheData, entry, size);
+                if(cacheData->residentBytes > cacheData->capacity) {
+                    EvictUntilUnderCapacity(cacheData);
+                }
+
+                return texels;
+            }
+
+            Sleep(0);
+        }
+    }
+
+    //=============================================================================================================================
+    static bool MakeResident(TextureCacheData* cacheData, TextureMapEntry* entry)
+    {
+        while(true) {
+            int32 residency = entry->residency;
+            if(residency == eResident) {
+                return true;
+            }
+
+            if(residency == eNotResident && Atomic::CompareExchange32(&entry->residency, eLoading, eNotResident)) {
+                Error err = ReadTextureResourceHeader(entry->filePath.Ascii(), PageInTile, entry, &entry->resource);
+                if(Failed_(err)) {
+                    WriteDebugInfo_("Failed to read texture %s", entry->filePath.Ascii());
+                    AssertMsg_(false, "Failed to read texture header.");
+                    entry->resource.data = nullptr;
+                    entry->residency = eNotResident;
+                    return false;
+                }
+
+                entry->tileHand = 0;
+                ChargeResidency(cacheData, entry, sizeof(TextureResourceData)
+                                                  + sizeof(TextureTile) * entry->resource.data->tileCount);
+
+                entry->residency = eResident;
+                return true;
+            }
+
+            // -- Another thread is loading the page table or sweeping this texture's tiles
+            Sleep(0);
+        }
+    }
+
     //=============================================================================================================================
     TextureCache::TextureCache()
         : cacheData(nullptr)
@@ -46,20 +442,33 @@ namespace Selas
     }
 
     //=============================================================================================================================
-    void TextureCache::Initialize(uint64 cacheSize)
+    void TextureCache::Initialize(uint64 cacheSize, uint32 ptexMaxFiles, uint64 ptexCacheSize)
     {
-        uint32 maxFiles = 128;
-
         cacheData = New_(TextureCacheData);
+        Memory::Zero(cacheData, sizeof(TextureCacheData));
+
+        cacheData->slots = AllocArrayAligned_(TextureCacheSlot, TextureCacheSlotCount_, CacheLineSize_);
+        Memory::Zero(cacheData->slots, sizeof(TextureCacheSlot) * TextureCacheSlotCount_);
+
         cacheData->capacity = cacheSize;
-        cacheData->ptexCache = Ptex::PtexCache::create(maxFiles, cacheSize, true, nullptr, nullptr);
+        cacheData->evictionLock = CreateSpinLock();
+        cacheData->ptexInputHandler = New_(PtexCountingInputHandler);
+        cacheData->ptexCache = Ptex::PtexCache::create((int)ptexMaxFiles, (size_t)ptexCacheSize, true,
+                                                       cacheData->ptexInputHandler, nullptr);
     }
 
     //=============================================================================================================================
     void TextureCache::Shutdown()
     {
         if(cacheData) {
+            for(uint scan = 0; scan < TextureCacheSlotCount_; ++scan) {
+                AssertMsg_(cacheData->slots[scan].entry == nullptr, "Texture was not unloaded before shutdown.");
+            }
+
             cacheData->ptexCache->release();
+            Delete_(cacheData->ptexInputHandler);
+            CloseSpinlock(cacheData->evictionLock);
+            FreeAligned_(cacheData->slots);
         }
         SafeDelete_(cacheData);
     }
@@ -72,27 +481,16 @@ namespace Selas
             return Success_;
         }
 
-        handle.hash = MurmurHash3_x86_32(textureName.Ascii(), StringUtil::Length(textureName.Ascii()));
-
-        auto obj = cacheData->map.find(handle.hash);
-        if(obj != cacheData->map.end()) {
-            ++obj->second->loadRefCount;
-            return Success_;
-        }
-
-        TextureMapEntry* entry = New_(TextureMapEntry);
-        Error err = ReadTextureResource(textureName.Ascii(), &entry->resource);
-        if(Failed_(err)) {
-            Delete_(entry);
-            return err;
+        // -- Only check that the texture exists. The header is read the first time the texture is fetched and tiles the first
+        // -- time they are sampled.
+        FilePathString filepath;
+        AssetFileUtils::AssetFilePath(TextureResource::kDataType, TextureResource::kDataVersion, textureName.Ascii(), filepath);
+        if(File::Exists(filepath.Ascii()) == false) {
+            return Error_("Texture %s does not exist", filepath.Ascii());
         }
 
-        entry->ptexFilePath.Clear();
-        entry->loadRefCount = 1;
-        entry->usageRefCount = 0;
-        cacheData->map.insert(TextureResourceKeyValue(handle.hash, entry));
-
-        return Success_;
+        handle.hash = MurmurHash3_x86_32(textureName.Ascii(), StringUtil::Length(textureName.Ascii()));
+        return AddEntry(cacheData, handle.hash, filepath.Ascii(), false);
     }
 
     //=============================================================================================================================
@@ -108,42 +506,42 @@ namespace Selas
         }
 
         handle.hash = MurmurHash3_x86_32(filepath.Ascii(), (uint32)filepath.Length());
-
-        auto obj = cacheData->map.find(handle.hash);
-        if(obj != cacheData->map.end()) {
-            ++obj->second->loadRefCount;
-            return Success_;
-        }
-
-        TextureMapEntry* entry = New_(TextureMapEntry);
-        entry->ptexFilePath.Copy(filepath.Ascii());
-        entry->loadRefCount = 1;
-        entry->usageRefCount = 0;
-
-        cacheData->map.insert(TextureResourceKeyValue(handle.hash, entry));
-
-        return Success_;
+        return AddEntry(cacheData, handle.hash, filepath.Ascii(), true);
     }
 
     //=============================================================================================================================
     void TextureCache::UnloadTexture(TextureHandle handle)
     {
-        auto obj = cacheData->map.find(handle.hash);
-        if(obj == cacheData->map.end()) {
+        TextureCacheSlot* slot = FindSlot(cacheData, handle.hash);
+        if(slot == nullptr || slot->entry == nullptr) {
             AssertMsg_(false, "Freeing texture that was never loaded or has already been unloaded.");
             return;
         }
 
-        if(obj->second->usageRefCount != 0) {
+        TextureMapEntry* entry = slot->entry;
+        if(entry->usageRefCount != 0) {
             AssertMsg_(false, "Freeing texture with a non-zero reference count.");
         }
 
-        --obj->second->loadRefCount;
-        if(obj->second->loadRefCount == 0) {
-            ShutdownTextureResource(&obj->second->resource);
+        if(Atomic::Decrement32(&entry->loadRefCount) == 1) {
+            // -- The CLOCK hand reads entries out of the slots and may be sweeping this one's tiles. Holding the eviction lock
+            // -- waits out any sweep in flight and keeps the hand from picking the entry up again before it is deleted.
+            EnterSpinLock(cacheData->evictionLock);
 
-            Delete_(obj->second);
-            cacheData->map.erase(obj);
+            // -- The key stays in the table so probe sequences of other keys are not broken
+            slot->entry = nullptr;
+
+            // -- Only a sweep or a header load in flight could leave the entry outside these two states and neither can be
+            // -- running now. A failed header load never charged any residency.
+            Assert_(entry->residency == eResident || entry->residency == eNotResident);
+            if(entry->residency == eResident) {
+                EvictTextureData(cacheData, entry);
+            }
+            Assert_(entry->residentSize == 0);
+
+            LeaveSpinLock(cacheData->evictionLock);
+
+            Delete_(entry);
         }
     }
 
@@ -154,14 +552,23 @@ namespace Selas
             return nullptr;
         }
 
-        auto obj = cacheData->map.find(handle.hash);
-        if(obj == cacheData->map.end()) {
+        TextureMapEntry* entry = FindEntry(cacheData, handle.hash);
+        if(entry == nullptr) {
             AssertMsg_(false, "Attempting to fetch texture that was never loaded.");
             return nullptr;
         }
 
-        Atomic::Increment64(&obj->second->usageRefCount);
-        return &obj->second->resource;
+        Atomic::AddU64(&cacheData->fetches, 1);
+
+        // -- Pin before looking at the residency; see EvictUntilUnderCapacity.
+        Atomic::Increment64(&entry->usageRefCount);
+
+        if(MakeResident(cacheData, entry) == false) {
+            Atomic::Decrement64(&entry->usageRefCount);
+            return nullptr;
+        }
+
+        return &entry->resource;
     }
 
     //=============================================================================================================================
@@ -171,19 +578,56 @@ namespace Selas
             return nullptr;
         }
 
-        auto obj = cacheData->map.find(handle.hash);
-        if(obj == cacheData->map.end()) {
+        TextureMapEntry* entry = FindEntry(cacheData, handle.hash);
+        if(entry == nullptr) {
             AssertMsg_(false, "Attempting to fetch texture that was never loaded.");
             return nullptr;
         }
 
+        Atomic::AddU64(&cacheData->ptexFetches, 1);
+
         Ptex::String error;
-        Ptex::PtexTexture* texture = cacheData->ptexCache->get(obj->second->ptexFilePath.Ascii(), error);
+        Ptex::PtexTexture* texture = cacheData->ptexCache->get(entry->filePath.Ascii(), error);
         Assert_(texture != nullptr);
 
         return texture;
     }
 
+    //=============================================================================================================================
+    void TextureCache::PrefetchPtex(TextureHandle handle)
+    {
+        if(handle.Valid() == false) {
+            return;
+        }
+
+        TextureMapEntry* entry = FindEntry(cacheData, handle.hash);
+        if(entry == nullptr || entry->isPtex == 0) {
+            return;
+        }
+
+        Ptex::String error;
+        Ptex::PtexTexture* texture = cacheData->ptexCache->get(entry->filePath.Ascii(), error);
+        if(texture == nullptr) {
+            WriteDebugInfo_("Failed to prefetch ptex file %s: %s", entry->filePath.Ascii(), error.c_str());
+            return;
+        }
+
+        Atomic::AddU64(&cacheData->ptexPrefetches, 1);
+
+        for(int32 face = 0, faceCount = texture->numFaces(); face < faceCount; ++face) {
+            Ptex::Res res = texture->getFaceInfo(face).res;
+            res.ulog2 = Min<int8>(res.ulog2, PtexPrefetchResLog2_);
+            res.vlog2 = Min<int8>(res.vlog2, PtexPrefetchResLog2_);
+
+            Ptex::PtexFaceData* data = texture->getData(face, res);
+            if(data != nullptr) {
+                data->release();
+            }
+        }
+
+        texture->release();
+    }
+
     //=============================================================================================================================
     void TextureCache::ReleaseTexture(TextureHandle handle)
     {
@@ -191,13 +635,65 @@ namespace Selas
             return;
         }
 
-        auto obj = cacheData->map.find(handle.hash);
-        if(obj == cacheData->map.end()) {
+        TextureMapEntry* entry = FindEntry(cacheData, handle.hash);
+        if(entry == nullptr) {
             AssertMsg_(false, "Attempting to fetch texture that was never loaded.");
             return;
         }
 
-        Assert_(obj->second->usageRefCount != 0);
-        Atomic::Decrement64(&obj->second->usageRefCount);
+        Assert_(entry->usageRefCount != 0);
+        Atomic::Decrement64(&entry->usageRefCount);
+    }
+
+    //=============================================================================================================================
+    void TextureCache::GetStats(TextureCacheStats* stats)
+    {
+        stats->fetches           = cacheData->fetches;
+        stats->pageIns           = cacheData->pageIns;
+        stats->evictions         = cacheData->evictions;
+        stats->bytesRead         = cacheData->bytesRead;
+        stats->residentBytes     = cacheData->residentBytes;
+        stats->peakResidentBytes = cacheData->peakResidentBytes;
+
+        Ptex::PtexCache::Stats ptexStats;
+        cacheData->ptexCache->getStats(ptexStats);
+
+        stats->ptexFetches    = cacheData->ptexFetches;
+        stats->ptexFileOpens  = cacheData->ptexInputHandler->fileOpens;
+        stats->ptexBytesRead  = cacheData->ptexInputHandler->bytesRead;
+        stats->ptexPrefetches = cacheData->ptexPrefetches;
+        stats->ptexMemoryUsed = ptexStats.memUsed;
+        stats->ptexFilesOpen  = ptexStats.filesOpen;
+    }
+
+    //=============================================================================================================================
+    void TextureCache::LogStats()
+    {
+        TextureCacheStats stats;
+        GetStats(&stats);
+
+        // -- Not synchronized with other callers; only the main thread logs
+        TextureCacheStats& last = cacheData->loggedStats;
+        const float mb = 1.0f / (1024.0f * 1024.0f);
+
+        uint64 fetches = stats.fetches - last.fetches;
+        if(fetches != 0) {
+            WriteDebugInfo_("Texture fetches %llu: %llu page ins, %llu evictions, %.2fMB read, %.2fMB resident (%.2fMB peak)",
+                            fetches, stats.pageIns - last.pageIns, stats.evictions - last.evictions,
+                            (stats.bytesRead - last.bytesRead) * mb, stats.residentBytes * mb, stats.peakResidentBytes * mb);
+        }
+
+        uint64 ptexFetches = stats.ptexFetches - last.ptexFetches;
+        uint64 ptexFileOpens = stats.ptexFileOpens - last.ptexFileOpens;
+        if(ptexFetches != 0 || ptexFileOpens != 0) {
+            // -- Opens done by prefetches count against the hit rate since they are handles the fetches did not find open
+            float hitRate = ptexFetches > 0 ? 1.0f - Min<float>(1.0f, (float)ptexFileOpens / ptexFetches) : 0.0f;
+            WriteDebugInfo_("Ptex fetches %llu: %.1f%% handle hit rate, %llu file opens, %llu prefetches, %.2fMB read, "
+                            "%.2fMB cached, %llu files open", ptexFetches, 100.0f * hitRate, ptexFileOpens,
+                            stats.ptexPrefetches - last.ptexPrefetches, (stats.ptexBytesRead - last.ptexBytesRead) * mb,
+                            stats.ptexMemoryUsed * mb, stats.ptexFilesOpen);
+        }
+
+        last = stats;
     }
 }
\ No newline at end of file
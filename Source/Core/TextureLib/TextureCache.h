@@ -13,10 +13,34 @@
 #include "ptex/Include/Ptexture.h"
 #pragma warning(pop)
 
+// -- Number of slots in the open addressing table. Must be a power of two and larger than the number of unique textures
+// -- that are loaded at once; slots are never reclaimed so a texture that is unloaded and loaded again reuses its slot.
+#define TextureCacheSlotCount_ (64 * 1024)
+
 namespace Selas
 {
     struct TextureCacheData;
 
+    struct TextureCacheStats
+    {
+        uint64 fetches;
+        // -- Texture headers and tiles read from disk
+        uint64 pageIns;
+        // -- Tiles evicted by the CLOCK hand
+        uint64 evictions;
+        uint64 bytesRead;
+        uint64 residentBytes;
+        uint64 peakResidentBytes;
+
+        // -- FetchPtex calls and the subset of them that had to open or reopen a file
+        uint64 ptexFetches;
+        uint64 ptexFileOpens;
+        uint64 ptexBytesRead;
+        uint64 ptexPrefetches;
+        uint64 ptexMemoryUsed;
+        uint64 ptexFilesOpen;
+    };
+
     #define InvalidTextureHandle_ 0
 
     struct TextureHandle
@@ -25,6 +49,7 @@ namespace Selas
 
         bool Valid() { return hash != InvalidTextureHandle_;  }
         bool Invalid() { return hash == InvalidTextureHandle_; }
+        Hash32 Key() const { return hash; }
 
     private:
         friend class TextureCache;
@@ -40,15 +65,29 @@ namespace Selas
          TextureCache();
         ~TextureCache();
 
-        void Initialize(uint64 cacheSize);
+        // -- cacheSize bounds the tiles of texture resources. Ptex data is cached separately in up to ptexCacheSize bytes with
+        // -- at most ptexMaxFiles file handles open at once.
+        void Initialize(uint64 cacheSize, uint32 ptexMaxFiles, uint64 ptexCacheSize);
         void Shutdown();
 
         Error LoadTextureResource(const FilePathString& textureName, TextureHandle& handle);
         Error LoadTexturePtex(const FilePathString& filepath, TextureHandle& handle);
         void UnloadTexture(TextureHandle handle);
 
+        // -- The texture header is read from disk the first time it is fetched and tiles are paged in when they are sampled.
+        // -- Tiles can be evicted once no thread holds a reference to the texture and the cache is over capacity. The
+        // -- returned resource and every tile sampled through it are valid until ReleaseTexture is called.
         const TextureResource* FetchTexture(TextureHandle handle);
         Ptex::PtexTexture* FetchPtex(TextureHandle handle);
         void ReleaseTexture(TextureHandle handle);
+
+        // -- Opens the ptex file and reads every face at a reduced resolution so the first lookups after a subscene is loaded
+        // -- do not each stall on I/O. Does nothing for other textures.
+        void PrefetchPtex(TextureHandle handle);
+
+        // -- Counters are totals since Initialize
+        void GetStats(TextureCacheStats* stats);
+        // -- Logs the counters accumulated since the previous call so calling it once per frame gives per frame numbers
+        void LogStats();
    };
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "TextureLib/TextureEncoding.h"
+#include "MathLib/FloatFuncs.h"
+#include "MathLib/Trigonometric.h"
+#include "SystemLib/MinMax.h"
+#include "SystemLib/JsAssert.h"
+
+namespace Selas
+{
+    namespace TextureEncoding
+    {
+        //=========================================================================================================================
+        uint16 FloatToHalf(float value)
+        {
+            // -- Round to nearest even. See Fabian Giesen's float_to_half_fast3_rtne.
+            union { uint32 u; float f; } bits;
+            union { uint32 u; float f; } denormMagic;
+            denormMagic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+
+            bits.f = value;
+            uint32 sign = bits.u & 0x80000000u;
+            bits.u ^= sign;
+
+            uint32 result;
+            if(bits.u >= (127 + 16) << 23) {
+                // -- Too large for a half becomes inf and nan stays nan
+                result = bits.u > 0x7f800000u ? 0x7e00 : 0x7c00;
+            }
+            else if(bits.u < (113 << 23)) {
+                // -- Denormal. Adding the magic number lets the fpu do the rounding.
+                bits.f += denormMagic.f;
+                result = bits.u - denormMagic.u;
+            }
+            else {
+                uint32 mantissaOdd = (bits.u >> 13) & 1;
+                bits.u += ((uint32)(15 - 127) << 23) + 0xfff;
+                bits.u += mantissaOdd;
+                result = bits.u >> 13;
+            }
+
+            return (uint16)(result | (sign >> 16));
+        }
+
+        //=========================================================================================================================
+        static uint8 FloatToUNorm8(float value)
+        {
+            return (uint8)(Saturate(value) * 255.0f + 0.5f);
+        }
+
+        //=========================================================================================================================
+        void EncodeTexel(TextureResourceData::TextureDataType format, float4 value, uint8* texel)
+        {
+            const float channels[4] = { value.x, value.y, value.z, value.w };
+            uint32 channelCount = TextureChannelCount(format);
+
+            float* floats = reinterpret_cast<float*>(texel);
+            uint16* halfs = reinterpret_cast<uint16*>(texel);
+
+            for(uint32 scan = 0; scan < channelCount; ++scan) {
+                switch(format) {
+                case TextureResourceData::Float:
+                case TextureResourceData::Float2:
+                case TextureResourceData::Float3:
+                case TextureResourceData::Float4:
+                    floats[scan] = channels[scan];
+                    break;
+                case TextureResourceData::Half:
+                case TextureResourceData::Half2:
+                case TextureResourceData::Half3:
+                case TextureResourceData::Half4:
+                    halfs[scan] = FloatToHalf(channels[scan]);
+                    break;
+                case TextureResourceData::UNorm8:
+                case TextureResourceData::UNorm8x2:
+                case TextureResourceData::UNorm8x3:
+                case TextureResourceData::UNorm8x4:
+                    texel[scan] = FloatToUNorm8(channels[scan]);
+                    break;
+                default:
+                    AssertMsg_(false, "Block compressed formats are encoded with EncodeBlock");
+                    return;
+                }
+            }
+        }
+
+        //=========================================================================================================================
+        static uint32 QuantizeRgb565(float3 rgb)
+        {
+            uint32 r = (uint32)(Saturate(rgb.x) * 31.0f + 0.5f);
+            uint32 g = (uint32)(Saturate(rgb.y) * 63.0f + 0.5f);
+            uint32 b = (uint32)(Saturate(rgb.z) * 31.0f + 0.5f);
+
+            return (r << 11) | (g << 5) | b;
+        }
+
+        //=========================================================================================================================
+        static float3 DequantizeRgb565(uint32 color)
+        {
+            return float3((color >> 11) * (1.0f / 31.0f), ((color >> 5) & 0x3f) * (1.0f / 63.0f), (color & 0x1f) * (1.0f / 31.0f));
+        }
+
+        //=========================================================================================================================
+        static void EncodeBC1Block(const float4 texels[BlockTexelCount], uint8* block)
+        {
+            // -- Endpoints are the extremes of the block along its principal axis, found with a few power iterations on the
+            // -- covariance matrix.
+            float3 mean = float3::Zero_;
+            for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                mean = mean + texels[scan].XYZ();
+            }
+            mean = mean * (1.0f / BlockTexelCount);
+
+            float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+            for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                float3 d = texels[scan].XYZ() - mean;
+                covariance[0] += d.x * d.x;
+                covariance[1] += d.x * d.y;
+                covariance[2] += d.x * d.z;
+                covariance[3] += d.y * d.y;
+                covariance[4] += d.y * d.z;
+                covariance[5] += d.z * d.z;
+            }
+
+            float3 axis = float3(1.0f, 1.0f, 1.0f);
+            for(uint32 iteration = 0; iteration < 8; ++iteration) {
+                float3 next = float3(covariance[0] * axis.x + covariance[1] * axis.y + covariance[2] * axis.z,
+                                     covariance[1] * axis.x + covariance[3] * axis.y + covariance[4] * axis.z,
+                                     covariance[2] * axis.x + covariance[4] * axis.y + covariance[5] * axis.z);
+                float length = Length(next);
+                if(length < 1e-8f) {
+                    break;
+                }
+                axis = next * (1.0f / length);
+            }
+
+            float minProjection = 0.0f;
+            float maxProjection = 0.0f;
+            for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                float projection = Dot(texels[scan].XYZ() - mean, axis);
+                minProjection = Min(minProjection, projection);
+                maxProjection = Max(maxProjection, projection);
+            }
+
+            uint32 c0 = QuantizeRgb565(mean + maxProjection * axis);
+            uint32 c1 = QuantizeRgb565(mean + minProjection * axis);
+
+            // -- c0 > c1 selects the four color mode. Equal endpoints are a solid block and only ever use index 0.
+            if(c0 < c1) {
+                uint32 swap = c0;
+                c0 = c1;
+                c1 = swap;
+            }
+
+            float3 palette[4];
+            palette[0] = DequantizeRgb565(c0);
+            palette[1] = DequantizeRgb565(c1);
+            palette[2] = (2.0f / 3.0f) * palette[0] + (1.0f / 3.0f) * palette[1];
+            palette[3] = (1.0f / 3.0f) * palette[0] + (2.0f / 3.0f) * palette[1];
+
+            uint32 indices = 0;
+            if(c0 != c1) {
+                for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                    uint32 best = 0;
+                    float bestDistance = LengthSquared(texels[scan].XYZ() - palette[0]);
+                    for(uint32 candidate = 1; candidate < 4; ++candidate) {
+                        float distance = LengthSquared(texels[scan].XYZ() - palette[candidate]);
+                        if(distance < bestDistance) {
+                            best = candidate;
+                            bestDistance = distance;
+                        }
+                    }
+                    indices |= best << (2 * scan);
+                }
+            }
+
+            block[0] = (uint8)(c0 & 0xff);
+            block[1] = (uint8)(c0 >> 8);
+            block[2] = (uint8)(c1 & 0xff);
+            block[3] = (uint8)(c1 >> 8);
+            block[4] = (uint8)(indices & 0xff);
+            block[5] = (uint8)((indices >> 8) & 0xff);
+            block[6] = (uint8)((indices >> 16) & 0xff);
+            block[7] = (uint8)(indices >> 24);
+        }
+
+        //=========================================================================================================================
+        static void EncodeBC4Block(const float values[BlockTexelCount], uint8* block)
+        {
+            float minValue = values[0];
+            float maxValue = values[0];
+            for(uint32 scan = 1; scan < BlockTexelCount; ++scan) {
+                minValue = Min(minValue, values[scan]);
+                maxValue = Max(maxValue, values[scan]);
+            }
+
+            // -- r0 > r1 selects the eight value mode
+            uint32 r0 = FloatToUNorm8(maxValue);
+            uint32 r1 = FloatToUNorm8(minValue);
+
+            float palette[8];
+            palette[0] = r0 / 255.0f;
+            palette[1] = r1 / 255.0f;
+            for(uint32 scan = 2; scan < 8; ++scan) {
+                palette[scan] = ((8 - scan) * r0 + (scan - 1) * r1) / (7.0f * 255.0f);
+            }
+
+            uint64 indices = 0;
+            if(r0 != r1) {
+                for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                    uint64 best = 0;
+                    float bestDistance = Math::Absf(values[scan] - palette[0]);
+                    for(uint32 candidate = 1; candidate < 8; ++candidate) {
+                        float distance = Math::Absf(values[scan] - palette[candidate]);
+                        if(distance < bestDistance) {
+                            best = candidate;
+                            bestDistance = distance;
+                        }
+                    }
+                    indices |= best << (3 * scan);
+                }
+            }
+
+            block[0] = (uint8)r0;
+            block[1] = (uint8)r1;
+            for(uint32 scan = 0; scan < 6; ++scan) {
+                block[2 + scan] = (uint8)((indices >> (8 * scan)) & 0xff);
+            }
+        }
+
+        //=========================================================================================================================
+        void EncodeBlock(TextureResourceData::TextureDataType format, const float4 texels[BlockTexelCount], uint8* block)
+        {
+            float channel[BlockTexelCount];
+
+            switch(format) {
+            case TextureResourceData::BC1:
+                EncodeBC1Block(texels, block);
+                break;
+            case TextureResourceData::BC4:
+                for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                    channel[scan] = texels[scan].x;
+                }
+                EncodeBC4Block(channel, block);
+                break;
+            case TextureResourceData::BC5:
+                for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                    channel[scan] = texels[scan].x;
+                }
+                EncodeBC4Block(channel, block);
+                for(uint32 scan = 0; scan < BlockTexelCount; ++scan) {
+                    channel[scan] = texels[scan].y;
+                }
+                EncodeBC4Block(channel, block + 8);
+                break;
+            default:
+                AssertMsg_(false, "Uncompressed formats are encoded with EncodeTexel");
+            }
+        }
+    }
+}
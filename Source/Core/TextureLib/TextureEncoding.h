@@ -0,0 +1,158 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "TextureLib/TextureResource.h"
+#include "MathLib/FloatStructs.h"
+#include "MathLib/FloatFuncs.h"
+#include "SystemLib/BasicTypes.h"
+
+namespace Selas
+{
+    namespace TextureEncoding
+    {
+        const uint32 BlockTexelCount = 16;
+
+        uint16 FloatToHalf(float value);
+
+        // -- Writes one texel of an uncompressed format. Channels past the format's channel count are dropped.
+        void EncodeTexel(TextureResourceData::TextureDataType format, float4 value, uint8* texel);
+        // -- Compresses a row major 4x4 block of texels for the BC formats
+        void EncodeBlock(TextureResourceData::TextureDataType format, const float4 texels[BlockTexelCount], uint8* block);
+
+        //=========================================================================================================================
+        inline float HalfToFloat(uint16 value)
+        {
+            union { uint32 u; float f; } bits;
+
+            // -- Moves the exponent and mantissa into place and rebiases the exponent by scaling with 2^112, which also
+            // -- handles denormals unless denormals-are-zero is enabled. Anything that lands at or past 2^16 was an inf or nan.
+            bits.u = (uint32)(value & 0x7fff) << 13;
+            bits.f *= 5.192296858534828e+33f;
+            if(bits.f >= 65536.0f) {
+                bits.u |= 0x7f800000;
+            }
+            bits.u |= (uint32)(value & 0x8000) << 16;
+
+            return bits.f;
+        }
+
+        //=========================================================================================================================
+        inline float UNorm8ToFloat(uint8 value)
+        {
+            return value * (1.0f / 255.0f);
+        }
+
+        //=========================================================================================================================
+        inline float3 DecodeBC1(const uint8* block, uint32 texel)
+        {
+            uint32 c0 = block[0] | (block[1] << 8);
+            uint32 c1 = block[2] | (block[3] << 8);
+            uint32 indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32)block[7] << 24);
+            uint32 index = (indices >> (2 * texel)) & 0x3;
+
+            float3 rgb0 = float3((c0 >> 11) * (1.0f / 31.0f), ((c0 >> 5) & 0x3f) * (1.0f / 63.0f), (c0 & 0x1f) * (1.0f / 31.0f));
+            float3 rgb1 = float3((c1 >> 11) * (1.0f / 31.0f), ((c1 >> 5) & 0x3f) * (1.0f / 63.0f), (c1 & 0x1f) * (1.0f / 31.0f));
+
+            switch(index) {
+            case 0:
+                return rgb0;
+            case 1:
+                return rgb1;
+            case 2:
+                return c0 > c1 ? (2.0f / 3.0f) * rgb0 + (1.0f / 3.0f) * rgb1 : 0.5f * (rgb0 + rgb1);
+            default:
+                return c0 > c1 ? (1.0f / 3.0f) * rgb0 + (2.0f / 3.0f) * rgb1 : float3::Zero_;
+            }
+        }
+
+        //=========================================================================================================================
+        inline float DecodeBC4(const uint8* block, uint32 texel)
+        {
+            uint32 r0 = block[0];
+            uint32 r1 = block[1];
+
+            uint32 bit = 3 * texel;
+            uint32 byte = 2 + bit / 8;
+            uint32 pair = block[byte] | (byte + 1 < 8 ? (block[byte + 1] << 8) : 0);
+            uint32 index = (pair >> (bit % 8)) & 0x7;
+
+            if(index == 0) {
+                return r0 * (1.0f / 255.0f);
+            }
+            if(index == 1) {
+                return r1 * (1.0f / 255.0f);
+            }
+            if(r0 > r1) {
+                return ((8 - index) * r0 + (index - 1) * r1) * (1.0f / (7.0f * 255.0f));
+            }
+            if(index < 6) {
+                return ((6 - index) * r0 + (index - 1) * r1) * (1.0f / (5.0f * 255.0f));
+            }
+            return index == 6 ? 0.0f : 1.0f;
+        }
+
+        //=========================================================================================================================
+        // -- Decodes texel (s, t) of a tile. Missing channels read as 0 and a missing alpha reads as 1.
+        inline float4 DecodeTexel(TextureResourceData::TextureDataType format, const uint8* tile, uint32 tileWidth, uint32 s,
+                                  uint32 t)
+        {
+            uint32 index = t * tileWidth + s;
+
+            const float* floats = reinterpret_cast<const float*>(tile);
+            const uint16* halfs = reinterpret_cast<const uint16*>(tile);
+
+            switch(format) {
+            case TextureResourceData::Float:
+                return float4(floats[index], 0.0f, 0.0f, 1.0f);
+            case TextureResourceData::Float2:
+                return float4(floats[2 * index], floats[2 * index + 1], 0.0f, 1.0f);
+            case TextureResourceData::Float3:
+                return float4(floats[3 * index], floats[3 * index + 1], floats[3 * index + 2], 1.0f);
+            case TextureResourceData::Float4:
+                return reinterpret_cast<const float4*>(tile)[index];
+            case TextureResourceData::Half:
+                return float4(HalfToFloat(halfs[index]), 0.0f, 0.0f, 1.0f);
+            case TextureResourceData::Half2:
+                return float4(HalfToFloat(halfs[2 * index]), HalfToFloat(halfs[2 * index + 1]), 0.0f, 1.0f);
+            case TextureResourceData::Half3:
+                return float4(HalfToFloat(halfs[3 * index]), HalfToFloat(halfs[3 * index + 1]),
+                              HalfToFloat(halfs[3 * index + 2]), 1.0f);
+            case TextureResourceData::Half4:
+                return float4(HalfToFloat(halfs[4 * index]), HalfToFloat(halfs[4 * index + 1]),
+                              HalfToFloat(halfs[4 * index + 2]), HalfToFloat(halfs[4 * index + 3]));
+            case TextureResourceData::UNorm8:
+                return float4(UNorm8ToFloat(tile[index]), 0.0f, 0.0f, 1.0f);
+            case TextureResourceData::UNorm8x2:
+                return float4(UNorm8ToFloat(tile[2 * index]), UNorm8ToFloat(tile[2 * index + 1]), 0.0f, 1.0f);
+            case TextureResourceData::UNorm8x3:
+                return float4(UNorm8ToFloat(tile[3 * index]), UNorm8ToFloat(tile[3 * index + 1]),
+                              UNorm8ToFloat(tile[3 * index + 2]), 1.0f);
+            case TextureResourceData::UNorm8x4:
+                return float4(UNorm8ToFloat(tile[4 * index]), UNorm8ToFloat(tile[4 * index + 1]),
+                              UNorm8ToFloat(tile[4 * index + 2]), UNorm8ToFloat(tile[4 * index + 3]));
+            default:
+                break;
+            }
+
+            // -- Block compressed formats
+            uint32 blocksX = (tileWidth + 3) / 4;
+            uint32 blockIndex = (t / 4) * blocksX + s / 4;
+            uint32 texel = (t % 4) * 4 + s % 4;
+
+            switch(format) {
+            case TextureResourceData::BC1:
+                return float4(DecodeBC1(tile + 8 * blockIndex, texel), 1.0f);
+            case TextureResourceData::BC4:
+                return float4(DecodeBC4(tile + 8 * blockIndex, texel), 0.0f, 0.0f, 1.0f);
+            case TextureResourceData::BC5:
+                return float4(DecodeBC4(tile + 16 * blockIndex, texel), DecodeBC4(tile + 16 * blockIndex + 8, texel), 0.0f,
+                              1.0f);
+            default:
+                return float4::Zero_;
+            }
+        }
+    }
+}
@@ -5,6 +5,7 @@
 //=================================================================================================================================
 
 #include "TextureLib/TextureResource.h"
+#include "TextureLib/TextureEncoding.h"
 #include "MathLib/FloatFuncs.h"
 #include "MathLib/IntStructs.h"
 #include "MathLib/Trigonometric.h"
@@ -18,8 +19,6 @@ namespace Selas
     const uint EwaLutSize = 128;
     static float EWAFilterLut[EwaLutSize];
         
-    struct TextureResourceData;
-
     namespace TextureFiltering
     {
         enum WrapMode
@@ -30,61 +29,75 @@ namespace Selas
 
         void InitializeEWAFilterWeights();
 
+        //=========================================================================================================================
+        ForceInline_ void ConvertTexel(float4 texel, float& result)  { result = texel.x; }
+        ForceInline_ void ConvertTexel(float4 texel, float2& result) { result = float2(texel.x, texel.y); }
+        ForceInline_ void ConvertTexel(float4 texel, float3& result) { result = texel.XYZ(); }
+        ForceInline_ void ConvertTexel(float4 texel, float4& result) { result = texel; }
+
         //=========================================================================================================================
         template <typename Type_>
-        static Type_ Sample(Type_* mip, WrapMode wrapMode, uint32 w, uint32 h, int32 s, int32 t)
+        static Type_ Sample(const TextureResource* texture, uint32 level, WrapMode wrapMode, int32 s, int32 t)
         {
+            int32 w = (int32)texture->data->mipWidths[level];
+            int32 h = (int32)texture->data->mipHeights[level];
+
             switch(wrapMode) {
             case WrapMode::Clamp:
                 s = Selas::Clamp<int32>(s, 0, w - 1);
                 t = Selas::Clamp<int32>(t, 0, h - 1);
                 break;
             case WrapMode::Repeat:
-                s = s % w;
-                t = t % h;
+                s = ((s % w) + w) % w;
+                t = ((t % h) + h) % h;
                 break;
             default:
                 Assert_(false);
             }
 
-            return mip[t * w + s];
+            uint32 tileWidth, tileHeight, tilesX, tilesY;
+            TextureTileDimensions(texture->data, level, tileWidth, tileHeight, tilesX, tilesY);
+
+            uint32 tileIndex = texture->mipFirstTile[level] + ((uint32)t / tileHeight) * tilesX + (uint32)s / tileWidth;
+            const uint8* tile = FetchTextureTile(texture, tileIndex);
+
+            float4 texel = TextureEncoding::DecodeTexel(texture->data->format, tile, tileWidth, (uint32)s % tileWidth,
+                                                        (uint32)t % tileHeight);
+
+            Type_ result;
+            ConvertTexel(texel, result);
+            return result;
         }
 
         //=========================================================================================================================
         template <typename Type_>
-        static void Point(TextureResourceData* texture, float2 st, Type_& result)
+        static void Point(const TextureResource* texture, float2 st, Type_& result)
         {
-            uint level = 0;
+            uint32 level = 0;
 
             WrapMode wrapMode = WrapMode::Repeat;
 
-            uint64 mipOffset = texture->mipOffsets[level];
-            uint32 mipWidth = texture->mipWidths[level];
-            uint32 mipHeight = texture->mipHeights[level];
-
-            Type_* mip = reinterpret_cast<Type_*>(&texture->texture[mipOffset]);
+            uint32 mipWidth = texture->data->mipWidths[level];
+            uint32 mipHeight = texture->data->mipHeights[level];
 
             float s = st.x * mipWidth;
             float t = st.y * mipHeight;
             int32 s0 = (int32)Math::Floor(s);
             int32 t0 = (int32)Math::Floor(t);
 
-            result = Sample<Type_>(mip, wrapMode, mipWidth, mipHeight, s0, t0);
+            result = Sample<Type_>(texture, level, wrapMode, s0, t0);
         }
 
         //=========================================================================================================================
         template <typename Type_>
-        void Triangle(TextureResourceData* texture, int32 level, float2 st, Type_& result)
+        void Triangle(const TextureResource* texture, int32 level, float2 st, Type_& result)
         {
-            level = Min<uint32>(level, texture->mipCount - 1);
+            level = Min<uint32>(level, texture->data->mipCount - 1);
 
             WrapMode wrapMode = WrapMode::Repeat;
 
-            uint64 mipOffset = texture->mipOffsets[level];
-            uint32 mipWidth = texture->mipWidths[level];
-            uint32 mipHeight = texture->mipHeights[level];
-
-            Type_* mip = reinterpret_cast<Type_*>(&texture->texture[mipOffset]);
+            uint32 mipWidth = texture->data->mipWidths[level];
+            uint32 mipHeight = texture->data->mipHeights[level];
 
             float s = st.x * mipWidth - 0.5f;
             float t = st.y * mipHeight - 0.5f;
@@ -93,32 +106,29 @@ namespace Selas
             int32 t0 = (int32)Math::Floor(t);
             float ds = s - s0;
             float dt = t - t0;
-            result = (1 - ds) * (1 - dt) * Sample<Type_>(mip, wrapMode, mipWidth, mipHeight, s0, t0) +
-                (1 - ds) *      dt  * Sample<Type_>(mip, wrapMode, mipWidth, mipHeight, s0, t0 + 1) +
-                ds * (1 - dt) * Sample<Type_>(mip, wrapMode, mipWidth, mipHeight, s0 + 1, t0) +
-                ds * dt  * Sample<Type_>(mip, wrapMode, mipWidth, mipHeight, s0 + 1, t0 + 1);
+            result = (1 - ds) * (1 - dt) * Sample<Type_>(texture, level, wrapMode, s0, t0) +
+                (1 - ds) *      dt  * Sample<Type_>(texture, level, wrapMode, s0, t0 + 1) +
+                ds * (1 - dt) * Sample<Type_>(texture, level, wrapMode, s0 + 1, t0) +
+                ds * dt  * Sample<Type_>(texture, level, wrapMode, s0 + 1, t0 + 1);
         }
 
         //=========================================================================================================================
         template <typename Type_>
-        static void EWA(TextureResourceData* texture, int32 reqLevel, float2 st, float2 dst0, float2 dst1, Type_& result)
+        static void EWA(const TextureResource* texture, int32 reqLevel, float2 st, float2 dst0, float2 dst1, Type_& result)
         {
             // -- Credit goes to pbrt for the EWA implementation
             // https://github.com/mmp/pbrt-v3
 
             WrapMode wrapMode = WrapMode::Repeat;
 
-            if(reqLevel >= (int32)texture->mipCount) {
-                uint64 mipOffset = texture->mipOffsets[texture->mipCount - 1];
-                Type_* mip = reinterpret_cast<Type_*>(&texture->texture[mipOffset]);
-                result = Sample<Type_>(mip, wrapMode, 1, 1, 0, 0);
+            if(reqLevel >= (int32)texture->data->mipCount) {
+                result = Sample<Type_>(texture, texture->data->mipCount - 1, wrapMode, 0, 0);
                 return;
             }
 
-            uint64 mipOffset = texture->mipOffsets[reqLevel];
-            uint32 mipWidth = texture->mipWidths[reqLevel];
-            uint32 mipHeight = texture->mipHeights[reqLevel];
-            Type_* mip = reinterpret_cast<Type_*>(&texture->texture[mipOffset]);
+            uint32 level = (uint32)reqLevel;
+            uint32 mipWidth = texture->data->mipWidths[level];
+            uint32 mipHeight = texture->data->mipHeights[level];
 
             // -- Convert EWA coordinates to appropriate scale for level
             st.x = st.x * mipWidth - 0.5f;
@@ -159,7 +169,7 @@ namespace Selas
                     if(r2 < 1) {
                         int32 index = Min<int32>((int32)(r2 * EwaLutSize), EwaLutSize - 1);
                         float weight = EWAFilterLut[index];
-                        sum += Sample<Type_>(mip, wrapMode, mipWidth, mipHeight, is, it) * weight;
+                        sum += Sample<Type_>(texture, level, wrapMode, is, it) * weight;
                         sumWts += weight;
                     }
                 }
@@ -170,7 +180,20 @@ namespace Selas
 
         //=========================================================================================================================
         template <typename Type_>
-        static void Trilinear(TextureResourceData* texture, float2 st, float2 dst0, float2 dst1, Type_& result)
+        static void TrilinearLod(const TextureResource* texture, float lod, float2 st, Type_& result)
+        {
+            float ilod = Math::Floor(lod);
+
+            Type_ r0;
+            Triangle<Type_>(texture, (int32)ilod, st, r0);
+            Type_ r1;
+            Triangle<Type_>(texture, (int32)ilod + 1, st, r1);
+            result = Lerp(r0, r1, lod - ilod);
+        }
+
+        //=========================================================================================================================
+        template <typename Type_>
+        static void Trilinear(const TextureResource* texture, float2 st, float2 dst0, float2 dst1, Type_& result)
         {
             float majorLength = Length(dst0);
             float minorLength = Length(dst1);
@@ -182,19 +205,13 @@ namespace Selas
             }
 
             // -- Choose which mip levels we want to sample
-            float lod = Max<float>(0.0f, texture->mipCount - 1.0f + Math::Log2(length));
-            float ilod = Math::Floor(lod);
-
-            Type_ r0;
-            Triangle<Type_>(texture, (int32)ilod, st, r0);
-            Type_ r1;
-            Triangle<Type_>(texture, (int32)ilod + 1, st, r1);
-            result = Lerp(r0, r1, lod - ilod);
+            float lod = Max<float>(0.0f, texture->data->mipCount - 1.0f + Math::Log2(length));
+            TrilinearLod<Type_>(texture, lod, st, result);
         }
 
         //=========================================================================================================================
         template <typename Type_>
-        static void EWA(TextureResourceData* texture, float2 st, float2 dst0, float2 dst1, Type_& result)
+        static void EWA(const TextureResource* texture, float2 st, float2 dst0, float2 dst1, Type_& result)
         {
             // -- Credit goes to pbrt for the EWA implementation
             // https://github.com/mmp/pbrt-v3
@@ -223,7 +240,7 @@ namespace Selas
             }
 
             // -- Choose which mip levels we want to sample
-            float lod = Max<float>(0.0f, texture->mipCount - 1.0f + Math::Log2(minorLength));
+            float lod = Max<float>(0.0f, texture->data->mipCount - 1.0f + Math::Log2(minorLength));
             float ilod = Math::Floor(lod);
 
             Type_ r0;
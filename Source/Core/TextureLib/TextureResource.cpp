@@ -3,6 +3,7 @@
 //=================================================================================================================================
 
 #include "TextureLib/TextureResource.h"
+#include "TextureLib/TextureEncoding.h"
 #include "TextureLib/StbImage.h"
 #include "Assets/AssetFileUtils.h"
 #include "StringLib/FixedString.h"
@@ -10,6 +11,11 @@
 #include "IoLib/BinaryStreamSerializer.h"
 #include "IoLib/File.h"
 #include "IoLib/Directory.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/Memory.h"
+#include "SystemLib/MinMax.h"
+#include "SystemLib/CountOf.h"
+#include "SystemLib/JsAssert.h"
 #include "SystemLib/BasicTypes.h"
 
 #include <stdio.h>
@@ -17,7 +23,7 @@
 namespace Selas
 {
     cpointer TextureResource::kDataType = "Textures";
-    const uint64 TextureResource::kDataVersion = 1534887410ul;
+    const uint64 TextureResource::kDataVersion = 1539620000ul;
 
     //=============================================================================================================================
     void Serialize(CSerializer* serializer, TextureResourceData& data)
@@ -36,7 +42,7 @@ namespace Selas
         }
 
         Serialize(serializer, (uint32&)data.format);
-        Serialize(serializer, data.pad);
+        Serialize(serializer, data.tileCount);
 
         serializer->SerializePtr((void*&)data.texture, data.dataSize, 0);
     }
@@ -53,37 +59,261 @@ namespace Selas
     //    return Success_;
     //}
 
+    //=============================================================================================================================
+    struct TextureFormatInfo
+    {
+        uint32 channelCount;
+        uint32 blockDimension;
+        uint32 blockByteSize;
+    };
+
+    static const TextureFormatInfo TextureFormats[] =
+    {
+        { 1, 1, 4  }, // Float
+        { 2, 1, 8  }, // Float2
+        { 3, 1, 12 }, // Float3
+        { 4, 1, 16 }, // Float4
+        { 1, 1, 2  }, // Half
+        { 2, 1, 4  }, // Half2
+        { 3, 1, 6  }, // Half3
+        { 4, 1, 8  }, // Half4
+        { 1, 1, 1  }, // UNorm8
+        { 2, 1, 2  }, // UNorm8x2
+        { 3, 1, 3  }, // UNorm8x3
+        { 4, 1, 4  }, // UNorm8x4
+        { 3, 4, 8  }, // BC1
+        { 1, 4, 8  }, // BC4
+        { 2, 4, 16 }, // BC5
+    };
+    static_assert(CountOf_(TextureFormats) == TextureResourceData::TextureDataTypeCount, "Missing texture format info");
+
+    //=============================================================================================================================
+    uint32 TextureChannelCount(TextureResourceData::TextureDataType format)
+    {
+        return TextureFormats[format].channelCount;
+    }
+
+    //=============================================================================================================================
+    uint32 TextureBlockDimension(TextureResourceData::TextureDataType format)
+    {
+        return TextureFormats[format].blockDimension;
+    }
+
+    //=============================================================================================================================
+    uint32 TextureBlockByteSize(TextureResourceData::TextureDataType format)
+    {
+        return TextureFormats[format].blockByteSize;
+    }
+
+    //=============================================================================================================================
+    void TextureTileDimensions(const TextureResourceData* data, uint32 level, uint32& tileWidth, uint32& tileHeight,
+                               uint32& tilesX, uint32& tilesY)
+    {
+        uint32 mipWidth  = data->mipWidths[level];
+        uint32 mipHeight = data->mipHeights[level];
+
+        tileWidth  = Min<uint32>(mipWidth, TextureResourceData::TileSize);
+        tileHeight = Min<uint32>(mipHeight, TextureResourceData::TileSize);
+        tilesX     = (mipWidth + tileWidth - 1) / tileWidth;
+        tilesY     = (mipHeight + tileHeight - 1) / tileHeight;
+    }
+
+    //=============================================================================================================================
+    static uint32 TileLevel(const TextureResource* texture, uint32 tileIndex)
+    {
+        uint32 level = 0;
+        while(level + 1 < texture->data->mipCount && texture->mipFirstTile[level + 1] <= tileIndex) {
+            ++level;
+        }
+
+        return level;
+    }
+
+    //=============================================================================================================================
+    uint64 TextureTileByteSize(const TextureResourceData* data, uint32 level)
+    {
+        uint32 tileWidth, tileHeight, tilesX, tilesY;
+        TextureTileDimensions(data, level, tileWidth, tileHeight, tilesX, tilesY);
+
+        uint32 blockDimension = TextureBlockDimension(data->format);
+        uint64 blocksX = (tileWidth + blockDimension - 1) / blockDimension;
+        uint64 blocksY = (tileHeight + blockDimension - 1) / blockDimension;
+
+        return blocksX * blocksY * TextureBlockByteSize(data->format);
+    }
+
+    //=============================================================================================================================
+    uint64 TextureTileByteSize(const TextureResource* texture, uint32 tileIndex)
+    {
+        return TextureTileByteSize(texture->data, TileLevel(texture, tileIndex));
+    }
+
+    //=============================================================================================================================
+    static uint64 TileDataOffset(const TextureResource* texture, uint32 tileIndex)
+    {
+        uint32 level = TileLevel(texture, tileIndex);
+        uint32 localIndex = tileIndex - texture->mipFirstTile[level];
+
+        return texture->data->mipOffsets[level] + localIndex * TextureTileByteSize(texture, tileIndex);
+    }
+
+    //=============================================================================================================================
+    static Error InitializePageTable(TextureResource* resource)
+    {
+        uint32 tileCount = 0;
+        for(uint32 scan = 0; scan < resource->data->mipCount; ++scan) {
+            uint32 tileWidth, tileHeight, tilesX, tilesY;
+            TextureTileDimensions(resource->data, scan, tileWidth, tileHeight, tilesX, tilesY);
+
+            resource->mipFirstTile[scan] = tileCount;
+            tileCount += tilesX * tilesY;
+        }
+
+        if(resource->data->format >= TextureResourceData::TextureDataTypeCount) {
+            return Error_("Unknown texture format %u", (uint32)resource->data->format);
+        }
+
+        if(tileCount != resource->data->tileCount) {
+            return Error_("Texture tile count %u does not match its mip chain (%u)", resource->data->tileCount, tileCount);
+        }
+
+        resource->tiles = AllocArray_(TextureTile, tileCount);
+        Memory::Zero(resource->tiles, sizeof(TextureTile) * tileCount);
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error InitializeTextureResource(TextureResourceData* data, TextureResource* resource)
+    {
+        resource->data = data;
+        resource->tiles = nullptr;
+        resource->fileDataOffset = 0;
+        resource->pageIn = nullptr;
+        resource->pageInUserData = nullptr;
+
+        ReturnError_(InitializePageTable(resource));
+
+        for(uint32 scan = 0, count = resource->data->tileCount; scan < count; ++scan) {
+            resource->tiles[scan].texels = resource->data->texture + TileDataOffset(resource, scan);
+            resource->tiles[scan].state = eTileResident;
+        }
+
+        return Success_;
+    }
+
     //=============================================================================================================================
     Error ReadTextureResource(cpointer textureName, TextureResource* resource)
     {
         FilePathString filepath;
         AssetFileUtils::AssetFilePath(TextureResource::kDataType, TextureResource::kDataVersion, textureName, filepath);
 
+        MemoryMappedFile dataFile;
         void* fileData = nullptr;
         uint64 fileSize = 0;
-        ReturnError_(File::ReadWholeFile(filepath.Ascii(), &fileData, &fileSize));
+        ReturnError_(AssetFileUtils::LoadAssetFile(filepath.Ascii(), &dataFile, &fileData, &fileSize));
 
-        AttachToBinary(resource->data, (uint8*)fileData, fileSize);
+        TextureResourceData* data;
+        AttachToBinary(data, (uint8*)fileData, fileSize);
 
+        Error err = InitializeTextureResource(data, resource);
+        if(Failed_(err)) {
+            AssetFileUtils::UnloadAssetFile(&dataFile, data);
+            resource->data = nullptr;
+            return err;
+        }
+
+        resource->dataFile = dataFile;
+        resource->fileDataOffset = (uint64)(resource->data->texture - (uint8*)fileData);
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error ReadTextureResourceHeader(cpointer filepath, TexturePageInFunction pageIn, void* pageInUserData,
+                                    TextureResource* resource)
+    {
+        resource->data = nullptr;
+        resource->tiles = nullptr;
+
+        ReturnError_(MemoryMappedFile_OpenReadOnly(filepath, &resource->tileFile));
+        if(resource->tileFile.size < sizeof(TextureResourceData)) {
+            MemoryMappedFile_Close(&resource->tileFile);
+            return Error_("Texture file %s is too small to hold its header", filepath);
+        }
+
+        resource->data = (TextureResourceData*)AllocAligned_(sizeof(TextureResourceData), 16);
+        Memory::Copy(resource->data, resource->tileFile.memory, sizeof(TextureResourceData));
+
+        // -- The serializer stores pointers as offsets from the start of the file
+        resource->fileDataOffset = (uint64)resource->data->texture;
+        resource->data->texture = nullptr;
+        resource->pageIn = pageIn;
+        resource->pageInUserData = pageInUserData;
+
+        Error err = InitializePageTable(resource);
+        if(Failed_(err)) {
+            SafeFreeAligned_(resource->data);
+            MemoryMappedFile_Close(&resource->tileFile);
+            return err;
+        }
+
+        return Success_;
+    }
+
+    //=============================================================================================================================
+    Error ReadTextureTile(const TextureResource* texture, uint32 tileIndex, uint8* texels)
+    {
+        uint64 offset = texture->fileDataOffset + TileDataOffset(texture, tileIndex);
+        uint64 size = TextureTileByteSize(texture, tileIndex);
+        if(offset + size > texture->tileFile.size) {
+            return Error_("Tile %u at offset %llu runs past the end of the %llu byte texture file", tileIndex, offset,
+                          texture->tileFile.size);
+        }
+
+        Memory::Copy(texels, (const uint8*)texture->tileFile.memory + offset, (uint)size);
         return Success_;
     }
 
     //=============================================================================================================================
     void ShutdownTextureResource(TextureResource* texture)
     {
-        SafeFreeAligned_(texture->data);
+        // -- Tiles of paged textures are individual allocations. Otherwise they point into the file data.
+        if(texture->pageIn != nullptr && texture->tiles != nullptr) {
+            for(uint32 scan = 0, count = texture->data->tileCount; scan < count; ++scan) {
+                SafeFreeAligned_(texture->tiles[scan].texels);
+            }
+        }
+
+        SafeFree_(texture->tiles);
+        AssetFileUtils::UnloadAssetFile(&texture->dataFile, texture->data);
+        MemoryMappedFile_Close(&texture->tileFile);
+        texture->data = nullptr;
     }
 
     //=============================================================================================================================
     static void DebugWriteTextureMip(TextureResource* texture, uint level, cpointer filepath)
     {
-        uint channels = (uint)texture->data->format + 1;
-
-        uint64 mipOffset = texture->data->mipOffsets[level];
+        TextureResourceData::TextureDataType format = texture->data->format;
         uint32 mipWidth  = texture->data->mipWidths[level];
         uint32 mipHeight = texture->data->mipHeights[level];
-        void*  mip       = &texture->data->texture[mipOffset];
-        StbImageWrite(filepath, mipWidth, mipHeight, channels, HDR, (void*)mip);
+
+        uint32 tileWidth, tileHeight, tilesX, tilesY;
+        TextureTileDimensions(texture->data, (uint32)level, tileWidth, tileHeight, tilesX, tilesY);
+
+        // -- Untile and decode the mip into a linear image
+        float4* mip = AllocArray_(float4, (uint64)mipWidth * mipHeight);
+        for(uint32 y = 0; y < mipHeight; ++y) {
+            for(uint32 x = 0; x < mipWidth; ++x) {
+                uint32 tileIndex = texture->mipFirstTile[level] + (y / tileHeight) * tilesX + x / tileWidth;
+                const uint8* tile = FetchTextureTile(texture, tileIndex);
+
+                mip[(uint64)y * mipWidth + x] = TextureEncoding::DecodeTexel(format, tile, tileWidth, x % tileWidth,
+                                                                             y % tileHeight);
+            }
+        }
+
+        StbImageWrite(filepath, mipWidth, mipHeight, 4, HDR, (void*)mip);
+        Free_(mip);
     }
 
     //=============================================================================================================================
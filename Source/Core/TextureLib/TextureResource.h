@@ -5,49 +5,138 @@
 //=================================================================================================================================
 
 #include "MathLib/FloatStructs.h"
+#include "StringLib/FixedString.h"
+#include "IoLib/MemoryMappedFile.h"
 #include "SystemLib/Error.h"
 #include "SystemLib/BasicTypes.h"
 
 namespace Selas
 {
     class CSerializer;
+    struct TextureResource;
 
     struct TextureResourceData
     {
         enum TextureDataType
         {
-            // -- Convert to something more like d3d formats?
             Float,
             Float2,
             Float3,
-            Float4
+            Float4,
+            Half,
+            Half2,
+            Half3,
+            Half4,
+            UNorm8,
+            UNorm8x2,
+            UNorm8x3,
+            UNorm8x4,
+            // -- 4x4 blocks of 8 bytes holding rgb
+            BC1,
+            // -- 4x4 blocks of 8 bytes holding r
+            BC4,
+            // -- 4x4 blocks of 16 bytes holding rg
+            BC5,
+
+            TextureDataTypeCount
         };
 
         static const uint MaxMipCount = 16;
 
+        // -- Each mip is stored as row major tiles of TileSize x TileSize texels, or a single tile the size of the mip
+        // -- once it is smaller than that. Tiles on the right and bottom edges are padded by repeating the edge texels.
+        // -- Block compressed tiles store row major blocks and pad partial blocks the same way.
+        static const uint TileSize = 64;
+
         uint32 mipCount;
         uint32 dataSize;
 
         uint32 mipWidths[MaxMipCount];
         uint32 mipHeights[MaxMipCount];
+        // -- Byte offset of the first tile of each mip
         uint64 mipOffsets[MaxMipCount];
 
         TextureDataType format;
-        uint32 pad;
+        uint32 tileCount;
 
         uint8* texture;
     };
     void Serialize(CSerializer* serializer, TextureResourceData& data);
 
+    struct TextureTile
+    {
+        uint8* volatile texels;
+        volatile int32 state;
+        // -- Set whenever the tile is sampled and cleared by the owner's eviction sweep
+        volatile int32 referenced;
+    };
+
+    // -- Called when a tile of a paged texture is sampled and not resident. Must return the tile's texels.
+    typedef const uint8* (*TexturePageInFunction)(void* userData, const TextureResource* texture, uint32 tileIndex);
+
     struct TextureResource
     {
         static cpointer kDataType;
         static const uint64 kDataVersion;
 
         TextureResourceData* data;
+        // -- Open when data points into a mapping of the asset file rather than an allocation
+        MemoryMappedFile dataFile;
+        // -- Read only mapping of the asset file that paged textures copy their tiles out of. Kept for as long as the
+        // -- texture is resident so page-ins don't open the file each time.
+        MemoryMappedFile tileFile;
+
+        // -- One entry per tile across all mips. Textures read with ReadTextureResource have every tile resident. Textures
+        // -- read with ReadTextureResourceHeader start with no tiles resident and fault them in through pageIn.
+        TextureTile* tiles;
+        uint32 mipFirstTile[TextureResourceData::MaxMipCount];
+        uint64 fileDataOffset;
+
+        TexturePageInFunction pageIn;
+        void* pageInUserData;
     };
 
-    Error ReadTextureResource(cpointer filepath, TextureResource* texture);
+    enum TextureTileState
+    {
+        eTileNotResident,
+        eTileLoading,
+        eTileResident
+    };
+
+    uint32 TextureChannelCount(TextureResourceData::TextureDataType format);
+    // -- Width and height in texels of the blocks a format is stored in. Uncompressed formats use 1x1 blocks.
+    uint32 TextureBlockDimension(TextureResourceData::TextureDataType format);
+    uint32 TextureBlockByteSize(TextureResourceData::TextureDataType format);
+    void TextureTileDimensions(const TextureResourceData* data, uint32 level, uint32& tileWidth, uint32& tileHeight,
+                               uint32& tilesX, uint32& tilesY);
+    uint64 TextureTileByteSize(const TextureResourceData* data, uint32 level);
+    uint64 TextureTileByteSize(const TextureResource* texture, uint32 tileIndex);
+
+    // -- Sets up the page table of a texture whose tiled data is already in memory with every tile resident
+    Error InitializeTextureResource(TextureResourceData* data, TextureResource* texture);
+    // -- Reads the whole file with every tile resident
+    Error ReadTextureResource(cpointer textureName, TextureResource* texture);
+    // -- Maps the asset at filepath, copies its header and sets up an empty page table. Tiles are read with ReadTextureTile
+    // -- by whoever owns the pageIn callback.
+    Error ReadTextureResourceHeader(cpointer filepath, TexturePageInFunction pageIn, void* pageInUserData,
+                                    TextureResource* texture);
+    Error ReadTextureTile(const TextureResource* texture, uint32 tileIndex, uint8* texels);
     void ShutdownTextureResource(TextureResource* texture);
     void DebugWriteTextureMips(TextureResource* texture, cpointer folder, cpointer name);
+
+    //=============================================================================================================================
+    inline const uint8* FetchTextureTile(const TextureResource* texture, uint32 tileIndex)
+    {
+        TextureTile* tile = &texture->tiles[tileIndex];
+
+        uint8* texels = tile->texels;
+        if(texels == nullptr) {
+            return texture->pageIn(texture->pageInUserData, texture, tileIndex);
+        }
+
+        if(tile->referenced == 0) {
+            tile->referenced = 1;
+        }
+        return texels;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,313 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "ThreadingLib/JobSystem.h"
+#include "ThreadingLib/Thread.h"
+#include "SystemLib/OSThreading.h"
+#include "SystemLib/Atomic.h"
+#include "SystemLib/MemoryAllocation.h"
+#include "SystemLib/MinMax.h"
+#include "SystemLib/JsAssert.h"
+
+// -- Jobs are run inline once a thread's deque is full.
+#define JobDequeCapacity_       4096
+#define MaxJobThreads_          256
+// -- Failed steal attempts before TaskGroup_Wait starts yielding its time slice
+#define WaitSpinCount_          64
+
+namespace Selas
+{
+    struct Job
+    {
+        JobFunction function;
+        void* userData;
+        TaskGroup* group;
+    };
+
+    //=============================================================================================================================
+    // -- The owning thread pushes and pops at the bottom. Other threads steal from the top.
+    struct JobDeque
+    {
+        uint8 spinlock[CacheLineSize_];
+        Job jobs[JobDequeCapacity_];
+        uint64 top;
+        uint64 bottom;
+    };
+
+    struct JobSystemData
+    {
+        uint threadCount;
+        JobDeque* deques;
+        ThreadHandle threads[MaxJobThreads_];
+
+        void* wakeSemaphore;
+        volatile int64 sleepingThreads;
+        volatile int64 queuedJobs;
+        volatile int64 shutdown;
+        volatile int64 threadCounter;
+    };
+
+    static JobSystemData* jobSystem = nullptr;
+    static thread_local uint jobThreadIndex = 0;
+
+    //=============================================================================================================================
+    static bool PushJob(JobDeque* deque, const Job& job)
+    {
+        EnterSpinLock(deque->spinlock);
+        bool pushed = (deque->bottom - deque->top) < JobDequeCapacity_;
+        if(pushed) {
+            deque->jobs[deque->bottom % JobDequeCapacity_] = job;
+            ++deque->bottom;
+        }
+        LeaveSpinLock(deque->spinlock);
+
+        return pushed;
+    }
+
+    //=============================================================================================================================
+    static bool PopJob(JobDeque* deque, Job& job)
+    {
+        EnterSpinLock(deque->spinlock);
+        bool popped = deque->bottom > deque->top;
+        if(popped) {
+            --deque->bottom;
+            job = deque->jobs[deque->bottom % JobDequeCapacity_];
+        }
+        LeaveSpinLock(deque->spinlock);
+
+        return popped;
+    }
+
+    //=============================================================================================================================
+    static bool StealJob(JobDeque* deque, Job& job)
+    {
+        // -- Don't contend with the owner for a lock on an empty deque
+        if(deque->bottom == deque->top) {
+            return false;
+        }
+
+        EnterSpinLock(deque->spinlock);
+        bool stolen = deque->bottom > deque->top;
+        if(stolen) {
+            job = deque->jobs[deque->top % JobDequeCapacity_];
+            ++deque->top;
+        }
+        LeaveSpinLock(deque->spinlock);
+
+        return stolen;
+    }
+
+    //=============================================================================================================================
+    static void ExecuteJob(const Job& job)
+    {
+        job.function(job.userData);
+        if(job.group != nullptr) {
+            Atomic::Decrement64(&job.group->pending);
+        }
+    }
+
+    //=============================================================================================================================
+    static bool TryRunJob(uint threadIndex)
+    {
+        Job job;
+        bool found = PopJob(&jobSystem->deques[threadIndex], job);
+
+        for(uint scan = 1; found == false && scan < jobSystem->threadCount; ++scan) {
+            uint victim = (threadIndex + scan) % jobSystem->threadCount;
+            found = StealJob(&jobSystem->deques[victim], job);
+        }
+
+        if(found == false) {
+            return false;
+        }
+
+        Atomic::Decrement64(&jobSystem->queuedJobs);
+        ExecuteJob(job);
+
+        return true;
+    }
+
+    //=============================================================================================================================
+    static void JobWorkerThread(void* userData)
+    {
+        Unused_(userData);
+
+        jobThreadIndex = (uint)Atomic::Increment64(&jobSystem->threadCounter);
+
+        while(jobSystem->shutdown == 0) {
+            if(TryRunJob(jobThreadIndex)) {
+                continue;
+            }
+
+            // -- Register as sleeping before the final check so a concurrent submit either sees us or we see its job.
+            Atomic::Increment64(&jobSystem->sleepingThreads);
+            if(jobSystem->queuedJobs == 0 && jobSystem->shutdown == 0) {
+                WaitForSemaphore(jobSystem->wakeSemaphore, InfiniteWait_);
+            }
+            Atomic::Decrement64(&jobSystem->sleepingThreads);
+        }
+    }
+
+    //=============================================================================================================================
+    void JobSystem_Initialize(uint threadCount)
+    {
+        Assert_(jobSystem == nullptr);
+
+        if(threadCount == 0) {
+            threadCount = ProcessorCount();
+        }
+        threadCount = Max<uint>(1, Min<uint>(threadCount, MaxJobThreads_));
+
+        jobSystem = New_(JobSystemData);
+        jobSystem->threadCount = threadCount;
+        jobSystem->deques = (JobDeque*)AllocAligned_(threadCount * sizeof(JobDeque), CacheLineSize_);
+        jobSystem->wakeSemaphore = CreateOSSemaphore(0, 0x7FFFFFFF);
+        jobSystem->sleepingThreads = 0;
+        jobSystem->queuedJobs = 0;
+        jobSystem->shutdown = 0;
+        // -- The initializing thread is index 0
+        jobSystem->threadCounter = 1;
+
+        for(uint scan = 0; scan < threadCount; ++scan) {
+            CreateSpinLock(jobSystem->deques[scan].spinlock);
+            jobSystem->deques[scan].top = 0;
+            jobSystem->deques[scan].bottom = 0;
+        }
+
+        jobThreadIndex = 0;
+        for(uint scan = 1; scan < threadCount; ++scan) {
+            jobSystem->threads[scan] = CreateThread(JobWorkerThread, nullptr);
+            SetThreadProcessorGroup(jobSystem->threads[scan], scan);
+        }
+    }
+
+    //=============================================================================================================================
+    void JobSystem_Shutdown()
+    {
+        Assert_(jobSystem != nullptr);
+        Assert_(jobSystem->queuedJobs == 0);
+
+        jobSystem->shutdown = 1;
+        PostSemaphore(jobSystem->wakeSemaphore, jobSystem->threadCount);
+
+        for(uint scan = 1; scan < jobSystem->threadCount; ++scan) {
+            ShutdownThread(jobSystem->threads[scan]);
+        }
+
+        CloseOSSemaphore(jobSystem->wakeSemaphore);
+        FreeAligned_(jobSystem->deques);
+        SafeDelete_(jobSystem);
+    }
+
+    //=============================================================================================================================
+    uint JobSystem_ThreadCount()
+    {
+        return jobSystem ? jobSystem->threadCount : 1;
+    }
+
+    //=============================================================================================================================
+    uint JobSystem_ThreadIndex()
+    {
+        return jobThreadIndex;
+    }
+
+    //=============================================================================================================================
+    void JobSystem_Submit(TaskGroup* group, JobFunction function, void* userData)
+    {
+        Job job;
+        job.function = function;
+        job.userData = userData;
+        job.group = group;
+
+        if(group != nullptr) {
+            Atomic::Increment64(&group->pending);
+        }
+
+        if(jobSystem == nullptr) {
+            ExecuteJob(job);
+            return;
+        }
+
+        Atomic::Increment64(&jobSystem->queuedJobs);
+        if(PushJob(&jobSystem->deques[jobThreadIndex], job) == false) {
+            Atomic::Decrement64(&jobSystem->queuedJobs);
+            ExecuteJob(job);
+            return;
+        }
+
+        if(jobSystem->sleepingThreads > 0) {
+            PostSemaphore(jobSystem->wakeSemaphore, 1);
+        }
+    }
+
+    //=============================================================================================================================
+    void TaskGroup_Wait(TaskGroup* group)
+    {
+        uint failedAttempts = 0;
+        while(group->pending > 0) {
+            // -- Help with queued work while the group's remaining jobs run on other threads
+            if(jobSystem != nullptr && TryRunJob(jobThreadIndex)) {
+                failedAttempts = 0;
+                continue;
+            }
+
+            // -- Nothing to steal so the group is waiting on jobs that are already running. Give the core to them rather
+            // -- than hammering the deque locks.
+            if(++failedAttempts >= WaitSpinCount_) {
+                Sleep(0);
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    struct ParallelForData
+    {
+        ParallelForFunction function;
+        void* userData;
+        uint count;
+        uint grainSize;
+        volatile int64 nextRange;
+    };
+
+    //=============================================================================================================================
+    static void ParallelForJob(void* userData)
+    {
+        ParallelForData* data = (ParallelForData*)userData;
+
+        while(true) {
+            uint start = (uint)Atomic::Increment64(&data->nextRange) * data->grainSize;
+            if(start >= data->count) {
+                break;
+            }
+
+            uint end = Min<uint>(start + data->grainSize, data->count);
+            data->function(data->userData, start, end, jobThreadIndex);
+        }
+    }
+
+    //=============================================================================================================================
+    void ParallelFor(uint count, uint grainSize, ParallelForFunction function, void* userData)
+    {
+        grainSize = Max<uint>(grainSize, 1);
+
+        ParallelForData data;
+        data.function = function;
+        data.userData = userData;
+        data.count = count;
+        data.grainSize = grainSize;
+        data.nextRange = 0;
+
+        // -- Each job pulls ranges until they run out so threads that start late or run fast balance the load.
+        uint rangeCount = (count + grainSize - 1) / grainSize;
+        uint jobCount = Min<uint>(rangeCount, JobSystem_ThreadCount());
+
+        TaskGroup group;
+        for(uint scan = 1; scan < jobCount; ++scan) {
+            JobSystem_Submit(&group, ParallelForJob, &data);
+        }
+
+        ParallelForJob(&data);
+        TaskGroup_Wait(&group);
+    }
+}
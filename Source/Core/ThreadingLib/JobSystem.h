@@ -0,0 +1,42 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "SystemLib/BasicTypes.h"
+
+namespace Selas
+{
+    typedef void(*JobFunction)(void* userData);
+    typedef void(*ParallelForFunction)(void* userData, uint start, uint end, uint threadIndex);
+
+    //=============================================================================================================================
+    // -- Tracks a set of submitted jobs so a thread can wait for all of them to finish.
+    struct TaskGroup
+    {
+        TaskGroup() : pending(0) { }
+
+        volatile int64 pending;
+    };
+
+    // -- Starts threadCount - 1 worker threads. The thread that calls Initialize becomes thread index 0 and runs jobs whenever
+    // -- it waits on a TaskGroup. A threadCount of 0 uses one thread per logical processor.
+    void JobSystem_Initialize(uint threadCount = 0);
+    void JobSystem_Shutdown();
+
+    // -- Total threads that execute jobs, including the initializing thread.
+    uint JobSystem_ThreadCount();
+    // -- Index of the calling thread in [0, JobSystem_ThreadCount()). Threads not owned by the job system report 0.
+    uint JobSystem_ThreadIndex();
+
+    // -- Pushes the job onto the calling thread's deque. Idle threads steal from the other end of it. group may be null.
+    void JobSystem_Submit(TaskGroup* group, JobFunction function, void* userData);
+
+    // -- Runs queued jobs on the calling thread until every job in the group has finished.
+    void TaskGroup_Wait(TaskGroup* group);
+
+    // -- Calls function over [0, count) in ranges of at most grainSize entries spread across all threads. Returns once every
+    // -- range has been processed.
+    void ParallelFor(uint count, uint grainSize, ParallelForFunction function, void* userData);
+}
@@ -4,6 +4,8 @@
 // Joe Schutte
 //=================================================================================================================================
 
+#include "SystemLib/BasicTypes.h"
+
 namespace Selas
 {
 
@@ -20,4 +22,8 @@ namespace Selas
 
     ThreadHandle CreateThread(ThreadFunction function, void* userData);
     void         ShutdownThread(ThreadHandle threadHandle);
+
+    // -- Moves the thread into the processor group that owns the given logical processor index. Only meaningful on Windows
+    // -- machines with more than 64 logical processors where new threads are otherwise confined to a single group.
+    void         SetThreadProcessorGroup(ThreadHandle threadHandle, uint logicalProcessorIndex);
 }
\ No newline at end of file
@@ -54,6 +54,14 @@ namespace Selas
 
         Free_(threadData);
     }
+
+    //=============================================================================================================================
+    void SetThreadProcessorGroup(ThreadHandle threadHandle, uint logicalProcessorIndex)
+    {
+        // -- The scheduler already places threads on any available processor.
+        Unused_(threadHandle);
+        Unused_(logicalProcessorIndex);
+    }
 }
 
 #endif
\ No newline at end of file
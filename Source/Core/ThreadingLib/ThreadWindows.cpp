@@ -25,6 +25,29 @@ namespace Selas
         WaitForSingleObject((HANDLE)threadHandle, INFINITE);
         CloseHandle((HANDLE)threadHandle);
     }
+
+    //=============================================================================================================================
+    void SetThreadProcessorGroup(ThreadHandle threadHandle, uint logicalProcessorIndex)
+    {
+        WORD groupCount = ::GetActiveProcessorGroupCount();
+        if(groupCount <= 1) {
+            return;
+        }
+
+        for(WORD group = 0; group < groupCount; ++group) {
+            DWORD groupSize = ::GetActiveProcessorCount(group);
+            if(logicalProcessorIndex < groupSize) {
+                GROUP_AFFINITY affinity;
+                ZeroMemory(&affinity, sizeof(affinity));
+                affinity.Group = group;
+                affinity.Mask = (groupSize >= 64) ? ~(KAFFINITY)0 : (((KAFFINITY)1 << groupSize) - 1);
+
+                ::SetThreadGroupAffinity((HANDLE)threadHandle, &affinity, nullptr);
+                return;
+            }
+            logicalProcessorIndex -= groupSize;
+        }
+    }
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "UtilityLib/RadixSort.h"
+#include "ThreadingLib/JobSystem.h"
+#include "SystemLib/Memory.h"
+#include "SystemLib/MinMax.h"
+#include "SystemLib/JsAssert.h"
+
+#define RadixBits_              8
+#define RadixBuckets_           (1 << RadixBits_)
+#define RadixPassCount_         (64 / RadixBits_)
+#define MaxRadixChunks_         32
+// -- Below this many entries per chunk the cost of spreading a pass across threads outweighs the parallel scatter
+#define MinEntriesPerChunk_     16 * 1024
+
+namespace Selas
+{
+    struct RadixSortData
+    {
+        uint64* srcKeys;
+        uint32* srcValues;
+        uint64* dstKeys;
+        uint32* dstValues;
+        uint count;
+        uint chunkCount;
+        uint chunkSize;
+        uint shift;
+
+        // -- One row of RadixBuckets_ per chunk. Holds the digit counts after the histogram pass and each chunk's scatter
+        // -- offsets after the prefix sum.
+        uint32* histograms;
+    };
+
+    //=============================================================================================================================
+    static void ChunkRange(const RadixSortData* data, uint chunk, uint& start, uint& end)
+    {
+        start = Min<uint>(chunk * data->chunkSize, data->count);
+        end = Min<uint>(start + data->chunkSize, data->count);
+    }
+
+    //=============================================================================================================================
+    static void HistogramChunks(void* userData, uint firstChunk, uint lastChunk, uint threadIndex)
+    {
+        Unused_(threadIndex);
+        RadixSortData* data = (RadixSortData*)userData;
+
+        for(uint chunk = firstChunk; chunk < lastChunk; ++chunk) {
+            uint start, end;
+            ChunkRange(data, chunk, start, end);
+
+            uint32* histogram = data->histograms + chunk * RadixBuckets_;
+            Memory::Zero(histogram, RadixBuckets_ * sizeof(uint32));
+            for(uint scan = start; scan < end; ++scan) {
+                ++histogram[(data->srcKeys[scan] >> data->shift) & (RadixBuckets_ - 1)];
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    static void ScatterChunks(void* userData, uint firstChunk, uint lastChunk, uint threadIndex)
+    {
+        Unused_(threadIndex);
+        RadixSortData* data = (RadixSortData*)userData;
+
+        for(uint chunk = firstChunk; chunk < lastChunk; ++chunk) {
+            uint start, end;
+            ChunkRange(data, chunk, start, end);
+
+            uint32* offsets = data->histograms + chunk * RadixBuckets_;
+            for(uint scan = start; scan < end; ++scan) {
+                uint32 index = offsets[(data->srcKeys[scan] >> data->shift) & (RadixBuckets_ - 1)]++;
+                data->dstKeys[index] = data->srcKeys[scan];
+                data->dstValues[index] = data->srcValues[scan];
+            }
+        }
+    }
+
+    //=============================================================================================================================
+    static void CopyChunks(void* userData, uint firstChunk, uint lastChunk, uint threadIndex)
+    {
+        Unused_(threadIndex);
+        RadixSortData* data = (RadixSortData*)userData;
+
+        for(uint chunk = firstChunk; chunk < lastChunk; ++chunk) {
+            uint start, end;
+            ChunkRange(data, chunk, start, end);
+
+            Memory::Copy(data->dstKeys + start, data->srcKeys + start, (end - start) * sizeof(uint64));
+            Memory::Copy(data->dstValues + start, data->srcValues + start, (end - start) * sizeof(uint32));
+        }
+    }
+
+    //=============================================================================================================================
+    void RadixSort64(uint64* keys, uint32* values, uint64* scratchKeys, uint32* scratchValues, uint count, uint threadCount)
+    {
+        if(count < 2) {
+            return;
+        }
+
+        uint chunkCount = Max<uint>(1, Min<uint>(threadCount, count / MinEntriesPerChunk_));
+        chunkCount = Min<uint>(chunkCount, MaxRadixChunks_);
+
+        uint32 histograms[MaxRadixChunks_ * RadixBuckets_];
+
+        RadixSortData data;
+        data.srcKeys = keys;
+        data.srcValues = values;
+        data.dstKeys = scratchKeys;
+        data.dstValues = scratchValues;
+        data.count = count;
+        data.chunkCount = chunkCount;
+        data.chunkSize = (count + chunkCount - 1) / chunkCount;
+        data.histograms = histograms;
+
+        // -- Each ParallelFor returns once every chunk is done so it doubles as the barrier between steps. With a single chunk
+        // -- ParallelFor runs inline on the calling thread.
+        for(uint pass = 0; pass < RadixPassCount_; ++pass) {
+            data.shift = pass * RadixBits_;
+
+            ParallelFor(chunkCount, 1, HistogramChunks, &data);
+
+            // -- Exclusive prefix sum over digits and then chunks so each chunk scatters into its own stable slice of every
+            // -- bucket. Passes where every key shares the same digit would only copy and are skipped.
+            bool skipPass = false;
+            uint32 running = 0;
+            for(uint digit = 0; digit < RadixBuckets_; ++digit) {
+                uint32 total = 0;
+                for(uint chunk = 0; chunk < chunkCount; ++chunk) {
+                    uint32 digitCount = histograms[chunk * RadixBuckets_ + digit];
+                    histograms[chunk * RadixBuckets_ + digit] = running + total;
+                    total += digitCount;
+                }
+
+                if(total == count) {
+                    skipPass = true;
+                    break;
+                }
+                running += total;
+            }
+
+            if(skipPass) {
+                continue;
+            }
+
+            ParallelFor(chunkCount, 1, ScatterChunks, &data);
+
+            uint64* tempKeys = data.srcKeys;
+            data.srcKeys = data.dstKeys;
+            data.dstKeys = tempKeys;
+
+            uint32* tempValues = data.srcValues;
+            data.srcValues = data.dstValues;
+            data.dstValues = tempValues;
+        }
+
+        if(data.srcKeys != keys) {
+            data.dstKeys = keys;
+            data.dstValues = values;
+            ParallelFor(chunkCount, 1, CopyChunks, &data);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+//=================================================================================================================================
+// Joe Schutte
+//=================================================================================================================================
+
+#include "SystemLib/BasicTypes.h"
+
+namespace Selas
+{
+    // -- Stable LSD radix sort of 64 bit keys with 8 bit digits. values are permuted along with their keys. The scratch buffers
+    // -- must each hold count entries. Passes where every key shares the same digit are skipped. When threadCount is greater
+    // -- than one the input is split into that many chunks that are histogrammed and scattered with JobSystem ParallelFor.
+    void RadixSort64(uint64* keys, uint32* values, uint64* scratchKeys, uint32* scratchValues, uint count,
+                     uint threadCount = 1);
+}